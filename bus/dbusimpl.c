@@ -27,8 +27,10 @@
 
 #include "global.h"
 #include "ibusimpl.h"
+#include "ibusservicemethodtable.h"
 #include "marshalers.h"
 #include "matchrule.h"
+#include "stats.h"
 #include "types.h"
 
 enum {
@@ -43,6 +45,76 @@ enum {
 };
 
 static guint dbus_signals[LAST_SIGNAL] = { 0 };
+static IBusServiceMethodTable *dbus_methods;
+
+/* the initial capacity of a BusMessageQueue. must be a power of two. */
+#define BUS_MESSAGE_QUEUE_CAPACITY  256
+/* the maximum length of a BusMessageQueue. must be a power of two. A message
+ * pushed to a full queue is dropped so that a flooding client cannot grow
+ * the memory of ibus-daemon without bound. */
+#define BUS_MESSAGE_QUEUE_MAX_LENGTH (64 * 1024)
+/* the number of messages popped from a BusMessageQueue at once. */
+#define BUS_MESSAGE_QUEUE_BATCH     64
+
+/* The priorities of the idle callbacks which drain the queues of each
+ * BusDBusLane. They are the same so that the main loop runs both callbacks
+ * on each iteration and the bulk lane is not starved. The interactive lane
+ * is drained completely on each wakeup, while the bulk lane handles one
+ * batch per wakeup, so a backlog of bulk messages delays an interactive
+ * message by one batch at most. */
+static const gint bus_dbus_lane_priorities[BUS_DBUS_LANE_LAST] = {
+    G_PRIORITY_DEFAULT,         /* BUS_DBUS_LANE_INTERACTIVE */
+    G_PRIORITY_DEFAULT,         /* BUS_DBUS_LANE_BULK */
+};
+
+/* Members of the messages which go to BUS_DBUS_LANE_BULK. */
+static const gchar *bus_dbus_bulk_members[] = {
+    /* properties */
+    "RegisterProperties",
+    "UpdateProperty",
+    "PropertyActivate",
+    "PropertyShow",
+    "PropertyHide",
+    /* engine lists */
+    "ListEngines",
+    "ListActiveEngines",
+    "GetEnginesByNames",
+    "PreloadEngines",
+    "SetPreloadEngines",
+    "RegisterComponent",
+    /* registry and config changes */
+    "RegistryChanged",
+    "ValueChanged",
+};
+
+/* A ring buffer of messages which is pushed by multiple threads and popped
+ * by the main thread only. Each operation is a single short critical
+ * section. The buffer doubles its capacity when it gets full up to
+ * BUS_MESSAGE_QUEUE_MAX_LENGTH; the capacity is kept for later bursts. */
+typedef struct _BusLaneRoute BusLaneRoute;
+struct _BusLaneRoute {
+    /* the messages of the key in the lane which are queued or being
+     * processed */
+    guint       n_queued;
+};
+
+typedef struct _BusMessageQueue BusMessageQueue;
+struct _BusMessageQueue {
+    GMutex    lock;
+    gpointer *items;
+    guint     capacity;
+    guint     head;
+    guint     length;
+    guint     high_water_mark;
+    /* the number of messages pushed so far. */
+    guint64   n_messages;
+    /* the number of messages dropped since the queue was full. */
+    guint64   n_dropped;
+    /* TRUE if an idle callback to drain the queue is already added. */
+    gboolean  scheduled;
+    /* frees the items pushed after bus_message_queue_clear(). */
+    GDestroyNotify free_func;
+};
 
 struct _BusDBusImpl {
     IBusService parent;
@@ -57,16 +129,30 @@ struct _BusDBusImpl {
     GList *objects;
     /* a list of active BusConnections. */
     GList *connections;
-    /* a list of BusMatchRules requested by the connections above. */
-    GList *rules;
+    /* an index of BusMatchRules requested by the connections above. */
+    BusMatchRuleIndex *rules;
     /* a serial number used to generate a unique name of a bus. */
     guint id;
 
-    GMutex dispatch_lock;
-    GList *dispatch_queue;
-
-    GMutex forward_lock;
-    GList *forward_queue;
+    /* messages pushed by the GDBus worker threads and drained by the main
+     * thread, per BusDBusLane. */
+    BusMessageQueue dispatch_queues[BUS_DBUS_LANE_LAST];
+    BusMessageQueue forward_queues[BUS_DBUS_LANE_LAST];
+    /* maps from a key to the BusLaneRoute of its queued messages, per
+     * BusDBusLane. The key of a dispatched message is its sender and the
+     * key of a forwarded message is its destination. A message goes to the
+     * lane of its class, so the messages of a sender are kept in order for
+     * each recipient and class, and a queued bulk message of a sender does
+     * not delay its interactive messages. */
+    GMutex lanes_lock;
+    GHashTable *dispatch_lanes[BUS_DBUS_LANE_LAST];
+    GHashTable *forward_lanes[BUS_DBUS_LANE_LAST];
+
+    /* a copy of the map from a unique or well-known name to the
+     * GDBusConnection of its primary owner. It's updated by the main thread
+     * and read by the GDBus's worker thread to forward messages directly. */
+    GMutex forward_names_lock;
+    GHashTable *forward_names;
 
     /* a list of BusMethodCall to be used to reply when services are
        really available */
@@ -98,6 +184,12 @@ struct _BusDispatchData {
     BusConnection *skip_connection;
 };
 
+typedef struct _BusForwardData BusForwardData;
+struct _BusForwardData {
+    GDBusMessage *message;
+    BusConnection *sender_connection;
+};
+
 typedef struct _BusNameService BusNameService;
 struct _BusNameService {
     gchar *name;
@@ -123,6 +215,10 @@ struct _BusMethodCall {
 
 /* functions prototype */
 static void     bus_dbus_impl_destroy           (BusDBusImpl        *dbus);
+static void     bus_dbus_impl_finalize          (GObject            *object);
+static IBusServiceMethodTable *
+                bus_dbus_impl_new_method_table
+                                                (IBusServiceClass   *class);
 static void     bus_dbus_impl_service_method_call
                                                 (IBusService        *service,
                                                  GDBusConnection    *dbus_connection,
@@ -171,6 +267,8 @@ static void      bus_dbus_impl_rule_destroy_cb  (BusMatchRule       *rule,
                                                  BusDBusImpl        *dbus);
 static void      bus_dbus_impl_object_destroy_cb(IBusService        *object,
                                                  BusDBusImpl        *dbus);
+static void      bus_dispatch_data_free         (BusDispatchData    *data);
+static void      bus_forward_data_free          (BusForwardData     *data);
 
 G_DEFINE_TYPE(BusDBusImpl, bus_dbus_impl, IBUS_TYPE_SERVICE)
 
@@ -506,6 +604,229 @@ bus_name_service_get_allow_replacement (BusNameService *service)
     return owner->allow_replacement;
 }
 
+/**
+ * bus_lanes_route:
+ * @lanes: The routes of each BusDBusLane.
+ * @returns: The lane of the message.
+ *
+ * Classify the message into a lane and count it in the route of @key in
+ * the lane. Call it with dbus->lanes_lock held and push the message before
+ * unlocking it.
+ */
+static BusDBusLane
+bus_lanes_route (GHashTable   **lanes,
+                 const gchar   *key,
+                 GDBusMessage  *message)
+{
+    BusDBusLane lane = bus_dbus_impl_classify_message (message);
+    BusLaneRoute *route = (BusLaneRoute *) g_hash_table_lookup (
+            lanes[lane], key ? key : "");
+
+    if (route == NULL) {
+        route = g_new (BusLaneRoute, 1);
+        route->n_queued = 0;
+        g_hash_table_insert (lanes[lane], g_strdup (key ? key : ""), route);
+    }
+    route->n_queued++;
+    return lane;
+}
+
+/**
+ * bus_lanes_unroute:
+ *
+ * Forget a message which bus_lanes_route() routed. Call it with
+ * dbus->lanes_lock held.
+ */
+static void
+bus_lanes_unroute (GHashTable  *lanes,
+                   const gchar *key)
+{
+    BusLaneRoute *route = (BusLaneRoute *) g_hash_table_lookup (
+            lanes, key ? key : "");
+
+    if (route != NULL && --route->n_queued == 0)
+        g_hash_table_remove (lanes, key ? key : "");
+}
+
+/**
+ * bus_lanes_done:
+ *
+ * Called when a message which bus_lanes_route() routed is processed.
+ */
+static void
+bus_lanes_done (BusDBusImpl *dbus,
+                GHashTable  *lanes,
+                const gchar *key)
+{
+    g_mutex_lock (&dbus->lanes_lock);
+    bus_lanes_unroute (lanes, key);
+    g_mutex_unlock (&dbus->lanes_lock);
+}
+
+static gboolean
+bus_lanes_has_queued (BusDBusImpl *dbus,
+                      GHashTable  *lanes,
+                      const gchar *key)
+{
+    gboolean retval;
+
+    g_mutex_lock (&dbus->lanes_lock);
+    retval = g_hash_table_contains (lanes, key ? key : "");
+    g_mutex_unlock (&dbus->lanes_lock);
+    return retval;
+}
+
+static void
+bus_message_queue_init (BusMessageQueue *queue)
+{
+    g_mutex_init (&queue->lock);
+    queue->capacity = BUS_MESSAGE_QUEUE_CAPACITY;
+    queue->items = g_new (gpointer, queue->capacity);
+    queue->head = 0;
+    queue->length = 0;
+    queue->high_water_mark = 0;
+    queue->n_messages = 0;
+    queue->n_dropped = 0;
+    queue->scheduled = FALSE;
+    queue->free_func = NULL;
+}
+
+/**
+ * bus_message_queue_clear:
+ *
+ * Free the queued items and close the queue. The filter of a GDBus worker
+ * thread could still push an item after this, so the lock and the buffer
+ * are kept until bus_message_queue_free_buffer() and a pushed item is freed
+ * with @free_func at once.
+ */
+static void
+bus_message_queue_clear (BusMessageQueue *queue,
+                         GDestroyNotify   free_func)
+{
+    guint i;
+
+    g_mutex_lock (&queue->lock);
+    for (i = 0; i < queue->length; i++)
+        free_func (queue->items[(queue->head + i) & (queue->capacity - 1)]);
+    queue->head = 0;
+    queue->length = 0;
+    queue->free_func = free_func;
+    g_mutex_unlock (&queue->lock);
+}
+
+/**
+ * bus_message_queue_free_buffer:
+ *
+ * Free the buffer and the lock of a cleared queue when no thread can push
+ * to it any more.
+ */
+static void
+bus_message_queue_free_buffer (BusMessageQueue *queue)
+{
+    g_assert (queue->length == 0);
+
+    g_free (queue->items);
+    queue->items = NULL;
+    queue->capacity = 0;
+    g_mutex_clear (&queue->lock);
+}
+
+/**
+ * bus_message_queue_push:
+ * @schedule: (out): TRUE if the caller needs to add an idle callback to
+ *     drain the queue.
+ * @returns: FALSE if the queue has BUS_MESSAGE_QUEUE_MAX_LENGTH items, in
+ *     which case the caller still owns @item.
+ *
+ * Append the item to the queue. This function could be called by the
+ * GDBus's worker thread.
+ */
+static gboolean
+bus_message_queue_push (BusMessageQueue *queue,
+                        gpointer         item,
+                        gboolean        *schedule)
+{
+    *schedule = FALSE;
+    g_mutex_lock (&queue->lock);
+    if (G_UNLIKELY (queue->free_func != NULL)) {
+        /* the queue is cleared. */
+        GDestroyNotify free_func = queue->free_func;
+        g_mutex_unlock (&queue->lock);
+        free_func (item);
+        return TRUE;
+    }
+    if (G_UNLIKELY (queue->length == BUS_MESSAGE_QUEUE_MAX_LENGTH)) {
+        /* warn once per overflow, the queue is usually drained soon. */
+        if (queue->n_dropped++ == 0)
+            g_warning ("Drop messages since a message queue is full.");
+        g_mutex_unlock (&queue->lock);
+        return FALSE;
+    }
+    queue->n_dropped = 0;
+    if (queue->length == queue->capacity) {
+        /* grow and unwrap the ring. */
+        gpointer *items = g_new (gpointer, queue->capacity * 2);
+        guint i;
+        for (i = 0; i < queue->length; i++)
+            items[i] = queue->items[(queue->head + i) & (queue->capacity - 1)];
+        g_free (queue->items);
+        queue->items = items;
+        queue->capacity *= 2;
+        queue->head = 0;
+    }
+    queue->items[(queue->head + queue->length) & (queue->capacity - 1)] = item;
+    queue->length++;
+    queue->n_messages++;
+    if (queue->length > queue->high_water_mark)
+        queue->high_water_mark = queue->length;
+    *schedule = !queue->scheduled;
+    queue->scheduled = TRUE;
+    g_mutex_unlock (&queue->lock);
+
+    return TRUE;
+}
+
+/**
+ * bus_message_queue_pop:
+ * @items: (out): An array to store the popped items.
+ * @max_items: The length of @items.
+ * @returns: The number of the popped items.
+ *
+ * Pop items from the head of the queue. When the queue gets empty, the next
+ * bus_message_queue_push() asks the caller to schedule a new idle callback.
+ */
+static guint
+bus_message_queue_pop (BusMessageQueue *queue,
+                       gpointer        *items,
+                       guint            max_items)
+{
+    guint n, i;
+
+    g_mutex_lock (&queue->lock);
+    n = MIN (queue->length, max_items);
+    for (i = 0; i < n; i++) {
+        items[i] = queue->items[queue->head];
+        queue->head = (queue->head + 1) & (queue->capacity - 1);
+    }
+    queue->length -= n;
+    if (queue->length == 0)
+        queue->scheduled = FALSE;
+    g_mutex_unlock (&queue->lock);
+
+    return n;
+}
+
+static void
+bus_message_queue_get_stats (BusMessageQueue   *queue,
+                             BusDBusQueueStats *stats)
+{
+    g_mutex_lock (&queue->lock);
+    stats->depth = queue->length;
+    stats->high_water_mark = queue->high_water_mark;
+    stats->n_messages = queue->n_messages;
+    g_mutex_unlock (&queue->lock);
+}
+
 static BusMethodCall *
 bus_method_call_new (BusDBusImpl           *dbus,
                      BusConnection         *connection,
@@ -539,6 +860,7 @@ bus_dbus_impl_class_init (BusDBusImplClass *class)
 {
     GObjectClass *gobject_class = G_OBJECT_CLASS (class);
 
+    gobject_class->finalize = bus_dbus_impl_finalize;
     IBUS_OBJECT_CLASS (gobject_class)->destroy =
             (IBusObjectDestroyFunc) bus_dbus_impl_destroy;
 
@@ -552,6 +874,7 @@ bus_dbus_impl_class_init (BusDBusImplClass *class)
 
     ibus_service_class_add_interfaces (IBUS_SERVICE_CLASS (class),
                                        introspection_xml);
+    dbus_methods = bus_dbus_impl_new_method_table (IBUS_SERVICE_CLASS (class));
 
     /* register a handler of the name-owner-changed signal below. */
     class->name_owner_changed = bus_dbus_impl_name_owner_changed;
@@ -614,14 +937,32 @@ bus_dbus_impl_class_init (BusDBusImplClass *class)
 static void
 bus_dbus_impl_init (BusDBusImpl *dbus)
 {
+    gint lane;
+
     dbus->unique_names = g_hash_table_new (g_str_hash, g_str_equal);
     dbus->names =
             g_hash_table_new_full (g_str_hash, g_str_equal,
                                    NULL,
                                    (GDestroyNotify) bus_name_service_free);
+    dbus->rules = bus_match_rule_index_new ();
+
+    for (lane = 0; lane < BUS_DBUS_LANE_LAST; lane++) {
+        bus_message_queue_init (&dbus->dispatch_queues[lane]);
+        bus_message_queue_init (&dbus->forward_queues[lane]);
+    }
 
-    g_mutex_init (&dbus->dispatch_lock);
-    g_mutex_init (&dbus->forward_lock);
+    g_mutex_init (&dbus->lanes_lock);
+    for (lane = 0; lane < BUS_DBUS_LANE_LAST; lane++) {
+        dbus->dispatch_lanes[lane] = g_hash_table_new_full (
+                g_str_hash, g_str_equal, g_free, g_free);
+        dbus->forward_lanes[lane] = g_hash_table_new_full (
+                g_str_hash, g_str_equal, g_free, g_free);
+    }
+
+    g_mutex_init (&dbus->forward_names_lock);
+    dbus->forward_names =
+            g_hash_table_new_full (g_str_hash, g_str_equal,
+                                   g_free, g_object_unref);
 
     /* other members are automatically zero-initialized. */
 }
@@ -641,14 +982,16 @@ bus_dbus_impl_destroy (BusDBusImpl *dbus)
     g_list_free (dbus->objects);
     dbus->objects = NULL;
 
-    for (p = dbus->rules; p != NULL; p = p->next) {
+    GList *rules = bus_match_rule_index_get_rules (dbus->rules);
+    for (p = rules; p != NULL; p = p->next) {
         BusMatchRule *rule = BUS_MATCH_RULE (p->data);
         g_signal_handlers_disconnect_by_func (rule,
                         G_CALLBACK (bus_dbus_impl_rule_destroy_cb), dbus);
         ibus_object_destroy ((IBusObject *) rule);
-        g_object_unref (rule);
     }
-    g_list_free (dbus->rules);
+    g_list_free (rules);
+    /* the index drops the references of the rules. */
+    bus_match_rule_index_free (dbus->rules);
     dbus->rules = NULL;
 
     for (p = dbus->connections; p != NULL; p = p->next) {
@@ -671,13 +1014,47 @@ bus_dbus_impl_destroy (BusDBusImpl *dbus)
                       (GDestroyNotify) bus_method_call_free);
     dbus->start_service_calls = NULL;
 
-    g_mutex_clear (&dbus->dispatch_lock);
-    g_mutex_clear (&dbus->forward_lock);
+    gint lane;
+    for (lane = 0; lane < BUS_DBUS_LANE_LAST; lane++) {
+        bus_message_queue_clear (&dbus->dispatch_queues[lane],
+                                 (GDestroyNotify) bus_dispatch_data_free);
+        bus_message_queue_clear (&dbus->forward_queues[lane],
+                                 (GDestroyNotify) bus_forward_data_free);
+    }
+    g_mutex_lock (&dbus->lanes_lock);
+    for (lane = 0; lane < BUS_DBUS_LANE_LAST; lane++) {
+        g_hash_table_remove_all (dbus->dispatch_lanes[lane]);
+        g_hash_table_remove_all (dbus->forward_lanes[lane]);
+    }
+    g_mutex_unlock (&dbus->lanes_lock);
+
+    /* the worker thread might still lock forward_names_lock. */
+    g_mutex_lock (&dbus->forward_names_lock);
+    g_hash_table_destroy (dbus->forward_names);
+    dbus->forward_names = NULL;
+    g_mutex_unlock (&dbus->forward_names_lock);
 
-    /* FIXME destruct _lock and _queue members. */
     IBUS_OBJECT_CLASS(bus_dbus_impl_parent_class)->destroy ((IBusObject *)dbus);
 }
 
+static void
+bus_dbus_impl_finalize (GObject *object)
+{
+    BusDBusImpl *dbus = BUS_DBUS_IMPL (object);
+    gint lane;
+
+    /* the connections which have the filters were closed in destroy. */
+    for (lane = 0; lane < BUS_DBUS_LANE_LAST; lane++) {
+        bus_message_queue_free_buffer (&dbus->dispatch_queues[lane]);
+        bus_message_queue_free_buffer (&dbus->forward_queues[lane]);
+        g_hash_table_destroy (dbus->dispatch_lanes[lane]);
+        g_hash_table_destroy (dbus->forward_lanes[lane]);
+    }
+    g_mutex_clear (&dbus->lanes_lock);
+
+    G_OBJECT_CLASS (bus_dbus_impl_parent_class)->finalize (object);
+}
+
 /**
  * bus_dbus_impl_hello:
  *
@@ -941,8 +1318,7 @@ static void
 bus_dbus_impl_rule_destroy_cb (BusMatchRule *rule,
                                BusDBusImpl  *dbus)
 {
-    dbus->rules = g_list_remove (dbus->rules, rule);
-    g_object_unref (rule);
+    bus_match_rule_index_remove (dbus->rules, rule);
 }
 
 /**
@@ -971,24 +1347,22 @@ bus_dbus_impl_add_match (BusDBusImpl           *dbus,
         bus_match_rule_set_sender (rule, IBUS_NAME_OWNER_NAME);
 
     g_dbus_method_invocation_return_value (invocation, NULL);
-    GList *p;
-    for (p = dbus->rules; p != NULL; p = p->next) {
-        if (bus_match_rule_is_equal (rule, (BusMatchRule *) p->data)) {
-            /* The same rule is already registered. Just reuse it. */
-            bus_match_rule_add_recipient ((BusMatchRule *) p->data, connection);
-            g_object_unref (rule);
-            return;
-        }
+    BusMatchRule *registered = bus_match_rule_index_lookup (dbus->rules, rule);
+    if (registered != NULL) {
+        /* The same rule is already registered. Just reuse it. */
+        bus_match_rule_add_recipient (registered, connection);
+        g_object_unref (rule);
+        return;
     }
 
-    if (rule) {
-        bus_match_rule_add_recipient (rule, connection);
-        dbus->rules = g_list_append (dbus->rules, rule);
-        g_signal_connect (rule,
-                          "destroy",
-                          G_CALLBACK (bus_dbus_impl_rule_destroy_cb),
-                          dbus);
-    }
+    bus_match_rule_add_recipient (rule, connection);
+    bus_match_rule_index_add (dbus->rules, rule);
+    g_signal_connect (rule,
+                      "destroy",
+                      G_CALLBACK (bus_dbus_impl_rule_destroy_cb),
+                      dbus);
+    /* the index holds the reference now. */
+    g_object_unref (rule);
 }
 
 /**
@@ -1015,18 +1389,14 @@ bus_dbus_impl_remove_match (BusDBusImpl           *dbus,
     }
 
     g_dbus_method_invocation_return_value (invocation, NULL);
-    GList *p;
-    for (p = dbus->rules; p != NULL; p = p->next) {
-        if (bus_match_rule_is_equal (rule, (BusMatchRule *) p->data)) {
-            /* p->data will be destroyed when the final recipient is removed. */
-            bus_match_rule_remove_recipient ((BusMatchRule *) p->data,
-                                             connection);
-            break;
-        }
-        /* FIXME should we return G_DBUS_ERROR if rule is not found in
-         * dbus->rules
-         */
+    BusMatchRule *registered = bus_match_rule_index_lookup (dbus->rules, rule);
+    if (registered != NULL) {
+        /* registered will be destroyed when the final recipient is removed. */
+        bus_match_rule_remove_recipient (registered, connection);
     }
+    /* FIXME should we return G_DBUS_ERROR if rule is not found in
+     * dbus->rules
+     */
     g_object_unref (rule);
 }
 
@@ -1312,6 +1682,25 @@ bus_dbus_impl_name_owner_changed (BusDBusImpl   *dbus,
     g_assert (old_owner != NULL);
     g_assert (new_owner != NULL);
 
+    /* update the copy for the worker thread. new_owner is always a unique
+     * name, which is in dbus->unique_names unless it's removed. */
+    BusConnection *owner = NULL;
+    if (*new_owner != '\0' && dbus->unique_names != NULL)
+        owner = (BusConnection *) g_hash_table_lookup (dbus->unique_names,
+                                                       new_owner);
+    g_mutex_lock (&dbus->forward_names_lock);
+    if (dbus->forward_names != NULL) {
+        if (owner != NULL) {
+            g_hash_table_insert (dbus->forward_names,
+                    g_strdup (name),
+                    g_object_ref (bus_connection_get_dbus_connection (owner)));
+        }
+        else {
+            g_hash_table_remove (dbus->forward_names, name);
+        }
+    }
+    g_mutex_unlock (&dbus->forward_names_lock);
+
     GDBusMessage *message = g_dbus_message_new_signal ("/org/freedesktop/DBus",
                                                        "org.freedesktop.DBus",
                                                        "NameOwnerChanged");
@@ -1410,6 +1799,37 @@ bus_dbus_impl_name_acquired (BusDBusImpl   *dbus,
     }
 }
 
+static const struct {
+    const gchar *method_name;
+    void (* method) (BusDBusImpl *,
+                     BusConnection *,
+                     GVariant *,
+                     GDBusMethodInvocation *);
+} methods[] =  {
+    /* DBus interface */
+    { "Hello",              bus_dbus_impl_hello },
+    { "ListNames",          bus_dbus_impl_list_names },
+    { "NameHasOwner",       bus_dbus_impl_name_has_owner },
+    { "GetNameOwner",       bus_dbus_impl_get_name_owner },
+    { "ListQueuedOwners",   bus_dbus_impl_list_queued_owners },
+    { "GetId",              bus_dbus_impl_get_id },
+    { "AddMatch",           bus_dbus_impl_add_match },
+    { "RemoveMatch",        bus_dbus_impl_remove_match },
+    { "RequestName",        bus_dbus_impl_request_name },
+    { "ReleaseName",        bus_dbus_impl_release_name },
+    { "StartServiceByName", bus_dbus_impl_start_service_by_name },
+};
+
+static IBusServiceMethodTable *
+bus_dbus_impl_new_method_table (IBusServiceClass *class)
+{
+    return ibus_service_method_table_new (class,
+                                          "org.freedesktop.DBus",
+                                          &methods[0].method_name,
+                                          G_N_ELEMENTS (methods),
+                                          sizeof (methods[0]));
+}
+
 /**
  * bus_dbus_impl_service_method_call:
  *
@@ -1428,6 +1848,15 @@ bus_dbus_impl_service_method_call (IBusService           *service,
 {
     BusDBusImpl *dbus = BUS_DBUS_IMPL (service);
 
+    gint i = ibus_service_method_table_lookup (dbus_methods, invocation);
+
+    if (i >= 0) {
+        BusConnection *connection = bus_connection_lookup (dbus_connection);
+        g_assert (BUS_IS_CONNECTION (connection));
+        methods[i].method (dbus, connection, parameters, invocation);
+        return;
+    }
+
     if (g_strcmp0 (interface_name, "org.freedesktop.DBus") != 0) {
         IBUS_SERVICE_CLASS (bus_dbus_impl_parent_class)->service_method_call (
                                         (IBusService *) dbus,
@@ -1441,37 +1870,6 @@ bus_dbus_impl_service_method_call (IBusService           *service,
         return;
     }
 
-    static const struct {
-        const gchar *method_name;
-        void (* method) (BusDBusImpl *,
-                         BusConnection *,
-                         GVariant *,
-                         GDBusMethodInvocation *);
-    } methods[] =  {
-        /* DBus interface */
-        { "Hello",              bus_dbus_impl_hello },
-        { "ListNames",          bus_dbus_impl_list_names },
-        { "NameHasOwner",       bus_dbus_impl_name_has_owner },
-        { "GetNameOwner",       bus_dbus_impl_get_name_owner },
-        { "ListQueuedOwners",   bus_dbus_impl_list_queued_owners },
-        { "GetId",              bus_dbus_impl_get_id },
-        { "AddMatch",           bus_dbus_impl_add_match },
-        { "RemoveMatch",        bus_dbus_impl_remove_match },
-        { "RequestName",        bus_dbus_impl_request_name },
-        { "ReleaseName",        bus_dbus_impl_release_name },
-        { "StartServiceByName", bus_dbus_impl_start_service_by_name },
-    };
-
-    gint i;
-    for (i = 0; i < G_N_ELEMENTS (methods); i++) {
-        if (!g_strcmp0 (method_name, methods[i].method_name)) {
-            BusConnection *connection = bus_connection_lookup (dbus_connection);
-            g_assert (BUS_IS_CONNECTION (connection));
-            methods[i].method (dbus, connection, parameters, invocation);
-            return;
-        }
-    }
-
     /* unsupported methods */
     g_dbus_method_invocation_return_error (
             invocation, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD,
@@ -1533,6 +1931,58 @@ bus_dbus_impl_service_set_property (IBusService        *service,
 
 }
 
+GDBusMessage *
+bus_dbus_message_set_sender (GDBusMessage *message,
+                             const gchar  *sender)
+{
+    GDBusMessage *new_message;
+    guchar *fields;
+    guint i;
+
+    g_assert (G_IS_DBUS_MESSAGE (message));
+
+    if (!g_dbus_message_get_locked (message)) {
+        g_dbus_message_set_sender (message, sender);
+        return message;
+    }
+    if (g_strcmp0 (g_dbus_message_get_sender (message), sender) == 0)
+        return message;
+
+    /* The body and the header values are immutable GVariants, so the new
+     * message just refs them. Unlike g_dbus_message_copy, file descriptors
+     * are not duplicated since the list is never modified after the message
+     * is locked. */
+    new_message = g_dbus_message_new ();
+    g_dbus_message_set_byte_order (new_message,
+                                   g_dbus_message_get_byte_order (message));
+    g_dbus_message_set_message_type (new_message,
+                                     g_dbus_message_get_message_type (message));
+    g_dbus_message_set_flags (new_message, g_dbus_message_get_flags (message));
+    g_dbus_message_set_serial (new_message, g_dbus_message_get_serial (message));
+    /* set the body before the header fields, since it resets the signature
+     * field. */
+    g_dbus_message_set_body (new_message, g_dbus_message_get_body (message));
+#ifdef G_OS_UNIX
+    if (g_dbus_message_get_unix_fd_list (message) != NULL) {
+        g_dbus_message_set_unix_fd_list (
+                new_message,
+                g_dbus_message_get_unix_fd_list (message));
+    }
+#endif
+    fields = g_dbus_message_get_header_fields (message);
+    for (i = 0; fields[i] != G_DBUS_MESSAGE_HEADER_FIELD_INVALID; i++) {
+        g_dbus_message_set_header (new_message,
+                                   fields[i],
+                                   g_dbus_message_get_header (message,
+                                                              fields[i]));
+    }
+    g_free (fields);
+    g_dbus_message_set_sender (new_message, sender);
+
+    g_object_unref (message);
+    return new_message;
+}
+
 /**
  * bus_dbus_impl_connection_filter_cb:
  * @returns: A GDBusMessage that will be processed by
@@ -1558,6 +2008,7 @@ bus_dbus_impl_connection_filter_cb (GDBusConnection *dbus_connection,
 
     if (incoming) {
         /* is incoming message */
+        bus_stats_count_message (message);
 
         /* get the destination aka bus name of the message. the destination is
          * set by g_dbus_connection_call_sync (for DBus and IBus messages
@@ -1567,17 +2018,10 @@ bus_dbus_impl_connection_filter_cb (GDBusConnection *dbus_connection,
         GDBusMessageType message_type =
                 g_dbus_message_get_message_type (message);
 
-        if (g_dbus_message_get_locked (message)) {
-            /* If the message is locked, we need make a copy of it. */
-            GDBusMessage *new_message = g_dbus_message_copy (message, NULL);
-            g_assert (new_message != NULL);
-            g_object_unref (message);
-            message = new_message;
-        }
-
         /* connection unique name as sender of the message*/
-        g_dbus_message_set_sender (message,
-                                   bus_connection_get_unique_name (connection));
+        message = bus_dbus_message_set_sender (
+                message,
+                bus_connection_get_unique_name (connection));
 
         if (!g_strcmp0 (destination, IBUS_SERVICE_IBUS) ||
             !g_strcmp0 (destination, IBUS_NAME_OWNER_NAME)) {
@@ -1661,15 +2105,11 @@ bus_dbus_impl_connection_filter_cb (GDBusConnection *dbus_connection,
     } else {
         /* is outgoing message */
         if (g_dbus_message_get_sender (message) == NULL) {
-            if (g_dbus_message_get_locked (message)) {
-                GDBusMessage *new_message = g_dbus_message_copy (message, NULL);
-                g_assert (new_message != NULL);
-                g_object_unref (message);
-                message = new_message;
-            }
             /* If the message is sending from ibus-daemon directly,
              * we set the sender to org.freedesktop.DBus */
-            g_dbus_message_set_sender (message, "org.freedesktop.DBus");
+            bus_stats_count_message (message);
+            message = bus_dbus_message_set_sender (message,
+                                                   "org.freedesktop.DBus");
         }
 
         /* dispatch the outgoing message by rules. */
@@ -1814,30 +2254,24 @@ bus_dbus_impl_get_connection_by_name (BusDBusImpl    *dbus,
     }
 }
 
-typedef struct _BusForwardData BusForwardData;
-struct _BusForwardData {
-    GDBusMessage *message;
-    BusConnection *sender_connection;
-};
+static void
+bus_forward_data_free (BusForwardData *data)
+{
+    g_object_unref (data->message);
+    g_object_unref (data->sender_connection);
+    g_slice_free (BusForwardData, data);
+}
 
 /**
- * bus_dbus_impl_forward_message_ible_cb:
+ * bus_dbus_impl_forward_message_real:
  *
- * Process the first element of the dbus->forward_queue. The first element is
- * forwarded by g_dbus_connection_send_message.
+ * Forward the message by g_dbus_connection_send_message, or reply an error
+ * to the sender if the destination is not found.
  */
-static gboolean
-bus_dbus_impl_forward_message_idle_cb (BusDBusImpl   *dbus)
+static void
+bus_dbus_impl_forward_message_real (BusDBusImpl    *dbus,
+                                    BusForwardData *data)
 {
-    g_return_val_if_fail (dbus->forward_queue != NULL, FALSE);
-
-    g_mutex_lock (&dbus->forward_lock);
-    BusForwardData *data = (BusForwardData *) dbus->forward_queue->data;
-    dbus->forward_queue = g_list_delete_link (dbus->forward_queue,
-                                              dbus->forward_queue);
-    gboolean has_message = (dbus->forward_queue != NULL);
-    g_mutex_unlock (&dbus->forward_lock);
-
     do {
         const gchar *destination =
                 g_dbus_message_get_destination (data->message);
@@ -1848,9 +2282,12 @@ bus_dbus_impl_forward_message_idle_cb (BusDBusImpl   *dbus)
                     destination);
         if (dest_connection != NULL) {
             /* FIXME workaround for gdbus. gdbus can not set an empty body
-             * message with signature '()' */
-            if (g_dbus_message_get_body (data->message) == NULL)
+             * message with signature '()'. The message could be locked by
+             * a failure in bus_dbus_impl_forward_message_direct. */
+            if (g_dbus_message_get_body (data->message) == NULL &&
+                !g_dbus_message_get_locked (data->message)) {
                 g_dbus_message_set_signature (data->message, NULL);
+            }
             GError *error = NULL;
             gboolean retval = g_dbus_connection_send_message (
                       bus_connection_get_dbus_connection (dest_connection),
@@ -1885,11 +2322,113 @@ bus_dbus_impl_forward_message_idle_cb (BusDBusImpl   *dbus)
                 NULL, NULL);
         g_object_unref (reply_message);
     } while (0);
+}
 
-    g_object_unref (data->message);
-    g_object_unref (data->sender_connection);
-    g_slice_free (BusForwardData, data);
-    return has_message;
+/**
+ * bus_dbus_impl_forward_lane:
+ *
+ * Forward messages in the dbus->forward_queues[lane] in batches. See
+ * bus_dbus_lane_priorities for how many batches are handled.
+ */
+static gboolean
+bus_dbus_impl_forward_lane (BusDBusImpl *dbus,
+                            BusDBusLane  lane)
+{
+    gpointer batch[BUS_MESSAGE_QUEUE_BATCH];
+    guint n, i;
+
+    /* the queues are cleared in bus_dbus_impl_destroy. */
+    if (G_UNLIKELY (IBUS_OBJECT_DESTROYED (dbus)))
+        return FALSE;
+
+    do {
+        n = bus_message_queue_pop (&dbus->forward_queues[lane],
+                                   batch, G_N_ELEMENTS (batch));
+        for (i = 0; i < n; i++) {
+            BusForwardData *data = (BusForwardData *) batch[i];
+            bus_dbus_impl_forward_message_real (dbus, data);
+            bus_lanes_done (dbus,
+                            dbus->forward_lanes[lane],
+                            g_dbus_message_get_destination (data->message));
+            bus_forward_data_free (data);
+        }
+    } while (n == G_N_ELEMENTS (batch) && lane == BUS_DBUS_LANE_INTERACTIVE);
+
+    /* keep the bulk lane callback while a full batch was popped. Otherwise
+     * the next push adds a new idle callback. */
+    return n == G_N_ELEMENTS (batch);
+}
+
+static gboolean
+bus_dbus_impl_forward_interactive_idle_cb (BusDBusImpl *dbus)
+{
+    return bus_dbus_impl_forward_lane (dbus, BUS_DBUS_LANE_INTERACTIVE);
+}
+
+static gboolean
+bus_dbus_impl_forward_bulk_idle_cb (BusDBusImpl *dbus)
+{
+    return bus_dbus_impl_forward_lane (dbus, BUS_DBUS_LANE_BULK);
+}
+
+/**
+ * bus_dbus_impl_forward_message_direct:
+ * @returns: TRUE if the message is forwarded.
+ *
+ * Forward the message from the GDBus's worker thread if the owner of the
+ * destination is in dbus->forward_names. Messages to a destination are still
+ * forwarded by the main thread while dbus->forward_queues have messages to
+ * the destination so that the order of the messages is kept. Filter
+ * functions of all connections are called by the same worker thread.
+ */
+static gboolean
+bus_dbus_impl_forward_message_direct (BusDBusImpl  *dbus,
+                                      GDBusMessage *message)
+{
+    const gchar *destination = g_dbus_message_get_destination (message);
+    GDBusConnection *dest_connection = NULL;
+    GError *error = NULL;
+    gboolean retval;
+
+    if (destination == NULL)
+        return FALSE;
+    if (bus_lanes_has_queued (
+                dbus,
+                dbus->forward_lanes[bus_dbus_impl_classify_message (message)],
+                destination)) {
+        return FALSE;
+    }
+
+    g_mutex_lock (&dbus->forward_names_lock);
+    if (dbus->forward_names != NULL) {
+        dest_connection = (GDBusConnection *) g_hash_table_lookup (
+                dbus->forward_names, destination);
+    }
+    if (dest_connection != NULL)
+        g_object_ref (dest_connection);
+    g_mutex_unlock (&dbus->forward_names_lock);
+
+    /* unknown names are replied with an error by the main thread. */
+    if (dest_connection == NULL)
+        return FALSE;
+
+    /* FIXME workaround for gdbus. See bus_dbus_impl_forward_message_real.
+     * The message is locked if it was passed through with its sender. */
+    if (g_dbus_message_get_body (message) == NULL &&
+        !g_dbus_message_get_locked (message)) {
+        g_dbus_message_set_signature (message, NULL);
+    }
+    retval = g_dbus_connection_send_message (
+            dest_connection,
+            message,
+            G_DBUS_SEND_MESSAGE_FLAGS_PRESERVE_SERIAL,
+            NULL, &error);
+    if (!retval) {
+        /* the main thread retries and replies an error if it fails again. */
+        g_error_free (error);
+    }
+    g_object_unref (dest_connection);
+    return retval;
 }
 
 void
@@ -1913,18 +2452,38 @@ bus_dbus_impl_forward_message (BusDBusImpl   *dbus,
      * could cause any real problems.
      */
 
+    if (bus_dbus_impl_forward_message_direct (dbus, message))
+        return;
+
     BusForwardData *data = g_slice_new (BusForwardData);
     data->message = g_object_ref (message);
     data->sender_connection = g_object_ref (connection);
 
-    g_mutex_lock (&dbus->forward_lock);
-    gboolean is_running = (dbus->forward_queue != NULL);
-    dbus->forward_queue = g_list_append (dbus->forward_queue, data);
-    g_mutex_unlock (&dbus->forward_lock);
-
-    if (!is_running) {
-        g_idle_add_full (G_PRIORITY_DEFAULT,
-                (GSourceFunc) bus_dbus_impl_forward_message_idle_cb,
+    gboolean schedule;
+    g_mutex_lock (&dbus->lanes_lock);
+    BusDBusLane lane = bus_lanes_route (
+            dbus->forward_lanes,
+            g_dbus_message_get_destination (message),
+            message);
+    if (!bus_message_queue_push (&dbus->forward_queues[lane],
+                                 data,
+                                 &schedule)) {
+        bus_lanes_unroute (dbus->forward_lanes[lane],
+                           g_dbus_message_get_destination (message));
+        g_mutex_unlock (&dbus->lanes_lock);
+        /* the sender floods the daemon and would wait for the reply of the
+         * dropped message forever, so disconnect it. */
+        g_dbus_connection_close (bus_connection_get_dbus_connection (connection),
+                                 NULL, NULL, NULL);
+        bus_forward_data_free (data);
+        return;
+    }
+    g_mutex_unlock (&dbus->lanes_lock);
+    if (schedule) {
+        g_idle_add_full (bus_dbus_lane_priorities[lane],
+                lane == BUS_DBUS_LANE_INTERACTIVE ?
+                        (GSourceFunc) bus_dbus_impl_forward_interactive_idle_cb :
+                        (GSourceFunc) bus_dbus_impl_forward_bulk_idle_cb,
                 g_object_ref (dbus), (GDestroyNotify) g_object_unref);
         /* the idle callback function will be called from the ibus's main
          * thread. */
@@ -1957,61 +2516,110 @@ bus_dispatch_data_free (BusDispatchData *data)
 }
 
 /**
- * bus_dbus_impl_dispatch_message_by_rule_idle_cb:
+ * bus_dbus_impl_dispatch_message_by_rule_real:
  *
- * Process the first element of the dbus->dispatch_queue.
+ * Send the message to the recipients of all match rules which match it.
+ * If @flush is TRUE, the connections of the recipients are flushed so
+ * that the GDBus worker thread writes the message out at once.
  */
-static gboolean
-bus_dbus_impl_dispatch_message_by_rule_idle_cb (BusDBusImpl *dbus)
+static void
+bus_dbus_impl_dispatch_message_by_rule_real (BusDBusImpl     *dbus,
+                                             BusDispatchData *data,
+                                             gboolean         flush)
 {
-    g_return_val_if_fail (dbus->dispatch_queue != NULL, FALSE);
-
-    if (G_UNLIKELY (IBUS_OBJECT_DESTROYED (dbus))) {
-        /* dbus was destryed */
-        g_mutex_lock (&dbus->dispatch_lock);
-        g_list_free_full (dbus->dispatch_queue,
-                          (GDestroyNotify) bus_dispatch_data_free);
-        dbus->dispatch_queue = NULL;
-        g_mutex_unlock (&dbus->dispatch_lock);
-        /* return FALSE to prevent this callback to be called again. */
-        return FALSE;
-    }
-
-    /* remove fist node */
-    g_mutex_lock (&dbus->dispatch_lock);
-    BusDispatchData *data = (BusDispatchData *) dbus->dispatch_queue->data;
-    dbus->dispatch_queue = g_list_delete_link (dbus->dispatch_queue,
-                                               dbus->dispatch_queue);
-    gboolean has_message = (dbus->dispatch_queue != NULL);
-    g_mutex_unlock (&dbus->dispatch_lock);
-
     GList *link = NULL;
-    GList *recipients = NULL;
-
-    /* check each match rules, and get recipients */
-    for (link = dbus->rules; link != NULL; link = link->next) {
-        GList *list = bus_match_rule_get_recipients (
-                (BusMatchRule *) link->data,
-                data->message);
-        recipients = g_list_concat (recipients, list);
-    }
+    /* check the match rules which could match the message, and get
+     * recipients */
+    GList *recipients = bus_match_rule_index_get_recipients (dbus->rules,
+                                                             data->message);
 
     /* send message to each recipients */
     for (link = recipients; link != NULL; link = link->next) {
         BusConnection *connection = (BusConnection *) link->data;
         if (G_LIKELY (connection != data->skip_connection)) {
+            GDBusConnection *dbus_connection =
+                    bus_connection_get_dbus_connection (connection);
             g_dbus_connection_send_message (
-                    bus_connection_get_dbus_connection (connection),
+                    dbus_connection,
                     data->message,
                     G_DBUS_SEND_MESSAGE_FLAGS_PRESERVE_SERIAL,
                     NULL, NULL);
+            if (flush)
+                g_dbus_connection_flush (dbus_connection, NULL, NULL, NULL);
         }
     }
     g_list_free (recipients);
-    bus_dispatch_data_free (data);
+}
 
-    /* remove this idle callback if no message is left by returning FALSE. */
-    return has_message;
+/**
+ * bus_dbus_impl_dispatch_lane:
+ *
+ * Dispatch messages in the dbus->dispatch_queues[lane] in batches. See
+ * bus_dbus_lane_priorities for how many batches are handled.
+ */
+static gboolean
+bus_dbus_impl_dispatch_lane (BusDBusImpl *dbus,
+                             BusDBusLane  lane)
+{
+    gpointer batch[BUS_MESSAGE_QUEUE_BATCH];
+    guint n, i;
+
+    /* the queues are cleared in bus_dbus_impl_destroy. */
+    if (G_UNLIKELY (IBUS_OBJECT_DESTROYED (dbus)))
+        return FALSE;
+
+    do {
+        n = bus_message_queue_pop (&dbus->dispatch_queues[lane],
+                                   batch, G_N_ELEMENTS (batch));
+        for (i = 0; i < n; i++) {
+            BusDispatchData *data = (BusDispatchData *) batch[i];
+            bus_dbus_impl_dispatch_message_by_rule_real (dbus, data, FALSE);
+            bus_lanes_done (dbus,
+                            dbus->dispatch_lanes[lane],
+                            g_dbus_message_get_sender (data->message));
+            bus_dispatch_data_free (data);
+        }
+    } while (n == G_N_ELEMENTS (batch) && lane == BUS_DBUS_LANE_INTERACTIVE);
+
+    /* keep the bulk lane callback while a full batch was popped. Otherwise
+     * the next push adds a new idle callback. */
+    return n == G_N_ELEMENTS (batch);
+}
+
+static gboolean
+bus_dbus_impl_dispatch_interactive_idle_cb (BusDBusImpl *dbus)
+{
+    return bus_dbus_impl_dispatch_lane (dbus, BUS_DBUS_LANE_INTERACTIVE);
+}
+
+static gboolean
+bus_dbus_impl_dispatch_bulk_idle_cb (BusDBusImpl *dbus)
+{
+    return bus_dbus_impl_dispatch_lane (dbus, BUS_DBUS_LANE_BULK);
+}
+
+/**
+ * bus_dbus_impl_mark_dispatched:
+ * @returns: FALSE if the message is already dispatched by rule.
+ *
+ * A message sent or forwarded by bus_dbus_impl_dispatch_lane is also
+ * processed by the filter callback, so the message is marked not to be
+ * dispatched twice.
+ */
+static gboolean
+bus_dbus_impl_mark_dispatched (GDBusMessage *message)
+{
+    static GQuark dispatched_quark = 0;
+    if (dispatched_quark == 0) {
+        dispatched_quark = g_quark_from_static_string ("DISPATCHED");
+    }
+
+    if (g_object_get_qdata ((GObject *) message, dispatched_quark) != NULL)
+        return FALSE;
+    g_object_set_qdata ((GObject *) message,
+                        dispatched_quark,
+                        GINT_TO_POINTER (1));
+    return TRUE;
 }
 
 void
@@ -2029,32 +2637,34 @@ bus_dbus_impl_dispatch_message_by_rule (BusDBusImpl     *dbus,
         return;
     /* FIXME - see the FIXME comment in bus_dbus_impl_forward_message. */
 
-    static GQuark dispatched_quark = 0;
-    if (dispatched_quark == 0) {
-        dispatched_quark = g_quark_from_static_string ("DISPATCHED");
-    }
-
-    /* A message sent or forwarded by
-     * bus_dbus_impl_dispatch_message_by_rule_idle_cb is also processed by the
-     * filter callback.
-     * If this message has been dispatched by rule, do nothing.
-     */
-    if (g_object_get_qdata ((GObject *) message, dispatched_quark) != NULL)
+    if (!bus_dbus_impl_mark_dispatched (message))
         return;
-    g_object_set_qdata ((GObject *) message,
-                        dispatched_quark,
-                        GINT_TO_POINTER (1));
 
     /* append dispatch data into the queue, and start idle task if necessary */
-    g_mutex_lock (&dbus->dispatch_lock);
-    gboolean is_running = (dbus->dispatch_queue != NULL);
-    dbus->dispatch_queue = g_list_append (dbus->dispatch_queue,
-                    bus_dispatch_data_new (message, skip_connection));
-    g_mutex_unlock (&dbus->dispatch_lock);
-    if (!is_running) {
+    BusDispatchData *data = bus_dispatch_data_new (message, skip_connection);
+    gboolean schedule;
+    g_mutex_lock (&dbus->lanes_lock);
+    BusDBusLane lane = bus_lanes_route (dbus->dispatch_lanes,
+                                        g_dbus_message_get_sender (message),
+                                        message);
+    if (!bus_message_queue_push (&dbus->dispatch_queues[lane],
+                                 data,
+                                 &schedule)) {
+        /* the message is a signal or a reply which nobody waits for in
+         * the daemon, so it is only dropped. */
+        bus_lanes_unroute (dbus->dispatch_lanes[lane],
+                           g_dbus_message_get_sender (message));
+        g_mutex_unlock (&dbus->lanes_lock);
+        bus_dispatch_data_free (data);
+        return;
+    }
+    g_mutex_unlock (&dbus->lanes_lock);
+    if (schedule) {
         g_idle_add_full (
-                G_PRIORITY_DEFAULT,
-                (GSourceFunc)bus_dbus_impl_dispatch_message_by_rule_idle_cb,
+                bus_dbus_lane_priorities[lane],
+                lane == BUS_DBUS_LANE_INTERACTIVE ?
+                        (GSourceFunc) bus_dbus_impl_dispatch_interactive_idle_cb :
+                        (GSourceFunc) bus_dbus_impl_dispatch_bulk_idle_cb,
                 g_object_ref (dbus),
                 (GDestroyNotify)g_object_unref);
         /* the idle callback function will be called from the ibus's main
@@ -2062,6 +2672,71 @@ bus_dbus_impl_dispatch_message_by_rule (BusDBusImpl     *dbus,
     }
 }
 
+typedef struct {
+    BusDBusImpl     *dbus;
+    BusDispatchData *data;
+} BusUrgentDispatchData;
+
+static gboolean
+bus_dbus_impl_dispatch_urgent_cb (BusUrgentDispatchData *urgent)
+{
+    if (!IBUS_OBJECT_DESTROYED (urgent->dbus)) {
+        bus_dbus_impl_dispatch_message_by_rule_real (urgent->dbus,
+                                                     urgent->data,
+                                                     TRUE);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+static void
+bus_urgent_dispatch_data_free (BusUrgentDispatchData *urgent)
+{
+    g_object_unref (urgent->dbus);
+    bus_dispatch_data_free (urgent->data);
+    g_slice_free (BusUrgentDispatchData, urgent);
+}
+
+void
+bus_dbus_impl_dispatch_urgent_message_by_rule (BusDBusImpl   *dbus,
+                                               GDBusMessage  *message,
+                                               BusConnection *skip_connection)
+{
+    BusUrgentDispatchData *urgent;
+
+    g_assert (BUS_IS_DBUS_IMPL (dbus));
+    g_assert (message != NULL);
+    g_assert (skip_connection == NULL || BUS_IS_CONNECTION (skip_connection));
+
+    if (G_UNLIKELY (IBUS_OBJECT_DESTROYED (dbus)))
+        return;
+    /* the message must not pass the queued messages of the same sender
+     * and class, e.g. a GlobalEngineChanged signal before the switcher
+     * response. */
+    if (bus_lanes_has_queued (
+                dbus,
+                dbus->dispatch_lanes[bus_dbus_impl_classify_message (message)],
+                g_dbus_message_get_sender (message))) {
+        bus_dbus_impl_dispatch_message_by_rule (dbus,
+                                                message,
+                                                skip_connection);
+        return;
+    }
+    if (!bus_dbus_impl_mark_dispatched (message))
+        return;
+
+    urgent = g_slice_new (BusUrgentDispatchData);
+    urgent->dbus = (BusDBusImpl *) g_object_ref (dbus);
+    urgent->data = bus_dispatch_data_new (message, skip_connection);
+    /* This calls the function at once in the main thread, which owns the
+     * default main context. Another thread gets a source which runs before
+     * the idle callbacks of the lanes and the incoming D-Bus calls. */
+    g_main_context_invoke_full (NULL,
+                                G_PRIORITY_HIGH,
+                                (GSourceFunc) bus_dbus_impl_dispatch_urgent_cb,
+                                urgent,
+                                (GDestroyNotify) bus_urgent_dispatch_data_free);
+}
+
 static void
 bus_dbus_impl_object_destroy_cb (IBusService *object,
                                  BusDBusImpl *dbus)
@@ -2125,3 +2800,48 @@ bus_dbus_impl_unregister_object (BusDBusImpl *dbus,
     return TRUE;
 }
 
+BusDBusLane
+bus_dbus_impl_classify_message (GDBusMessage *message)
+{
+    static GHashTable *bulk_members = NULL;
+    const gchar *member;
+
+    g_assert (G_IS_DBUS_MESSAGE (message));
+
+    if (g_once_init_enter (&bulk_members)) {
+        GHashTable *table = g_hash_table_new (g_str_hash, g_str_equal);
+        guint i;
+        for (i = 0; i < G_N_ELEMENTS (bus_dbus_bulk_members); i++)
+            g_hash_table_add (table, (gpointer) bus_dbus_bulk_members[i]);
+        g_once_init_leave (&bulk_members, table);
+    }
+
+    /* method returns and errors have no member, and their callers are
+     * waiting for them. */
+    member = g_dbus_message_get_member (message);
+    if (member != NULL && g_hash_table_contains (bulk_members, member))
+        return BUS_DBUS_LANE_BULK;
+    return BUS_DBUS_LANE_INTERACTIVE;
+}
+
+void
+bus_dbus_impl_get_queue_stats (BusDBusImpl       *dbus,
+                               BusDBusQueue       queue,
+                               BusDBusLane        lane,
+                               BusDBusQueueStats *stats)
+{
+    g_assert (BUS_IS_DBUS_IMPL (dbus));
+    g_assert (lane < BUS_DBUS_LANE_LAST);
+    g_assert (stats != NULL);
+
+    switch (queue) {
+    case BUS_DBUS_QUEUE_DISPATCH:
+        bus_message_queue_get_stats (&dbus->dispatch_queues[lane], stats);
+        break;
+    case BUS_DBUS_QUEUE_FORWARD:
+        bus_message_queue_get_stats (&dbus->forward_queues[lane], stats);
+        break;
+    default:
+        g_return_if_reached ();
+    }
+}
@@ -51,6 +51,39 @@ G_BEGIN_DECLS
 
 typedef struct _BusDBusImpl BusDBusImpl;
 typedef struct _BusDBusImplClass BusDBusImplClass;
+typedef struct _BusDBusQueueStats BusDBusQueueStats;
+
+/**
+ * BusDBusLane:
+ * @BUS_DBUS_LANE_INTERACTIVE: Messages which affect the typing latency.
+ * @BUS_DBUS_LANE_BULK: Messages which can wait behind interactive ones.
+ *
+ * Messages are dispatched and forwarded in the order of the lanes. A message follows the queued messages of its sender
+ * (dispatched) or of its destination (forwarded) into their lane, so the messages of a sender keep their order for
+ * each recipient.
+ */
+typedef enum {
+    BUS_DBUS_LANE_INTERACTIVE,
+    BUS_DBUS_LANE_BULK,
+    BUS_DBUS_LANE_LAST,
+} BusDBusLane;
+
+typedef enum {
+    BUS_DBUS_QUEUE_DISPATCH,
+    BUS_DBUS_QUEUE_FORWARD,
+} BusDBusQueue;
+
+/**
+ * BusDBusQueueStats:
+ * @depth: The number of messages in the queue now.
+ * @high_water_mark: The maximum depth of the queue so far.
+ * @n_messages: The number of messages pushed to the queue so far.
+ */
+struct _BusDBusQueueStats {
+    guint   depth;
+    guint   high_water_mark;
+    guint64 n_messages;
+};
 
 GType            bus_dbus_impl_get_type         (void);
 
@@ -86,8 +119,9 @@ BusConnection   *bus_dbus_impl_get_connection_by_name
 /**
  * bus_dbus_impl_forward_message:
  *
- * Push the message to the queue (dbus->forward_queue) and schedule a idle function call (bus_dbus_impl_forward_message_idle_cb) which
- * actually forwards the message to the destination. Note that the destination of the message is embedded in the message.
+ * Forward the message to the destination from the current thread if the owner of the destination is known.
+ * Otherwise push the message to the queue of its lane (dbus->forward_queues) and schedule a idle function call (bus_dbus_impl_forward_lane) which
+ * actually forwards the message to the destination, or replies an error. Note that the destination of the message is embedded in the message.
  */
 void             bus_dbus_impl_forward_message  (BusDBusImpl    *dbus,
                                                  BusConnection  *connection,
@@ -96,7 +130,7 @@ void             bus_dbus_impl_forward_message  (BusDBusImpl    *dbus,
 /**
  * bus_dbus_impl_dispatch_message_by_rule:
  *
- * Push the message to the queue (dbus->dispatch_queue) and schedule a idle function call (bus_dbus_impl_dispatch_message_by_rule_idle_cb)
+ * Push the message to the queue of its lane (dbus->dispatch_queues) and schedule a idle function call (bus_dbus_impl_dispatch_lane)
  * which actually dispatch the message by rule.
  */
 void             bus_dbus_impl_dispatch_message_by_rule
@@ -104,6 +138,19 @@ void             bus_dbus_impl_dispatch_message_by_rule
                                                  GDBusMessage   *message,
                                                  BusConnection  *skip_connection);
 
+/**
+ * bus_dbus_impl_dispatch_urgent_message_by_rule:
+ *
+ * Dispatch the message by rule ahead of the queued messages and flush the connections of the recipients. It is for the
+ * few signals which the user waits for, like GlobalShortcutKeyResponded, so the message does not wait for the idle
+ * function call of its lane. Dispatched in the main thread at once, otherwise in a G_PRIORITY_HIGH source.
+ * If the sender has queued messages, the message is queued after them like bus_dbus_impl_dispatch_message_by_rule.
+ */
+void             bus_dbus_impl_dispatch_urgent_message_by_rule
+                                                (BusDBusImpl    *dbus,
+                                                 GDBusMessage   *message,
+                                                 BusConnection  *skip_connection);
+
 /**
  * bus_dbus_impl_register_object:
  * @object: A new service which implements IBusService, like BusIBusImpl and BusInputContext.
@@ -123,6 +170,43 @@ gboolean         bus_dbus_impl_register_object  (BusDBusImpl    *dbus,
  */
 gboolean         bus_dbus_impl_unregister_object(BusDBusImpl    *dbus,
                                                  IBusService    *object);
+
+/**
+ * bus_dbus_impl_classify_message:
+ * @returns: The lane of the message. The messages of a sender are kept in order for each recipient and lane.
+ *
+ * Key events, commit text, preedit and forwarded keys go to the interactive lane, and properties, engine lists and
+ * registry changes go to the bulk lane. Messages without a member (method returns and errors) and unknown members go
+ * to the interactive lane. Thread safe.
+ */
+BusDBusLane      bus_dbus_impl_classify_message (GDBusMessage   *message);
+
+/**
+ * bus_dbus_impl_get_queue_stats:
+ * @queue: The queue type.
+ * @lane: The lane of the queue.
+ * @stats: (out): The statistics of the queue.
+ *
+ * Get the statistics of dbus->dispatch_queues[lane] or dbus->forward_queues[lane]. Thread safe.
+ */
+void             bus_dbus_impl_get_queue_stats  (BusDBusImpl    *dbus,
+                                                 BusDBusQueue    queue,
+                                                 BusDBusLane     lane,
+                                                 BusDBusQueueStats
+                                                                *stats);
+
+/**
+ * bus_dbus_message_set_sender:
+ * @message: (transfer full): A message.
+ * @sender: The new sender of the message.
+ * @returns: (transfer full): @message or a new message.
+ *
+ * Set the sender of the message. If the message is locked, return a new
+ * message which shares the body and the header values with @message, and
+ * unref @message. Thread safe.
+ */
+GDBusMessage    *bus_dbus_message_set_sender    (GDBusMessage   *message,
+                                                 const gchar    *sender);
 G_END_DECLS
 #endif
 
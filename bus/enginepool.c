@@ -0,0 +1,393 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/* ibus - The Input Bus
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#include "enginepool.h"
+
+#include "global.h"
+
+typedef struct _PoolEntry PoolEntry;
+struct _PoolEntry {
+    BusEngineProxy *engine;
+    /* the name of the engine, which is kept after the proxy is destroyed */
+    gchar          *name;
+    /* TRUE if the pool has the only reference of the engine */
+    gboolean        idle;
+    gulong          destroy_handler_id;
+};
+
+/* the entries from the most recently used idle one */
+static GQueue        pool = G_QUEUE_INIT;
+static gchar       **preload_names;
+/* the names of the engines being pre-created */
+static GHashTable   *pending_names;
+static GCancellable *pending_cancellable;
+/* cancels the engines which bus_engine_pool_prewarm() creates */
+static GCancellable *prewarm_cancellable;
+static guint         trim_id;
+static guint64       n_hits;
+static guint64       n_misses;
+
+static gboolean
+bus_engine_pool_is_preload (const gchar *name)
+{
+    return preload_names != NULL &&
+           g_strv_contains ((const gchar * const *) preload_names, name);
+}
+
+static guint
+bus_engine_pool_get_n_idle (void)
+{
+    GList *p;
+    guint n = 0;
+
+    for (p = pool.head; p != NULL; p = p->next) {
+        if (((PoolEntry *) p->data)->idle)
+            n++;
+    }
+    return n;
+}
+
+static void bus_engine_pool_toggle_notify (PoolEntry *entry,
+                                           GObject   *object,
+                                           gboolean   is_last_ref);
+
+static void
+bus_engine_pool_remove (PoolEntry *entry)
+{
+    g_queue_remove (&pool, entry);
+    g_signal_handler_disconnect (entry->engine, entry->destroy_handler_id);
+    /* This destroys an idle engine. */
+    g_object_remove_toggle_ref ((GObject *) entry->engine,
+                                (GToggleNotify) bus_engine_pool_toggle_notify,
+                                entry);
+    g_free (entry->name);
+    g_slice_free (PoolEntry, entry);
+}
+
+/**
+ * bus_engine_pool_trim:
+ *
+ * Destroy the idle engines which are not preloaded and the least recently
+ * used idle ones above --engine-pool-size.
+ */
+static gboolean
+bus_engine_pool_trim (gpointer user_data)
+{
+    GList *p, *prev;
+    guint n_idle = bus_engine_pool_get_n_idle ();
+
+    trim_id = 0;
+    for (p = pool.tail; p != NULL; p = prev) {
+        PoolEntry *entry = (PoolEntry *) p->data;
+        prev = p->prev;
+        if (!entry->idle)
+            continue;
+        if (n_idle > (guint) g_engine_pool_size ||
+            !bus_engine_pool_is_preload (entry->name)) {
+            bus_engine_pool_remove (entry);
+            n_idle--;
+        }
+    }
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * bus_engine_pool_toggle_notify:
+ *
+ * A GToggleNotify function to be called when the pool gets the only
+ * reference of an engine or loses it.
+ */
+static void
+bus_engine_pool_toggle_notify (PoolEntry *entry,
+                               GObject   *object,
+                               gboolean   is_last_ref)
+{
+    entry->idle = is_last_ref;
+    if (!is_last_ref)
+        return;
+
+    g_queue_remove (&pool, entry);
+    g_queue_push_head (&pool, entry);
+    /* The engine is being unreferenced, so destroy it later. */
+    if (trim_id == 0)
+        trim_id = g_idle_add (bus_engine_pool_trim, NULL);
+}
+
+/**
+ * bus_engine_pool_engine_destroy_cb:
+ *
+ * A callback function to be called when the engine is destroyed by its
+ * component, e.g. when the engine process exits.
+ */
+static void
+bus_engine_pool_engine_destroy_cb (BusEngineProxy *engine,
+                                   PoolEntry      *entry)
+{
+    bus_engine_pool_remove (entry);
+}
+
+static PoolEntry *
+bus_engine_pool_lookup (BusEngineProxy *engine)
+{
+    GList *p;
+
+    for (p = pool.head; p != NULL; p = p->next) {
+        if (((PoolEntry *) p->data)->engine == engine)
+            return (PoolEntry *) p->data;
+    }
+    return NULL;
+}
+
+static gboolean
+bus_engine_pool_has_engine (const gchar *name,
+                            gboolean     idle_only)
+{
+    GList *p;
+
+    for (p = pool.head; p != NULL; p = p->next) {
+        PoolEntry *entry = (PoolEntry *) p->data;
+        if ((entry->idle || !idle_only) &&
+            g_strcmp0 (entry->name, name) == 0) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+void
+bus_engine_pool_add (BusEngineProxy *engine)
+{
+    PoolEntry *entry;
+    IBusEngineDesc *desc;
+
+    g_assert (BUS_IS_ENGINE_PROXY (engine));
+
+    desc = bus_engine_proxy_get_desc (engine);
+    if (g_engine_pool_size <= 0 || desc == NULL ||
+        !bus_engine_pool_is_preload (ibus_engine_desc_get_name (desc)) ||
+        bus_engine_pool_lookup (engine) != NULL) {
+        return;
+    }
+
+    entry = g_slice_new0 (PoolEntry);
+    entry->engine = engine;
+    entry->name = g_strdup (ibus_engine_desc_get_name (desc));
+    entry->destroy_handler_id =
+            g_signal_connect (engine,
+                              "destroy",
+                              G_CALLBACK (bus_engine_pool_engine_destroy_cb),
+                              entry);
+    g_queue_push_tail (&pool, entry);
+    g_object_add_toggle_ref ((GObject *) engine,
+                             (GToggleNotify) bus_engine_pool_toggle_notify,
+                             entry);
+}
+
+BusEngineProxy *
+bus_engine_pool_take (IBusEngineDesc *desc)
+{
+    const gchar *name;
+    GList *p;
+
+    g_assert (IBUS_IS_ENGINE_DESC (desc));
+
+    name = ibus_engine_desc_get_name (desc);
+    if (g_engine_pool_size <= 0 || !bus_engine_pool_is_preload (name))
+        return NULL;
+
+    for (p = pool.head; p != NULL; p = p->next) {
+        PoolEntry *entry = (PoolEntry *) p->data;
+        if (entry->idle && g_strcmp0 (entry->name, name) == 0) {
+            n_hits++;
+            /* The toggle notify marks the entry in use. */
+            return g_object_ref (entry->engine);
+        }
+    }
+    n_misses++;
+    return NULL;
+}
+
+/**
+ * bus_engine_pool_prewarm_cb:
+ *
+ * A callback function to be called when bus_engine_proxy_new() of a
+ * preload engine is finished.
+ */
+static void
+bus_engine_pool_prewarm_cb (GObject      *source,
+                            GAsyncResult *res,
+                            gchar        *name)
+{
+    GError *error = NULL;
+    BusEngineProxy *engine = bus_engine_proxy_new_finish (res, &error);
+
+    if (pending_names != NULL)
+        g_hash_table_remove (pending_names, name);
+
+    if (engine == NULL) {
+        if (g_verbose) {
+            g_warning ("Cannot pre-create the engine %s: %s",
+                       name, error->message);
+        }
+        g_error_free (error);
+    } else {
+        /* The engine is destroyed if the pool does not keep it. */
+        bus_engine_pool_add (engine);
+        g_object_unref (engine);
+    }
+    g_free (name);
+}
+
+static void
+bus_engine_pool_init_pending (void)
+{
+    if (pending_names != NULL)
+        return;
+    pending_names = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                           g_free, NULL);
+    pending_cancellable = g_cancellable_new ();
+    prewarm_cancellable = g_cancellable_new ();
+}
+
+/**
+ * bus_engine_pool_create:
+ *
+ * Create a proxy of @desc for the pool unless the pool is already creating
+ * one.
+ */
+static void
+bus_engine_pool_create (IBusEngineDesc *desc,
+                        GCancellable   *cancellable)
+{
+    const gchar *name = ibus_engine_desc_get_name (desc);
+
+    if (g_hash_table_contains (pending_names, name))
+        return;
+
+    g_hash_table_add (pending_names, g_strdup (name));
+    bus_engine_proxy_new (desc,
+                          g_gdbus_timeout,
+                          cancellable,
+                          (GAsyncReadyCallback) bus_engine_pool_prewarm_cb,
+                          g_strdup (name));
+}
+
+void
+bus_engine_pool_set_preload_engines (GList *descs)
+{
+    GList *p;
+    guint n_names = 0;
+    guint n_idle;
+
+    g_strfreev (preload_names);
+    preload_names = g_new0 (gchar *, g_list_length (descs) + 1);
+    for (p = descs; p != NULL; p = p->next) {
+        preload_names[n_names++] = g_strdup (
+                ibus_engine_desc_get_name ((IBusEngineDesc *) p->data));
+    }
+
+    bus_engine_pool_trim (NULL);
+    if (g_engine_pool_size <= 0)
+        return;
+
+    bus_engine_pool_init_pending ();
+    n_idle = bus_engine_pool_get_n_idle ();
+    for (p = descs; p != NULL; p = p->next) {
+        IBusEngineDesc *desc = (IBusEngineDesc *) p->data;
+
+        if (n_idle + g_hash_table_size (pending_names) >=
+            (guint) g_engine_pool_size) {
+            break;
+        }
+        if (!bus_engine_pool_has_engine (ibus_engine_desc_get_name (desc),
+                                         FALSE)) {
+            bus_engine_pool_create (desc, pending_cancellable);
+        }
+    }
+}
+
+const gchar * const *
+bus_engine_pool_get_preload_engines (void)
+{
+    return (const gchar * const *) preload_names;
+}
+
+void
+bus_engine_pool_prewarm (GList *descs)
+{
+    GList *p;
+
+    if (g_engine_pool_size <= 0)
+        return;
+
+    bus_engine_pool_init_pending ();
+    for (p = descs; p != NULL; p = p->next) {
+        IBusEngineDesc *desc = (IBusEngineDesc *) p->data;
+        const gchar *name = ibus_engine_desc_get_name (desc);
+
+        if (bus_engine_pool_is_preload (name) &&
+            !bus_engine_pool_has_engine (name, TRUE)) {
+            bus_engine_pool_create (desc, prewarm_cancellable);
+        }
+    }
+}
+
+void
+bus_engine_pool_cancel_prewarm (void)
+{
+    if (prewarm_cancellable == NULL)
+        return;
+
+    /* The callbacks of the cancelled engines remove their pending names. */
+    g_cancellable_cancel (prewarm_cancellable);
+    g_object_unref (prewarm_cancellable);
+    prewarm_cancellable = g_cancellable_new ();
+}
+
+void
+bus_engine_pool_clear (void)
+{
+    if (pending_cancellable != NULL) {
+        g_cancellable_cancel (pending_cancellable);
+        g_clear_object (&pending_cancellable);
+    }
+    if (prewarm_cancellable != NULL) {
+        g_cancellable_cancel (prewarm_cancellable);
+        g_clear_object (&prewarm_cancellable);
+    }
+    g_clear_pointer (&pending_names, g_hash_table_destroy);
+
+    if (trim_id != 0) {
+        g_source_remove (trim_id);
+        trim_id = 0;
+    }
+    while (!g_queue_is_empty (&pool))
+        bus_engine_pool_remove ((PoolEntry *) g_queue_peek_head (&pool));
+    g_clear_pointer (&preload_names, g_strfreev);
+}
+
+GVariant *
+bus_engine_pool_get_stats (void)
+{
+    return g_variant_new ("(uutt)",
+                          g_queue_get_length (&pool),
+                          bus_engine_pool_get_n_idle (),
+                          n_hits,
+                          n_misses);
+}
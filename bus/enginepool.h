@@ -0,0 +1,120 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/* ibus - The Input Bus
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#ifndef __BUS_ENGINE_POOL_H_
+#define __BUS_ENGINE_POOL_H_
+
+#include <ibus.h>
+#include "engineproxy.h"
+
+/*
+ * A pool of the engine proxies of the preload engines, so that an input
+ * context switches to a preload engine without starting its component and
+ * calling CreateEngine of its factory.
+ *
+ * The pool keeps the proxies which it pre-created or which were created
+ * for the input contexts. A proxy which no input context uses is idle and
+ * at most --engine-pool-size idle proxies are kept; the least recently
+ * used ones are destroyed first. The pool is off unless --engine-pool-size
+ * is set, since the components of its proxies keep running. The pool is
+ * used only in the main thread.
+ */
+
+G_BEGIN_DECLS
+
+/**
+ * bus_engine_pool_set_preload_engines:
+ * @descs: (element-type IBusEngineDesc): The preload engines.
+ *
+ * Destroy the idle proxies of the engines which are not in @descs and
+ * pre-create the proxies of the engines in @descs which are not in the
+ * pool, until the pool is full.
+ */
+void             bus_engine_pool_set_preload_engines
+                                            (GList          *descs);
+
+/**
+ * bus_engine_pool_get_preload_engines:
+ * @returns: (nullable): The names of the preload engines in the order of
+ *     the last bus_engine_pool_set_preload_engines().
+ */
+const gchar * const *
+                 bus_engine_pool_get_preload_engines
+                                            (void);
+
+/**
+ * bus_engine_pool_prewarm:
+ * @descs: (element-type IBusEngineDesc): The engines which the user will
+ *     likely switch to.
+ *
+ * Start creating the proxies of the preload engines in @descs which do
+ * not have an idle proxy, even if the pool gets more than
+ * --engine-pool-size idle proxies; the least recently used ones are
+ * destroyed then.
+ */
+void             bus_engine_pool_prewarm    (GList          *descs);
+
+/**
+ * bus_engine_pool_cancel_prewarm:
+ *
+ * Cancel the proxies which bus_engine_pool_prewarm() is creating. A
+ * component which was already started keeps running.
+ */
+void             bus_engine_pool_cancel_prewarm
+                                            (void);
+
+/**
+ * bus_engine_pool_add:
+ * @engine: A new engine proxy.
+ *
+ * Keep @engine in the pool if it is a preload engine. It becomes idle
+ * when the other references of @engine are released.
+ */
+void             bus_engine_pool_add        (BusEngineProxy *engine);
+
+/**
+ * bus_engine_pool_take:
+ * @desc: An engine.
+ * @returns: (transfer full) (nullable): The most recently used idle proxy
+ *     of @desc or %NULL if the pool does not have one.
+ *
+ * The proxy stays in the pool and becomes idle again when the returned
+ * reference and the other new ones are released.
+ */
+BusEngineProxy  *bus_engine_pool_take       (IBusEngineDesc *desc);
+
+/**
+ * bus_engine_pool_clear:
+ *
+ * Cancel the pre-creation and release all the proxies. The proxies which
+ * no input context uses are destroyed.
+ */
+void             bus_engine_pool_clear      (void);
+
+/**
+ * bus_engine_pool_get_stats:
+ * @returns: A floating GVariant "(uutt)" of the number of the proxies in
+ *     the pool, the number of the idle ones, and the numbers of the
+ *     switches to a preload engine which found an idle proxy (hits) and
+ *     which did not (misses).
+ */
+GVariant        *bus_engine_pool_get_stats  (void);
+
+G_END_DECLS
+#endif
@@ -23,9 +23,14 @@
 
 #include "engineproxy.h"
 
+#include <gio/gunixfdlist.h>
+#include <string.h>
+
 #include "global.h"
 #include "ibusimpl.h"
+#include "ibusprocesskeyevent.h"
 #include "marshalers.h"
+#include "stats.h"
 #include "types.h"
 
 struct _BusEngineProxy {
@@ -49,6 +54,13 @@ struct _BusEngineProxy {
 
     /* a key mapping for the engine that converts keycode into keysym. the mapping is used only when use_sys_layout is FALSE. */
     IBusKeymap     *keymap;
+    /* the latencies and the key event deadline of the engine, shared by
+     * all the proxies of the engine. */
+    BusEngineStats *stats;
+    /* the ProcessKeyEvent(s) calls which the engine did not reply yet, in
+     * the order they were sent. The engine answers them in this order, so
+     * the head is the call the engine is processing. */
+    GQueue          key_event_calls;
     /* private member */
 
     /* cached surrounding text (see also IBusEnginePrivate and
@@ -57,6 +69,19 @@ struct _BusEngineProxy {
     guint     surrounding_cursor_pos;
     guint     selection_anchor_pos;
 
+    /* TRUE if the engine has the cached surrounding text, so that a change
+     * can be sent as a delta against surrounding_revision */
+    gboolean  surrounding_text_synced;
+    guint     surrounding_revision;
+    /* incremented each time the whole surrounding text is sent */
+    guint     surrounding_text_serial;
+    /* TRUE if the engine does not know SetSurroundingTextDelta */
+    gboolean  no_surrounding_text_delta;
+    /* TRUE if the engine does not know ProcessKeyEvents */
+    gboolean  no_process_key_events;
+    /* TRUE once the engine answered a ProcessKeyEvents call */
+    gboolean  process_key_events_checked;
+
     /* cached properties */
     IBusPropList *prop_list;
     gboolean has_focus_id;
@@ -136,6 +161,8 @@ static void     bus_engine_proxy_get_has_focus_id
                                                 (BusEngineProxy    *engine);
 static void     bus_engine_proxy_get_active_surrounding_text
                                                 (BusEngineProxy    *engine);
+static gboolean bus_engine_proxy_is_processing_missed_call
+                                                (BusEngineProxy    *engine);
 
 G_DEFINE_TYPE_WITH_CODE (BusEngineProxy, bus_engine_proxy, IBUS_TYPE_PROXY,
                          G_IMPLEMENT_INTERFACE (
@@ -485,6 +512,7 @@ bus_engine_proxy_init (BusEngineProxy *engine)
 {
     engine->surrounding_text = g_object_ref_sink (text_empty);
     engine->prop_list = g_object_ref_sink (prop_list_empty);
+    g_queue_init (&engine->key_event_calls);
 }
 
 static void
@@ -497,6 +525,10 @@ bus_engine_proxy_set_property (BusEngineProxy *engine,
     case PROP_ENGINE_DESC:
         g_assert (engine->desc == NULL);
         engine->desc = g_value_dup_object (value);
+        if (engine->desc != NULL) {
+            engine->stats = bus_stats_get_engine (
+                    ibus_engine_desc_get_name (engine->desc));
+        }
         break;
     default:
         G_OBJECT_WARN_INVALID_PROPERTY_ID (engine, prop_id, pspec);
@@ -615,6 +647,19 @@ bus_engine_proxy_g_signal (GDBusProxy  *proxy,
         }
     }
 
+    /* the application already handled the key events of a missed call
+     * with --key-deadline-policy=pass, so the text of the engine for them
+     * would duplicate the input. */
+    if (bus_engine_proxy_is_processing_missed_call (engine) &&
+        g_strcmp0 (g_key_deadline_policy, "pass") == 0 &&
+        (!g_strcmp0 (signal_name, "CommitText") ||
+         !g_strcmp0 (signal_name, "ForwardKeyEvent"))) {
+        if (g_verbose)
+            g_message ("Drop %s of an engine after the key event deadline.",
+                       signal_name);
+        return;
+    }
+
     /* Handle D-Bus signals with parameters. Deserialize them and emit a glib
      * signal.
      */
@@ -1128,16 +1173,12 @@ bus_engine_proxy_new_finish (GAsyncResult   *res,
     return retval;
 }
 
-void
-bus_engine_proxy_process_key_event (BusEngineProxy      *engine,
-                                    guint                keyval,
-                                    guint                keycode,
-                                    guint                state,
-                                    GAsyncReadyCallback  callback,
-                                    gpointer             user_data)
+static guint
+bus_engine_proxy_lookup_keyval (BusEngineProxy *engine,
+                                guint           keyval,
+                                guint           keycode,
+                                guint           state)
 {
-    g_assert (BUS_IS_ENGINE_PROXY (engine));
-
     if (keycode != 0 &&
         bus_ibus_impl_is_use_sys_layout (BUS_DEFAULT_IBUS) == FALSE) {
         /* Since use_sys_layout is false, we don't rely on XKB. Try to convert
@@ -1153,15 +1194,311 @@ bus_engine_proxy_process_key_event (BusEngineProxy      *engine,
             }
         }
     }
+    return keyval;
+}
+
+/* The deadline of a key event is KEY_DEADLINE_SCALE times the p99 latency
+ * of the engine if it is longer than --key-deadline. */
+#define KEY_DEADLINE_SCALE      4
+/* The p99 latency is read again after this number of calls. */
+#define KEY_DEADLINE_N_CALLS    64
+/* The deadline of an engine with less calls is this times --key-deadline,
+ * since engines often load their data for the first key events. */
+#define KEY_DEADLINE_WARM_UP    20
+/* A degraded engine becomes normal after this number of calls in a row
+ * which meet --key-deadline. */
+#define KEY_DEADLINE_RECOVERY   8
+
+typedef struct {
+    BusEngineStats *stats;
+    gint64          start_time;
+    GTask          *task;
+    /* the number of the key events, or 0 for "ProcessKeyEvent" */
+    guint           n_keys;
+    guint           deadline_id;
+    /* TRUE if the task returned without the engine at the deadline */
+    gboolean        missed;
+} ProcessKeyEventCallData;
+
+/**
+ * bus_engine_proxy_get_key_deadline:
+ *
+ * Returns the deadline of a call with @n_keys key events in milliseconds,
+ * or 0 without the deadline.
+ */
+static guint
+bus_engine_proxy_get_key_deadline (BusEngineProxy *engine,
+                                   guint           n_keys)
+{
+    BusEngineStats *stats = engine->stats;
+    gint64 deadline;
+
+    if (g_key_deadline <= 0 || stats == NULL)
+        return 0;
+
+    deadline = (gint64) g_key_deadline * 1000;
+    /* a degraded engine keeps its usual latency too, since a shorter
+     * deadline only misses more key events which the engine handles. */
+    if (stats->key_latency.count < KEY_DEADLINE_N_CALLS) {
+        deadline *= KEY_DEADLINE_WARM_UP;
+    } else {
+        if (stats->adaptive_deadline == 0 ||
+            ++stats->n_calls >= KEY_DEADLINE_N_CALLS) {
+            stats->adaptive_deadline = KEY_DEADLINE_SCALE *
+                    bus_latency_histogram_get_percentile (
+                            &stats->key_latency, 99);
+            stats->n_calls = 0;
+        }
+        deadline = MAX (deadline, stats->adaptive_deadline);
+    }
+    deadline = deadline * MAX (n_keys, 1) / 1000 + 1;
+    /* the deadline after the D-Bus timeout is useless. */
+    if (g_gdbus_timeout > 0 && deadline >= g_gdbus_timeout)
+        return 0;
+    return (guint) deadline;
+}
+
+/**
+ * bus_engine_proxy_key_deadline_cb:
+ *
+ * Answer a ProcessKeyEvent(s) call which the engine did not answer by
+ * the deadline as --key-deadline-policy and mark the engine degraded.
+ */
+static gboolean
+bus_engine_proxy_key_deadline_cb (ProcessKeyEventCallData *data)
+{
+    gboolean handled = g_strcmp0 (g_key_deadline_policy, "drop") == 0;
+    BusEngineProxy *engine = g_task_get_source_object (data->task);
+    GVariant *reply;
+
+    data->deadline_id = 0;
+    data->missed = TRUE;
+    data->stats->n_deadline_misses++;
+    data->stats->n_on_time = 0;
+    if (!data->stats->degraded && g_verbose)
+        g_message ("An engine missed the key event deadline.");
+    data->stats->degraded = TRUE;
+
+    if (data->n_keys == 0) {
+        reply = ibus_process_key_event_reply (handled);
+    } else {
+        gsize size = (data->n_keys + 7) / 8;
+        guint8 *bitmap = g_malloc (size);
+        memset (bitmap, handled ? 0xff : 0, size);
+        reply = ibus_process_key_events_reply_new (bitmap, data->n_keys);
+        g_free (bitmap);
+    }
+    g_task_return_pointer (data->task,
+                           g_variant_ref_sink (reply),
+                           (GDestroyNotify) g_variant_unref);
+    return G_SOURCE_REMOVE;
+}
+
+/**
+ * bus_engine_proxy_is_processing_missed_call:
+ *
+ * Returns %TRUE if the signals of the engine now belong to a
+ * ProcessKeyEvent(s) call answered at the deadline. The engine emits the
+ * signals of a call before its reply, and D-Bus keeps the order of them.
+ */
+static gboolean
+bus_engine_proxy_is_processing_missed_call (BusEngineProxy *engine)
+{
+    ProcessKeyEventCallData *data =
+            g_queue_peek_head (&engine->key_event_calls);
+
+    return data != NULL && data->missed;
+}
+
+/**
+ * bus_engine_proxy_process_key_event_done:
+ *
+ * A GAsyncReadyCallback function to record the latency of a
+ * ProcessKeyEvent(s) call and return its task. The reply after the
+ * deadline is dropped since the key events were already answered. If the
+ * engine handled a key event which the application handled with
+ * --key-deadline-policy=pass, the engine is reset to drop its preedit of
+ * the key event. Its commits and forwarded key events before the reply
+ * are dropped in bus_engine_proxy_g_signal().
+ */
+static void
+bus_engine_proxy_process_key_event_done (GObject                 *source,
+                                         GAsyncResult            *res,
+                                         ProcessKeyEventCallData *data)
+{
+    GError *error = NULL;
+    GVariant *value = g_dbus_proxy_call_finish ((GDBusProxy *)source,
+                                                 res,
+                                                 &error);
+
+    g_queue_remove (&BUS_ENGINE_PROXY (source)->key_event_calls, data);
+    if (data->stats != NULL) {
+        bus_latency_histogram_record (
+                &data->stats->key_latency,
+                g_get_monotonic_time () - data->start_time);
+    }
+
+    if (data->n_keys > 0) {
+        BusEngineProxy *engine = g_task_get_source_object (data->task);
+
+        /* engines built with an older libibus */
+        if (value == NULL &&
+            g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD))
+            engine->no_process_key_events = TRUE;
+        engine->process_key_events_checked = TRUE;
+    }
+
+    if (data->missed) {
+        BusEngineProxy *engine = g_task_get_source_object (data->task);
+
+        if (value != NULL) {
+            gboolean handled = FALSE;
+            if (data->n_keys == 0) {
+                handled = ibus_process_key_event_reply_get (value);
+            } else {
+                const guint8 *bitmap =
+                        ibus_process_key_events_reply_get (value,
+                                                           data->n_keys);
+                guint i;
+                for (i = 0; bitmap != NULL && i < data->n_keys; i++)
+                    handled = handled || ((bitmap[i / 8] >> (i % 8)) & 1);
+            }
+            if (handled) {
+                data->stats->n_late_handled++;
+                if (g_strcmp0 (g_key_deadline_policy, "pass") == 0)
+                    bus_engine_proxy_reset (engine);
+            }
+            g_variant_unref (value);
+        } else {
+            g_error_free (error);
+        }
+    } else {
+        if (data->deadline_id != 0) {
+            g_source_remove (data->deadline_id);
+            if (data->stats->degraded &&
+                ++data->stats->n_on_time >= KEY_DEADLINE_RECOVERY) {
+                data->stats->degraded = FALSE;
+                data->stats->adaptive_deadline = 0;
+            }
+        }
+        if (value != NULL) {
+            g_task_return_pointer (data->task,
+                                   value,
+                                   (GDestroyNotify) g_variant_unref);
+        } else {
+            g_task_return_error (data->task, error);
+        }
+    }
+    g_object_unref (data->task);
+    g_slice_free (ProcessKeyEventCallData, data);
+}
 
+static ProcessKeyEventCallData *
+bus_engine_proxy_new_process_key_event_call (BusEngineProxy      *engine,
+                                             guint                n_keys,
+                                             GAsyncReadyCallback  callback,
+                                             gpointer             user_data)
+{
+    ProcessKeyEventCallData *data = g_slice_new0 (ProcessKeyEventCallData);
+    guint deadline = bus_engine_proxy_get_key_deadline (engine, n_keys);
+
+    data->stats = engine->stats;
+    data->start_time = g_get_monotonic_time ();
+    data->task = g_task_new (engine, NULL, callback, user_data);
+    data->n_keys = n_keys;
+    g_queue_push_tail (&engine->key_event_calls, data);
+    if (deadline > 0) {
+        data->deadline_id = g_timeout_add (
+                deadline,
+                (GSourceFunc) bus_engine_proxy_key_deadline_cb,
+                data);
+    }
+    return data;
+}
+
+void
+bus_engine_proxy_process_key_event (BusEngineProxy      *engine,
+                                    guint                keyval,
+                                    guint                keycode,
+                                    guint                state,
+                                    GAsyncReadyCallback  callback,
+                                    gpointer             user_data)
+{
+    g_assert (BUS_IS_ENGINE_PROXY (engine));
+
+    keyval = bus_engine_proxy_lookup_keyval (engine, keyval, keycode, state);
+    if (callback != NULL) {
+        /* a call without a callback expects no reply. */
+        user_data = bus_engine_proxy_new_process_key_event_call (engine,
+                                                                 0,
+                                                                 callback,
+                                                                 user_data);
+        callback = (GAsyncReadyCallback)
+                bus_engine_proxy_process_key_event_done;
+    }
     g_dbus_proxy_call ((GDBusProxy *)engine,
                        "ProcessKeyEvent",
-                       g_variant_new ("(uuu)", keyval, keycode, state),
+                       ibus_process_key_event_args_new (keyval,
+                                                        keycode,
+                                                        state),
+                       G_DBUS_CALL_FLAGS_NONE,
+                       -1,
+                       NULL,
+                       callback,
+                       user_data);
+}
+
+void
+bus_engine_proxy_process_key_events (BusEngineProxy                *engine,
+                                     const IBusProcessKeyEventData *keys,
+                                     guint                          n_keys,
+                                     GAsyncReadyCallback            callback,
+                                     gpointer                       user_data)
+{
+    IBusProcessKeyEventData *args;
+    guint i;
+
+    g_assert (BUS_IS_ENGINE_PROXY (engine));
+    g_assert (keys != NULL && n_keys > 0);
+
+    args = g_new (IBusProcessKeyEventData, n_keys);
+    for (i = 0; i < n_keys; i++) {
+        args[i].keyval = bus_engine_proxy_lookup_keyval (engine,
+                                                         keys[i].keyval,
+                                                         keys[i].keycode,
+                                                         keys[i].state);
+        args[i].keycode = keys[i].keycode;
+        args[i].state = keys[i].state;
+    }
+    if (callback != NULL) {
+        /* a call without a callback expects no reply. */
+        user_data = bus_engine_proxy_new_process_key_event_call (engine,
+                                                                 n_keys,
+                                                                 callback,
+                                                                 user_data);
+        callback = (GAsyncReadyCallback)
+                bus_engine_proxy_process_key_event_done;
+    }
+    g_dbus_proxy_call ((GDBusProxy *)engine,
+                       "ProcessKeyEvents",
+                       ibus_process_key_events_args_new (args, n_keys),
                        G_DBUS_CALL_FLAGS_NONE,
                        -1,
                        NULL,
                        callback,
                        user_data);
+    g_free (args);
+}
+
+GVariant *
+bus_engine_proxy_process_key_event_finish (BusEngineProxy *engine,
+                                           GAsyncResult   *res,
+                                           GError        **error)
+{
+    g_assert (BUS_IS_ENGINE_PROXY (engine));
+    g_assert (g_task_is_valid (res, engine));
+
+    return g_task_propagate_pointer (G_TASK (res), error);
 }
 
 void
@@ -1293,6 +1630,64 @@ void bus_engine_proxy_property_hide (BusEngineProxy *engine,
                        NULL);
 }
 
+static void
+bus_engine_proxy_send_surrounding_text (BusEngineProxy *engine)
+{
+    GVariant *variant =
+            ibus_serializable_serialize ((IBusSerializable *)
+                                         engine->surrounding_text);
+
+    engine->surrounding_text_synced = TRUE;
+    engine->surrounding_revision = 0;
+    engine->surrounding_text_serial++;
+    g_dbus_proxy_call ((GDBusProxy *)engine,
+                       "SetSurroundingText",
+                       g_variant_new ("(vuu)",
+                                      variant,
+                                      engine->surrounding_cursor_pos,
+                                      engine->selection_anchor_pos),
+                       G_DBUS_CALL_FLAGS_NONE,
+                       -1,
+                       NULL,
+                       NULL,
+                       NULL);
+}
+
+/**
+ * bus_engine_proxy_set_surrounding_text_delta_done:
+ *
+ * A GAsyncReadyCallback function to be called when the
+ * "SetSurroundingTextDelta" D-Bus method call is finished. If the engine
+ * could not apply the delta, send the whole surrounding text.
+ */
+static void
+bus_engine_proxy_set_surrounding_text_delta_done (BusEngineProxy *engine,
+                                                  GAsyncResult   *res,
+                                                  gpointer        user_data)
+{
+    GError *error = NULL;
+    GVariant *variant;
+    gboolean applied = FALSE;
+
+    variant = g_dbus_proxy_call_finish ((GDBusProxy *)engine, res, &error);
+    if (variant != NULL) {
+        g_variant_get (variant, "(b)", &applied);
+        g_variant_unref (variant);
+    }
+    else {
+        /* engines built with an older libibus */
+        if (g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD))
+            engine->no_surrounding_text_delta = TRUE;
+        g_error_free (error);
+    }
+
+    if (!applied &&
+        GPOINTER_TO_UINT (user_data) == engine->surrounding_text_serial &&
+        engine->surrounding_text != NULL) {
+        bus_engine_proxy_send_surrounding_text (engine);
+    }
+}
+
 void bus_engine_proxy_set_surrounding_text (BusEngineProxy *engine,
                                             IBusText       *text,
                                             guint           cursor_pos,
@@ -1305,25 +1700,49 @@ void bus_engine_proxy_set_surrounding_text (BusEngineProxy *engine,
         g_strcmp0 (text->text, engine->surrounding_text->text) != 0 ||
         cursor_pos != engine->surrounding_cursor_pos ||
         anchor_pos != engine->selection_anchor_pos) {
-        GVariant *variant =
-                ibus_serializable_serialize ((IBusSerializable *)text);
-        if (engine->surrounding_text)
-            g_object_unref (engine->surrounding_text);
+        IBusText *old_text = engine->surrounding_text;
+
         engine->surrounding_text = (IBusText *) g_object_ref_sink (text);
         engine->surrounding_cursor_pos = cursor_pos;
         engine->selection_anchor_pos = anchor_pos;
 
-        g_dbus_proxy_call ((GDBusProxy *)engine,
-                           "SetSurroundingText",
-                           g_variant_new ("(vuu)",
-                                          variant,
-                                          cursor_pos,
-                                          anchor_pos),
-                           G_DBUS_CALL_FLAGS_NONE,
-                           -1,
-                           NULL,
-                           NULL,
-                           NULL);
+        /* Send only the changed range if the engine has the previous text.
+         * Attributes cannot be sent in a delta. */
+        if (old_text != NULL &&
+            engine->surrounding_text_synced &&
+            !engine->no_surrounding_text_delta &&
+            (text->attrs == NULL ||
+             ibus_attr_list_get (text->attrs, 0) == NULL)) {
+            guint offset = 0;
+            guint n_deleted = 0;
+            gchar *inserted = ibus_text_diff (old_text,
+                                              text,
+                                              &offset,
+                                              &n_deleted);
+            g_dbus_proxy_call ((GDBusProxy *)engine,
+                               "SetSurroundingTextDelta",
+                               g_variant_new ("(uuusuu)",
+                                              engine->surrounding_revision,
+                                              offset,
+                                              n_deleted,
+                                              inserted,
+                                              cursor_pos,
+                                              anchor_pos),
+                               G_DBUS_CALL_FLAGS_NONE,
+                               -1,
+                               NULL,
+                               (GAsyncReadyCallback)
+                               bus_engine_proxy_set_surrounding_text_delta_done,
+                               GUINT_TO_POINTER (
+                                       engine->surrounding_text_serial));
+            engine->surrounding_revision++;
+            g_free (inserted);
+        }
+        else {
+            bus_engine_proxy_send_surrounding_text (engine);
+        }
+        if (old_text)
+            g_object_unref (old_text);
     }
 }
 
@@ -1654,6 +2073,17 @@ bus_engine_proxy_is_enabled (BusEngineProxy *engine)
     return engine->enabled;
 }
 
+gboolean
+bus_engine_proxy_has_process_key_events (BusEngineProxy *engine,
+                                         gboolean       *checked)
+{
+    g_assert (BUS_IS_ENGINE_PROXY (engine));
+
+    if (checked != NULL)
+        *checked = engine->process_key_events_checked;
+    return !engine->no_process_key_events;
+}
+
 void
 bus_engine_proxy_panel_extension_received (BusEngineProxy     *engine,
                                            IBusExtensionEvent *event)
@@ -1692,6 +2122,61 @@ bus_engine_proxy_panel_extension_register_keys (BusEngineProxy *engine,
                        NULL);
 }
 
+void
+bus_engine_proxy_open_peer_connection (BusEngineProxy      *engine,
+                                       gint                 fd,
+                                       const gchar         *guid,
+                                       GAsyncReadyCallback  callback,
+                                       gpointer             user_data)
+{
+    GUnixFDList *fd_list;
+
+    g_assert (BUS_IS_ENGINE_PROXY (engine));
+    g_assert (guid != NULL);
+
+    fd_list = g_unix_fd_list_new_from_array (&fd, 1);
+    g_dbus_proxy_call_with_unix_fd_list ((GDBusProxy *)engine,
+                                         "OpenPeerConnection",
+                                         g_variant_new ("(hs)", 0, guid),
+                                         G_DBUS_CALL_FLAGS_NONE,
+                                         -1,
+                                         fd_list,
+                                         NULL,
+                                         callback,
+                                         user_data);
+    g_object_unref (fd_list);
+}
+
+void
+bus_engine_proxy_close_peer_connection (BusEngineProxy      *engine,
+                                        GAsyncReadyCallback  callback,
+                                        gpointer             user_data)
+{
+    g_assert (BUS_IS_ENGINE_PROXY (engine));
+
+    g_dbus_proxy_call ((GDBusProxy *)engine,
+                       "ClosePeerConnection",
+                       NULL,
+                       G_DBUS_CALL_FLAGS_NONE,
+                       -1,
+                       NULL,
+                       callback,
+                       user_data);
+}
+
+const gchar *
+bus_engine_proxy_get_keymap_name (BusEngineProxy *engine)
+{
+    IBusKeymap *keymap;
+
+    g_assert (BUS_IS_ENGINE_PROXY (engine));
+
+    if (bus_ibus_impl_is_use_sys_layout (BUS_DEFAULT_IBUS))
+        return NULL;
+    keymap = engine->keymap ? engine->keymap : BUS_DEFAULT_KEYMAP;
+    return keymap ? keymap->name : NULL;
+}
+
 static gboolean
 initable_init (GInitable     *initable,
                GCancellable  *cancellable,
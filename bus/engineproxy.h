@@ -95,7 +95,8 @@ IBusEngineDesc *bus_engine_proxy_get_desc    (BusEngineProxy     *engine);
  * @callback: A function to be called when the method invocation is done.
  * @user_data: Data supplied to @callback.
  *
- * Call "ProcessKeyEvent" method of an engine asynchronously.
+ * Call "ProcessKeyEvent" method of an engine asynchronously. The reply is
+ * read with bus_engine_proxy_process_key_event_finish() in @callback.
  */
 void            bus_engine_proxy_process_key_event
                                              (BusEngineProxy     *engine,
@@ -104,6 +105,42 @@ void            bus_engine_proxy_process_key_event
                                               guint               state,
                                               GAsyncReadyCallback callback,
                                               gpointer            user_data);
+/**
+ * bus_engine_proxy_process_key_events:
+ * @engine: A #BusEngineProxy.
+ * @keys: (array length=n_keys): The key events.
+ * @n_keys: The number of @keys.
+ * @callback: A function to be called when the method invocation is done.
+ * @user_data: Data supplied to @callback.
+ *
+ * Call "ProcessKeyEvents" method of an engine asynchronously. The reply
+ * is read with bus_engine_proxy_process_key_event_finish() in @callback
+ * and ibus_process_key_events_reply_get().
+ */
+void            bus_engine_proxy_process_key_events
+                                             (BusEngineProxy     *engine,
+                                              const IBusProcessKeyEventData
+                                                                 *keys,
+                                              guint               n_keys,
+                                              GAsyncReadyCallback callback,
+                                              gpointer            user_data);
+/**
+ * bus_engine_proxy_process_key_event_finish:
+ * @engine: A #BusEngineProxy.
+ * @res: The #GAsyncResult passed to the callback.
+ * @error: Return location for error or %NULL.
+ * @returns: (transfer full): The reply of "ProcessKeyEvent(s)" or %NULL
+ *     on error.
+ *
+ * Finish a call of bus_engine_proxy_process_key_event() or
+ * bus_engine_proxy_process_key_events(). When the engine does not answer
+ * by the --key-deadline of ibus-daemon, the reply is made by the
+ * --key-deadline-policy without the engine.
+ */
+GVariant       *bus_engine_proxy_process_key_event_finish
+                                             (BusEngineProxy     *engine,
+                                              GAsyncResult       *res,
+                                              GError            **error);
 /**
  * bus_engine_proxy_set_cursor_location:
  * @engine: A #BusEngineProxy.
@@ -268,6 +305,17 @@ void            bus_engine_proxy_property_hide
  */
 gboolean        bus_engine_proxy_is_enabled  (BusEngineProxy     *engine);
 
+/**
+ * bus_engine_proxy_has_process_key_events:
+ * @engine: A #BusEngineProxy.
+ * @checked: (out) (allow-none): Return location for %TRUE if the engine
+ *     already answered a "ProcessKeyEvents" call.
+ * @returns: %FALSE if the engine does not know "ProcessKeyEvents".
+ */
+gboolean        bus_engine_proxy_has_process_key_events
+                                             (BusEngineProxy     *engine,
+                                              gboolean           *checked);
+
 /**
  * bus_engine_proxy_set_surrounding_text:
  * @engine: A #BusEngineProxy.
@@ -354,5 +402,47 @@ void            bus_engine_proxy_panel_extension_register_keys
                                              (BusEngineProxy     *engine,
                                               GVariant           *parameters);
 
+/**
+ * bus_engine_proxy_open_peer_connection:
+ * @engine: A #BusEngineProxy.
+ * @fd: One end of a socket pair. The engine proxy takes it.
+ * @guid: The GUID of the D-Bus server side of the connection.
+ * @callback: A function to be called when the method invocation is done.
+ * @user_data: Data supplied to @callback.
+ *
+ * Call "OpenPeerConnection" method of an engine asynchronously so that
+ * the client on the other end of @fd can send key events to the engine
+ * directly.
+ */
+void            bus_engine_proxy_open_peer_connection
+                                             (BusEngineProxy     *engine,
+                                              gint                fd,
+                                              const gchar        *guid,
+                                              GAsyncReadyCallback callback,
+                                              gpointer            user_data);
+
+/**
+ * bus_engine_proxy_close_peer_connection:
+ * @engine: A #BusEngineProxy.
+ * @callback: A function to be called when the method invocation is done.
+ * @user_data: Data supplied to @callback.
+ *
+ * Call "ClosePeerConnection" method of an engine asynchronously. The
+ * engine does not send signals to the peer after the reply.
+ */
+void            bus_engine_proxy_close_peer_connection
+                                             (BusEngineProxy     *engine,
+                                              GAsyncReadyCallback callback,
+                                              gpointer            user_data);
+
+/**
+ * bus_engine_proxy_get_keymap_name:
+ * @engine: A #BusEngineProxy.
+ * @returns: The name of the keymap which converts the keycodes of the key
+ *           events for the engine, or %NULL if the system layout is used.
+ */
+const gchar    *bus_engine_proxy_get_keymap_name
+                                             (BusEngineProxy     *engine);
+
 G_END_DECLS
 #endif
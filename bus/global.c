@@ -31,3 +31,9 @@ gchar *g_cache = "auto";
 gboolean g_mempro = FALSE;
 gboolean g_verbose = FALSE;
 gint   g_gdbus_timeout = 15000;
+gboolean g_coalesce_updates = FALSE;
+gint   g_key_deadline = 0;
+gint   g_engine_pool_size = 0;
+gchar *g_key_deadline_policy = "pass";
+gboolean g_paged_lookup_table = FALSE;
+gchar *g_trace = NULL;
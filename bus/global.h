@@ -34,6 +34,12 @@ extern gchar *g_cache;
 extern gboolean g_mempro;
 extern gboolean g_verbose;
 extern gint   g_gdbus_timeout;
+extern gboolean g_coalesce_updates;
+extern gint   g_key_deadline;
+extern gint   g_engine_pool_size;
+extern gchar *g_key_deadline_policy;
+extern gboolean g_paged_lookup_table;
+extern gchar *g_trace;
 
 G_END_DECLS
 
@@ -32,11 +32,15 @@
 
 #include "connection.h"
 #include "dbusimpl.h"
+#include "enginepool.h"
 #include "factoryproxy.h"
 #include "global.h"
+#include "ibushotkeymatcher.h"
+#include "ibusservicemethodtable.h"
 #include "inputcontext.h"
 #include "panelproxy.h"
 #include "server.h"
+#include "stats.h"
 #include "types.h"
 
 struct _BusIBusImpl {
@@ -54,6 +58,16 @@ struct _BusIBusImpl {
     /* a list of engines that are started by a user (without the --ibus
      * command line flag.) */
     GList *register_engine_list;
+    /* a mapping from an engine name to the first IBusEngineDesc object of
+     * the name in register_engine_list. */
+    GHashTable *register_engine_table;
+
+    /* a mapping from an IBusEngineDesc object to its serialized GVariant,
+     * and the replies of "Engines" and "ActiveEngines". They are cleared
+     * when the registry or the registered components change. */
+    GHashTable *serialized_engine_table;
+    GVariant *engines_variant;
+    GVariant *active_engines_variant;
 
     /* if TRUE, ibus-daemon uses a keysym translated by the system
      * (i.e. XKB) as-is. otherwise, ibus-daemon itself converts keycode
@@ -89,6 +103,31 @@ struct _BusIBusImpl {
     gchar *global_previous_engine_name;
     GVariant *extension_register_keys;
     IBusProcessKeyEventData *ime_switcher_keys;
+    /* the ime_switcher_keys compiled for bus_ibus_impl_process_key_event()
+     * and the state of their presses and releases */
+    IBusHotkeyMatcher *hotkey_matcher;
+    IBusHotkeyMatcherState hotkey_state;
+    /* the modifiers of the forward and the backward IME switcher keys */
+    guint switcher_forward_modifiers;
+    guint switcher_backward_modifiers;
+    /* the switcher modifier pressed alone, the timeout to pre-warm the
+     * engines while it is held, and whether the engines were pre-warmed
+     * and the switcher keys matched since its press */
+    guint prewarm_modifier;
+    guint prewarm_id;
+    gboolean prewarmed;
+    gboolean prewarm_switched;
+};
+
+/* the milliseconds that a switcher modifier is held alone before the
+ * engines are pre-warmed, so that shortcuts such as Control-c do not
+ * start engines. */
+#define PREWARM_DELAY 200
+
+/* the actions of the hotkey_matcher */
+enum {
+    HOTKEY_ACTION_IME_SWITCHER = 1,
+    HOTKEY_ACTION_IME_SWITCHER_BACKWARD,
 };
 
 struct _BusIBusImplClass {
@@ -109,8 +148,13 @@ enum {
 static guint            _signals[LAST_SIGNAL] = { 0 };
 */
 
+static IBusServiceMethodTable *ibus_methods;
+
 /* functions prototype */
 static void     bus_ibus_impl_destroy   (BusIBusImpl        *ibus);
+static IBusServiceMethodTable *
+                bus_ibus_impl_new_method_table
+                                        (IBusServiceClass   *class);
 static void     bus_ibus_impl_service_method_call
                                         (IBusService        *service,
                                          GDBusConnection    *connection,
@@ -144,6 +188,8 @@ static void     bus_ibus_impl_registry_init
                                         (BusIBusImpl        *ibus);
 static void     bus_ibus_impl_registry_changed
                                         (BusIBusImpl        *ibus);
+static void     bus_ibus_impl_clear_engine_cache
+                                        (BusIBusImpl        *ibus);
 static void     bus_ibus_impl_registry_destroy
                                         (BusIBusImpl        *ibus);
 static void     bus_ibus_impl_component_name_owner_changed
@@ -281,6 +327,28 @@ static const gchar introspection_xml[] =
     "      <annotation name='org.freedesktop.DBus.Deprecated' value='true'/>\n"
     "    </method>\n"
     "  </interface>\n"
+    /* The latencies are (count, p50, p99, max) in microseconds. The
+     * slow key events are (serial, monotonic time, client, engine,
+     * latency). The properties are computed when they are read. */
+    "  <interface name='org.freedesktop.IBus.Stats'>\n"
+    "    <annotation name='org.gtk.GDBus.Since'\n"
+    "        value='1.5.33' />\n"
+    "    <annotation name='org.gtk.GDBus.DocString'\n"
+    "        value='Stability: Unstable' />\n"
+    "    <annotation\n"
+    "        name='org.freedesktop.DBus.Property.EmitsChangedSignal'\n"
+    "        value='false' />\n"
+    "    <property name='ContextKeyLatency' type='a(ss(tttt))'\n"
+    "              access='read' />\n"
+    "    <property name='EngineKeyLatency' type='a(s(tttt))'\n"
+    "              access='read' />\n"
+    "    <property name='EngineKeyDeadlines' type='a(sbtt)'\n"
+    "              access='read' />\n"
+    "    <property name='QueueStats' type='a(ss(uut))' access='read' />\n"
+    "    <property name='MessageCounts' type='a{st}' access='read' />\n"
+    "    <property name='SlowKeyEvents' type='a(txsst)' access='read' />\n"
+    "    <property name='EnginePool' type='(uutt)' access='read' />\n"
+    "  </interface>\n"
     "</node>\n";
 
 
@@ -303,6 +371,7 @@ bus_ibus_impl_class_init (BusIBusImplClass *class)
      * called on a method call defined in the xml (e.g. 'GetAddress'.) */
     ibus_service_class_add_interfaces (IBUS_SERVICE_CLASS (class),
                                        introspection_xml);
+    ibus_methods = bus_ibus_impl_new_method_table (IBUS_SERVICE_CLASS (class));
 }
 
 /**
@@ -487,6 +556,7 @@ static void
 _registry_changed_cb (IBusRegistry *registry,
                       BusIBusImpl  *ibus)
 {
+    bus_ibus_impl_clear_engine_cache (ibus);
     bus_ibus_impl_registry_changed (ibus);
 }
 
@@ -648,6 +718,14 @@ bus_ibus_impl_init (BusIBusImpl *ibus)
     bus_input_context_focus_in (ibus->fake_context);
 
     ibus->register_engine_list = NULL;
+    ibus->register_engine_table = g_hash_table_new (g_str_hash, g_str_equal);
+    ibus->serialized_engine_table =
+            g_hash_table_new_full (g_direct_hash,
+                                   g_direct_equal,
+                                   NULL,
+                                   (GDestroyNotify) g_variant_unref);
+    ibus->engines_variant = NULL;
+    ibus->active_engines_variant = NULL;
     ibus->contexts = NULL;
     ibus->focused_context = NULL;
     ibus->panel = NULL;
@@ -689,6 +767,11 @@ bus_ibus_impl_destroy (BusIBusImpl *ibus)
     gint status;
     gboolean flag;
 
+    if (ibus->prewarm_id != 0) {
+        g_source_remove (ibus->prewarm_id);
+        ibus->prewarm_id = 0;
+    }
+    bus_engine_pool_clear ();
     g_list_foreach (ibus->components, (GFunc) bus_component_stop, NULL);
 
     timeout = 0;
@@ -720,6 +803,9 @@ bus_ibus_impl_destroy (BusIBusImpl *ibus)
         }
     }
 
+    bus_ibus_impl_clear_engine_cache (ibus);
+    g_clear_pointer (&ibus->serialized_engine_table, g_hash_table_destroy);
+    g_clear_pointer (&ibus->register_engine_table, g_hash_table_destroy);
     g_list_free_full (ibus->register_engine_list, g_object_unref);
     ibus->register_engine_list = NULL;
 
@@ -731,6 +817,7 @@ bus_ibus_impl_destroy (BusIBusImpl *ibus)
 
     g_clear_pointer (&ibus->global_engine_name, g_free);
     g_clear_pointer (&ibus->global_previous_engine_name, g_free);
+    g_clear_pointer (&ibus->hotkey_matcher, ibus_hotkey_matcher_unref);
 
     if (ibus->fake_context)
         g_clear_pointer (&ibus->fake_context, g_object_unref);
@@ -788,21 +875,72 @@ _ibus_get_address_depre (BusIBusImpl           *ibus,
     g_variant_unref (variant);
 }
 
-static IBusEngineDesc *
-_find_engine_desc_by_name (BusIBusImpl *ibus,
-                           const gchar *engine_name)
+/**
+ * bus_ibus_impl_clear_engine_cache:
+ *
+ * Clear the serialized engines, which are created again on the next
+ * "Engines", "ActiveEngines" or "GetEnginesByNames" call.
+ */
+static void
+bus_ibus_impl_clear_engine_cache (BusIBusImpl *ibus)
+{
+    if (ibus->serialized_engine_table)
+        g_hash_table_remove_all (ibus->serialized_engine_table);
+    g_clear_pointer (&ibus->engines_variant, g_variant_unref);
+    g_clear_pointer (&ibus->active_engines_variant, g_variant_unref);
+}
+
+/**
+ * bus_ibus_impl_register_engines_changed:
+ *
+ * Index register_engine_list by the engine names after a component is
+ * registered or destroyed.
+ */
+static void
+bus_ibus_impl_register_engines_changed (BusIBusImpl *ibus)
 {
-    IBusEngineDesc *desc = NULL;
     GList *p;
 
-    /* find engine in registered engine list */
+    g_hash_table_remove_all (ibus->register_engine_table);
     for (p = ibus->register_engine_list; p != NULL; p = p->next) {
-        desc = (IBusEngineDesc *) p->data;
-        if (g_strcmp0 (ibus_engine_desc_get_name (desc), engine_name) == 0)
-            return desc;
+        IBusEngineDesc *desc = (IBusEngineDesc *) p->data;
+        const gchar *name = ibus_engine_desc_get_name (desc);
+        /* the first one wins as the engine list was searched in order. */
+        if (!g_hash_table_contains (ibus->register_engine_table, name)) {
+            g_hash_table_insert (ibus->register_engine_table,
+                                 (gpointer) name,
+                                 desc);
+        }
     }
+    bus_ibus_impl_clear_engine_cache (ibus);
+}
 
-    return NULL;
+/**
+ * bus_ibus_impl_serialize_engine_desc:
+ * @returns: (transfer none): The serialized @desc.
+ */
+static GVariant *
+bus_ibus_impl_serialize_engine_desc (BusIBusImpl    *ibus,
+                                     IBusEngineDesc *desc)
+{
+    GVariant *variant = (GVariant *) g_hash_table_lookup (
+            ibus->serialized_engine_table, desc);
+
+    if (variant == NULL) {
+        variant = g_variant_ref_sink (
+                ibus_serializable_serialize ((IBusSerializable *) desc));
+        g_hash_table_insert (ibus->serialized_engine_table, desc, variant);
+    }
+    return variant;
+}
+
+static IBusEngineDesc *
+_find_engine_desc_by_name (BusIBusImpl *ibus,
+                           const gchar *engine_name)
+{
+    /* find engine in registered engine list */
+    return (IBusEngineDesc *) g_hash_table_lookup (ibus->register_engine_table,
+                                                   engine_name);
 }
 
 /**
@@ -1352,6 +1490,7 @@ _component_destroy_cb (BusComponent *component,
         }
     }
     g_list_free (engines);
+    bus_ibus_impl_register_engines_changed (ibus);
 
     g_object_unref (component);
 
@@ -1407,6 +1546,7 @@ _ibus_register_component (BusIBusImpl           *ibus,
     g_list_foreach (engines, (GFunc) g_object_ref, NULL);
     ibus->register_engine_list = g_list_concat (ibus->register_engine_list,
                                                engines);
+    bus_ibus_impl_register_engines_changed (ibus);
 
     g_signal_connect (buscomp,
                       "destroy",
@@ -1426,11 +1566,13 @@ _ibus_get_engines (BusIBusImpl     *ibus,
                    GDBusConnection *connection,
                    GError         **error)
 {
-    GVariant *retval;
     GVariantBuilder builder;
     GList *engines = NULL;
     GList *p;
 
+    if (ibus->engines_variant)
+        return g_variant_ref (ibus->engines_variant);
+
     g_variant_builder_init (&builder, G_VARIANT_TYPE ("av"));
 
     engines = g_hash_table_get_values (ibus->engine_table);
@@ -1438,14 +1580,16 @@ _ibus_get_engines (BusIBusImpl     *ibus,
     for (p = engines; p != NULL; p = p->next) {
         g_variant_builder_add (
                 &builder, "v",
-                ibus_serializable_serialize ((IBusSerializable *) p->data));
+                bus_ibus_impl_serialize_engine_desc (
+                        ibus, (IBusEngineDesc *) p->data));
     }
 
     g_list_free (engines);
 
-    retval = g_variant_builder_end (&builder);
-    g_assert (retval);
-    return retval;
+    ibus->engines_variant = g_variant_ref_sink (
+            g_variant_builder_end (&builder));
+    g_assert (ibus->engines_variant);
+    return g_variant_ref (ibus->engines_variant);
 }
 
 static void
@@ -1464,6 +1608,7 @@ _ibus_list_engines_depre (BusIBusImpl           *ibus,
 
     g_dbus_method_invocation_return_value (invocation,
                                            g_variant_new ("(@av)", variant));
+    g_variant_unref (variant);
 }
 
 /**
@@ -1493,7 +1638,7 @@ _ibus_get_engines_by_names (BusIBusImpl           *ibus,
         g_variant_builder_add (
                 &builder,
                 "v",
-                ibus_serializable_serialize ((IBusSerializable *)desc));
+                bus_ibus_impl_serialize_engine_desc (ibus, desc));
     }
     g_dbus_method_invocation_return_value (invocation,
                                            g_variant_new ("(av)", &builder));
@@ -1510,21 +1655,25 @@ _ibus_get_active_engines (BusIBusImpl     *ibus,
                           GDBusConnection *connection,
                           GError         **error)
 {
-    GVariant *retval;
     GVariantBuilder builder;
     GList *p;
 
+    if (ibus->active_engines_variant)
+        return g_variant_ref (ibus->active_engines_variant);
+
     g_variant_builder_init (&builder, G_VARIANT_TYPE ("av"));
 
     for (p = ibus->register_engine_list; p != NULL; p = p->next) {
         g_variant_builder_add (
                 &builder, "v",
-                ibus_serializable_serialize ((IBusSerializable *) p->data));
+                bus_ibus_impl_serialize_engine_desc (
+                        ibus, (IBusEngineDesc *) p->data));
     }
 
-    retval = g_variant_builder_end (&builder);
-    g_assert (retval);
-    return retval;
+    ibus->active_engines_variant = g_variant_ref_sink (
+            g_variant_builder_end (&builder));
+    g_assert (ibus->active_engines_variant);
+    return g_variant_ref (ibus->active_engines_variant);
 }
 
 static void
@@ -1543,6 +1692,7 @@ _ibus_list_active_engines_depre (BusIBusImpl           *ibus,
 
     g_dbus_method_invocation_return_value (invocation,
                                            g_variant_new ("(@av)", variant));
+    g_variant_unref (variant);
 }
 
 /**
@@ -1903,6 +2053,7 @@ _ibus_set_preload_engines (BusIBusImpl     *ibus,
     BusComponent *component = NULL;
     BusFactoryProxy *factory = NULL;
     GPtrArray *array = g_ptr_array_new ();
+    GList *descs = NULL;
 
     g_variant_get (value, "^a&s", &names);
 
@@ -1918,9 +2069,11 @@ _ibus_set_preload_engines (BusIBusImpl     *ibus,
                          "Cannot find engine %s.",
                          names[i]);
             g_ptr_array_free (array, FALSE);
+            g_list_free (descs);
             return FALSE;
         }
 
+        descs = g_list_prepend (descs, desc);
         component = bus_component_from_engine_desc (desc);
         factory = bus_component_get_factory (component);
 
@@ -1947,6 +2100,11 @@ _ibus_set_preload_engines (BusIBusImpl     *ibus,
 
     g_ptr_array_free (array, FALSE);
 
+    /* Create the preload engines so that the first switch to them is fast. */
+    descs = g_list_reverse (descs);
+    bus_engine_pool_set_preload_engines (descs);
+    g_list_free (descs);
+
     bus_ibus_impl_property_changed (ibus, "PreloadEngines", value);
 
     return TRUE;
@@ -1989,6 +2147,43 @@ _ibus_set_embed_preedit_text (BusIBusImpl     *ibus,
     return TRUE;
 }
 
+/**
+ * bus_ibus_impl_compile_hotkeys:
+ *
+ * Compile ime_switcher_keys into the hotkey_matcher. The keycode of a key
+ * is not 0 for the backward switcher.
+ */
+static void
+bus_ibus_impl_compile_hotkeys (BusIBusImpl *ibus)
+{
+    IBusHotkeyBinding *bindings;
+    guint i, n;
+
+    for (n = 0; ibus->ime_switcher_keys[n].keyval; ++n) {}
+    bindings = g_new (IBusHotkeyBinding, n);
+    ibus->switcher_forward_modifiers = 0;
+    ibus->switcher_backward_modifiers = 0;
+    for (i = 0; i < n; i++) {
+        const IBusProcessKeyEventData *key = &ibus->ime_switcher_keys[i];
+        guint modifiers = ibus_hotkey_matcher_normalize_modifiers (key->state);
+        bindings[i].keyval = key->keyval;
+        bindings[i].modifiers = modifiers;
+        if (key->keycode != 0) {
+            bindings[i].action = HOTKEY_ACTION_IME_SWITCHER_BACKWARD;
+            ibus->switcher_backward_modifiers |= modifiers;
+        } else {
+            bindings[i].action = HOTKEY_ACTION_IME_SWITCHER;
+            ibus->switcher_forward_modifiers |= modifiers;
+        }
+    }
+    if (ibus->hotkey_matcher)
+        ibus_hotkey_matcher_unref (ibus->hotkey_matcher);
+    ibus->hotkey_matcher = ibus_hotkey_matcher_new (bindings, n);
+    ibus->hotkey_state.modifiers = 0;
+    ibus->hotkey_state.action = 0;
+    g_free (bindings);
+}
+
 /**
  * _ibus_set_global_shortcut_keys:
  *
@@ -2033,6 +2228,11 @@ _ibus_set_global_shortcut_keys (BusIBusImpl     *ibus,
                            ibus->ime_switcher_keys);
         }
         ibus->ime_switcher_keys = keys;
+        bus_ibus_impl_compile_hotkeys (ibus);
+        /* the client sends the keys of the old shortcuts to the engine
+         * directly. */
+        if (ibus->focused_context)
+            bus_input_context_close_engine_link (ibus->focused_context);
         break;
     default:
         g_slice_free1 (sizeof (IBusProcessKeyEventData) * (size + 1), keys);
@@ -2040,6 +2240,185 @@ _ibus_set_global_shortcut_keys (BusIBusImpl     *ibus,
     return TRUE;
 }
 
+/**
+ * _stats_get_context_key_latency:
+ *
+ * Implement the "ContextKeyLatency" get property of the
+ * org.freedesktop.IBus.Stats interface.
+ */
+static GVariant *
+_stats_get_context_key_latency (BusIBusImpl     *ibus,
+                                GDBusConnection *connection,
+                                GError         **error)
+{
+    GVariantBuilder builder;
+    GList *p;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ss(tttt))"));
+    for (p = ibus->contexts; p != NULL; p = p->next) {
+        BusInputContext *context = (BusInputContext *) p->data;
+        const gchar *client = bus_input_context_get_client (context);
+        g_variant_builder_add (
+                &builder,
+                "(ss@(tttt))",
+                ibus_service_get_object_path ((IBusService *) context),
+                client ? client : "",
+                bus_latency_histogram_serialize (
+                        bus_input_context_get_key_latency (context)));
+    }
+    return g_variant_builder_end (&builder);
+}
+
+/**
+ * _stats_get_engine_key_latency:
+ *
+ * Implement the "EngineKeyLatency" get property of the
+ * org.freedesktop.IBus.Stats interface.
+ */
+static GVariant *
+_stats_get_engine_key_latency (BusIBusImpl     *ibus,
+                               GDBusConnection *connection,
+                               GError         **error)
+{
+    return bus_stats_get_engine_key_latencies ();
+}
+
+/**
+ * _stats_get_engine_key_deadlines:
+ *
+ * Implement the "EngineKeyDeadlines" get property of the
+ * org.freedesktop.IBus.Stats interface.
+ */
+static GVariant *
+_stats_get_engine_key_deadlines (BusIBusImpl     *ibus,
+                                 GDBusConnection *connection,
+                                 GError         **error)
+{
+    return bus_stats_get_engine_key_deadlines ();
+}
+
+/**
+ * _stats_get_queue_stats:
+ *
+ * Implement the "QueueStats" get property of the
+ * org.freedesktop.IBus.Stats interface.
+ */
+static GVariant *
+_stats_get_queue_stats (BusIBusImpl     *ibus,
+                        GDBusConnection *connection,
+                        GError         **error)
+{
+    static const gchar *queue_names[] = { "dispatch", "forward" };
+    static const gchar *lane_names[BUS_DBUS_LANE_LAST] = {
+        "interactive",
+        "bulk",
+    };
+    GVariantBuilder builder;
+    gint queue, lane;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ss(uut))"));
+    for (queue = BUS_DBUS_QUEUE_DISPATCH;
+         queue <= BUS_DBUS_QUEUE_FORWARD;
+         queue++) {
+        for (lane = 0; lane < BUS_DBUS_LANE_LAST; lane++) {
+            BusDBusQueueStats stats;
+            bus_dbus_impl_get_queue_stats (BUS_DEFAULT_DBUS,
+                                           queue,
+                                           lane,
+                                           &stats);
+            g_variant_builder_add (&builder,
+                                   "(ss(uut))",
+                                   queue_names[queue],
+                                   lane_names[lane],
+                                   stats.depth,
+                                   stats.high_water_mark,
+                                   stats.n_messages);
+        }
+    }
+    return g_variant_builder_end (&builder);
+}
+
+/**
+ * _stats_get_message_counts:
+ *
+ * Implement the "MessageCounts" get property of the
+ * org.freedesktop.IBus.Stats interface. The messages are counted from
+ * the first read.
+ */
+static GVariant *
+_stats_get_message_counts (BusIBusImpl     *ibus,
+                           GDBusConnection *connection,
+                           GError         **error)
+{
+    return bus_stats_get_message_counts ();
+}
+
+/**
+ * _stats_get_slow_key_events:
+ *
+ * Implement the "SlowKeyEvents" get property of the
+ * org.freedesktop.IBus.Stats interface, the latest key events which were
+ * answered later than BUS_STATS_SLOW_KEY_EVENT_USEC.
+ */
+static GVariant *
+_stats_get_slow_key_events (BusIBusImpl     *ibus,
+                            GDBusConnection *connection,
+                            GError         **error)
+{
+    return bus_stats_get_slow_key_events ();
+}
+
+/**
+ * _stats_get_engine_pool:
+ *
+ * Implement the "EnginePool" get property of the
+ * org.freedesktop.IBus.Stats interface, the numbers of the proxies, the
+ * idle proxies, the hits and the misses of the engine pool.
+ */
+static GVariant *
+_stats_get_engine_pool (BusIBusImpl     *ibus,
+                        GDBusConnection *connection,
+                        GError         **error)
+{
+    return bus_engine_pool_get_stats ();
+}
+
+/* all methods in the xml definition above should be listed here. */
+static const struct {
+    const gchar *method_name;
+    void (* method_callback) (BusIBusImpl *,
+                              GVariant *,
+                              GDBusMethodInvocation *);
+} methods [] =  {
+    /* IBus interface */
+    { "CreateInputContext",    _ibus_create_input_context },
+    { "RegisterComponent",     _ibus_register_component },
+    { "GetEnginesByNames",     _ibus_get_engines_by_names },
+    { "Exit",                  _ibus_exit },
+    { "Ping",                  _ibus_ping },
+    { "SetGlobalEngine",       _ibus_set_global_engine },
+    /* Start of deprecated methods */
+    { "GetAddress",            _ibus_get_address_depre },
+    { "CurrentInputContext",   _ibus_current_input_context_depre },
+    { "ListEngines",           _ibus_list_engines_depre },
+    { "ListActiveEngines",     _ibus_list_active_engines_depre },
+    { "GetUseSysLayout",       _ibus_get_use_sys_layout_depre },
+    { "GetUseGlobalEngine",    _ibus_get_use_global_engine_depre },
+    { "GetGlobalEngine",       _ibus_get_global_engine_depre },
+    { "IsGlobalEngineEnabled", _ibus_is_global_engine_enabled_depre },
+    /* End of deprecated methods */
+};
+
+static IBusServiceMethodTable *
+bus_ibus_impl_new_method_table (IBusServiceClass *class)
+{
+    return ibus_service_method_table_new (class,
+                                          IBUS_INTERFACE_IBUS,
+                                          &methods[0].method_name,
+                                          G_N_ELEMENTS (methods),
+                                          sizeof (methods[0]));
+}
+
 /**
  * bus_ibus_impl_service_method_call:
  *
@@ -2056,7 +2435,9 @@ bus_ibus_impl_service_method_call (IBusService           *service,
                                    GVariant              *parameters,
                                    GDBusMethodInvocation *invocation)
 {
-    if (g_strcmp0 (interface_name, IBUS_INTERFACE_IBUS) != 0) {
+    gint i = ibus_service_method_table_lookup (ibus_methods, invocation);
+
+    if (i < 0) {
         IBUS_SERVICE_CLASS (bus_ibus_impl_parent_class)->service_method_call (
                         service, connection, sender, object_path,
                         interface_name, method_name,
@@ -2064,44 +2445,9 @@ bus_ibus_impl_service_method_call (IBusService           *service,
         return;
     }
 
-    /* all methods in the xml definition above should be listed here. */
-    static const struct {
-        const gchar *method_name;
-        void (* method_callback) (BusIBusImpl *,
-                                  GVariant *,
-                                  GDBusMethodInvocation *);
-    } methods [] =  {
-        /* IBus interface */
-        { "CreateInputContext",    _ibus_create_input_context },
-        { "RegisterComponent",     _ibus_register_component },
-        { "GetEnginesByNames",     _ibus_get_engines_by_names },
-        { "Exit",                  _ibus_exit },
-        { "Ping",                  _ibus_ping },
-        { "SetGlobalEngine",       _ibus_set_global_engine },
-        /* Start of deprecated methods */
-        { "GetAddress",            _ibus_get_address_depre },
-        { "CurrentInputContext",   _ibus_current_input_context_depre },
-        { "ListEngines",           _ibus_list_engines_depre },
-        { "ListActiveEngines",     _ibus_list_active_engines_depre },
-        { "GetUseSysLayout",       _ibus_get_use_sys_layout_depre },
-        { "GetUseGlobalEngine",    _ibus_get_use_global_engine_depre },
-        { "GetGlobalEngine",       _ibus_get_global_engine_depre },
-        { "IsGlobalEngineEnabled", _ibus_is_global_engine_enabled_depre },
-        /* End of deprecated methods */
-    };
-
-    gint i;
-    for (i = 0; i < G_N_ELEMENTS (methods); i++) {
-        if (g_strcmp0 (methods[i].method_name, method_name) == 0) {
-            methods[i].method_callback ((BusIBusImpl *) service,
-                                        parameters,
-                                        invocation);
-            return;
-        }
-    }
-
-    g_warning ("service_method_call received an unknown method: %s",
-               method_name ? method_name : "(null)");
+    methods[i].method_callback ((BusIBusImpl *) service,
+                                parameters,
+                                invocation);
 }
 
 /**
@@ -2133,9 +2479,33 @@ bus_ibus_impl_service_get_property (IBusService     *service,
         { "GlobalEngine",          _ibus_get_global_engine },
         { "EmbedPreeditText",      _ibus_get_embed_preedit_text },
     };
+    static const struct {
+        const gchar *method_name;
+        GVariant * (* method_callback) (BusIBusImpl *,
+                                        GDBusConnection *,
+                                        GError **);
+    } stats_methods [] =  {
+        { "ContextKeyLatency",     _stats_get_context_key_latency },
+        { "EngineKeyLatency",      _stats_get_engine_key_latency },
+        { "EngineKeyDeadlines",    _stats_get_engine_key_deadlines },
+        { "QueueStats",            _stats_get_queue_stats },
+        { "MessageCounts",         _stats_get_message_counts },
+        { "SlowKeyEvents",         _stats_get_slow_key_events },
+        { "EnginePool",            _stats_get_engine_pool },
+    };
 
     if (error)
         *error = NULL;
+    if (g_strcmp0 (interface_name, IBUS_INTERFACE_STATS) == 0) {
+        for (i = 0; i < G_N_ELEMENTS (stats_methods); i++) {
+            if (g_strcmp0 (stats_methods[i].method_name, property_name) == 0) {
+                return stats_methods[i].method_callback (
+                        (BusIBusImpl *) service,
+                        connection,
+                        error);
+            }
+        }
+    }
     if (g_strcmp0 (interface_name, IBUS_INTERFACE_IBUS) != 0) {
         return IBUS_SERVICE_CLASS (
                 bus_ibus_impl_parent_class)->service_get_property (
@@ -2339,6 +2709,7 @@ bus_ibus_impl_registry_destroy (BusIBusImpl *ibus)
     g_list_free_full (ibus->components, g_object_unref);
     ibus->components = NULL;
 
+    bus_ibus_impl_clear_engine_cache (ibus);
     g_clear_pointer (&ibus->engine_table, g_hash_table_destroy);
 
     /* g_clear_pointer() does not set the cast. */
@@ -2464,10 +2835,9 @@ bus_ibus_impl_property_changed (BusIBusImpl *service,
  *
  * Send a D-Bus signal to buses (connections) that are listening to the signal.
  */
-static void
-bus_ibus_impl_emit_signal (BusIBusImpl *ibus,
-                           const gchar *signal_name,
-                           GVariant    *parameters)
+static GDBusMessage *
+bus_ibus_impl_new_signal (const gchar *signal_name,
+                          GVariant    *parameters)
 {
     GDBusMessage *message = g_dbus_message_new_signal (IBUS_PATH_IBUS,
                                                        IBUS_INTERFACE_IBUS,
@@ -2477,10 +2847,39 @@ bus_ibus_impl_emit_signal (BusIBusImpl *ibus,
     g_dbus_message_set_sender (message, IBUS_NAME_OWNER_NAME);
     if (parameters)
         g_dbus_message_set_body (message, parameters);
+    return message;
+}
+
+static void
+bus_ibus_impl_emit_signal (BusIBusImpl *ibus,
+                           const gchar *signal_name,
+                           GVariant    *parameters)
+{
+    GDBusMessage *message = bus_ibus_impl_new_signal (signal_name,
+                                                      parameters);
     bus_dbus_impl_dispatch_message_by_rule (BUS_DEFAULT_DBUS, message, NULL);
     g_object_unref (message);
 }
 
+/**
+ * bus_ibus_impl_emit_urgent_signal:
+ *
+ * Send a D-Bus signal ahead of the queued messages and flush it to the
+ * buses which are listening to the signal.
+ */
+static void
+bus_ibus_impl_emit_urgent_signal (BusIBusImpl *ibus,
+                                  const gchar *signal_name,
+                                  GVariant    *parameters)
+{
+    GDBusMessage *message = bus_ibus_impl_new_signal (signal_name,
+                                                      parameters);
+    bus_dbus_impl_dispatch_urgent_message_by_rule (BUS_DEFAULT_DBUS,
+                                                   message,
+                                                   NULL);
+    g_object_unref (message);
+}
+
 static void
 bus_ibus_impl_registry_changed (BusIBusImpl *ibus)
 {
@@ -2545,33 +2944,94 @@ bus_ibus_impl_get_engine_active_surrounding_text_table (BusIBusImpl *ibus)
     return ibus->engine_active_surrounding_text_table;
 }
 
-static guint
-keyval_to_modifier(guint keyval)
-{
-    switch(keyval) {
-    case IBUS_KEY_Control_L:
-    case IBUS_KEY_Control_R:
-        return IBUS_CONTROL_MASK;
-    case IBUS_KEY_Shift_L:
-    case IBUS_KEY_Shift_R:
-        return IBUS_SHIFT_MASK;
-    case IBUS_KEY_Caps_Lock:
-        return IBUS_LOCK_MASK;
-    case IBUS_KEY_Alt_L:
-    case IBUS_KEY_Alt_R:
-        return IBUS_MOD1_MASK;
-    case IBUS_KEY_Meta_L:
-    case IBUS_KEY_Meta_R:
-        return IBUS_META_MASK;
-    case IBUS_KEY_Super_L:
-    case IBUS_KEY_Super_R:
-        return IBUS_MOD4_MASK;
-    case IBUS_KEY_Hyper_L:
-    case IBUS_KEY_Hyper_R:
-        return IBUS_HYPER_MASK;
-    default:;
-    }
-    return 0;
+/**
+ * bus_ibus_impl_prewarm_switcher_engines:
+ *
+ * Start creating the engines which the IME switcher selects next in the
+ * order of the preload engines, and the previous global engine which the
+ * switcher selects when the panel orders the engines by their last use.
+ */
+static void
+bus_ibus_impl_prewarm_switcher_engines (BusIBusImpl *ibus,
+                                        gboolean     forward,
+                                        gboolean     backward)
+{
+    const gchar * const *names = bus_engine_pool_get_preload_engines ();
+    const gchar *current = NULL;
+    const gchar *candidates[3] = { NULL, };
+    GList *descs = NULL;
+    guint n, i;
+
+    if (names == NULL || names[0] == NULL)
+        return;
+
+    if (ibus->use_global_engine) {
+        current = ibus->global_engine_name;
+    } else if (ibus->focused_context != NULL) {
+        IBusEngineDesc *desc =
+                bus_input_context_get_engine_desc (ibus->focused_context);
+        if (desc != NULL)
+            current = ibus_engine_desc_get_name (desc);
+    }
+
+    n = g_strv_length ((gchar **) names);
+    for (i = 0; i < n; i++) {
+        if (g_strcmp0 (names[i], current) == 0)
+            break;
+    }
+    if (i == n) {
+        candidates[0] = names[0];
+    } else {
+        if (forward)
+            candidates[0] = names[(i + 1) % n];
+        if (backward)
+            candidates[1] = names[(i + n - 1) % n];
+    }
+    if (ibus->use_global_engine)
+        candidates[2] = ibus->global_previous_engine_name;
+
+    for (i = 0; i < G_N_ELEMENTS (candidates); i++) {
+        IBusEngineDesc *desc;
+        if (candidates[i] == NULL || g_strcmp0 (candidates[i], current) == 0)
+            continue;
+        desc = bus_ibus_impl_get_engine_desc (ibus, candidates[i]);
+        if (desc != NULL && g_list_find (descs, desc) == NULL)
+            descs = g_list_append (descs, desc);
+    }
+    bus_engine_pool_prewarm (descs);
+    g_list_free (descs);
+}
+
+/**
+ * bus_ibus_impl_start_prewarm:
+ *
+ * Pre-warm the engines of the switcher keys of the held prewarm_modifier
+ * unless they are already pre-warmed.
+ */
+static void
+bus_ibus_impl_start_prewarm (BusIBusImpl *ibus)
+{
+    guint modifier = ibus->prewarm_modifier;
+
+    if (ibus->prewarm_id != 0) {
+        g_source_remove (ibus->prewarm_id);
+        ibus->prewarm_id = 0;
+    }
+    if (ibus->prewarmed)
+        return;
+    ibus->prewarmed = TRUE;
+    bus_ibus_impl_prewarm_switcher_engines (
+            ibus,
+            (modifier & ibus->switcher_forward_modifiers) != 0,
+            (modifier & ibus->switcher_backward_modifiers) != 0);
+}
+
+static gboolean
+_prewarm_timeout_cb (BusIBusImpl *ibus)
+{
+    ibus->prewarm_id = 0;
+    bus_ibus_impl_start_prewarm (ibus);
+    return G_SOURCE_REMOVE;
 }
 
 gboolean
@@ -2580,73 +3040,106 @@ bus_ibus_impl_process_key_event (BusIBusImpl *ibus,
                                  guint        keycode,
                                  guint        state)
 {
-    int i;
-    guint modifiers = state;
-    guint bind_keyval = 0;
-    guint bind_state = 0;
-    static guint binding_state = 0;
     gboolean is_pressed = (state & IBUS_RELEASE_MASK) == 0;
-    gboolean is_backward = FALSE;
-    gboolean hit = FALSE;
-    IBusBusGlobalBindingType type = IBUS_BUS_GLOBAL_BINDING_TYPE_ANY;
+    guint modifier = ibus_hotkey_matcher_get_modifier (keyval);
+    guint action = 0;
+    IBusHotkeyMatch match;
 
     g_assert (BUS_IS_IBUS_IMPL (ibus));
-    if (!ibus->ime_switcher_keys)
+    if (!ibus->hotkey_matcher)
         return FALSE;
+
+    if (is_pressed && ibus->prewarm_modifier == 0) {
+        /* The user may be starting the switcher keys, so start the engines
+         * which the switcher will select if the modifier is held alone. */
+        if (ibus->hotkey_state.modifiers == 0 &&
+            (modifier & (ibus->switcher_forward_modifiers |
+                         ibus->switcher_backward_modifiers)) != 0) {
+            ibus->prewarm_modifier = modifier;
+            ibus->prewarmed = FALSE;
+            ibus->prewarm_switched = FALSE;
+            ibus->prewarm_id = g_timeout_add (
+                    PREWARM_DELAY,
+                    (GSourceFunc) _prewarm_timeout_cb,
+                    ibus);
+        }
+    } else if (is_pressed && modifier != ibus->prewarm_modifier &&
+               ibus->prewarm_id != 0) {
+        /* Another key is pressed with the modifier, which is likely a
+         * shortcut of the application. The switcher keys pre-warm the
+         * engines below instead. */
+        g_source_remove (ibus->prewarm_id);
+        ibus->prewarm_id = 0;
+    }
+
     /*
      * GTK3 has both IBUS_SUPER_MASK & IBUS_MOD4_MASK.
      * GTK4 has IBUS_SUPER_MASK.
      * Qt5 has IBUS_MOD4_MASK.
+     * The matcher normalizes them. It matches the press of Super-space and
+     * the release of both Super and space.
      */
-    if (modifiers & IBUS_SUPER_MASK) {
-        modifiers &= ~IBUS_SUPER_MASK;
-        modifiers |= IBUS_MOD4_MASK;
-    }
-    modifiers &= IBUS_MODIFIER_FILTER & ~IBUS_RELEASE_MASK;
-    for (i = 0; ibus->ime_switcher_keys[i].keyval; ++i) {
-        bind_keyval = ibus->ime_switcher_keys[i].keyval;
-        bind_state = ibus->ime_switcher_keys[i].state;
-        is_backward = ibus->ime_switcher_keys[i].keycode != 0;
-        if (keyval == bind_keyval && modifiers == bind_state) {
-            if (modifiers != 0) {
-                /* If Super-space is pressed */
-                if (is_pressed)
-                    binding_state = bind_state;
-                /* If Super is pressed but space is released */
-                else if (!is_pressed && binding_state)
-                    break;
-            }
-            hit = TRUE;
-            type = IBUS_BUS_GLOBAL_BINDING_TYPE_IME_SWITCHER;
-            break;
-        } else if (binding_state && !is_pressed) {
-            guint released_modifier = keyval_to_modifier(keyval);
-            binding_state &= modifiers;
-            binding_state &= ~released_modifier;
-            /* If both Super and space is released */
-            if (!binding_state) {
-                hit = TRUE;
-                type = IBUS_BUS_GLOBAL_BINDING_TYPE_IME_SWITCHER;
-            }
-            break;
-        }
-    }
-    if (hit) {
-        g_assert (bind_keyval);
+    match = ibus_hotkey_matcher_process (ibus->hotkey_matcher,
+                                         &ibus->hotkey_state,
+                                         keyval,
+                                         state,
+                                         &action);
+    if (match != IBUS_HOTKEY_MATCH_NONE) {
         GVariant *variant = g_variant_new (
-                "(yuuub)", type, keyval, keycode, state, is_backward);
-        /* TODO: dbus-monitor can observe the key release D-Bus signal is sent
-         *       immediately but IBusPanelService sometimes gets the signal
-         *       with a delay because the D-Bus receives seems depend on
-         *       the GMainLoop. The delay is resolved with another key press
-         *       as the workaround.
-         *       I also tried g_idle_add() for bus_ibus_impl_emit_signal() and
-         *       a D-Bus method from BusPanelProxy instead of this D-Bus signal
-         *       but this problem couldn't be resolved.
+                "(yuuub)",
+                IBUS_BUS_GLOBAL_BINDING_TYPE_IME_SWITCHER,
+                keyval,
+                keycode,
+                state,
+                action == HOTKEY_ACTION_IME_SWITCHER_BACKWARD);
+        /* The panel used to get the key release signal with a delay until
+         * the next key press since the signal waited for the idle callback
+         * of the dispatch queue here and for the default priority of the
+         * GMainLoop in the panel. The signal is now flushed at once and
+         * IBusBus receives it with a D-Bus filter in the GDBus worker
+         * thread and emits it in a G_PRIORITY_HIGH source.
          */
-        bus_ibus_impl_emit_signal (ibus, "GlobalShortcutKeyResponded", variant);
+        bus_ibus_impl_emit_urgent_signal (ibus,
+                                          "GlobalShortcutKeyResponded",
+                                          variant);
+        /* the first press of the switcher keys pre-warms the engines
+         * before the modifier is released. */
+        if (is_pressed && ibus->prewarm_modifier != 0)
+            bus_ibus_impl_start_prewarm (ibus);
+        ibus->prewarm_switched = TRUE;
+    }
+    if (!is_pressed && ibus->prewarm_modifier != 0 &&
+        modifier == ibus->prewarm_modifier) {
+        if (ibus->prewarm_id != 0) {
+            g_source_remove (ibus->prewarm_id);
+            ibus->prewarm_id = 0;
+        }
+        /* The modifier is released without the switcher keys. */
+        if (ibus->prewarmed && !ibus->prewarm_switched)
+            bus_engine_pool_cancel_prewarm ();
+        ibus->prewarm_modifier = 0;
     }
-    return hit;
+    return match != IBUS_HOTKEY_MATCH_NONE;
+}
+
+gboolean
+bus_ibus_impl_is_hotkey_event (BusIBusImpl *ibus,
+                               guint        keyval,
+                               guint        state)
+{
+    IBusHotkeyMatcherState hotkey_state;
+    guint action = 0;
+
+    g_assert (BUS_IS_IBUS_IMPL (ibus));
+    if (!ibus->hotkey_matcher)
+        return FALSE;
+    /* match with a copy so that the state does not change. */
+    hotkey_state = ibus->hotkey_state;
+    return ibus_hotkey_matcher_process (ibus->hotkey_matcher,
+                                        &hotkey_state,
+                                        keyval,
+                                        state,
+                                        &action) != IBUS_HOTKEY_MATCH_NONE;
 }
 
 gboolean
@@ -2655,3 +3148,10 @@ bus_ibus_impl_is_wayland_session (BusIBusImpl *ibus)
     g_assert (BUS_IS_IBUS_IMPL (ibus));
     return ibus->ime_switcher_keys ? TRUE : FALSE;
 }
+
+const IBusProcessKeyEventData *
+bus_ibus_impl_get_ime_switcher_keys (BusIBusImpl *ibus)
+{
+    g_assert (BUS_IS_IBUS_IMPL (ibus));
+    return ibus->ime_switcher_keys;
+}
@@ -106,6 +106,16 @@ gboolean         bus_ibus_impl_process_key_event    (BusIBusImpl        *ibus,
                                                      guint
                                                                         keycode,
                                                      guint               state);
+/* %TRUE if bus_ibus_impl_process_key_event() would handle the key event.
+ * It does not change the state of the hotkeys. */
+gboolean         bus_ibus_impl_is_hotkey_event      (BusIBusImpl        *ibus,
+                                                     guint               keyval,
+                                                     guint               state);
 gboolean         bus_ibus_impl_is_wayland_session   (BusIBusImpl        *ibus);
+/* A zero-terminated array of the shortcut keys which ibus-daemon handles
+ * in bus_ibus_impl_process_key_event(), or %NULL. */
+const IBusProcessKeyEventData *
+                 bus_ibus_impl_get_ime_switcher_keys
+                                                    (BusIBusImpl        *ibus);
 G_END_DECLS
 #endif
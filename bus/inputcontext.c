@@ -22,13 +22,22 @@
  */
 #include "inputcontext.h"
 
+#include <glib-unix.h>
+#include <gio/gunixfdlist.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
+#include "enginepool.h"
 #include "engineproxy.h"
 #include "factoryproxy.h"
 #include "global.h"
 #include "ibusimpl.h"
+#include "ibuskeychannel.h"
+#include "ibusprocesskeyevent.h"
+#include "ibusservicemethodtable.h"
 #include "marshalers.h"
+#include "trace.h"
 #include "types.h"
 
 #define MAX_SYNC_DATA 30
@@ -96,6 +105,9 @@ struct _BusInputContext {
     gboolean  preedit_visible;
     guint     preedit_mode;
     gboolean  client_commit_preedit;
+    /* preedit text the client received last, the base of
+     * UpdatePreeditTextDelta */
+    IBusText *client_preedit_text;
 
     /* auxiliary text */
     IBusText *auxiliary_text;
@@ -105,6 +117,13 @@ struct _BusInputContext {
     IBusLookupTable *lookup_table;
     gboolean lookup_table_visible;
 
+    /* surrounding text sent by the client, the base of
+     * SetSurroundingTextDelta */
+    IBusText *surrounding_text;
+    guint     surrounding_cursor_pos;
+    guint     selection_anchor_pos;
+    guint     surrounding_revision;
+
     /* filter release */
     gboolean filter_release;
 
@@ -123,6 +142,45 @@ struct _BusInputContext {
     GQueue *queue_during_process_key_event;
     gboolean use_post_process_key_event;
     gboolean processing_key_event;
+    /* ProcessKeyEventData in the order the key events were received */
+    GQueue   pending_key_events;
+    /* the time from receiving a key event to answering it */
+    BusLatencyHistogram key_latency;
+    /* key events from the client without D-Bus, see OpenKeyChannel */
+    IBusKeyChannel *key_channel;
+    guint    key_channel_source_id;
+    /* D-Bus signals sent to the client, so that the client can apply the
+     * signals before a reply from key_channel */
+    guint32  n_emitted_signals;
+    /* the engine which talks with the client over a peer connection, see
+     * OpenEngineLink. Its signals for the client are not relayed. */
+    BusEngineProxy *engine_link;
+    /* the client end of the peer connection, to shut it down */
+    gint     engine_link_fd;
+    gboolean engine_link_closing;
+
+    /* engine updates held back while key events are in flight, see
+     * bus_input_context_flush_engine_updates() */
+    guint    coalescing_key_events;
+    /* TRUE while a "ProcessKeyEvents" call goes to an engine which may not
+     * know it. The later key events for the engine wait in
+     * held_key_events so that they cannot overtake the key events which
+     * are sent one by one if the engine does not know the call. */
+    gboolean checking_process_key_events;
+    GQueue   held_key_events;
+
+    /* the number of the context in the trace of --trace, or 0 for fake
+     * contexts which are not recorded */
+    guint32  trace_id;
+    guint    coalesced_updates;
+    IBusText *coalesced_preedit_text;
+    guint     coalesced_preedit_cursor_pos;
+    gboolean  coalesced_preedit_visible;
+    guint     coalesced_preedit_mode;
+    IBusText *coalesced_auxiliary_text;
+    gboolean  coalesced_auxiliary_visible;
+    IBusLookupTable *coalesced_lookup_table;
+    gboolean  coalesced_lookup_table_visible;
 
     /* IBus CandidatePanel has focus if the client application does not support
      * the Wayland input-method protocol likes setting XMODIFIERS or
@@ -173,9 +231,17 @@ enum {
     PROP_0,
 };
 
+/* kinds of engine updates which can be coalesced */
+enum {
+    COALESCED_PREEDIT_TEXT   = 1 << 0,
+    COALESCED_AUXILIARY_TEXT = 1 << 1,
+    COALESCED_LOOKUP_TABLE   = 1 << 2,
+};
+
 typedef struct _BusInputContextPrivate BusInputContextPrivate;
 
 static guint    context_signals[LAST_SIGNAL] = { 0 };
+static IBusServiceMethodTable *context_methods;
 
 /* functions prototype */
 static void     bus_input_context_destroy
@@ -207,6 +273,9 @@ static gboolean bus_input_context_service_set_property
                                     const gchar           *property_name,
                                     GVariant              *value,
                                     GError               **error);
+static IBusServiceMethodTable *
+                bus_input_context_new_method_table
+                                   (IBusServiceClass      *class);
 static void     bus_input_context_unset_engine
                                    (BusInputContext       *context);
 static void     bus_input_context_show_preedit_text
@@ -243,6 +312,14 @@ static void     bus_input_context_update_property
                                     IBusProperty          *prop);
 static void     _engine_destroy_cb (BusEngineProxy        *factory,
                                     BusInputContext       *context);
+static void     bus_input_context_flush_engine_updates
+                                   (BusInputContext       *context);
+static void     bus_input_context_clear_engine_updates
+                                   (BusInputContext       *context);
+static void     bus_input_context_close_key_channel
+                                   (BusInputContext       *context);
+static void     bus_input_context_send_held_key_events
+                                   (BusInputContext       *context);
 
 static IBusText *text_empty = NULL;
 static IBusLookupTable *lookup_table_empty = NULL;
@@ -279,6 +356,14 @@ static const gchar introspection_xml[] =
     "      <arg direction='in'  type='u' name='state' />\n"
     "      <arg direction='out' type='b' name='handled' />\n"
     "    </method>\n"
+    "    <method name='ProcessKeyEvents'>\n"
+    "      <arg direction='in'  type='a(uuu)' name='keys' />\n"
+    "      <arg direction='out' type='ay' name='handled' />\n"
+    "      <annotation name='org.gtk.GDBus.Since'\n"
+    "          value='1.5.33' />\n"
+    "      <annotation name='org.gtk.GDBus.DocString'\n"
+    "          value='Stability: Unstable' />\n"
+    "    </method>\n"
     "    <method name='SetCursorLocation'>\n"
     "      <arg direction='in' type='i' name='x' />\n"
     "      <arg direction='in' type='i' name='y' />\n"
@@ -318,6 +403,26 @@ static const gchar introspection_xml[] =
     "      <arg direction='in' type='u' name='cursor_pos' />\n"
     "      <arg direction='in' type='u' name='anchor_pos' />\n"
     "    </method>\n"
+    "    <method name='OpenKeyChannel'>\n"
+    "      <arg direction='in' type='h' name='memfd' />\n"
+    "      <arg direction='in' type='h' name='key_fd' />\n"
+    "      <arg direction='in' type='h' name='reply_fd' />\n"
+    "    </method>\n"
+    "    <method name='OpenEngineLink'>\n"
+    "      <arg direction='out' type='h' name='fd' />\n"
+    "      <arg direction='out' type='o' name='engine_path' />\n"
+    "      <arg direction='out' type='s' name='keymap' />\n"
+    "      <arg direction='out' type='a(uu)' name='reserved_keys' />\n"
+    "    </method>\n"
+    "    <method name='SetSurroundingTextDelta'>\n"
+    "      <arg direction='in' type='u' name='revision' />\n"
+    "      <arg direction='in' type='u' name='offset' />\n"
+    "      <arg direction='in' type='u' name='n_deleted' />\n"
+    "      <arg direction='in' type='s' name='inserted' />\n"
+    "      <arg direction='in' type='u' name='cursor_pos' />\n"
+    "      <arg direction='in' type='u' name='anchor_pos' />\n"
+    "      <arg direction='out' type='b' name='applied' />\n"
+    "    </method>\n"
 
     /* signals */
     "    <signal name='CommitText'>\n"
@@ -339,6 +444,21 @@ static const gchar introspection_xml[] =
     "      <arg type='b' name='visible' />\n"
     "      <arg type='u' name='mode' />\n"
     "    </signal>\n"
+    "    <signal name='UpdatePreeditTextDelta'>\n"
+    "      <arg type='u' name='offset' />\n"
+    "      <arg type='u' name='n_deleted' />\n"
+    "      <arg type='s' name='inserted' />\n"
+    "      <arg type='a(uuuu)' name='removed_attrs' />\n"
+    "      <arg type='a(uuuu)' name='added_attrs' />\n"
+    "      <arg type='u' name='cursor_pos' />\n"
+    "      <arg type='b' name='visible' />\n"
+    "      <arg type='u' name='mode' />\n"
+    "      <arg type='b' name='with_mode' />\n"
+    "    </signal>\n"
+    "    <signal name='KeyChannelReply'>\n"
+    "      <arg type='u' name='serial' />\n"
+    "      <arg type='b' name='processed' />\n"
+    "    </signal>\n"
     "    <signal name='ShowPreeditText'/>\n"
     "    <signal name='HidePreeditText'/>\n"
     "    <signal name='UpdateAuxiliaryText'>\n"
@@ -393,6 +513,19 @@ G_DEFINE_TYPE (BusInputContext, bus_input_context, IBUS_TYPE_SERVICE)
      && !context->is_extension_lookup_table \
      && bus_ibus_impl_is_wayland_session (BUS_DEFAULT_IBUS))
 
+/* %TRUE if the keys and the text of the context must not be in the trace. */
+#define TRACE_PRIVATE_CONDITION \
+    (context->purpose == IBUS_INPUT_PURPOSE_PASSWORD || \
+     context->purpose == IBUS_INPUT_PURPOSE_PIN)
+
+/* %TRUE if the client can send key events to the engine directly. The
+ * emoji extension, the post-process mode and the preedit committed by the
+ * client need ibus-daemon in the middle. */
+#define ENGINE_LINK_CONDITION \
+    (context->has_focus && context->engine && !context->fake && \
+     !context->emoji_extension && !context->use_post_process_key_event && \
+     !context->client_commit_preedit && PREEDIT_CONDITION)
+
 static void
 _connection_destroy_cb (BusConnection   *connection,
                         BusInputContext *context)
@@ -431,6 +564,8 @@ bus_input_context_class_init (BusInputContextClass *class)
     /* register the xml so that bus_ibus_impl_service_method_call will be
      * called on a method call defined in the xml (e.g. 'FocusIn'.) */
     ibus_service_class_add_interfaces (IBUS_SERVICE_CLASS (class), introspection_xml);
+    context_methods = bus_input_context_new_method_table (
+            IBUS_SERVICE_CLASS (class));
 
     /* install glib signals that would be handled by other classes like
      * ibusimpl.c and panelproxy.c.
@@ -802,12 +937,18 @@ bus_input_context_init (BusInputContext *context)
     context->auxiliary_text = text_empty;
     g_object_ref_sink (lookup_table_empty);
     context->lookup_table = lookup_table_empty;
+    g_queue_init (&context->pending_key_events);
+    g_queue_init (&context->held_key_events);
+    context->engine_link_fd = -1;
     /* other member variables will automatically be zero-cleared. */
 }
 
 static void
 bus_input_context_destroy (BusInputContext *context)
 {
+    bus_trace_record (BUS_TRACE_EVENT_DESTROY, context->trace_id,
+                      0, 0, 0, NULL);
+
     if (context->has_focus) {
         bus_input_context_focus_out (context);
         context->has_focus = FALSE;
@@ -816,11 +957,15 @@ bus_input_context_destroy (BusInputContext *context)
     if (context->engine) {
         bus_input_context_unset_engine (context);
     }
+    /* focus_out and unset_engine sent the held updates, so this only frees
+     * any left over. */
+    bus_input_context_clear_engine_updates (context);
 
     if (context->preedit_text) {
         g_object_unref (context->preedit_text);
         context->preedit_text = NULL;
     }
+    g_clear_object (&context->client_preedit_text);
 
     if (context->auxiliary_text) {
         g_object_unref (context->auxiliary_text);
@@ -832,6 +977,10 @@ bus_input_context_destroy (BusInputContext *context)
         context->lookup_table = NULL;
     }
 
+    g_clear_object (&context->surrounding_text);
+    bus_input_context_close_key_channel (context);
+    bus_input_context_close_engine_link (context);
+
     if (context->connection) {
         g_signal_handlers_disconnect_by_func (
                 context->connection,
@@ -902,6 +1051,7 @@ bus_input_context_emit_signal (BusInputContext *context,
         return TRUE;
     }
 
+    context->n_emitted_signals++;
     return bus_input_context_send_signal (context,
                                           "org.freedesktop.IBus.InputContext",
                                           signal_name,
@@ -941,10 +1091,204 @@ bus_input_context_property_changed (BusInputContext *context,
 }
 
 
-typedef struct _PanelProcessKeyEventData {
+/* a "ProcessKeyEvents" method call which is answered when all its key
+ * events are answered */
+typedef struct _ProcessKeyEventsData ProcessKeyEventsData;
+struct _ProcessKeyEventsData {
     GDBusMethodInvocation *invocation;
-    BusInputContext *context;
-} PanelProcessKeyEventData;
+    guint   n_keys;
+    guint   n_pending;
+    guint8 *handled;
+    GError *error;
+};
+
+typedef struct _ProcessKeyEventData ProcessKeyEventData;
+struct _ProcessKeyEventData {
+    GDBusMethodInvocation *invocation;
+    BusInputContext       *context;
+    guint keyval;
+    guint keycode;
+    guint modifiers;
+    /* serial of a key event from context->key_channel, which has no
+     * invocation */
+    guint32 serial;
+    /* the "ProcessKeyEvents" call of the key event and its index there */
+    ProcessKeyEventsData *batch;
+    guint  index;
+    /* g_get_monotonic_time() when the key event was received */
+    gint64 received_time;
+    /* TRUE if the key event is in the trace */
+    gboolean traced;
+    /* the reply which waits for the earlier key events */
+    gboolean  done;
+    GVariant *value;
+    GError   *error;
+};
+
+/**
+ * bus_input_context_queue_key_event:
+ *
+ * Keep a "ProcessKeyEvent" method call in context->pending_key_events
+ * until it is answered.
+ */
+static ProcessKeyEventData *
+bus_input_context_queue_key_event (BusInputContext       *context,
+                                   GDBusMethodInvocation *invocation,
+                                   guint                  keyval,
+                                   guint                  keycode,
+                                   guint                  modifiers)
+{
+    ProcessKeyEventData *data = g_slice_new0 (ProcessKeyEventData);
+    data->invocation = invocation;
+    data->context = g_object_ref (context);
+    data->keyval = keyval;
+    data->keycode = keycode;
+    data->modifiers = modifiers;
+    data->received_time = g_get_monotonic_time ();
+    g_queue_push_tail (&context->pending_key_events, data);
+    if (bus_trace_is_recording () && !TRACE_PRIVATE_CONDITION) {
+        data->traced = TRUE;
+        bus_trace_record (BUS_TRACE_EVENT_KEY, context->trace_id,
+                          keyval, keycode, modifiers, NULL);
+    }
+    return data;
+}
+
+/**
+ * bus_input_context_reply_key_channel:
+ *
+ * Send the reply of a key event which came from context->key_channel.
+ * The number of the D-Bus signals sent so far lets the client apply the
+ * signals which the engine emitted for the key event before the reply.
+ */
+static void
+bus_input_context_reply_key_channel (BusInputContext     *context,
+                                     ProcessKeyEventData *data)
+{
+    gboolean processed = FALSE;
+
+    if (data->value != NULL) {
+        processed = ibus_process_key_event_reply_get (data->value);
+        g_variant_unref (data->value);
+    } else {
+        g_error_free (data->error);
+    }
+    if (context->key_channel == NULL)
+        return;
+    if (!ibus_key_channel_push_reply (context->key_channel,
+                                      data->serial,
+                                      processed,
+                                      context->n_emitted_signals)) {
+        /* the client does not read the replies. A signal still follows the
+         * signals of the key event. */
+        bus_input_context_emit_signal (context,
+                                       "KeyChannelReply",
+                                       g_variant_new ("(ub)",
+                                                      data->serial,
+                                                      processed),
+                                       NULL);
+    }
+}
+
+/**
+ * bus_input_context_reply_key_events:
+ *
+ * Set the bit of a key event in the bitmap of its "ProcessKeyEvents" call
+ * and answer the call with the bitmap after its last key event.
+ */
+static void
+bus_input_context_reply_key_events (ProcessKeyEventData *data)
+{
+    ProcessKeyEventsData *batch = data->batch;
+
+    if (data->value != NULL) {
+        if (ibus_process_key_event_reply_get (data->value))
+            batch->handled[data->index / 8] |= 1 << (data->index % 8);
+        g_variant_unref (data->value);
+    } else if (batch->error == NULL) {
+        batch->error = data->error;
+    } else {
+        g_error_free (data->error);
+    }
+    g_assert (batch->n_pending > 0);
+    if (--batch->n_pending > 0)
+        return;
+
+    if (batch->error == NULL) {
+        g_dbus_method_invocation_return_value (
+                batch->invocation,
+                ibus_process_key_events_reply_new (batch->handled,
+                                                   batch->n_keys));
+    } else {
+        g_dbus_method_invocation_return_gerror (batch->invocation,
+                                                batch->error);
+        g_error_free (batch->error);
+    }
+    g_free (batch->handled);
+    g_slice_free (ProcessKeyEventsData, batch);
+}
+
+/**
+ * bus_input_context_return_key_event:
+ *
+ * Answer a "ProcessKeyEvent" method call with @value or @error.
+ * The engine, the emoji extension or a hotkey can finish a key event
+ * before the earlier ones, so the reply is held back until all the key
+ * events received before it are answered. Clients can then send
+ * several key events without waiting and get the replies in order.
+ */
+static void
+bus_input_context_return_key_event (ProcessKeyEventData *data,
+                                    GVariant            *value,
+                                    GError              *error)
+{
+    BusInputContext *context = data->context;
+
+    g_assert (!data->done);
+    data->done = TRUE;
+    data->value = value ? g_variant_ref_sink (value) : NULL;
+    data->error = error;
+
+    g_object_ref (context);
+    while ((data = g_queue_peek_head (&context->pending_key_events)) != NULL &&
+           data->done) {
+        gint64 latency = g_get_monotonic_time () - data->received_time;
+        g_queue_pop_head (&context->pending_key_events);
+        bus_latency_histogram_record (&context->key_latency, latency);
+        if (data->traced && bus_trace_is_recording ()) {
+            gboolean handled = data->value != NULL &&
+                               ibus_process_key_event_reply_get (data->value);
+            bus_trace_record (BUS_TRACE_EVENT_KEY_REPLY, context->trace_id,
+                              handled, MIN (latency, G_MAXUINT32), 0, NULL);
+        }
+        if (latency >= BUS_STATS_SLOW_KEY_EVENT_USEC) {
+            IBusEngineDesc *desc = context->engine ?
+                    bus_engine_proxy_get_desc (context->engine) : NULL;
+            bus_stats_record_slow_key_event (
+                    context->client,
+                    desc ? ibus_engine_desc_get_name (desc) : NULL,
+                    latency);
+        }
+        if (data->batch != NULL) {
+            bus_input_context_reply_key_events (data);
+        } else if (data->invocation == NULL) {
+            bus_input_context_reply_key_channel (context, data);
+        } else if (data->value != NULL) {
+            g_dbus_method_invocation_return_value (data->invocation,
+                                                   data->value);
+            g_variant_unref (data->value);
+        } else {
+            g_dbus_method_invocation_return_gerror (data->invocation,
+                                                    data->error);
+            g_error_free (data->error);
+        }
+        if (g_queue_is_empty (&context->pending_key_events))
+            context->processing_key_event = FALSE;
+        g_object_unref (data->context);
+        g_slice_free (ProcessKeyEventData, data);
+    }
+    g_object_unref (context);
+}
 
 /**
  * _panel_process_key_event_cb:
@@ -953,40 +1297,47 @@ typedef struct _PanelProcessKeyEventData {
  * bus_panel_proxy_process_key_event() is finished.
  */
 static void
-_panel_process_key_event_cb (GObject                  *source,
-                             GAsyncResult             *res,
-                             PanelProcessKeyEventData *data)
+_panel_process_key_event_cb (GObject             *source,
+                             GAsyncResult        *res,
+                             ProcessKeyEventData *data)
 {
     GError *error = NULL;
     GVariant *value = g_dbus_proxy_call_finish ((GDBusProxy *)source,
                                                  res,
                                                  &error);
-    GDBusMethodInvocation *invocation;
-    BusInputContext *context;
 
     g_assert (data);
-    invocation = data->invocation;
-    context = data->context;
-    g_slice_free (PanelProcessKeyEventData, data);
-    if (value != NULL) {
-        g_dbus_method_invocation_return_value (invocation, value);
+    bus_input_context_return_key_event (data, value, error);
+    if (value != NULL)
         g_variant_unref (value);
-    }
-    else {
-        g_dbus_method_invocation_return_gerror (invocation, error);
-        g_error_free (error);
-    }
-    context->processing_key_event = FALSE;
 }
 
-typedef struct _ProcessKeyEventData ProcessKeyEventData;
-struct _ProcessKeyEventData {
-    GDBusMethodInvocation *invocation;
-    BusInputContext       *context;
-    guint keyval;
-    guint keycode;
-    guint modifiers;
-};
+/**
+ * bus_input_context_return_engine_key_event:
+ *
+ * Answer a key event which the engine processed, or pass it to the emoji
+ * extension if the engine did not handle it.
+ */
+static void
+bus_input_context_return_engine_key_event (BusInputContext     *context,
+                                           ProcessKeyEventData *data,
+                                           gboolean             retval)
+{
+    if (context->emoji_extension && !retval) {
+        bus_panel_proxy_process_key_event (context->emoji_extension,
+                                           data->keyval,
+                                           data->keycode,
+                                           data->modifiers,
+                                           (GAsyncReadyCallback)
+                                                _panel_process_key_event_cb,
+                                           data);
+    } else {
+        bus_input_context_return_key_event (
+                data,
+                ibus_process_key_event_reply (retval),
+                NULL);
+    }
+}
 
 /**
  * _ic_process_key_event_reply_cb:
@@ -999,45 +1350,143 @@ _ic_process_key_event_reply_cb (GObject               *source,
                                 GAsyncResult          *res,
                                 ProcessKeyEventData   *data)
 {
-    GDBusMethodInvocation *invocation = data->invocation;
     BusInputContext *context = data->context;
-    guint keyval = data->keyval;
-    guint keycode = data->keycode;
-    guint modifiers = data->modifiers;
     GError *error = NULL;
-    GVariant *value = g_dbus_proxy_call_finish ((GDBusProxy *)source,
-                                                 res,
-                                                 &error);
+    GVariant *value = bus_engine_proxy_process_key_event_finish (
+            (BusEngineProxy *)source,
+            res,
+            &error);
+
+    /* The engine has finished with the key event, so send the last state of
+     * the updates which were held back while it was being processed. */
+    if (context->coalescing_key_events > 0)
+        context->coalescing_key_events--;
+    bus_input_context_flush_engine_updates (context);
 
     if (value != NULL) {
-        gboolean retval = FALSE;
-        g_variant_get (value, "(b)", &retval);
-        if (context->emoji_extension && !retval) {
-            PanelProcessKeyEventData *pdata =
-                    g_slice_new (PanelProcessKeyEventData);
-            pdata->invocation = invocation;
-            pdata->context = context;
-            bus_panel_proxy_process_key_event (context->emoji_extension,
-                                               keyval,
-                                               keycode,
-                                               modifiers,
-                                               (GAsyncReadyCallback)
-                                                    _panel_process_key_event_cb,
-                                               pdata);
-        } else {
-            g_dbus_method_invocation_return_value (invocation, value);
-            context->processing_key_event = FALSE;
-        }
+        bus_input_context_return_engine_key_event (
+                context,
+                data,
+                ibus_process_key_event_reply_get (value));
         g_variant_unref (value);
     }
     else {
-        g_dbus_method_invocation_return_gerror (invocation, error);
-        g_error_free (error);
-        context->processing_key_event = FALSE;
+        bus_input_context_return_key_event (data, NULL, error);
     }
+}
 
-    g_object_unref (context);
-    g_slice_free (ProcessKeyEventData, data);
+/* consecutive key events of a "ProcessKeyEvents" call which are sent to
+ * the engine with one "ProcessKeyEvents" call */
+typedef struct _ProcessKeyEventsRun ProcessKeyEventsRun;
+struct _ProcessKeyEventsRun {
+    BusInputContext *context;
+    BusEngineProxy  *engine;
+    GPtrArray       *keys;
+    /* TRUE if the run set context->checking_process_key_events */
+    gboolean         checking;
+};
+
+static void
+process_key_events_run_free (ProcessKeyEventsRun *run)
+{
+    g_object_unref (run->context);
+    g_object_unref (run->engine);
+    g_ptr_array_free (run->keys, TRUE);
+    g_slice_free (ProcessKeyEventsRun, run);
+}
+
+/**
+ * bus_input_context_send_key_events_one_by_one:
+ *
+ * Send the key events of @run to its engine with "ProcessKeyEvent" calls.
+ */
+static void
+bus_input_context_send_key_events_one_by_one (ProcessKeyEventsRun *run)
+{
+    BusInputContext *context = run->context;
+    guint i;
+
+    for (i = 0; i < run->keys->len; i++) {
+        ProcessKeyEventData *data = g_ptr_array_index (run->keys, i);
+        if (g_coalesce_updates)
+            context->coalescing_key_events++;
+        bus_engine_proxy_process_key_event (
+                run->engine,
+                data->keyval,
+                data->keycode,
+                data->modifiers,
+                (GAsyncReadyCallback) _ic_process_key_event_reply_cb,
+                data);
+    }
+}
+
+/**
+ * _ic_process_key_events_reply_cb:
+ *
+ * A GAsyncReadyCallback function to be called when
+ * bus_engine_proxy_process_key_events() is finished.
+ */
+static void
+_ic_process_key_events_reply_cb (GObject             *source,
+                                 GAsyncResult        *res,
+                                 ProcessKeyEventsRun *run)
+{
+    BusInputContext *context = run->context;
+    const guint8 *handled = NULL;
+    GError *error = NULL;
+    GVariant *value = bus_engine_proxy_process_key_event_finish (
+            (BusEngineProxy *)source,
+            res,
+            &error);
+    guint i;
+
+    if (context->coalescing_key_events > 0)
+        context->coalescing_key_events--;
+    bus_input_context_flush_engine_updates (context);
+    if (run->checking)
+        context->checking_process_key_events = FALSE;
+
+    if (value != NULL) {
+        handled = ibus_process_key_events_reply_get (value, run->keys->len);
+        if (handled == NULL) {
+            g_set_error (&error,
+                         G_DBUS_ERROR,
+                         G_DBUS_ERROR_INVALID_ARGS,
+                         "The engine replied ProcessKeyEvents with %s.",
+                         g_variant_get_type_string (value));
+        }
+    } else if (g_error_matches (error,
+                                G_DBUS_ERROR,
+                                G_DBUS_ERROR_UNKNOWN_METHOD)) {
+        /* The engine is built with an older libibus, so send the key events
+         * one by one before the key events held back after them. */
+        g_clear_error (&error);
+        bus_input_context_send_key_events_one_by_one (run);
+        if (run->checking)
+            bus_input_context_send_held_key_events (context);
+        process_key_events_run_free (run);
+        return;
+    }
+
+    for (i = 0; i < run->keys->len; i++) {
+        ProcessKeyEventData *data = g_ptr_array_index (run->keys, i);
+        if (handled != NULL) {
+            bus_input_context_return_engine_key_event (
+                    context,
+                    data,
+                    (handled[i / 8] >> (i % 8)) & 1);
+        } else {
+            bus_input_context_return_key_event (data,
+                                                NULL,
+                                                g_error_copy (error));
+        }
+    }
+    g_clear_error (&error);
+    if (value != NULL)
+        g_variant_unref (value);
+    if (run->checking)
+        bus_input_context_send_held_key_events (context);
+    process_key_events_run_free (run);
 }
 
 static void
@@ -1046,111 +1495,607 @@ _forward_process_key_event_reply_cb (GObject               *source,
                                      ProcessKeyEventData   *data)
 {
     BusInputContext *context = data->context;
+    GError *error = NULL;
+    GVariant *value = bus_engine_proxy_process_key_event_finish (
+            (BusEngineProxy *)source,
+            res,
+            &error);
+    if (value != NULL)
+        g_variant_unref (value);
+    else
+        g_error_free (error);
+    g_object_unref (context);
+    g_slice_free (ProcessKeyEventData, data);
+}
+
+/**
+ * bus_input_context_filter_queued_key_event:
+ *
+ * Pass a key event from bus_input_context_queue_key_event() to the
+ * hotkeys. Returns %TRUE if the key event should go to context->engine,
+ * otherwise the key event is answered.
+ */
+static gboolean
+bus_input_context_filter_queued_key_event (BusInputContext     *context,
+                                           ProcessKeyEventData *data)
+{
+    guint keyval = data->keyval;
+    guint keycode = data->keycode;
+    guint modifiers = data->modifiers;
+
+    if (bus_ibus_impl_process_key_event (BUS_DEFAULT_IBUS,
+                                         keyval,
+                                         keycode,
+                                         modifiers)) {
+        /* If the shortcut key hits, it should return TRUE.
+         * Otherwise a space would be inserted into the active input-context
+         * by pressing Super-space.
+         */
+        bus_input_context_return_key_event (data,
+                                            ibus_process_key_event_reply (TRUE),
+                                            NULL);
+        return FALSE;
+    }
+    if (G_UNLIKELY (!context->has_focus)) {
+        /* workaround: set focus if context does not have focus */
+        BusInputContext *focused_context =
+                bus_ibus_impl_get_focused_input_context (BUS_DEFAULT_IBUS);
+        if (focused_context == NULL ||
+            focused_context->fake == TRUE ||
+            context->fake == FALSE) {
+            /* grab focus, if context is a real IC or current focused IC is
+             * fake */
+            bus_input_context_focus_in (context);
+        }
+    }
+
+    /* If I move the focus from the URL entry box of google-chrome
+     * to the text buffer of gnome-terminal,
+     * focus-in/focus-out of google-chrome is caused after
+     * focus-in of gonme-terminal and gnome-terminal loses the focus.
+     * The following focus events are received in ibusimcontext:
+     * 1) (gnome-terminal:445): IBUS-WARNING **: 15:32:36:717  focus_in
+     * 2) (google-chrome:495): IBUS-WARNING **: 15:32:36:866  focus_out
+     * 3) (google-chrome:495): IBUS-WARNING **: 15:32:36:875  focus_in
+     * 4) (google-chrome:495): IBUS-WARNING **: 15:32:36:890  focus_out
+     * In 2), Just return because focused_context is not google-chrome.
+     * In 3), focused_context is changed from gnome-terminal to google-chrome
+     * In 4), focused_context is changed from google-chrome to faked_context.
+     *
+     * It seems google-chrome has a popup window of the prediction of URL
+     * and async focus-in/focus-out.
+     */
+    if (context->has_focus && context->engine == NULL &&
+        context->fake == FALSE) {
+        BusInputContext *focused_context =
+                bus_ibus_impl_get_focused_input_context (BUS_DEFAULT_IBUS);
+
+        if (focused_context != NULL && context != focused_context &&
+            (context->capabilities & IBUS_CAP_FOCUS) != 0) {
+            context->has_focus = FALSE;
+            bus_input_context_focus_in (context);
+        }
+    }
+
+    /* ignore key events, if it is a fake input context */
+    if (context->has_focus && context->engine && context->fake == FALSE)
+        return TRUE;
+
+    bus_input_context_return_key_event (data,
+                                        ibus_process_key_event_reply (FALSE),
+                                        NULL);
+    return FALSE;
+}
+
+/**
+ * bus_input_context_process_queued_key_event:
+ *
+ * Pass a key event from bus_input_context_queue_key_event() to the
+ * hotkeys and the engine.
+ */
+static void
+bus_input_context_process_queued_key_event (BusInputContext     *context,
+                                            ProcessKeyEventData *data)
+{
+    if (!bus_input_context_filter_queued_key_event (context, data))
+        return;
+
+    if (context->checking_process_key_events) {
+        g_queue_push_tail (&context->held_key_events, data);
+        return;
+    }
+    if (g_coalesce_updates)
+        context->coalescing_key_events++;
+    bus_engine_proxy_process_key_event (context->engine,
+                                        data->keyval,
+                                        data->keycode,
+                                        data->modifiers,
+                                        (GAsyncReadyCallback)
+                                            _ic_process_key_event_reply_cb,
+                                        data);
+}
+
+/**
+ * bus_input_context_send_key_events_run:
+ *
+ * Send the key events of @run to its engine. A single key event, and the
+ * key events for an engine which does not know "ProcessKeyEvents", are
+ * sent with "ProcessKeyEvent". The run waits in context->held_key_events
+ * while the engine is checked for "ProcessKeyEvents".
+ */
+static void
+bus_input_context_send_key_events_run (ProcessKeyEventsRun *run)
+{
+    BusInputContext *context = run->context;
+    IBusProcessKeyEventData *keys;
+    gboolean checked = FALSE;
+    guint i;
+
+    if (context->checking_process_key_events) {
+        for (i = 0; i < run->keys->len; i++) {
+            g_queue_push_tail (&context->held_key_events,
+                               g_ptr_array_index (run->keys, i));
+        }
+        process_key_events_run_free (run);
+        return;
+    }
+
+    if (run->keys->len == 1 ||
+        !bus_engine_proxy_has_process_key_events (run->engine, &checked)) {
+        bus_input_context_send_key_events_one_by_one (run);
+        process_key_events_run_free (run);
+        return;
+    }
+    if (!checked) {
+        run->checking = TRUE;
+        context->checking_process_key_events = TRUE;
+    }
+
+    keys = g_new (IBusProcessKeyEventData, run->keys->len);
+    for (i = 0; i < run->keys->len; i++) {
+        ProcessKeyEventData *data = g_ptr_array_index (run->keys, i);
+        keys[i].keyval = data->keyval;
+        keys[i].keycode = data->keycode;
+        keys[i].state = data->modifiers;
+    }
+    if (g_coalesce_updates)
+        context->coalescing_key_events++;
+    bus_engine_proxy_process_key_events (run->engine,
+                                         keys,
+                                         run->keys->len,
+                                         (GAsyncReadyCallback)
+                                             _ic_process_key_events_reply_cb,
+                                         run);
+    g_free (keys);
+}
+
+/**
+ * bus_input_context_send_held_key_events:
+ *
+ * Send the key events which waited in context->held_key_events to
+ * context->engine after the engine was checked for "ProcessKeyEvents".
+ */
+static void
+bus_input_context_send_held_key_events (BusInputContext *context)
+{
+    ProcessKeyEventsRun *run;
+    ProcessKeyEventData *data;
+
+    if (g_queue_is_empty (&context->held_key_events))
+        return;
+
+    if (context->engine == NULL) {
+        while ((data = g_queue_pop_head (&context->held_key_events)) != NULL) {
+            bus_input_context_return_key_event (
+                    data,
+                    ibus_process_key_event_reply (FALSE),
+                    NULL);
+        }
+        return;
+    }
+
+    run = g_slice_new0 (ProcessKeyEventsRun);
+    run->context = g_object_ref (context);
+    run->engine = g_object_ref (context->engine);
+    run->keys = g_ptr_array_new ();
+    while ((data = g_queue_pop_head (&context->held_key_events)) != NULL)
+        g_ptr_array_add (run->keys, data);
+    bus_input_context_send_key_events_run (run);
+}
+
+/**
+ * _ic_process_key_event:
+ *
+ * Implement the "ProcessKeyEvent" method call of the
+ * org.freedesktop.IBus.InputContext interface.
+ */
+static void
+_ic_process_key_event (BusInputContext       *context,
+                       GVariant              *parameters,
+                       GDBusMethodInvocation *invocation)
+{
+    guint keyval = IBUS_KEY_VoidSymbol;
+    guint keycode = 0;
+    guint modifiers = 0;
+    ProcessKeyEventData *data;
+
+    if (context->use_post_process_key_event)
+        context->processing_key_event = TRUE;
+    ibus_process_key_event_args_get (parameters,
+                                     &keyval, &keycode, &modifiers);
+    data = bus_input_context_queue_key_event (context,
+                                              invocation,
+                                              keyval,
+                                              keycode,
+                                              modifiers);
+    bus_input_context_process_queued_key_event (context, data);
+}
+
+/**
+ * _ic_process_key_events:
+ *
+ * Implement the "ProcessKeyEvents" method call of the
+ * org.freedesktop.IBus.InputContext interface.
+ * The key events go through the hotkeys one by one like "ProcessKeyEvent"
+ * and the runs of them between the hotkeys are sent to the engine with
+ * one call.
+ */
+static void
+_ic_process_key_events (BusInputContext       *context,
+                        GVariant              *parameters,
+                        GDBusMethodInvocation *invocation)
+{
+    const IBusProcessKeyEventData *keys;
+    ProcessKeyEventsData *batch;
+    ProcessKeyEventsRun *run = NULL;
+    gsize n_keys = 0;
+    gsize i;
+
+    keys = ibus_process_key_events_args_get (parameters, &n_keys);
+    if (n_keys == 0) {
+        g_dbus_method_invocation_return_value (
+                invocation,
+                ibus_process_key_events_reply_new (NULL, 0));
+        return;
+    }
+
+    if (context->use_post_process_key_event)
+        context->processing_key_event = TRUE;
+    batch = g_slice_new0 (ProcessKeyEventsData);
+    batch->invocation = invocation;
+    batch->n_keys = n_keys;
+    batch->n_pending = n_keys;
+    batch->handled = g_new0 (guint8, (n_keys + 7) / 8);
+
+    g_object_ref (context);
+    for (i = 0; i < n_keys; i++) {
+        ProcessKeyEventData *data =
+                bus_input_context_queue_key_event (context,
+                                                   NULL,
+                                                   keys[i].keyval,
+                                                   keys[i].keycode,
+                                                   keys[i].state);
+        data->batch = batch;
+        data->index = i;
+        /* the engine gets the earlier key events before the filter runs a
+         * hotkey action or moves the focus. */
+        if (run != NULL &&
+            (!context->has_focus ||
+             bus_ibus_impl_is_hotkey_event (BUS_DEFAULT_IBUS,
+                                            keys[i].keyval,
+                                            keys[i].state))) {
+            bus_input_context_send_key_events_run (run);
+            run = NULL;
+        }
+        if (!bus_input_context_filter_queued_key_event (context, data)) {
+            /* keep the order of the engine calls and the hotkey actions */
+            if (run != NULL)
+                bus_input_context_send_key_events_run (run);
+            run = NULL;
+            continue;
+        }
+        if (run != NULL && run->engine != context->engine) {
+            bus_input_context_send_key_events_run (run);
+            run = NULL;
+        }
+        if (run == NULL) {
+            run = g_slice_new0 (ProcessKeyEventsRun);
+            run->context = g_object_ref (context);
+            run->engine = g_object_ref (context->engine);
+            run->keys = g_ptr_array_new ();
+        }
+        g_ptr_array_add (run->keys, data);
+    }
+    if (run != NULL)
+        bus_input_context_send_key_events_run (run);
+    g_object_unref (context);
+}
+
+/**
+ * _key_channel_cb:
+ *
+ * A GUnixFDSourceFunc to be called when the client pushes key events to
+ * context->key_channel.
+ */
+static gboolean
+_key_channel_cb (gint             fd,
+                 GIOCondition     condition,
+                 BusInputContext *context)
+{
+    guint32 keyval, keycode, state, serial;
+    guint n_keys;
+
+    if (condition & (G_IO_ERR | G_IO_HUP)) {
+        context->key_channel_source_id = 0;
+        g_clear_pointer (&context->key_channel, ibus_key_channel_free);
+        return G_SOURCE_REMOVE;
+    }
+
+    ibus_key_channel_acknowledge (context->key_channel, TRUE);
+    g_object_ref (context);
+    /* the client can push keys as fast as they are popped. Leave the rest
+     * to the next wake-up so that the other sources can run. */
+    for (n_keys = 0; context->key_channel != NULL; n_keys++) {
+        ProcessKeyEventData *data;
+
+        if (n_keys == IBUS_KEY_CHANNEL_N_SLOTS) {
+            ibus_key_channel_wake_up (context->key_channel, TRUE);
+            break;
+        }
+        if (!ibus_key_channel_pop_key (context->key_channel,
+                                       &keyval, &keycode, &state, &serial)) {
+            break;
+        }
+        data = bus_input_context_queue_key_event (context,
+                                                  NULL,
+                                                  keyval,
+                                                  keycode,
+                                                  state);
+        data->serial = serial;
+        bus_input_context_process_queued_key_event (context, data);
+    }
+    g_object_unref (context);
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+bus_input_context_close_key_channel (BusInputContext *context)
+{
+    if (context->key_channel_source_id != 0) {
+        g_source_remove (context->key_channel_source_id);
+        context->key_channel_source_id = 0;
+    }
+    g_clear_pointer (&context->key_channel, ibus_key_channel_free);
+}
+
+/**
+ * _ic_open_key_channel:
+ *
+ * Implement the "OpenKeyChannel" method call of the
+ * org.freedesktop.IBus.InputContext interface.
+ */
+static void
+_ic_open_key_channel (BusInputContext       *context,
+                      GVariant              *parameters,
+                      GDBusMethodInvocation *invocation)
+{
+    GUnixFDList *fd_list = g_dbus_message_get_unix_fd_list (
+            g_dbus_method_invocation_get_message (invocation));
+    gint32 handles[3] = { -1, -1, -1 };
+    gint fds[3] = { -1, -1, -1 };
+    GError *error = NULL;
+    gint i;
+
+    if (context->fake || fd_list == NULL) {
+        g_dbus_method_invocation_return_error (
+                invocation,
+                G_DBUS_ERROR,
+                G_DBUS_ERROR_INVALID_ARGS,
+                "The key channel needs file descriptors.");
+        return;
+    }
+
+    g_variant_get (parameters, "(hhh)", &handles[0], &handles[1], &handles[2]);
+    for (i = 0; i < G_N_ELEMENTS (fds); i++) {
+        fds[i] = g_unix_fd_list_get (fd_list, handles[i], &error);
+        if (fds[i] < 0) {
+            while (--i >= 0)
+                close (fds[i]);
+            g_dbus_method_invocation_return_gerror (invocation, error);
+            g_error_free (error);
+            return;
+        }
+    }
+
+    bus_input_context_close_key_channel (context);
+    context->key_channel = ibus_key_channel_new_from_fds (fds[0],
+                                                          fds[1],
+                                                          fds[2],
+                                                          &error);
+    if (context->key_channel == NULL) {
+        g_dbus_method_invocation_return_gerror (invocation, error);
+        g_error_free (error);
+        return;
+    }
+    context->key_channel_source_id =
+            g_unix_fd_add (fds[1],
+                           G_IO_IN | G_IO_ERR | G_IO_HUP,
+                           (GUnixFDSourceFunc) _key_channel_cb,
+                           context);
+    g_dbus_method_invocation_return_value (invocation, NULL);
+}
+
+typedef struct _OpenEngineLinkData OpenEngineLinkData;
+struct _OpenEngineLinkData {
+    BusInputContext       *context;
+    BusEngineProxy        *engine;
+    GDBusMethodInvocation *invocation;
+    gint                   fd;
+};
+
+static void
+_engine_link_closed_cb (GObject         *source,
+                        GAsyncResult    *res,
+                        BusInputContext *context)
+{
     GError *error = NULL;
     GVariant *value = g_dbus_proxy_call_finish ((GDBusProxy *)source,
                                                  res,
                                                  &error);
-    if (value != NULL)
-        g_variant_unref (value);
-    else
+
+    if (value != NULL)
+        g_variant_unref (value);
+    else
+        g_error_free (error);
+
+    /* The engine sent the signals for the peer before the reply, so
+     * ibus-daemon relays the signals from here on. */
+    if (context->engine_link_fd >= 0) {
+        shutdown (context->engine_link_fd, SHUT_RDWR);
+        close (context->engine_link_fd);
+        context->engine_link_fd = -1;
+    }
+    g_clear_object (&context->engine_link);
+    context->engine_link_closing = FALSE;
+    /* the client applied preedit updates which ibus-daemon did not send. */
+    g_clear_object (&context->client_preedit_text);
+    g_object_unref (context);
+}
+
+void
+bus_input_context_close_engine_link (BusInputContext *context)
+{
+    g_assert (BUS_IS_INPUT_CONTEXT (context));
+
+    if (context->engine_link == NULL || context->engine_link_closing)
+        return;
+    context->engine_link_closing = TRUE;
+    bus_engine_proxy_close_peer_connection (
+            context->engine_link,
+            (GAsyncReadyCallback) _engine_link_closed_cb,
+            g_object_ref (context));
+}
+
+static void
+_engine_link_opened_cb (BusEngineProxy     *engine,
+                        GAsyncResult       *res,
+                        OpenEngineLinkData *data)
+{
+    BusInputContext *context = data->context;
+    const IBusProcessKeyEventData *keys;
+    const gchar *keymap;
+    GVariantBuilder builder;
+    GUnixFDList *fd_list;
+    GError *error = NULL;
+    GVariant *value = g_dbus_proxy_call_finish ((GDBusProxy *)engine,
+                                                 res,
+                                                 &error);
+
+    if (value == NULL) {
+        close (data->fd);
+        g_dbus_method_invocation_return_gerror (data->invocation, error);
         g_error_free (error);
-    g_object_unref (context);
-    g_slice_free (ProcessKeyEventData, data);
+        goto out;
+    }
+    g_variant_unref (value);
+
+    if (context->engine != engine || context->engine_link != NULL ||
+        !ENGINE_LINK_CONDITION) {
+        /* the context changed while the engine opened the connection. */
+        bus_engine_proxy_close_peer_connection (engine, NULL, NULL);
+        close (data->fd);
+        g_dbus_method_invocation_return_error (
+                data->invocation,
+                G_DBUS_ERROR,
+                G_DBUS_ERROR_NOT_SUPPORTED,
+                "The input context changed.");
+        goto out;
+    }
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(uu)"));
+    keys = bus_ibus_impl_get_ime_switcher_keys (BUS_DEFAULT_IBUS);
+    for (; keys && keys->keyval; keys++)
+        g_variant_builder_add (&builder, "(uu)", keys->keyval, keys->state);
+    keymap = bus_engine_proxy_get_keymap_name (engine);
+
+    fd_list = g_unix_fd_list_new ();
+    if (g_unix_fd_list_append (fd_list, data->fd, &error) < 0) {
+        g_variant_builder_clear (&builder);
+        bus_engine_proxy_close_peer_connection (engine, NULL, NULL);
+        close (data->fd);
+        g_dbus_method_invocation_return_gerror (data->invocation, error);
+        g_error_free (error);
+        g_object_unref (fd_list);
+        goto out;
+    }
+    context->engine_link = g_object_ref (engine);
+    context->engine_link_fd = data->fd;
+    g_dbus_method_invocation_return_value_with_unix_fd_list (
+            data->invocation,
+            g_variant_new ("(hosa(uu))",
+                           0,
+                           g_dbus_proxy_get_object_path ((GDBusProxy *)engine),
+                           keymap ? keymap : "",
+                           &builder),
+            fd_list);
+    g_object_unref (fd_list);
+
+out:
+    g_object_unref (data->engine);
+    g_object_unref (data->context);
+    g_slice_free (OpenEngineLinkData, data);
 }
 
 /**
- * _ic_process_key_event:
+ * _ic_open_engine_link:
  *
- * Implement the "ProcessKeyEvent" method call of the
- * org.freedesktop.IBus.InputContext interface.
+ * Implement the "OpenEngineLink" method call of the
+ * org.freedesktop.IBus.InputContext interface. ibus-daemon gives the
+ * engine and the client the ends of a socket pair, so that the client
+ * sends key events to the engine without a hop through ibus-daemon.
+ * ibus-daemon still handles the focus, the shortcut keys and the engine
+ * switching and closes the link when one of them needs it.
  */
 static void
-_ic_process_key_event (BusInputContext       *context,
-                       GVariant              *parameters,
-                       GDBusMethodInvocation *invocation)
+_ic_open_engine_link (BusInputContext       *context,
+                      GVariant              *parameters,
+                      GDBusMethodInvocation *invocation)
 {
-    guint keyval = IBUS_KEY_VoidSymbol;
-    guint keycode = 0;
-    guint modifiers = 0;
+    OpenEngineLinkData *data;
+    gchar *guid;
+    gint fds[2];
 
-    if (context->use_post_process_key_event)
-        context->processing_key_event = TRUE;
-    g_variant_get (parameters, "(uuu)", &keyval, &keycode, &modifiers);
-    if (bus_ibus_impl_process_key_event (BUS_DEFAULT_IBUS,
-                                         keyval,
-                                         keycode,
-                                         modifiers)) {
-        /* If the shortcut key hits, it should return TRUE.
-         * Otherwise a space would be inserted into the active input-context
-         * by pressing Super-space.
-         */
-        g_dbus_method_invocation_return_value (invocation,
-                                               g_variant_new ("(b)", TRUE));
-        context->processing_key_event = FALSE;
+    if (context->engine_link != NULL || !ENGINE_LINK_CONDITION) {
+        g_dbus_method_invocation_return_error (
+                invocation,
+                G_DBUS_ERROR,
+                G_DBUS_ERROR_NOT_SUPPORTED,
+                "The input context cannot link the engine now.");
         return;
     }
-    if (G_UNLIKELY (!context->has_focus)) {
-        /* workaround: set focus if context does not have focus */
-        BusInputContext *focused_context =
-                bus_ibus_impl_get_focused_input_context (BUS_DEFAULT_IBUS);
-        if (focused_context == NULL ||
-            focused_context->fake == TRUE ||
-            context->fake == FALSE) {
-            /* grab focus, if context is a real IC or current focused IC is
-             * fake */
-            bus_input_context_focus_in (context);
-        }
-    }
-
-    /* If I move the focus from the URL entry box of google-chrome
-     * to the text buffer of gnome-terminal,
-     * focus-in/focus-out of google-chrome is caused after
-     * focus-in of gonme-terminal and gnome-terminal loses the focus.
-     * The following focus events are received in ibusimcontext:
-     * 1) (gnome-terminal:445): IBUS-WARNING **: 15:32:36:717  focus_in
-     * 2) (google-chrome:495): IBUS-WARNING **: 15:32:36:866  focus_out
-     * 3) (google-chrome:495): IBUS-WARNING **: 15:32:36:875  focus_in
-     * 4) (google-chrome:495): IBUS-WARNING **: 15:32:36:890  focus_out
-     * In 2), Just return because focused_context is not google-chrome.
-     * In 3), focused_context is changed from gnome-terminal to google-chrome
-     * In 4), focused_context is changed from google-chrome to faked_context.
-     *
-     * It seems google-chrome has a popup window of the prediction of URL
-     * and async focus-in/focus-out.
-     */
-    if (context->has_focus && context->engine == NULL &&
-        context->fake == FALSE) {
-        BusInputContext *focused_context =
-                bus_ibus_impl_get_focused_input_context (BUS_DEFAULT_IBUS);
-
-        if (focused_context != NULL && context != focused_context &&
-            (context->capabilities & IBUS_CAP_FOCUS) != 0) {
-            context->has_focus = FALSE;
-            bus_input_context_focus_in (context);
-        }
+    if (socketpair (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+        int errsv = errno;
+        g_dbus_method_invocation_return_error (
+                invocation,
+                G_IO_ERROR,
+                g_io_error_from_errno (errsv),
+                "socketpair: %s", g_strerror (errsv));
+        return;
     }
 
-    /* ignore key events, if it is a fake input context */
-    if (context->has_focus && context->engine && context->fake == FALSE) {
-        ProcessKeyEventData *data = g_slice_new0 (ProcessKeyEventData);
-        data->invocation = invocation;
-        data->context = g_object_ref (context);
-        data->keyval = keyval;
-        data->keycode = keycode;
-        data->modifiers = modifiers;
-        bus_engine_proxy_process_key_event (context->engine,
-                                            keyval,
-                                            keycode,
-                                            modifiers,
-                                            (GAsyncReadyCallback)
-                                                _ic_process_key_event_reply_cb,
-                                            data);
-    }
-    else {
-        g_dbus_method_invocation_return_value (invocation,
-                                               g_variant_new ("(b)", FALSE));
-        context->processing_key_event = FALSE;
-    }
+    data = g_slice_new0 (OpenEngineLinkData);
+    data->context = g_object_ref (context);
+    data->engine = g_object_ref (context->engine);
+    data->invocation = invocation;
+    data->fd = fds[1];
+    guid = g_dbus_generate_guid ();
+    bus_engine_proxy_open_peer_connection (
+            context->engine,
+            fds[0],
+            guid,
+            (GAsyncReadyCallback) _engine_link_opened_cb,
+            data);
+    g_free (guid);
 }
 
 /**
@@ -1481,6 +2426,38 @@ _ic_get_engine (BusInputContext       *context,
                                    (IBusSerializable *)desc)));
 }
 
+/**
+ * bus_input_context_set_surrounding_text:
+ *
+ * Cache the surrounding text of the client and pass it to the engine.
+ */
+static void
+bus_input_context_set_surrounding_text (BusInputContext *context,
+                                        IBusText        *text,
+                                        guint            cursor_pos,
+                                        guint            anchor_pos)
+{
+    g_object_ref_sink (text);
+    if (!TRACE_PRIVATE_CONDITION) {
+        bus_trace_record (BUS_TRACE_EVENT_SURROUNDING_TEXT, context->trace_id,
+                          cursor_pos, anchor_pos, 0,
+                          ibus_text_get_text (text));
+    }
+    if (context->surrounding_text)
+        g_object_unref (context->surrounding_text);
+    context->surrounding_text = text;
+    context->surrounding_cursor_pos = cursor_pos;
+    context->selection_anchor_pos = anchor_pos;
+
+    if ((context->capabilities & IBUS_CAP_SURROUNDING_TEXT) &&
+         context->has_focus && context->engine) {
+        bus_engine_proxy_set_surrounding_text (context->engine,
+                                               text,
+                                               cursor_pos,
+                                               anchor_pos);
+    }
+}
+
 static void
 _ic_set_surrounding_text (BusInputContext       *context,
                           GVariant              *parameters,
@@ -1499,20 +2476,66 @@ _ic_set_surrounding_text (BusInputContext       *context,
     text = IBUS_TEXT (ibus_serializable_deserialize (variant));
     g_variant_unref (variant);
 
-    if ((context->capabilities & IBUS_CAP_SURROUNDING_TEXT) &&
-         context->has_focus && context->engine) {
-        bus_engine_proxy_set_surrounding_text (context->engine,
-                                               text,
-                                               cursor_pos,
-                                               anchor_pos);
-    }
-
-    if (g_object_is_floating (text))
-        g_object_unref (text);
+    context->surrounding_revision = 0;
+    bus_input_context_set_surrounding_text (context,
+                                            text,
+                                            cursor_pos,
+                                            anchor_pos);
 
     g_dbus_method_invocation_return_value (invocation, NULL);
 }
 
+/**
+ * _ic_set_surrounding_text_delta:
+ *
+ * Implement the "SetSurroundingTextDelta" method call of the
+ * org.freedesktop.IBus.InputContext interface. The delta is applied only if
+ * it is based on the current revision of the cached surrounding text,
+ * otherwise %FALSE is returned and the client sends the whole text with
+ * "SetSurroundingText".
+ */
+static void
+_ic_set_surrounding_text_delta (BusInputContext       *context,
+                                GVariant              *parameters,
+                                GDBusMethodInvocation *invocation)
+{
+    IBusText *text = NULL;
+    const gchar *inserted = NULL;
+    guint revision = 0;
+    guint offset = 0;
+    guint n_deleted = 0;
+    guint cursor_pos = 0;
+    guint anchor_pos = 0;
+
+    g_variant_get (parameters,
+                   "(uuu&suu)",
+                   &revision,
+                   &offset,
+                   &n_deleted,
+                   &inserted,
+                   &cursor_pos,
+                   &anchor_pos);
+
+    if (context->surrounding_text != NULL &&
+        revision == context->surrounding_revision) {
+        text = ibus_text_new_from_splice (context->surrounding_text,
+                                          offset,
+                                          n_deleted,
+                                          inserted);
+    }
+    if (text != NULL) {
+        context->surrounding_revision++;
+        bus_input_context_set_surrounding_text (context,
+                                                text,
+                                                cursor_pos,
+                                                anchor_pos);
+    }
+
+    g_dbus_method_invocation_return_value (invocation,
+                                           g_variant_new ("(b)",
+                                                          text != NULL));
+}
+
 /*
  * Since IBusService is inherited by IBusImpl, this method cannot be
  * applied to IBusServiceClass.method_call() directly but can be in
@@ -1527,6 +2550,43 @@ bus_input_context_service_authorized_method (IBusService     *service,
     return FALSE;
 }
 
+/* all methods in the xml definition above should be listed here. */
+static const struct {
+    const gchar *method_name;
+    void (* method_callback) (BusInputContext *,
+                              GVariant *,
+                              GDBusMethodInvocation *);
+} methods [] =  {
+    { "ProcessKeyEvent",   _ic_process_key_event },
+    { "ProcessKeyEvents",  _ic_process_key_events },
+    { "SetCursorLocation", _ic_set_cursor_location },
+    { "SetCursorLocationRelative", _ic_set_cursor_location_relative },
+    { "ProcessHandWritingEvent",
+                           _ic_process_hand_writing_event },
+    { "CancelHandWriting", _ic_cancel_hand_writing },
+    { "FocusIn",           _ic_focus_in },
+    { "FocusOut",          _ic_focus_out },
+    { "Reset",             _ic_reset },
+    { "SetCapabilities",   _ic_set_capabilities },
+    { "PropertyActivate",  _ic_property_activate },
+    { "SetEngine",         _ic_set_engine },
+    { "GetEngine",         _ic_get_engine },
+    { "SetSurroundingText", _ic_set_surrounding_text },
+    { "SetSurroundingTextDelta", _ic_set_surrounding_text_delta },
+    { "OpenKeyChannel",    _ic_open_key_channel },
+    { "OpenEngineLink",    _ic_open_engine_link }
+};
+
+static IBusServiceMethodTable *
+bus_input_context_new_method_table (IBusServiceClass *class)
+{
+    return ibus_service_method_table_new (class,
+                                          IBUS_INTERFACE_INPUT_CONTEXT,
+                                          &methods[0].method_name,
+                                          G_N_ELEMENTS (methods),
+                                          sizeof (methods[0]));
+}
+
 /**
  * bus_input_context_service_method_call:
  *
@@ -1543,7 +2603,9 @@ bus_input_context_service_method_call (IBusService            *service,
                                        GVariant               *parameters,
                                        GDBusMethodInvocation  *invocation)
 {
-    if (g_strcmp0 (interface_name, IBUS_INTERFACE_INPUT_CONTEXT) != 0) {
+    gint i = ibus_service_method_table_lookup (context_methods, invocation);
+
+    if (i < 0) {
         IBUS_SERVICE_CLASS (bus_input_context_parent_class)->
                 service_method_call (service,
                                      connection,
@@ -1556,43 +2618,12 @@ bus_input_context_service_method_call (IBusService            *service,
         return;
     }
 
-    static const struct {
-        const gchar *method_name;
-        void (* method_callback) (BusInputContext *,
-                                  GVariant *,
-                                  GDBusMethodInvocation *);
-    } methods [] =  {
-        { "ProcessKeyEvent",   _ic_process_key_event },
-        { "SetCursorLocation", _ic_set_cursor_location },
-        { "SetCursorLocationRelative", _ic_set_cursor_location_relative },
-        { "ProcessHandWritingEvent",
-                               _ic_process_hand_writing_event },
-        { "CancelHandWriting", _ic_cancel_hand_writing },
-        { "FocusIn",           _ic_focus_in },
-        { "FocusOut",          _ic_focus_out },
-        { "Reset",             _ic_reset },
-        { "SetCapabilities",   _ic_set_capabilities },
-        { "PropertyActivate",  _ic_property_activate },
-        { "SetEngine",         _ic_set_engine },
-        { "GetEngine",         _ic_get_engine },
-        { "SetSurroundingText", _ic_set_surrounding_text }
-    };
-
-    gint i;
-
     if (!bus_input_context_service_authorized_method (service, connection))
         return;
 
-    for (i = 0; i < G_N_ELEMENTS (methods); i++) {
-        if (g_strcmp0 (method_name, methods[i].method_name) == 0) {
-            methods[i].method_callback ((BusInputContext *)service,
-                                        parameters,
-                                        invocation);
-            return;
-        }
-    }
-
-    g_return_if_reached ();
+    methods[i].method_callback ((BusInputContext *)service,
+                                parameters,
+                                invocation);
 }
 
 /**
@@ -1729,6 +2760,8 @@ _ic_set_client_commit_preedit (BusInputContext *context,
                                GError         **error)
 {
     g_variant_get (value, "(b)", &context->client_commit_preedit);
+    if (context->client_commit_preedit)
+        bus_input_context_close_engine_link (context);
     return TRUE;
 }
 
@@ -1738,6 +2771,8 @@ _ic_set_use_post_process_key_event (BusInputContext *context,
                                     GError         **error)
 {
     g_variant_get (value, "(b)", &context->use_post_process_key_event);
+    if (context->use_post_process_key_event)
+        bus_input_context_close_engine_link (context);
     return TRUE;
 }
 
@@ -1892,6 +2927,8 @@ bus_input_context_focus_in (BusInputContext *context)
         return;
 
     context->has_focus = TRUE;
+    bus_trace_record (BUS_TRACE_EVENT_FOCUS_IN, context->trace_id,
+                      0, 0, 0, NULL);
 
     /* To make sure that we won't use an old value left before we losing focus
      * last time. */
@@ -1999,6 +3036,14 @@ bus_input_context_focus_out (BusInputContext *context)
     if (!context->has_focus)
         return;
 
+    bus_trace_record (BUS_TRACE_EVENT_FOCUS_OUT, context->trace_id,
+                      0, 0, 0, NULL);
+    /* the preedit text committed or cleared below is the latest one of the
+     * engine. */
+    bus_input_context_flush_engine_updates (context);
+    /* the engine replies to ClosePeerConnection before FocusOut. */
+    bus_input_context_close_engine_link (context);
+
     if (context->client_commit_preedit)
         bus_input_context_clear_preedit_text (context, FALSE);
     else
@@ -2560,6 +3605,80 @@ bus_input_context_update_property (BusInputContext *context,
     }
 }
 
+/**
+ * bus_input_context_clear_engine_updates:
+ *
+ * Drop the engine updates held back by the coalescing stage without sending
+ * them. Only for a context being destroyed; otherwise flush them with
+ * bus_input_context_flush_engine_updates() so that a following
+ * clear_preedit_text() commits the latest preedit text.
+ */
+static void
+bus_input_context_clear_engine_updates (BusInputContext *context)
+{
+    g_clear_object (&context->coalesced_preedit_text);
+    g_clear_object (&context->coalesced_auxiliary_text);
+    g_clear_object (&context->coalesced_lookup_table);
+    context->coalesced_updates = 0;
+}
+
+/**
+ * bus_input_context_flush_engine_updates:
+ *
+ * Send the last preedit text, auxiliary text and lookup table held back by
+ * the coalescing stage. While a ProcessKeyEvent call is in flight and the
+ * daemon runs with --coalesce-updates, an update of the same kind supersedes
+ * the previous one, so the client and the panel receive at most one update
+ * per kind for a key event. Any other engine signal flushes the held updates
+ * first to keep the order seen by the client.
+ */
+static void
+bus_input_context_flush_engine_updates (BusInputContext *context)
+{
+    guint updates = context->coalesced_updates;
+    IBusText *preedit_text = context->coalesced_preedit_text;
+    IBusText *auxiliary_text = context->coalesced_auxiliary_text;
+    IBusLookupTable *lookup_table = context->coalesced_lookup_table;
+
+    if (updates == 0)
+        return;
+
+    context->coalesced_updates = 0;
+    context->coalesced_preedit_text = NULL;
+    context->coalesced_auxiliary_text = NULL;
+    context->coalesced_lookup_table = NULL;
+
+    if (updates & COALESCED_PREEDIT_TEXT) {
+        bus_input_context_update_preedit_text (
+                context,
+                preedit_text,
+                context->coalesced_preedit_cursor_pos,
+                context->coalesced_preedit_visible,
+                context->coalesced_preedit_mode,
+                TRUE);
+    }
+    if (updates & COALESCED_AUXILIARY_TEXT) {
+        bus_input_context_update_auxiliary_text (
+                context,
+                auxiliary_text,
+                context->coalesced_auxiliary_visible);
+    }
+    if (updates & COALESCED_LOOKUP_TABLE) {
+        bus_input_context_update_lookup_table (
+                context,
+                lookup_table,
+                context->coalesced_lookup_table_visible,
+                FALSE);
+    }
+
+    if (preedit_text)
+        g_object_unref (preedit_text);
+    if (auxiliary_text)
+        g_object_unref (auxiliary_text);
+    if (lookup_table)
+        g_object_unref (lookup_table);
+}
+
 /**
  * _engine_destroy_cb:
  *
@@ -2578,6 +3697,15 @@ _engine_destroy_cb (BusEngineProxy  *engine,
     bus_input_context_set_engine (context, NULL);
 }
 
+/* %TRUE if @engine sends its signals for the client over the peer
+ * connection of OpenEngineLink, so ibus-daemon only keeps the state. */
+static gboolean
+bus_input_context_is_engine_linked (BusInputContext *context,
+                                    BusEngineProxy  *engine)
+{
+    return context->engine_link != NULL && context->engine_link == engine;
+}
+
 /**
  * _engine_commit_text_cb:
  *
@@ -2595,6 +3723,9 @@ _engine_commit_text_cb (BusEngineProxy  *engine,
 
     g_assert (context->engine == engine);
 
+    bus_input_context_flush_engine_updates (context);
+    if (bus_input_context_is_engine_linked (context, engine))
+        return;
     bus_input_context_commit_text (context, text);
 }
 
@@ -2618,6 +3749,9 @@ _engine_forward_key_event_cb (BusEngineProxy    *engine,
     g_assert (context->engine == engine);
     g_assert (context->queue_during_process_key_event);
 
+    bus_input_context_flush_engine_updates (context);
+    if (bus_input_context_is_engine_linked (context, engine))
+        return;
     pre_data.u.uints[0] = keyval;
     pre_data.u.uints[1] = keycode;
     pre_data.u.uints[2] = state;
@@ -2648,6 +3782,9 @@ _engine_delete_surrounding_text_cb (BusEngineProxy    *engine,
     g_assert (BUS_IS_INPUT_CONTEXT (context));
     g_assert (context->engine == engine);
 
+    bus_input_context_flush_engine_updates (context);
+    if (bus_input_context_is_engine_linked (context, engine))
+        return;
     pre_data.u.deleting.offset = offset_from_cursor;
     pre_data.u.deleting.nchars = nchars;
     if (bus_input_context_make_post_process_key_event (context, &pre_data))
@@ -2675,6 +3812,9 @@ _engine_require_surrounding_text_cb (BusEngineProxy    *engine,
     g_assert (BUS_IS_INPUT_CONTEXT (context));
     g_assert (context->engine == engine);
 
+    bus_input_context_flush_engine_updates (context);
+    if (bus_input_context_is_engine_linked (context, engine))
+        return;
     if (bus_input_context_make_post_process_key_event (context, &pre_data))
         return;
     bus_input_context_emit_signal (context,
@@ -2703,6 +3843,29 @@ _engine_update_preedit_text_cb (BusEngineProxy  *engine,
 
     g_assert (context->engine == engine);
 
+    if (bus_input_context_is_engine_linked (context, engine)) {
+        g_object_ref_sink (text);
+        g_object_unref (context->preedit_text);
+        context->preedit_text = text;
+        context->preedit_cursor_pos = cursor_pos;
+        context->preedit_visible = visible;
+        context->preedit_mode = mode;
+        g_clear_object (&context->client_preedit_text);
+        return;
+    }
+
+    if (context->coalescing_key_events > 0) {
+        g_object_ref_sink (text);
+        if (context->coalesced_preedit_text)
+            g_object_unref (context->coalesced_preedit_text);
+        context->coalesced_preedit_text = text;
+        context->coalesced_preedit_cursor_pos = cursor_pos;
+        context->coalesced_preedit_visible = visible;
+        context->coalesced_preedit_mode = mode;
+        context->coalesced_updates |= COALESCED_PREEDIT_TEXT;
+        return;
+    }
+
     bus_input_context_update_preedit_text (context, text,
                                            cursor_pos, visible, mode,
                                            TRUE);
@@ -2726,6 +3889,16 @@ _engine_update_auxiliary_text_cb (BusEngineProxy   *engine,
 
     g_assert (context->engine == engine);
 
+    if (context->coalescing_key_events > 0) {
+        g_object_ref_sink (text);
+        if (context->coalesced_auxiliary_text)
+            g_object_unref (context->coalesced_auxiliary_text);
+        context->coalesced_auxiliary_text = text;
+        context->coalesced_auxiliary_visible = visible;
+        context->coalesced_updates |= COALESCED_AUXILIARY_TEXT;
+        return;
+    }
+
     bus_input_context_update_auxiliary_text (context, text, visible);
 }
 
@@ -2747,6 +3920,16 @@ _engine_update_lookup_table_cb (BusEngineProxy   *engine,
 
     g_assert (context->engine == engine);
 
+    if (context->coalescing_key_events > 0) {
+        g_object_ref_sink (table);
+        if (context->coalesced_lookup_table)
+            g_object_unref (context->coalesced_lookup_table);
+        context->coalesced_lookup_table = table;
+        context->coalesced_lookup_table_visible = visible;
+        context->coalesced_updates |= COALESCED_LOOKUP_TABLE;
+        return;
+    }
+
     bus_input_context_update_lookup_table (context, table, visible, FALSE);
 }
 
@@ -2767,6 +3950,7 @@ _engine_register_properties_cb (BusEngineProxy  *engine,
 
     g_assert (context->engine == engine);
 
+    bus_input_context_flush_engine_updates (context);
     bus_input_context_register_properties (context, props);
 }
 
@@ -2827,6 +4011,11 @@ _engine_show_preedit_text_cb (BusEngineProxy  *engine,
 
     g_assert (context->engine == engine);
 
+    bus_input_context_flush_engine_updates (context);
+    if (bus_input_context_is_engine_linked (context, engine)) {
+        context->preedit_visible = TRUE;
+        return;
+    }
     bus_input_context_show_preedit_text (context, FALSE);
 }
 
@@ -2839,6 +4028,11 @@ _engine_hide_preedit_text_cb (BusEngineProxy  *engine,
 
     g_assert (context->engine == engine);
 
+    bus_input_context_flush_engine_updates (context);
+    if (bus_input_context_is_engine_linked (context, engine)) {
+        context->preedit_visible = FALSE;
+        return;
+    }
     bus_input_context_hide_preedit_text (context, FALSE);
 }
 
@@ -2852,6 +4046,7 @@ _engine_hide_preedit_text_cb (BusEngineProxy  *engine,
                                                                 \
         g_assert (context->engine == engine);                   \
                                                                 \
+        bus_input_context_flush_engine_updates (context);       \
         bus_input_context_##name (context);                     \
     }
 
@@ -2895,6 +4090,11 @@ bus_input_context_new (BusConnection    *connection,
 
     /* it is a fake input context, just need process hotkey */
     context->fake = (strncmp (client, "fake", 4) == 0);
+    if (!context->fake) {
+        context->trace_id = id;
+        bus_trace_record (BUS_TRACE_EVENT_CREATE, context->trace_id,
+                          0, 0, 0, client);
+    }
     context->queue_during_process_key_event = g_queue_new ();
 
     if (connection) {
@@ -2957,6 +4157,9 @@ bus_input_context_disable (BusInputContext *context)
 {
     g_assert (BUS_IS_INPUT_CONTEXT (context));
 
+    bus_input_context_flush_engine_updates (context);
+    bus_input_context_close_engine_link (context);
+
     bus_input_context_clear_preedit_text (context, TRUE);
     bus_input_context_update_auxiliary_text (context, text_empty, FALSE);
     bus_input_context_update_lookup_table (context,
@@ -3016,6 +4219,9 @@ bus_input_context_unset_engine (BusInputContext *context)
 {
     g_assert (BUS_IS_INPUT_CONTEXT (context));
 
+    bus_input_context_flush_engine_updates (context);
+    bus_input_context_close_engine_link (context);
+
     bus_input_context_clear_preedit_text (context, TRUE);
     bus_input_context_update_auxiliary_text (context, text_empty, FALSE);
     bus_input_context_update_lookup_table (context,
@@ -3051,6 +4257,13 @@ bus_input_context_set_engine (BusInputContext *context,
     if (context->engine == engine)
         return;
 
+    if (bus_trace_is_recording ()) {
+        IBusEngineDesc *desc =
+                engine ? bus_engine_proxy_get_desc (engine) : NULL;
+        bus_trace_record (BUS_TRACE_EVENT_ENGINE, context->trace_id, 0, 0, 0,
+                          desc ? ibus_engine_desc_get_name (desc) : NULL);
+    }
+
     if (context->engine != NULL) {
         bus_input_context_unset_engine (context);
     }
@@ -3143,6 +4356,8 @@ new_engine_cb (GObject             *obj,
                                      "Operation was cancelled");
         }
         else {
+            /* Keep the engine of a preload engine for the next switch. */
+            bus_engine_pool_add (engine);
             /* Let BusEngineProxy call a Disable signal. */
             bus_input_context_disable (data->context);
             bus_input_context_set_engine (data->context, engine);
@@ -3221,6 +4436,7 @@ bus_input_context_set_engine_by_desc (BusInputContext    *context,
 {
     GTask *task;
     SetEngineByDescData *data;
+    BusEngineProxy *engine;
 
     g_assert (BUS_IS_INPUT_CONTEXT (context));
     g_assert (IBUS_IS_ENGINE_DESC (desc));
@@ -3249,6 +4465,25 @@ bus_input_context_set_engine_by_desc (BusInputContext    *context,
         return;
     }
 
+    engine = bus_engine_pool_take (desc);
+    if (engine != NULL) {
+        /* Switch to the idle engine of the pool without creating a new
+         * one. See new_engine_cb(). The engine may still have the state
+         * of the input context which used it last. */
+        bus_engine_proxy_reset (engine);
+        bus_engine_proxy_set_capabilities (engine, context->capabilities);
+        bus_engine_proxy_set_content_type (engine,
+                                           context->purpose,
+                                           context->hints);
+        bus_input_context_disable (context);
+        bus_input_context_set_engine (context, engine);
+        g_object_unref (engine);
+        bus_input_context_enable (context);
+        g_task_return_boolean (task, TRUE);
+        g_object_unref (task);
+        return;
+    }
+
     data = g_slice_new0 (SetEngineByDescData);
     context->data = data;
     data->context = context;
@@ -3338,7 +4573,16 @@ bus_input_context_set_capabilities (BusInputContext    *context,
     }
 
     if (context->capabilities != capabilities) {
+        /* the client drops IBUS_CAP_PREEDIT_DELTA when a delta did not apply
+         * to its pre-edit text. */
+        gboolean resend_preedit_text =
+                (context->capabilities & ~capabilities &
+                 IBUS_CAP_PREEDIT_DELTA) != 0 &&
+                context->client_preedit_text != NULL;
+
         context->capabilities = capabilities;
+        bus_trace_record (BUS_TRACE_EVENT_CAPABILITIES, context->trace_id,
+                          capabilities, 0, 0, NULL);
 
         /* If the context does not support IBUS_CAP_FOCUS, then we always assume
          * it has focus. */
@@ -3349,6 +4593,20 @@ bus_input_context_set_capabilities (BusInputContext    *context,
         if (context->engine) {
             bus_engine_proxy_set_capabilities (context->engine, capabilities);
         }
+        if (!ENGINE_LINK_CONDITION)
+            bus_input_context_close_engine_link (context);
+        if (resend_preedit_text) {
+            IBusText *text = g_object_ref (context->preedit_text);
+            g_clear_object (&context->client_preedit_text);
+            bus_input_context_update_preedit_text (
+                    context,
+                    text,
+                    context->preedit_cursor_pos,
+                    context->preedit_visible,
+                    context->preedit_mode,
+                    FALSE);
+            g_object_unref (text);
+        }
     }
 
     context->capabilities = capabilities;
@@ -3362,6 +4620,13 @@ bus_input_context_get_client (BusInputContext *context)
     return context->client;
 }
 
+const BusLatencyHistogram *
+bus_input_context_get_key_latency (BusInputContext *context)
+{
+    g_assert (BUS_IS_INPUT_CONTEXT (context));
+    return &context->key_latency;
+}
+
 void
 bus_input_context_get_content_type (BusInputContext *context,
                                     guint           *purpose,
@@ -3429,6 +4694,103 @@ bus_input_context_commit_text (BusInputContext *context,
     bus_input_context_commit_text_use_extension (context, text, TRUE);
 }
 
+static gboolean
+bus_attribute_equal (IBusAttribute *a,
+                     IBusAttribute *b)
+{
+    return a->type == b->type && a->value == b->value &&
+           a->start_index == b->start_index &&
+           a->end_index == b->end_index;
+}
+
+static gboolean
+bus_attr_list_contains (IBusAttrList  *attrs,
+                        IBusAttribute *attr)
+{
+    IBusAttribute *a;
+    guint i;
+
+    if (attrs == NULL)
+        return FALSE;
+    for (i = 0; (a = ibus_attr_list_get (attrs, i)) != NULL; i++) {
+        if (bus_attribute_equal (a, attr))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/* Add the attributes of @attrs which are not in @other to @builder. */
+static void
+bus_attr_list_build_difference (IBusAttrList    *attrs,
+                                IBusAttrList    *other,
+                                GVariantBuilder *builder)
+{
+    IBusAttribute *a;
+    guint i;
+
+    if (attrs == NULL)
+        return;
+    for (i = 0; (a = ibus_attr_list_get (attrs, i)) != NULL; i++) {
+        if (bus_attr_list_contains (other, a))
+            continue;
+        g_variant_builder_add (builder, "(uuuu)",
+                               a->type, a->value,
+                               a->start_index, a->end_index);
+    }
+}
+
+/**
+ * bus_input_context_emit_preedit_text_delta:
+ *
+ * Send context->preedit_text to the client as the difference from
+ * context->client_preedit_text if the client has IBUS_CAP_PREEDIT_DELTA.
+ * Returns %FALSE if the whole text has to be sent instead.
+ */
+static gboolean
+bus_input_context_emit_preedit_text_delta (BusInputContext *context,
+                                           gboolean         visible)
+{
+    GVariantBuilder removed;
+    GVariantBuilder added;
+    gchar *inserted;
+    guint offset = 0;
+    guint n_deleted = 0;
+
+    if ((context->capabilities & IBUS_CAP_PREEDIT_DELTA) == 0 ||
+        context->client_preedit_text == NULL) {
+        return FALSE;
+    }
+
+    inserted = ibus_text_diff (context->client_preedit_text,
+                               context->preedit_text,
+                               &offset,
+                               &n_deleted);
+    g_variant_builder_init (&removed, G_VARIANT_TYPE ("a(uuuu)"));
+    g_variant_builder_init (&added, G_VARIANT_TYPE ("a(uuuu)"));
+    bus_attr_list_build_difference (context->client_preedit_text->attrs,
+                                    context->preedit_text->attrs,
+                                    &removed);
+    bus_attr_list_build_difference (context->preedit_text->attrs,
+                                    context->client_preedit_text->attrs,
+                                    &added);
+    bus_input_context_emit_signal (
+            context,
+            "UpdatePreeditTextDelta",
+            g_variant_new ("(uusa(uuuu)a(uuuu)ubub)",
+                           offset,
+                           n_deleted,
+                           inserted,
+                           &removed,
+                           &added,
+                           context->preedit_cursor_pos,
+                           visible,
+                           context->preedit_mode,
+                           context->client_commit_preedit),
+            NULL);
+    g_free (inserted);
+    return TRUE;
+}
+
 void
 bus_input_context_update_preedit_text (BusInputContext *context,
                                        IBusText        *text,
@@ -3462,8 +4824,6 @@ bus_input_context_update_preedit_text (BusInputContext *context,
                                              context->preedit_visible);
     } else if (PREEDIT_CONDITION) {
         SyncForwardingPreData pre_data = { 'u', context->preedit_text, };
-        GVariant *variant = ibus_serializable_serialize (
-                (IBusSerializable *)context->preedit_text);
         pre_data.u.uints[0] = context->preedit_cursor_pos;
         pre_data.u.uints[1] = extension_visible ? 1 : 0;
         pre_data.u.uints[2] = context->preedit_mode;
@@ -3471,28 +4831,38 @@ bus_input_context_update_preedit_text (BusInputContext *context,
             pre_data.key = 'm';
         if (bus_input_context_make_post_process_key_event (context,
                                                            &pre_data)) {
-            g_variant_unref (variant);
+            /* the client applies it later, so the next update is sent
+             * whole. */
+            g_clear_object (&context->client_preedit_text);
             return;
-        } else if (context->client_commit_preedit) {
-            bus_input_context_emit_signal (
-                    context,
-                    "UpdatePreeditTextWithMode",
-                    g_variant_new ("(vubu)",
-                                   variant,
-                                   context->preedit_cursor_pos,
-                                   extension_visible,
-                                   context->preedit_mode),
-                    NULL);
-        } else {
-            bus_input_context_emit_signal (
+        } else if (!bus_input_context_emit_preedit_text_delta (
                     context,
-                    "UpdatePreeditText",
-                    g_variant_new ("(vub)",
-                                   variant,
-                                   context->preedit_cursor_pos,
-                                   extension_visible),
-                    NULL);
+                    extension_visible)) {
+            GVariant *variant = ibus_serializable_serialize (
+                    (IBusSerializable *)context->preedit_text);
+            if (context->client_commit_preedit) {
+                bus_input_context_emit_signal (
+                        context,
+                        "UpdatePreeditTextWithMode",
+                        g_variant_new ("(vubu)",
+                                       variant,
+                                       context->preedit_cursor_pos,
+                                       extension_visible,
+                                       context->preedit_mode),
+                        NULL);
+            } else {
+                bus_input_context_emit_signal (
+                        context,
+                        "UpdatePreeditText",
+                        g_variant_new ("(vub)",
+                                       variant,
+                                       context->preedit_cursor_pos,
+                                       extension_visible),
+                        NULL);
+            }
         }
+        g_clear_object (&context->client_preedit_text);
+        context->client_preedit_text = g_object_ref (context->preedit_text);
     } else {
         if (IGNORE_FOCUS_OUT_CONDITION)
             context->ignore_focus_out = TRUE;
@@ -3516,6 +4886,7 @@ bus_input_context_set_emoji_extension (BusInputContext *context,
     context->emoji_extension = emoji_extension;
     if (emoji_extension) {
         g_object_ref (context->emoji_extension);
+        bus_input_context_close_engine_link (context);
         if (!context->connection)
             return;
         /* Use bus_input_context_update_preedit_text() instead of
@@ -3573,6 +4944,17 @@ bus_input_context_is_extension_lookup_table (BusInputContext *context)
     return context->is_extension_lookup_table;
 }
 
+IBusLookupTable *
+bus_input_context_get_lookup_table (BusInputContext *context,
+                                    gboolean        *visible)
+{
+    g_assert (BUS_IS_INPUT_CONTEXT (context));
+
+    if (visible != NULL)
+        *visible = context->lookup_table_visible;
+    return context->lookup_table;
+}
+
 void
 bus_input_context_forward_process_key_event (BusInputContext *context,
                                              guint            keyval,
@@ -27,6 +27,7 @@
 
 #include "connection.h"
 #include "factoryproxy.h"
+#include "stats.h"
 
 #ifndef __BUS_PANEL_PROXY_DEFINED
 #define __BUS_PANEL_PROXY_DEFINED
@@ -275,6 +276,16 @@ void                 bus_input_context_set_capabilities
 const gchar         *bus_input_context_get_client
                                                 (BusInputContext    *context);
 
+/**
+ * bus_input_context_get_key_latency:
+ * @context: A #BusInputContext.
+ * @returns: The histogram of the time from receiving a key event to
+ *     answering it.
+ */
+const BusLatencyHistogram *
+                     bus_input_context_get_key_latency
+                                                (BusInputContext    *context);
+
 /**
  * bus_input_context_get_content_type:
  * @context: A #BusInputContext.
@@ -327,6 +338,17 @@ void                 bus_input_context_set_emoji_extension
                                                 (BusInputContext *context,
                                                  BusPanelProxy   *extension);
 
+/**
+ * bus_input_context_close_engine_link:
+ * @context: A #BusInputContext.
+ *
+ * Close the peer connection between the client and the engine which
+ * the "OpenEngineLink" method opened, so that the key events and the
+ * engine signals go through ibus-daemon again.
+ */
+void                 bus_input_context_close_engine_link
+                                                (BusInputContext *context);
+
 /**
  * bus_input_context_update_preedit_text:
  * @context: A #BusInputContext.
@@ -400,6 +422,16 @@ void                 bus_input_context_clear_preedit_text
 gboolean             bus_input_context_is_extension_lookup_table
                                                 (BusInputContext    *context);
 
+/**
+ * bus_input_context_get_lookup_table:
+ * @visible: (out) (optional): The visibility of the lookup table.
+ *
+ * Returns: (transfer none): The current lookup table of the context.
+ */
+IBusLookupTable     *bus_input_context_get_lookup_table
+                                                (BusInputContext    *context,
+                                                 gboolean           *visible);
+
 /**
  * bus_input_context_forward_process_key_event:
  *
@@ -44,6 +44,7 @@
 #include "global.h"
 #include "ibusimpl.h"
 #include "server.h"
+#include "trace.h"
 
 static gboolean daemonize = FALSE;
 static gboolean single = FALSE;
@@ -82,6 +83,12 @@ static const GOptionEntry entries[] =
     { "replace",   'r', 0, G_OPTION_ARG_NONE,   &replace,   "if there is an old ibus-daemon is running, it will be replaced.", NULL },
     { "cache",     't', 0, G_OPTION_ARG_STRING, &g_cache,   "specify the cache mode. [auto/refresh/none]", NULL },
     { "timeout",   'o', 0, G_OPTION_ARG_INT,    &g_gdbus_timeout, "gdbus reply timeout in milliseconds. pass -1 to use the default timeout of gdbus.", "timeout [default is 15000]" },
+    { "key-deadline", 0, 0, G_OPTION_ARG_INT, &g_key_deadline, "answer a key event without a slow engine after milliseconds, which are longer for an engine with a longer usual latency. 0 waits for the engine.", "msec [default is 0]" },
+    { "key-deadline-policy", 0, 0, G_OPTION_ARG_STRING, &g_key_deadline_policy, "answer a key event after the deadline as not handled (pass) or handled (drop).", "pass|drop [default is pass]" },
+    { "engine-pool-size", 0, 0, G_OPTION_ARG_INT, &g_engine_pool_size, "keep up to num idle engines of the preload engines for fast engine switching. pass 0 to destroy an engine when it is not used.", "num [default is 0]" },
+    { "coalesce-updates", 0, 0, G_OPTION_ARG_NONE, &g_coalesce_updates, "send only the last preedit, auxiliary text and lookup table update of an engine per key event.", NULL },
+    { "paged-lookup-table", 0, 0, G_OPTION_ARG_NONE, &g_paged_lookup_table, "send only the current page of the lookup table to the panel.", NULL },
+    { "trace",     0, 0, G_OPTION_ARG_FILENAME, &g_trace, "record the key, focus, surrounding text and engine events of input contexts to file for test-replay.", "file" },
     { "mem-profile", 'm', 0, G_OPTION_ARG_NONE,   &g_mempro,   "enable memory profile, send SIGUSR2 to print out the memory profile.", NULL },
     { "restart",     'R', 0, G_OPTION_ARG_NONE,   &restart,    "restart panel and config processes when they die.", NULL },
     { "verbose",   'v', 0, G_OPTION_ARG_NONE,   &g_verbose,   "verbose.", NULL },
@@ -201,6 +208,21 @@ main (gint argc, gchar **argv)
         g_printerr ("Bad timeout (must be >= -1): %d\n", g_gdbus_timeout);
         exit (-1);
     }
+    if (g_key_deadline < 0) {
+        g_printerr ("Bad key deadline (must be >= 0): %d\n", g_key_deadline);
+        exit (-1);
+    }
+    if (g_engine_pool_size < 0) {
+        g_printerr ("Bad engine pool size (must be >= 0): %d\n",
+                    g_engine_pool_size);
+        exit (-1);
+    }
+    if (g_strcmp0 (g_key_deadline_policy, "pass") != 0 &&
+        g_strcmp0 (g_key_deadline_policy, "drop") != 0) {
+        g_printerr ("Bad key deadline policy (must be pass or drop): %s\n",
+                    g_key_deadline_policy);
+        exit (-1);
+    }
 
     if (g_mempro) {
         g_warning ("--mem-profile no longer works with the GLib 2.46 or later");
@@ -248,6 +270,11 @@ main (gint argc, gchar **argv)
         g_object_unref (bus);
     }
 
+    if (g_trace != NULL && !bus_trace_open (g_trace, &error)) {
+        g_printerr ("%s\n", error->message);
+        exit (-1);
+    }
+
     bus_server_init ();
     for (i = 0; i < G_N_ELEMENTS(panel_extension_disable_users); i++) {
         if (!g_strcmp0 (username, panel_extension_disable_users[i]) != 0) {
@@ -740,3 +740,286 @@ bus_match_rule_get_recipients (BusMatchRule   *rule,
     return recipients;
 }
 
+
+struct _BusMatchRuleIndex {
+    /* a set of all rules in the index. Equal rules share an entry. */
+    GHashTable *rules;
+    /* maps from a member, interface or path name to a GPtrArray of the
+     * rules which require the name. A rule is bucketed by its member if it
+     * has one, then by its interface, then by its path. */
+    GHashTable *members;
+    GHashTable *interfaces;
+    GHashTable *paths;
+    /* rules which require none of the names above, per message type.
+     * G_DBUS_MESSAGE_TYPE_INVALID is used for rules without a type. */
+    GPtrArray  *others[G_DBUS_MESSAGE_TYPE_SIGNAL + 1];
+};
+
+static guint
+bus_match_rule_hash (BusMatchRule *rule)
+{
+    guint hash = rule->flags * 31 + rule->message_type;
+    guint i;
+
+#define HASH_STR(s) hash = hash * 31 + ((s) != NULL ? g_str_hash (s) : 0)
+    HASH_STR (rule->interface);
+    HASH_STR (rule->member);
+    HASH_STR (rule->sender);
+    HASH_STR (rule->destination);
+    HASH_STR (rule->path);
+    for (i = 0; i < rule->args->len; i++)
+        HASH_STR (g_array_index (rule->args, const gchar *, i));
+#undef HASH_STR
+
+    return hash;
+}
+
+BusMatchRuleIndex *
+bus_match_rule_index_new (void)
+{
+    BusMatchRuleIndex *index = g_slice_new0 (BusMatchRuleIndex);
+    guint i;
+
+    index->rules = g_hash_table_new_full ((GHashFunc) bus_match_rule_hash,
+                                          (GEqualFunc) bus_match_rule_is_equal,
+                                          (GDestroyNotify) g_object_unref,
+                                          NULL);
+    index->members = g_hash_table_new_full (g_str_hash, g_str_equal,
+            g_free, (GDestroyNotify) g_ptr_array_unref);
+    index->interfaces = g_hash_table_new_full (g_str_hash, g_str_equal,
+            g_free, (GDestroyNotify) g_ptr_array_unref);
+    index->paths = g_hash_table_new_full (g_str_hash, g_str_equal,
+            g_free, (GDestroyNotify) g_ptr_array_unref);
+    for (i = 0; i < G_N_ELEMENTS (index->others); i++)
+        index->others[i] = g_ptr_array_new ();
+
+    return index;
+}
+
+void
+bus_match_rule_index_free (BusMatchRuleIndex *index)
+{
+    guint i;
+
+    g_assert (index != NULL);
+
+    g_hash_table_destroy (index->members);
+    g_hash_table_destroy (index->interfaces);
+    g_hash_table_destroy (index->paths);
+    for (i = 0; i < G_N_ELEMENTS (index->others); i++)
+        g_ptr_array_unref (index->others[i]);
+    /* drop the references of the rules at last. */
+    g_hash_table_destroy (index->rules);
+    g_slice_free (BusMatchRuleIndex, index);
+}
+
+/**
+ * bus_match_rule_index_get_bucket:
+ * @table: (out): The table which holds the bucket, or NULL.
+ * @key: (out): The key of the bucket in @table.
+ *
+ * Return the bucket in which the rule should be stored.
+ */
+static GPtrArray *
+bus_match_rule_index_get_bucket (BusMatchRuleIndex *index,
+                                 BusMatchRule      *rule,
+                                 gboolean           create,
+                                 GHashTable       **table,
+                                 const gchar      **key)
+{
+    GPtrArray *bucket;
+
+    if (rule->flags & MATCH_MEMBER) {
+        *table = index->members;
+        *key = rule->member;
+    }
+    else if (rule->flags & MATCH_INTERFACE) {
+        *table = index->interfaces;
+        *key = rule->interface;
+    }
+    else if (rule->flags & MATCH_PATH) {
+        *table = index->paths;
+        *key = rule->path;
+    }
+    else {
+        *table = NULL;
+        *key = NULL;
+        return index->others[rule->message_type];
+    }
+
+    bucket = (GPtrArray *) g_hash_table_lookup (*table, *key);
+    if (bucket == NULL && create) {
+        bucket = g_ptr_array_new ();
+        g_hash_table_insert (*table, g_strdup (*key), bucket);
+    }
+    return bucket;
+}
+
+BusMatchRule *
+bus_match_rule_index_lookup (BusMatchRuleIndex *index,
+                             BusMatchRule      *rule)
+{
+    g_assert (index != NULL);
+    g_assert (BUS_IS_MATCH_RULE (rule));
+
+    return (BusMatchRule *) g_hash_table_lookup (index->rules, rule);
+}
+
+void
+bus_match_rule_index_add (BusMatchRuleIndex *index,
+                          BusMatchRule      *rule)
+{
+    GHashTable *table;
+    const gchar *key;
+    GPtrArray *bucket;
+
+    g_assert (index != NULL);
+    g_assert (BUS_IS_MATCH_RULE (rule));
+    g_assert (!g_hash_table_contains (index->rules, rule));
+
+    g_hash_table_add (index->rules, g_object_ref (rule));
+    bucket = bus_match_rule_index_get_bucket (index, rule, TRUE, &table, &key);
+    g_ptr_array_add (bucket, rule);
+}
+
+gboolean
+bus_match_rule_index_remove (BusMatchRuleIndex *index,
+                             BusMatchRule      *rule)
+{
+    GHashTable *table;
+    const gchar *key;
+    GPtrArray *bucket;
+
+    g_assert (index != NULL);
+    g_assert (BUS_IS_MATCH_RULE (rule));
+
+    /* an equal but different rule might be in the index. */
+    if (g_hash_table_lookup (index->rules, rule) != rule)
+        return FALSE;
+
+    bucket = bus_match_rule_index_get_bucket (index, rule, FALSE, &table, &key);
+    g_assert (bucket != NULL);
+    g_ptr_array_remove_fast (bucket, rule);
+    if (bucket->len == 0 && table != NULL)
+        g_hash_table_remove (table, key);
+
+    g_hash_table_remove (index->rules, rule);
+    return TRUE;
+}
+
+guint
+bus_match_rule_index_size (BusMatchRuleIndex *index)
+{
+    g_assert (index != NULL);
+
+    return g_hash_table_size (index->rules);
+}
+
+GList *
+bus_match_rule_index_get_rules (BusMatchRuleIndex *index)
+{
+    g_assert (index != NULL);
+
+    return g_hash_table_get_keys (index->rules);
+}
+
+static guint
+bus_match_rule_index_match_bucket (GPtrArray        *bucket,
+                                   GDBusMessage     *message,
+                                   BusMatchRuleFunc  func,
+                                   gpointer          user_data)
+{
+    guint i;
+    guint matched = 0;
+
+    if (bucket == NULL)
+        return 0;
+
+    for (i = 0; i < bucket->len; i++) {
+        BusMatchRule *rule = (BusMatchRule *) g_ptr_array_index (bucket, i);
+        if (bus_match_rule_match (rule, message)) {
+            func (rule, user_data);
+            matched++;
+        }
+    }
+    return matched;
+}
+
+static GPtrArray *
+bus_match_rule_index_lookup_bucket (GHashTable  *table,
+                                    const gchar *key)
+{
+    if (key == NULL)
+        return NULL;
+    return (GPtrArray *) g_hash_table_lookup (table, key);
+}
+
+guint
+bus_match_rule_index_foreach_match (BusMatchRuleIndex *index,
+                                    GDBusMessage      *message,
+                                    BusMatchRuleFunc   func,
+                                    gpointer           user_data)
+{
+    GDBusMessageType type;
+    guint matched = 0;
+
+    g_assert (index != NULL);
+    g_assert (G_IS_DBUS_MESSAGE (message));
+    g_assert (func != NULL);
+
+    /* every rule is stored in exactly one bucket, so a rule is never
+     * checked twice and rules in other buckets are never touched. */
+    matched += bus_match_rule_index_match_bucket (
+            bus_match_rule_index_lookup_bucket (
+                    index->members,
+                    g_dbus_message_get_member (message)),
+            message, func, user_data);
+    matched += bus_match_rule_index_match_bucket (
+            bus_match_rule_index_lookup_bucket (
+                    index->interfaces,
+                    g_dbus_message_get_interface (message)),
+            message, func, user_data);
+    matched += bus_match_rule_index_match_bucket (
+            bus_match_rule_index_lookup_bucket (
+                    index->paths,
+                    g_dbus_message_get_path (message)),
+            message, func, user_data);
+    matched += bus_match_rule_index_match_bucket (
+            index->others[G_DBUS_MESSAGE_TYPE_INVALID],
+            message, func, user_data);
+
+    type = g_dbus_message_get_message_type (message);
+    if (type > G_DBUS_MESSAGE_TYPE_INVALID &&
+        type < G_N_ELEMENTS (index->others)) {
+        matched += bus_match_rule_index_match_bucket (index->others[type],
+                                                      message,
+                                                      func, user_data);
+    }
+
+    return matched;
+}
+
+static void
+bus_match_rule_index_prepend_recipients (BusMatchRule *rule,
+                                         GList       **recipients)
+{
+    GList *link;
+
+    for (link = rule->recipients; link != NULL; link = link->next) {
+        BusRecipient *recipient = (BusRecipient *) link->data;
+        *recipients = g_list_prepend (*recipients, recipient->connection);
+    }
+}
+
+GList *
+bus_match_rule_index_get_recipients (BusMatchRuleIndex *index,
+                                     GDBusMessage      *message)
+{
+    GList *recipients = NULL;
+
+    bus_match_rule_index_foreach_match (
+            index, message,
+            (BusMatchRuleFunc) bus_match_rule_index_prepend_recipients,
+            &recipients);
+    return g_list_reverse (recipients);
+}
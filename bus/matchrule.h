@@ -49,6 +49,10 @@ G_BEGIN_DECLS
 
 typedef struct _BusMatchRule BusMatchRule;
 typedef struct _BusMatchRuleClass BusMatchRuleClass;
+typedef struct _BusMatchRuleIndex BusMatchRuleIndex;
+
+typedef void   (* BusMatchRuleFunc)             (BusMatchRule       *rule,
+                                                 gpointer            user_data);
 
 GType            bus_match_rule_get_type    (void);
 BusMatchRule    *bus_match_rule_new         (const gchar        *text);
@@ -88,6 +92,78 @@ GList           *bus_match_rule_get_recipients
                                             (BusMatchRule   *rule,
                                              GDBusMessage   *message);
 
+/**
+ * bus_match_rule_index_new:
+ *
+ * Create an index of match rules. Rules are interned by their contents and
+ * bucketed by the member, interface or path they require so that matching a
+ * message only checks the rules which could possibly match it.
+ */
+BusMatchRuleIndex
+                *bus_match_rule_index_new   (void);
+void             bus_match_rule_index_free  (BusMatchRuleIndex  *index);
+
+/**
+ * bus_match_rule_index_lookup:
+ * @rule: A match rule.
+ * @returns: A rule in the index which is equal to @rule, or NULL.
+ */
+BusMatchRule    *bus_match_rule_index_lookup
+                                            (BusMatchRuleIndex  *index,
+                                             BusMatchRule       *rule);
+
+/**
+ * bus_match_rule_index_add:
+ * @rule: A match rule which is not in the index yet.
+ *
+ * Add the rule to the index. The index holds a reference of the rule.
+ * The rule must not be modified while it is in the index.
+ */
+void             bus_match_rule_index_add   (BusMatchRuleIndex  *index,
+                                             BusMatchRule       *rule);
+
+/**
+ * bus_match_rule_index_remove:
+ * @rule: A match rule.
+ * @returns: TRUE if the rule was in the index.
+ *
+ * Remove the rule from the index and drop the reference of the index.
+ */
+gboolean         bus_match_rule_index_remove
+                                            (BusMatchRuleIndex  *index,
+                                             BusMatchRule       *rule);
+guint            bus_match_rule_index_size  (BusMatchRuleIndex  *index);
+
+/**
+ * bus_match_rule_index_get_rules:
+ * @returns: A newly allocated list of all rules in the index. The rules
+ *     are not ref'ed.
+ */
+GList           *bus_match_rule_index_get_rules
+                                            (BusMatchRuleIndex  *index);
+
+/**
+ * bus_match_rule_index_foreach_match:
+ * @func: A function to be called for each matched rule.
+ * @returns: The number of matched rules.
+ *
+ * Call @func for each rule in the index which matches the message.
+ */
+guint            bus_match_rule_index_foreach_match
+                                            (BusMatchRuleIndex  *index,
+                                             GDBusMessage       *message,
+                                             BusMatchRuleFunc    func,
+                                             gpointer            user_data);
+
+/**
+ * bus_match_rule_index_get_recipients:
+ * @returns: A list of BusConnections of all rules which match the message.
+ *     The connections are not ref'ed.
+ */
+GList           *bus_match_rule_index_get_recipients
+                                            (BusMatchRuleIndex  *index,
+                                             GDBusMessage       *message);
+
 G_END_DECLS
 #endif
 
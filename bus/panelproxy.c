@@ -67,6 +67,11 @@ struct _BusPanelProxy {
     /* instance members */
     BusInputContext *focused_context;
     PanelType panel_type;
+
+    /* %TRUE if the panel was sent the page of the lookup table which starts
+     * at lookup_table_page_start instead of the whole table. */
+    gboolean lookup_table_paged;
+    guint    lookup_table_page_start;
 };
 
 struct _BusPanelProxyClass {
@@ -638,6 +643,56 @@ bus_panel_proxy_update_auxiliary_text (BusPanelProxy *panel,
                        -1, NULL, NULL, NULL);
 }
 
+static guint
+bus_lookup_table_get_page_start (IBusLookupTable *table)
+{
+    guint page_size = ibus_lookup_table_get_page_size (table);
+
+    if (page_size == 0)
+        return 0;
+    return ibus_lookup_table_get_cursor_pos (table) / page_size * page_size;
+}
+
+IBusLookupTable *
+bus_panel_proxy_new_lookup_table_page (IBusLookupTable *table)
+{
+    IBusLookupTable *page;
+    guint page_size;
+    guint page_start;
+    guint page_end;
+    guint i;
+
+    g_assert (IBUS_IS_LOOKUP_TABLE (table));
+
+    page_size = ibus_lookup_table_get_page_size (table);
+    page_start = bus_lookup_table_get_page_start (table);
+    page_end = MIN (page_start + page_size,
+                    ibus_lookup_table_get_number_of_candidates (table));
+
+    page = ibus_lookup_table_new (page_size,
+                                  ibus_lookup_table_get_cursor_pos (table) -
+                                          page_start,
+                                  ibus_lookup_table_is_cursor_visible (table),
+                                  ibus_lookup_table_is_round (table));
+    ibus_lookup_table_set_orientation (
+            page,
+            ibus_lookup_table_get_orientation (table));
+
+    for (i = page_start; i < page_end; i++) {
+        ibus_lookup_table_append_candidate (
+                page,
+                ibus_lookup_table_get_candidate (table, i));
+    }
+    for (i = 0; i < page_size; i++) {
+        IBusText *label = ibus_lookup_table_get_label (table, i);
+        if (label == NULL)
+            break;
+        ibus_lookup_table_append_label (page, label);
+    }
+
+    return g_object_ref_sink (page);
+}
+
 void
 bus_panel_proxy_update_lookup_table (BusPanelProxy   *panel,
                                      IBusLookupTable *table,
@@ -646,7 +701,24 @@ bus_panel_proxy_update_lookup_table (BusPanelProxy   *panel,
     g_assert (BUS_IS_PANEL_PROXY (panel));
     g_assert (IBUS_IS_LOOKUP_TABLE (table));
 
-    GVariant *variant = ibus_serializable_serialize ((IBusSerializable* )table);
+    GVariant *variant;
+
+    /* The panel draws the current page only, so the candidates of the
+     * other pages do not have to be serialized and sent to it. Cursor moves
+     * inside the page are then sent as CursorUp/DownLookupTable by
+     * bus_panel_proxy_sync_lookup_table_page(). */
+    panel->lookup_table_paged = g_paged_lookup_table &&
+                                panel->panel_type == PANEL_TYPE_PANEL;
+    if (panel->lookup_table_paged) {
+        IBusLookupTable *page = bus_panel_proxy_new_lookup_table_page (table);
+        panel->lookup_table_page_start =
+                bus_lookup_table_get_page_start (table);
+        variant = ibus_serializable_serialize ((IBusSerializable *)page);
+        g_object_unref (page);
+    }
+    else {
+        variant = ibus_serializable_serialize ((IBusSerializable *)table);
+    }
     g_dbus_proxy_call ((GDBusProxy *)panel,
                        "UpdateLookupTable",
                        g_variant_new ("(vb)", variant, visible),
@@ -654,6 +726,34 @@ bus_panel_proxy_update_lookup_table (BusPanelProxy   *panel,
                        -1, NULL, NULL, NULL);
 }
 
+/**
+ * bus_panel_proxy_sync_lookup_table_page:
+ *
+ * Send the page of the lookup table of @context to the panel if the cursor
+ * of the table left the page which the panel has got.
+ * Returns: %TRUE if the page was sent, %FALSE if the panel can move the
+ *     cursor of its page by itself.
+ */
+static gboolean
+bus_panel_proxy_sync_lookup_table_page (BusPanelProxy   *panel,
+                                        BusInputContext *context)
+{
+    IBusLookupTable *table;
+    gboolean visible = FALSE;
+
+    if (!panel->lookup_table_paged)
+        return FALSE;
+
+    table = bus_input_context_get_lookup_table (context, &visible);
+    if (bus_lookup_table_get_page_start (table) ==
+        panel->lookup_table_page_start) {
+        return FALSE;
+    }
+
+    bus_panel_proxy_update_lookup_table (panel, table, visible);
+    return TRUE;
+}
+
 void
 bus_panel_proxy_register_properties (BusPanelProxy  *panel,
                                      IBusPropList   *prop_list)
@@ -952,6 +1052,21 @@ _context_set_content_type_cb (BusInputContext *context,
         bus_panel_proxy_##name (panel);                         \
     }
 
+#define DEFINE_FUNCTION_PAGED(name)                             \
+    static void _context_##name##_cb (BusInputContext *context, \
+                                      BusPanelProxy   *panel)   \
+    {                                                           \
+        g_assert (BUS_IS_INPUT_CONTEXT (context));              \
+        g_assert (BUS_IS_PANEL_PROXY (panel));                  \
+                                                                \
+        g_return_if_fail (panel->focused_context == context);   \
+                                                                \
+        if (bus_panel_proxy_sync_lookup_table_page (panel,      \
+                                                    context))   \
+            return;                                             \
+        bus_panel_proxy_##name (panel);                         \
+    }
+
 #define DEFINE_FUNCTION_NO_EXTENSION(name)                      \
     static void _context_##name##_cb (BusInputContext *context, \
                                       BusPanelProxy   *panel)   \
@@ -981,13 +1096,14 @@ DEFINE_FUNCTION (show_auxiliary_text)
 DEFINE_FUNCTION (hide_auxiliary_text)
 DEFINE_FUNCTION (show_lookup_table)
 DEFINE_FUNCTION (hide_lookup_table)
-DEFINE_FUNCTION (page_up_lookup_table)
-DEFINE_FUNCTION (page_down_lookup_table)
-DEFINE_FUNCTION (cursor_up_lookup_table)
-DEFINE_FUNCTION (cursor_down_lookup_table)
+DEFINE_FUNCTION_PAGED (page_up_lookup_table)
+DEFINE_FUNCTION_PAGED (page_down_lookup_table)
+DEFINE_FUNCTION_PAGED (cursor_up_lookup_table)
+DEFINE_FUNCTION_PAGED (cursor_down_lookup_table)
 DEFINE_FUNCTION (state_changed)
 
 #undef DEFINE_FUNCTION
+#undef DEFINE_FUNCTION_PAGED
 #undef DEFINE_FUNCTION_NO_EXTENSION
 
 static const struct {
@@ -1090,6 +1206,7 @@ bus_panel_proxy_focus_out (BusPanelProxy    *panel,
 
     g_object_unref (panel->focused_context);
     panel->focused_context = NULL;
+    panel->lookup_table_paged = FALSE;
 }
 
 void
@@ -111,6 +111,16 @@ void             bus_panel_proxy_update_lookup_table
                                                (BusPanelProxy     *panel,
                                                 IBusLookupTable   *table,
                                                 gboolean           visible);
+/**
+ * bus_panel_proxy_new_lookup_table_page:
+ * @table: A #IBusLookupTable.
+ *
+ * Returns: (transfer full): A new #IBusLookupTable which holds the candidates
+ *     of the current page of @table only and whose cursor is the cursor in
+ *     the page.
+ */
+IBusLookupTable *bus_panel_proxy_new_lookup_table_page
+                                               (IBusLookupTable   *table);
 void             bus_panel_proxy_show_lookup_table
                                                (BusPanelProxy     *panel);
 void             bus_panel_proxy_hide_lookup_table
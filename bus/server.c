@@ -32,6 +32,7 @@
 #include "dbusimpl.h"
 #include "ibusimpl.h"
 #include "global.h"
+#include "trace.h"
 
 
 static GDBusServer *server = NULL;
@@ -367,6 +368,8 @@ bus_server_run (void)
 
     ibus_object_destroy ((IBusObject *)dbus);
     ibus_object_destroy ((IBusObject *)ibus);
+    /* the input contexts are destroyed above. */
+    bus_trace_close ();
 
     /* release resources */
     g_object_unref (server);
@@ -0,0 +1,304 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/* ibus - The Input Bus
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#include "stats.h"
+
+#define SUB_BITS        BUS_LATENCY_HISTOGRAM_SUB_BITS
+#define N_SUB_BUCKETS   (1 << SUB_BITS)
+#define N_LINEAR        (2 << SUB_BITS)
+
+/* engine name -> BusEngineStats, used only in the main thread */
+static GHashTable *engine_stats;
+
+/* member -> guint64 count, or NULL until the counts are read once */
+static GHashTable *message_counts;
+static GMutex      message_counts_lock;
+
+typedef struct _SlowKeyEvent SlowKeyEvent;
+struct _SlowKeyEvent {
+    guint64 serial;
+    gint64  time;
+    gchar  *client;
+    gchar  *engine_name;
+    gint64  usec;
+};
+
+/* a ring of the latest slow key events, used only in the main thread */
+static SlowKeyEvent slow_key_events[BUS_STATS_N_SLOW_KEY_EVENTS];
+static guint64      slow_key_event_serial;
+
+static guint
+bus_latency_histogram_get_index (guint32 value)
+{
+    guint exponent;
+
+    if (value < N_LINEAR)
+        return value;
+    exponent = g_bit_storage (value) - 1;
+    return N_LINEAR + (exponent - SUB_BITS - 1) * N_SUB_BUCKETS +
+           ((value >> (exponent - SUB_BITS)) & (N_SUB_BUCKETS - 1));
+}
+
+/* the largest value in the bucket */
+static gint64
+bus_latency_histogram_get_value (guint index)
+{
+    guint exponent;
+    guint64 lower;
+
+    if (index < N_LINEAR)
+        return index;
+    index -= N_LINEAR;
+    exponent = index / N_SUB_BUCKETS + SUB_BITS + 1;
+    lower = (guint64)(N_SUB_BUCKETS + index % N_SUB_BUCKETS) <<
+            (exponent - SUB_BITS);
+    return lower + ((guint64)1 << (exponent - SUB_BITS)) - 1;
+}
+
+void
+bus_latency_histogram_record (BusLatencyHistogram *histogram,
+                              gint64               usec)
+{
+    guint32 value;
+
+    g_assert (histogram != NULL);
+
+    /* the monotonic clock does not go back, but be safe. */
+    if (usec < 0)
+        usec = 0;
+    value = (guint32) MIN (usec, G_MAXUINT32);
+    histogram->buckets[bus_latency_histogram_get_index (value)]++;
+    histogram->count++;
+    if (usec > histogram->max)
+        histogram->max = usec;
+}
+
+gint64
+bus_latency_histogram_get_percentile (const BusLatencyHistogram *histogram,
+                                      gdouble                    percentile)
+{
+    guint64 target;
+    guint64 n = 0;
+    guint i;
+
+    g_assert (histogram != NULL);
+
+    if (histogram->count == 0)
+        return 0;
+    percentile = CLAMP (percentile, 0.0, 100.0);
+    target = (guint64) (histogram->count * percentile / 100.0 + 0.5);
+    target = CLAMP (target, 1, histogram->count);
+    for (i = 0; i < BUS_LATENCY_HISTOGRAM_N_BUCKETS; i++) {
+        n += histogram->buckets[i];
+        if (n >= target)
+            return MIN (bus_latency_histogram_get_value (i), histogram->max);
+    }
+    return histogram->max;
+}
+
+GVariant *
+bus_latency_histogram_serialize (const BusLatencyHistogram *histogram)
+{
+    if (histogram == NULL)
+        return g_variant_new ("(tttt)",
+                              (guint64) 0, (guint64) 0,
+                              (guint64) 0, (guint64) 0);
+    return g_variant_new (
+            "(tttt)",
+            histogram->count,
+            (guint64) bus_latency_histogram_get_percentile (histogram, 50),
+            (guint64) bus_latency_histogram_get_percentile (histogram, 99),
+            (guint64) histogram->max);
+}
+
+BusEngineStats *
+bus_stats_get_engine (const gchar *engine_name)
+{
+    BusEngineStats *stats;
+
+    g_assert (engine_name != NULL);
+
+    if (engine_stats == NULL) {
+        engine_stats = g_hash_table_new_full (g_str_hash,
+                                              g_str_equal,
+                                              g_free,
+                                              g_free);
+    }
+    stats = g_hash_table_lookup (engine_stats, engine_name);
+    if (stats == NULL) {
+        stats = g_new0 (BusEngineStats, 1);
+        g_hash_table_insert (engine_stats, g_strdup (engine_name), stats);
+    }
+    return stats;
+}
+
+BusLatencyHistogram *
+bus_stats_get_engine_key_latency (const gchar *engine_name)
+{
+    return &bus_stats_get_engine (engine_name)->key_latency;
+}
+
+GVariant *
+bus_stats_get_engine_key_latencies (void)
+{
+    GVariantBuilder builder;
+    GHashTableIter iter;
+    const gchar *name;
+    BusEngineStats *stats;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(s(tttt))"));
+    if (engine_stats != NULL) {
+        g_hash_table_iter_init (&iter, engine_stats);
+        while (g_hash_table_iter_next (&iter,
+                                       (gpointer *)&name,
+                                       (gpointer *)&stats)) {
+            g_variant_builder_add (
+                    &builder,
+                    "(s@(tttt))",
+                    name,
+                    bus_latency_histogram_serialize (&stats->key_latency));
+        }
+    }
+    return g_variant_builder_end (&builder);
+}
+
+GVariant *
+bus_stats_get_engine_key_deadlines (void)
+{
+    GVariantBuilder builder;
+    GHashTableIter iter;
+    const gchar *name;
+    BusEngineStats *stats;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sbtt)"));
+    if (engine_stats != NULL) {
+        g_hash_table_iter_init (&iter, engine_stats);
+        while (g_hash_table_iter_next (&iter,
+                                       (gpointer *)&name,
+                                       (gpointer *)&stats)) {
+            g_variant_builder_add (&builder,
+                                   "(sbtt)",
+                                   name,
+                                   stats->degraded,
+                                   stats->n_deadline_misses,
+                                   stats->n_late_handled);
+        }
+    }
+    return g_variant_builder_end (&builder);
+}
+
+void
+bus_stats_count_message (GDBusMessage *message)
+{
+    const gchar *member;
+    guint64 *count;
+
+    /* A racy read is fine: a message may be missed while the counting
+     * starts. */
+    if (g_atomic_pointer_get (&message_counts) == NULL)
+        return;
+    member = g_dbus_message_get_member (message);
+    if (member == NULL)
+        return;
+
+    g_mutex_lock (&message_counts_lock);
+    count = g_hash_table_lookup (message_counts, member);
+    if (count == NULL &&
+        g_hash_table_size (message_counts) >= BUS_STATS_MAX_MESSAGE_MEMBERS) {
+        /* the members come from the clients, so the table is bounded. */
+        member = BUS_STATS_OTHER_MESSAGE_MEMBER;
+        count = g_hash_table_lookup (message_counts, member);
+    }
+    if (count == NULL) {
+        count = g_new0 (guint64, 1);
+        g_hash_table_insert (message_counts, g_strdup (member), count);
+    }
+    (*count)++;
+    g_mutex_unlock (&message_counts_lock);
+}
+
+GVariant *
+bus_stats_get_message_counts (void)
+{
+    GVariantBuilder builder;
+    GHashTableIter iter;
+    const gchar *member;
+    guint64 *count;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{st}"));
+    g_mutex_lock (&message_counts_lock);
+    if (message_counts == NULL) {
+        g_atomic_pointer_set (&message_counts,
+                              g_hash_table_new_full (g_str_hash,
+                                                     g_str_equal,
+                                                     g_free,
+                                                     g_free));
+    }
+    g_hash_table_iter_init (&iter, message_counts);
+    while (g_hash_table_iter_next (&iter,
+                                   (gpointer *)&member,
+                                   (gpointer *)&count)) {
+        g_variant_builder_add (&builder, "{st}", member, *count);
+    }
+    g_mutex_unlock (&message_counts_lock);
+    return g_variant_builder_end (&builder);
+}
+
+void
+bus_stats_record_slow_key_event (const gchar *client,
+                                 const gchar *engine_name,
+                                 gint64       usec)
+{
+    SlowKeyEvent *event;
+
+    if (usec < BUS_STATS_SLOW_KEY_EVENT_USEC)
+        return;
+
+    event = &slow_key_events[slow_key_event_serial %
+                             BUS_STATS_N_SLOW_KEY_EVENTS];
+    event->serial = ++slow_key_event_serial;
+    event->time = g_get_monotonic_time ();
+    g_free (event->client);
+    event->client = g_strdup (client ? client : "");
+    g_free (event->engine_name);
+    event->engine_name = g_strdup (engine_name ? engine_name : "");
+    event->usec = usec;
+}
+
+GVariant *
+bus_stats_get_slow_key_events (void)
+{
+    GVariantBuilder builder;
+    guint64 serial;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(txsst)"));
+    serial = slow_key_event_serial > BUS_STATS_N_SLOW_KEY_EVENTS ?
+             slow_key_event_serial - BUS_STATS_N_SLOW_KEY_EVENTS : 0;
+    for (; serial < slow_key_event_serial; serial++) {
+        SlowKeyEvent *event =
+                &slow_key_events[serial % BUS_STATS_N_SLOW_KEY_EVENTS];
+        g_variant_builder_add (&builder, "(txsst)",
+                               event->serial,
+                               event->time,
+                               event->client,
+                               event->engine_name,
+                               (guint64) event->usec);
+    }
+    return g_variant_builder_end (&builder);
+}
@@ -0,0 +1,210 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/* ibus - The Input Bus
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#ifndef __BUS_STATS_H_
+#define __BUS_STATS_H_
+
+#include <gio/gio.h>
+
+/*
+ * The statistics of ibus-daemon which are read with the
+ * org.freedesktop.IBus.Stats interface.
+ */
+
+G_BEGIN_DECLS
+
+/* Values below 2 << BUS_LATENCY_HISTOGRAM_SUB_BITS get a bucket each and
+ * each power of two above gets 1 << BUS_LATENCY_HISTOGRAM_SUB_BITS
+ * buckets, so a bucket is at most 1/8 of its values wide. */
+#define BUS_LATENCY_HISTOGRAM_SUB_BITS  3
+#define BUS_LATENCY_HISTOGRAM_N_BUCKETS \
+    ((2 << BUS_LATENCY_HISTOGRAM_SUB_BITS) + \
+     (32 - BUS_LATENCY_HISTOGRAM_SUB_BITS - 1) * \
+     (1 << BUS_LATENCY_HISTOGRAM_SUB_BITS))
+
+typedef struct _BusLatencyHistogram BusLatencyHistogram;
+typedef struct _BusEngineStats BusEngineStats;
+
+/**
+ * BusLatencyHistogram:
+ * @count: The number of the recorded values.
+ * @max: The largest recorded value.
+ * @buckets: The number of the recorded values in each bucket.
+ *
+ * A histogram of latencies in microseconds with log-linear buckets like
+ * HdrHistogram. Recording a value does not allocate.
+ */
+struct _BusLatencyHistogram {
+    guint64 count;
+    gint64  max;
+    guint32 buckets[BUS_LATENCY_HISTOGRAM_N_BUCKETS];
+};
+
+/**
+ * BusEngineStats:
+ * @key_latency: The latencies of the ProcessKeyEvent(s) calls.
+ * @n_deadline_misses: The number of the calls which were answered without
+ *     the engine after the key event deadline.
+ * @n_late_handled: The number of the calls which missed the deadline and
+ *     in which the engine handled a key event later.
+ * @degraded: %TRUE after a deadline miss until the engine meets the
+ *     deadline again for some calls in a row.
+ * @n_on_time: The number of the calls in a row which met the deadline
+ *     while @degraded.
+ * @adaptive_deadline: The deadline from @key_latency in microseconds.
+ * @n_calls: The number of the calls since @adaptive_deadline was updated.
+ *
+ * The statistics and the deadline state of an engine, which is shared by
+ * all the proxies of the engine and kept while ibus-daemon runs.
+ */
+struct _BusEngineStats {
+    BusLatencyHistogram key_latency;
+    guint64  n_deadline_misses;
+    guint64  n_late_handled;
+    gboolean degraded;
+    guint    n_on_time;
+    gint64   adaptive_deadline;
+    guint    n_calls;
+};
+
+/**
+ * bus_latency_histogram_record:
+ * @usec: A latency in microseconds. Values above G_MAXUINT32 are recorded
+ *     as G_MAXUINT32.
+ */
+void             bus_latency_histogram_record
+                                        (BusLatencyHistogram *histogram,
+                                         gint64               usec);
+
+/**
+ * bus_latency_histogram_get_percentile:
+ * @percentile: A percentile between 0 and 100.
+ * @returns: The largest value in the bucket of @percentile, which is at
+ *     most 1/8 larger than the recorded value, or 0 if no value is
+ *     recorded.
+ */
+gint64           bus_latency_histogram_get_percentile
+                                        (const BusLatencyHistogram
+                                                             *histogram,
+                                         gdouble              percentile);
+
+/**
+ * bus_latency_histogram_serialize:
+ * @histogram: (nullable): A histogram.
+ * @returns: A floating GVariant "(tttt)" of the count, p50, p99 and max.
+ */
+GVariant        *bus_latency_histogram_serialize
+                                        (const BusLatencyHistogram
+                                                             *histogram);
+
+/**
+ * bus_stats_get_engine:
+ * @engine_name: The name of an engine.
+ * @returns: The statistics of the engine. They are kept while ibus-daemon
+ *     runs, so they are kept when the engine restarts.
+ */
+BusEngineStats  *bus_stats_get_engine
+                                        (const gchar         *engine_name);
+
+/**
+ * bus_stats_get_engine_key_latency:
+ * @engine_name: The name of an engine.
+ * @returns: The histogram of the ProcessKeyEvent calls of the engine.
+ */
+BusLatencyHistogram *
+                 bus_stats_get_engine_key_latency
+                                        (const gchar         *engine_name);
+
+/**
+ * bus_stats_get_engine_key_latencies:
+ * @returns: A floating GVariant "a(s(tttt))" of the engine names and
+ *     their latencies.
+ */
+GVariant        *bus_stats_get_engine_key_latencies
+                                        (void);
+
+/**
+ * bus_stats_get_engine_key_deadlines:
+ * @returns: A floating GVariant "a(sbtt)" of the engine names, whether
+ *     they are degraded, their deadline misses and their late handled
+ *     calls.
+ */
+GVariant        *bus_stats_get_engine_key_deadlines
+                                        (void);
+
+/* The number of members which bus_stats_count_message() counts apart.
+ * The messages of the other members are counted together as
+ * BUS_STATS_OTHER_MESSAGE_MEMBER, which is not a valid member name. */
+#define BUS_STATS_MAX_MESSAGE_MEMBERS   256
+#define BUS_STATS_OTHER_MESSAGE_MEMBER  "(other)"
+
+/**
+ * bus_stats_count_message:
+ *
+ * Count the message by its member. It does nothing until
+ * bus_stats_get_message_counts() is called once, so that the messages
+ * are not counted when no one reads them. Thread safe.
+ */
+void             bus_stats_count_message
+                                        (GDBusMessage        *message);
+
+/**
+ * bus_stats_get_message_counts:
+ * @returns: A floating GVariant "a{st}" of the members and the numbers of
+ *     their messages.
+ *
+ * Start counting the messages if they are not counted yet. Thread safe.
+ */
+GVariant        *bus_stats_get_message_counts
+                                        (void);
+
+/* A key event is slow when it is answered this late. */
+#define BUS_STATS_SLOW_KEY_EVENT_USEC   20000
+/* The number of the latest slow key events which are kept. */
+#define BUS_STATS_N_SLOW_KEY_EVENTS     64
+
+/**
+ * bus_stats_record_slow_key_event:
+ * @client: (nullable): The client name of the input context.
+ * @engine_name: (nullable): The name of the engine or %NULL if the key
+ *     event was not sent to an engine.
+ * @usec: The latency of the key event.
+ *
+ * Keep the key event if @usec is not less than
+ * BUS_STATS_SLOW_KEY_EVENT_USEC. Only the latest
+ * BUS_STATS_N_SLOW_KEY_EVENTS events are kept and the key values are not,
+ * so that the overhead is bounded and typed text is not revealed.
+ */
+void             bus_stats_record_slow_key_event
+                                        (const gchar         *client,
+                                         const gchar         *engine_name,
+                                         gint64               usec);
+
+/**
+ * bus_stats_get_slow_key_events:
+ * @returns: A floating GVariant "a(txsst)" of the serial numbers, the
+ *     monotonic times, the clients, the engine names and the latencies of
+ *     the kept slow key events from the oldest one. The serial numbers
+ *     start with 1 and let a reader skip the events which it already read.
+ */
+GVariant        *bus_stats_get_slow_key_events
+                                        (void);
+
+G_END_DECLS
+#endif
@@ -0,0 +1,144 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+#include <stdlib.h>
+
+#include <ibus.h>
+#include <locale.h>
+#include <glib.h>
+#include "test-client.h"
+
+/* key repeat at 120 Hz for 2 seconds */
+#define REPEAT_RATE 120
+#define N_KEYS (REPEAT_RATE * 2)
+/* evdev keycode of 'a' */
+#define KEYCODE_A 30
+
+/* ibus key repeat latency test
+   Send a repeated key press to ibus-daemon at 120 Hz, once waiting for
+   each reply before sending the next key and once keeping all the key
+   events in flight. The latency of a key is measured from the time the
+   key repeat generated it, so the time a key waits for the earlier replies
+   is counted. The replies have to arrive in order.
+*/
+static struct {
+    BusTestClient *client;
+    gboolean pipelined;
+    gint64   due_time[N_KEYS];
+    guint    n_due;
+    guint    n_sent;
+    guint    n_replied;
+    gboolean in_flight;
+    gboolean in_order;
+    gint64   total_latency;
+    gint64   max_latency;
+} repeat;
+
+static void send_next_key (void);
+
+static void
+_process_key_event_done (GObject      *object,
+                         GAsyncResult *res,
+                         gpointer      user_data)
+{
+    guint index = GPOINTER_TO_UINT (user_data);
+    GError *error = NULL;
+    gint64 latency;
+
+    ibus_input_context_process_key_event_async_finish (
+            IBUS_INPUT_CONTEXT (object), res, &error);
+    if (error != NULL) {
+        g_printerr ("ProcessKeyEvent failed: %s\n", error->message);
+        g_error_free (error);
+    }
+
+    if (index != repeat.n_replied)
+        repeat.in_order = FALSE;
+    latency = g_get_monotonic_time () - repeat.due_time[index];
+    repeat.total_latency += latency;
+    repeat.max_latency = MAX (repeat.max_latency, latency);
+    repeat.in_flight = FALSE;
+
+    if (++repeat.n_replied == N_KEYS) {
+        ibus_quit ();
+        return;
+    }
+    /* the key repeat went on while the reply was waited for. */
+    if (!repeat.pipelined && repeat.n_sent < repeat.n_due)
+        send_next_key ();
+}
+
+static void
+send_next_key (void)
+{
+    guint index = repeat.n_sent++;
+
+    repeat.in_flight = TRUE;
+    ibus_input_context_process_key_event_async (repeat.client->ibuscontext,
+                                                IBUS_KEY_a,
+                                                KEYCODE_A,
+                                                0,
+                                                -1,
+                                                NULL,
+                                                _process_key_event_done,
+                                                GUINT_TO_POINTER (index));
+}
+
+static gboolean
+_repeat_cb (gpointer user_data)
+{
+    repeat.due_time[repeat.n_due++] = g_get_monotonic_time ();
+    if (repeat.pipelined || !repeat.in_flight)
+        send_next_key ();
+    return repeat.n_due < N_KEYS ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+static gboolean
+run (gboolean pipelined)
+{
+    repeat.pipelined = pipelined;
+    repeat.n_due = repeat.n_sent = repeat.n_replied = 0;
+    repeat.in_flight = FALSE;
+    repeat.in_order = TRUE;
+    repeat.total_latency = repeat.max_latency = 0;
+
+    g_timeout_add (1000 / REPEAT_RATE, _repeat_cb, NULL);
+    ibus_main ();
+    ibus_input_context_process_key_event (repeat.client->ibuscontext,
+                                          IBUS_KEY_a,
+                                          KEYCODE_A,
+                                          IBUS_RELEASE_MASK);
+    ibus_input_context_reset (repeat.client->ibuscontext);
+
+    g_print ("%s: mean %.2f ms, max %.2f ms, replies %s\n",
+             pipelined ? "pipelined " : "serialized",
+             repeat.total_latency / 1000.0 / N_KEYS,
+             repeat.max_latency / 1000.0,
+             repeat.in_order ? "in order" : "OUT OF ORDER");
+    return repeat.in_order;
+}
+
+gint
+main (gint argc, gchar **argv)
+{
+    gboolean in_order = TRUE;
+
+    setlocale (LC_ALL, "");
+    ibus_init ();
+
+    /* need to set active engine */
+    repeat.client = bus_test_client_new ();
+    if (repeat.client == NULL) {
+        g_printerr ("don't create test-client instance.");
+        exit(1);
+    }
+    if (!bus_test_client_is_enabled (repeat.client)) {
+        g_printerr ("ibus engine is not enabled\n");
+        exit(1);
+    }
+
+    g_print ("%d keys at %d Hz\n", N_KEYS, REPEAT_RATE);
+    in_order &= run (FALSE);
+    in_order &= run (TRUE);
+
+    return in_order ? 0 : 1;
+}
@@ -0,0 +1,141 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+
+#include "panelproxy.h"
+
+#define N_CANDIDATES 500
+#define PAGE_SIZE 10
+#define N_MOVES 100000
+
+static IBusLookupTable *
+create_lookup_table (guint n_candidates)
+{
+    IBusLookupTable *table = ibus_lookup_table_new (PAGE_SIZE, 0, TRUE, TRUE);
+    guint i;
+
+    for (i = 0; i < n_candidates; i++) {
+        gchar *text = g_strdup_printf ("candidate %u", i);
+        ibus_lookup_table_append_candidate (table,
+                                            ibus_text_new_from_string (text));
+        g_free (text);
+    }
+    for (i = 0; i < PAGE_SIZE; i++) {
+        gchar *text = g_strdup_printf ("%u.", i + 1);
+        ibus_lookup_table_append_label (table,
+                                        ibus_text_new_from_string (text));
+        g_free (text);
+    }
+    return g_object_ref_sink (table);
+}
+
+static void
+test_page (void)
+{
+    IBusLookupTable *table = create_lookup_table (N_CANDIDATES);
+    IBusLookupTable *page;
+    guint i;
+
+    ibus_lookup_table_set_cursor_pos (table, 23);
+    ibus_lookup_table_set_orientation (table,
+                                       IBUS_ORIENTATION_VERTICAL);
+    page = bus_panel_proxy_new_lookup_table_page (table);
+
+    g_assert_cmpuint (ibus_lookup_table_get_number_of_candidates (page), ==,
+                      PAGE_SIZE);
+    g_assert_cmpuint (ibus_lookup_table_get_page_size (page), ==, PAGE_SIZE);
+    g_assert_cmpuint (ibus_lookup_table_get_cursor_pos (page), ==, 3);
+    g_assert_cmpuint (ibus_lookup_table_get_cursor_in_page (page), ==,
+                      ibus_lookup_table_get_cursor_in_page (table));
+    g_assert (ibus_lookup_table_is_round (page));
+    g_assert_cmpint (ibus_lookup_table_get_orientation (page), ==,
+                     IBUS_ORIENTATION_VERTICAL);
+    for (i = 0; i < PAGE_SIZE; i++) {
+        g_assert (ibus_lookup_table_get_candidate (page, i) ==
+                  ibus_lookup_table_get_candidate (table, 20 + i));
+        g_assert (ibus_lookup_table_get_label (page, i) ==
+                  ibus_lookup_table_get_label (table, i));
+    }
+    g_object_unref (page);
+    g_object_unref (table);
+
+    /* the last page is not full. */
+    table = create_lookup_table (PAGE_SIZE * 2 + 5);
+    ibus_lookup_table_set_cursor_pos (table, PAGE_SIZE * 2 + 4);
+    page = bus_panel_proxy_new_lookup_table_page (table);
+    g_assert_cmpuint (ibus_lookup_table_get_number_of_candidates (page), ==,
+                      5);
+    g_assert_cmpuint (ibus_lookup_table_get_cursor_pos (page), ==, 4);
+    g_assert (ibus_lookup_table_get_candidate (page, 0) ==
+              ibus_lookup_table_get_candidate (table, PAGE_SIZE * 2));
+    g_object_unref (page);
+    g_object_unref (table);
+}
+
+/* Compare the cost of a cursor move for the panel when the whole table is
+ * serialized and when only the page is serialized on a page change. */
+static void
+bench_cursor_down (void)
+{
+    IBusLookupTable *table = create_lookup_table (N_CANDIDATES);
+    GTimer *timer = g_timer_new ();
+    gdouble full_time, paged_time;
+    gsize full_size = 0, paged_size = 0;
+    guint page_start = 0;
+    guint i;
+
+    for (i = 0; i < N_MOVES; i++) {
+        GVariant *variant;
+        ibus_lookup_table_cursor_down (table);
+        variant = g_variant_ref_sink (
+                ibus_serializable_serialize ((IBusSerializable *)table));
+        full_size += g_variant_get_size (variant);
+        g_variant_unref (variant);
+    }
+    full_time = g_timer_elapsed (timer, NULL);
+
+    ibus_lookup_table_set_cursor_pos (table, 0);
+    g_timer_start (timer);
+    for (i = 0; i < N_MOVES; i++) {
+        IBusLookupTable *page;
+        GVariant *variant;
+        ibus_lookup_table_cursor_down (table);
+        if (ibus_lookup_table_get_cursor_pos (table) / PAGE_SIZE * PAGE_SIZE
+            == page_start) {
+            /* CursorDownLookupTable without arguments */
+            continue;
+        }
+        page_start = ibus_lookup_table_get_cursor_pos (table) / PAGE_SIZE *
+                     PAGE_SIZE;
+        page = bus_panel_proxy_new_lookup_table_page (table);
+        variant = g_variant_ref_sink (
+                ibus_serializable_serialize ((IBusSerializable *)page));
+        paged_size += g_variant_get_size (variant);
+        g_variant_unref (variant);
+        g_object_unref (page);
+    }
+    paged_time = g_timer_elapsed (timer, NULL);
+
+    g_print ("%u candidates, page size %u\n", N_CANDIDATES, PAGE_SIZE);
+    g_print ("whole table: %.1f ns/move, %" G_GSIZE_FORMAT " bytes/move\n",
+             full_time * 1e9 / N_MOVES, full_size / N_MOVES);
+    g_print ("paged table: %.1f ns/move, %" G_GSIZE_FORMAT " bytes/move\n",
+             paged_time * 1e9 / N_MOVES, paged_size / N_MOVES);
+
+    g_timer_destroy (timer);
+    g_object_unref (table);
+}
+
+int
+main (gint argc, gchar **argv)
+{
+    ibus_init ();
+    /* only for g_test_perf (), the checks use g_assert. */
+    g_test_init (&argc, &argv, NULL);
+
+    test_page ();
+    /* it measures rather than checks, so run it with "-m perf". */
+    if (g_test_perf ())
+        bench_cursor_down ();
+
+    return 0;
+}
@@ -16,6 +16,115 @@ struct _BusMatchRule {
     GList *recipients;
 };
 
+#define BENCH_MESSAGES 100000
+
+static void
+count_match_cb (BusMatchRule *rule,
+                guint        *count)
+{
+    (*count)++;
+}
+
+static void
+test_index (void)
+{
+    BusMatchRuleIndex *index = bus_match_rule_index_new ();
+    BusMatchRule *rule, *rule1;
+    GDBusMessage *message;
+    guint count = 0;
+
+    rule = bus_match_rule_new ("type='signal',"
+                               "interface='org.freedesktop.IBus.InputContext',"
+                               "member='CommitText'");
+    bus_match_rule_index_add (index, rule);
+    g_object_unref (rule);
+
+    rule = bus_match_rule_new ("type='signal',"
+                               "interface='org.freedesktop.IBus.InputContext'");
+    bus_match_rule_index_add (index, rule);
+    g_object_unref (rule);
+
+    rule = bus_match_rule_new ("type='signal'");
+    bus_match_rule_index_add (index, rule);
+    g_object_unref (rule);
+
+    rule = bus_match_rule_new ("type='method_call'");
+    bus_match_rule_index_add (index, rule);
+    g_object_unref (rule);
+    g_assert (bus_match_rule_index_size (index) == 4);
+
+    /* interning */
+    rule1 = bus_match_rule_new ("member='CommitText',"
+                                "interface='org.freedesktop.IBus.InputContext',"
+                                "type='signal'");
+    rule = bus_match_rule_index_lookup (index, rule1);
+    g_assert (rule != NULL && rule != rule1);
+    g_object_unref (rule1);
+
+    message = g_dbus_message_new_signal ("/org/freedesktop/IBus/InputContext_1",
+                                         "org.freedesktop.IBus.InputContext",
+                                         "CommitText");
+    bus_match_rule_index_foreach_match (index, message,
+                                        (BusMatchRuleFunc) count_match_cb,
+                                        &count);
+    g_assert (count == 3);
+    g_object_unref (message);
+
+    g_object_ref (rule);
+    g_assert (bus_match_rule_index_remove (index, rule));
+    g_assert (!bus_match_rule_index_remove (index, rule));
+    g_assert (bus_match_rule_index_lookup (index, rule) == NULL);
+    g_object_unref (rule);
+    g_assert (bus_match_rule_index_size (index) == 3);
+
+    bus_match_rule_index_free (index);
+}
+
+/* Dispatch cost should stay flat as the number of unrelated rules grows. */
+static void
+bench_index (void)
+{
+    static const guint sizes[] = { 10, 100, 1000, 10000 };
+    guint i, j;
+
+    for (i = 0; i < G_N_ELEMENTS (sizes); i++) {
+        BusMatchRuleIndex *index = bus_match_rule_index_new ();
+        GDBusMessage *message;
+        GTimer *timer;
+        guint count = 0;
+
+        for (j = 0; j < sizes[i]; j++) {
+            gchar *text = g_strdup_printf (
+                    "type='signal',"
+                    "interface='org.freedesktop.IBus.Test%u',"
+                    "member='Member%u'", j, j);
+            BusMatchRule *rule = bus_match_rule_new (text);
+            bus_match_rule_index_add (index, rule);
+            g_object_unref (rule);
+            g_free (text);
+        }
+
+        message = g_dbus_message_new_signal ("/org/freedesktop/IBus",
+                                             "org.freedesktop.IBus.Test0",
+                                             "Member0");
+        timer = g_timer_new ();
+        for (j = 0; j < BENCH_MESSAGES; j++) {
+            bus_match_rule_index_foreach_match (
+                    index, message,
+                    (BusMatchRuleFunc) count_match_cb, &count);
+        }
+        g_timer_stop (timer);
+        g_assert (count == BENCH_MESSAGES);
+
+        g_print ("%5u rules: %.1f ns/message\n", sizes[i],
+                 g_timer_elapsed (timer, NULL) * 1e9 / BENCH_MESSAGES);
+
+        g_timer_destroy (timer);
+        g_object_unref (message);
+        bus_match_rule_index_free (index);
+    }
+}
+
 int
 main(gint argc, gchar **argv)
 {
@@ -23,6 +132,8 @@ main(gint argc, gchar **argv)
 #if !GLIB_CHECK_VERSION(2,35,0)
     g_type_init ();
 #endif
+    /* only for g_test_perf (), the checks below use g_assert. */
+    g_test_init (&argc, &argv, NULL);
 
     rule = bus_match_rule_new (" type='signal' , interface = 'org.freedesktop.IBus' ");
     g_assert (rule->message_type == G_DBUS_MESSAGE_TYPE_SIGNAL);
@@ -61,6 +172,11 @@ main(gint argc, gchar **argv)
     rule = bus_match_rule_new ("eavesdrop=true");
     g_assert (rule != NULL);
     g_object_unref (rule);
-    
+
+    test_index ();
+    /* it measures rather than checks, so run it with "-m perf". */
+    if (g_test_perf ())
+        bench_index ();
+
     return 0;
 }
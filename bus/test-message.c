@@ -0,0 +1,161 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+
+#include "dbusimpl.h"
+
+#define N_CANDIDATES 500
+#define N_MESSAGES 100000
+
+/* An UpdateLookupTable signal as the panel receives it on each key. */
+static GDBusMessage *
+create_lookup_table_message (void)
+{
+    IBusLookupTable *table = ibus_lookup_table_new (10, 0, TRUE, TRUE);
+    GDBusMessage *message;
+    GVariant *variant;
+    guint i;
+
+    for (i = 0; i < N_CANDIDATES; i++) {
+        gchar *text = g_strdup_printf ("candidate %u", i);
+        ibus_lookup_table_append_candidate (table,
+                                            ibus_text_new_from_string (text));
+        g_free (text);
+    }
+    variant = ibus_serializable_serialize ((IBusSerializable *) table);
+    g_object_unref (table);
+
+    message = g_dbus_message_new_signal ("/org/freedesktop/IBus/Panel",
+                                         "org.freedesktop.IBus.Panel",
+                                         "UpdateLookupTable");
+    g_dbus_message_set_body (message, g_variant_new ("(vb)", variant, TRUE));
+    g_dbus_message_set_serial (message, 1);
+    g_dbus_message_lock (message);
+    return message;
+}
+
+static void
+test_set_sender (void)
+{
+    GDBusMessage *message = create_lookup_table_message ();
+    GDBusMessage *new_message;
+
+    g_object_ref (message);
+    new_message = bus_dbus_message_set_sender (message, "org.freedesktop.DBus");
+    g_assert (new_message != message);
+    g_assert (!g_dbus_message_get_locked (new_message));
+    g_assert (g_dbus_message_get_body (new_message) ==
+              g_dbus_message_get_body (message));
+    g_assert_cmpstr (g_dbus_message_get_sender (new_message), ==,
+                     "org.freedesktop.DBus");
+    g_assert_cmpstr (g_dbus_message_get_path (new_message), ==,
+                     g_dbus_message_get_path (message));
+    g_assert_cmpstr (g_dbus_message_get_interface (new_message), ==,
+                     g_dbus_message_get_interface (message));
+    g_assert_cmpstr (g_dbus_message_get_member (new_message), ==,
+                     g_dbus_message_get_member (message));
+    g_assert_cmpstr (g_dbus_message_get_signature (new_message), ==,
+                     g_dbus_message_get_signature (message));
+    g_assert_cmpuint (g_dbus_message_get_serial (new_message), ==,
+                      g_dbus_message_get_serial (message));
+
+    /* the sender is already set. */
+    g_dbus_message_lock (new_message);
+    g_assert (bus_dbus_message_set_sender (new_message,
+                                           "org.freedesktop.DBus") ==
+              new_message);
+
+    g_object_unref (new_message);
+    g_object_unref (message);
+}
+
+static void
+test_classify (void)
+{
+    static const struct {
+        const gchar *member;
+        BusDBusLane  lane;
+    } signals[] = {
+        { "CommitText",         BUS_DBUS_LANE_INTERACTIVE },
+        { "UpdatePreeditText",  BUS_DBUS_LANE_INTERACTIVE },
+        { "ForwardKeyEvent",    BUS_DBUS_LANE_INTERACTIVE },
+        { "RegisterProperties", BUS_DBUS_LANE_BULK },
+        { "UpdateProperty",     BUS_DBUS_LANE_BULK },
+        { "RegistryChanged",    BUS_DBUS_LANE_BULK },
+    };
+    GDBusMessage *message;
+    GDBusMessage *reply;
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (signals); i++) {
+        message = g_dbus_message_new_signal ("/org/freedesktop/IBus",
+                                             "org.freedesktop.IBus",
+                                             signals[i].member);
+        g_assert (bus_dbus_impl_classify_message (message) == signals[i].lane);
+        g_object_unref (message);
+    }
+
+    message = g_dbus_message_new_method_call (
+            NULL,
+            "/org/freedesktop/IBus/InputContext_1",
+            "org.freedesktop.IBus.InputContext",
+            "ProcessKeyEvent");
+    g_assert (bus_dbus_impl_classify_message (message) ==
+              BUS_DBUS_LANE_INTERACTIVE);
+    reply = g_dbus_message_new_method_reply (message);
+    g_assert (bus_dbus_impl_classify_message (reply) ==
+              BUS_DBUS_LANE_INTERACTIVE);
+    g_object_unref (reply);
+    g_object_unref (message);
+}
+
+/* Compare the cost of rewriting the sender of a locked message with and
+ * without g_dbus_message_copy. */
+static void
+bench_set_sender (void)
+{
+    GDBusMessage *message = create_lookup_table_message ();
+    gsize body_size = g_variant_get_size (g_dbus_message_get_body (message));
+    GTimer *timer = g_timer_new ();
+    gdouble copy_time, rewrite_time;
+    guint i;
+
+    for (i = 0; i < N_MESSAGES; i++) {
+        GDBusMessage *new_message = g_dbus_message_copy (message, NULL);
+        g_dbus_message_set_sender (new_message, "org.freedesktop.DBus");
+        g_object_unref (new_message);
+    }
+    copy_time = g_timer_elapsed (timer, NULL);
+
+    g_timer_start (timer);
+    for (i = 0; i < N_MESSAGES; i++) {
+        GDBusMessage *new_message = bus_dbus_message_set_sender (
+                g_object_ref (message), "org.freedesktop.DBus");
+        g_object_unref (new_message);
+    }
+    rewrite_time = g_timer_elapsed (timer, NULL);
+
+    g_print ("body: %" G_GSIZE_FORMAT " bytes, shared by both\n", body_size);
+    g_print ("g_dbus_message_copy: %.1f ns/message\n",
+             copy_time * 1e9 / N_MESSAGES);
+    g_print ("bus_dbus_message_set_sender: %.1f ns/message\n",
+             rewrite_time * 1e9 / N_MESSAGES);
+
+    g_timer_destroy (timer);
+    g_object_unref (message);
+}
+
+int
+main (gint argc, gchar **argv)
+{
+    ibus_init ();
+    /* only for g_test_perf (), the checks use g_assert. */
+    g_test_init (&argc, &argv, NULL);
+
+    test_set_sender ();
+    test_classify ();
+    /* it measures rather than checks, so run it with "-m perf". */
+    if (g_test_perf ())
+        bench_set_sender ();
+
+    return 0;
+}
@@ -0,0 +1,234 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/* ibus - The Input Bus
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#include <ibus.h>
+#include <locale.h>
+#include <stdlib.h>
+
+#include "stats.h"
+#include "trace.h"
+
+/* ibus replay test
+   Send the events of a trace, which ibus-daemon --trace=FILE recorded, to
+   the running ibus-daemon at the recorded times or as fast as possible.
+   Compare the replies of the key events with the recorded ones and print
+   the recorded and replayed latencies.
+*/
+
+typedef struct _ReplayContext ReplayContext;
+struct _ReplayContext {
+    IBusInputContext *context;
+    /* the replies of the replayed key events which are not compared with
+     * the recorded ones yet */
+    GQueue handled;
+};
+
+static gboolean max_speed = FALSE;
+
+static const GOptionEntry entries[] =
+{
+    { "max-speed", 'm', 0, G_OPTION_ARG_NONE, &max_speed,
+      "send the events without waiting for the recorded times.", NULL },
+    { NULL },
+};
+
+static void
+replay_context_free (ReplayContext *replay)
+{
+    ibus_proxy_destroy ((IBusProxy *)replay->context);
+    g_object_unref (replay->context);
+    g_queue_clear (&replay->handled);
+    g_slice_free (ReplayContext, replay);
+}
+
+/* the replayed input contexts receive signals of the engines. */
+static void
+dispatch_pending_events (void)
+{
+    while (g_main_context_iteration (NULL, FALSE));
+}
+
+static void
+print_histogram (const gchar               *name,
+                 const BusLatencyHistogram *histogram)
+{
+    g_print ("%-8s %8" G_GUINT64_FORMAT
+             " %8" G_GINT64_FORMAT " %8" G_GINT64_FORMAT
+             " %8" G_GINT64_FORMAT " %8" G_GINT64_FORMAT "\n",
+             name,
+             histogram->count,
+             bus_latency_histogram_get_percentile (histogram, 50),
+             bus_latency_histogram_get_percentile (histogram, 90),
+             bus_latency_histogram_get_percentile (histogram, 99),
+             histogram->max);
+}
+
+gint
+main (gint argc, gchar **argv)
+{
+    GOptionContext *option;
+    GError *error = NULL;
+    IBusBus *bus;
+    BusTraceReader *reader;
+    BusTraceEvent event;
+    GHashTable *contexts;
+    ReplayContext *replay;
+    BusLatencyHistogram recorded = { 0, };
+    BusLatencyHistogram replayed = { 0, };
+    gchar *engine_name = NULL;
+    gint64 start_time;
+    guint n_differences = 0;
+
+    setlocale (LC_ALL, "");
+
+    option = g_option_context_new ("TRACE");
+    g_option_context_add_main_entries (option, entries, NULL);
+    if (!g_option_context_parse (option, &argc, &argv, &error)) {
+        g_printerr ("Option parsing failed: %s\n", error->message);
+        g_error_free (error);
+        exit (1);
+    }
+    g_option_context_free (option);
+    if (argc != 2) {
+        g_printerr ("Usage: %s [--max-speed] TRACE\n", argv[0]);
+        exit (1);
+    }
+
+    reader = bus_trace_reader_new (argv[1], &error);
+    if (reader == NULL) {
+        g_printerr ("%s\n", error->message);
+        g_error_free (error);
+        exit (1);
+    }
+
+    ibus_init ();
+    bus = ibus_bus_new ();
+    if (!ibus_bus_is_connected (bus)) {
+        g_printerr ("ibus-daemon is not running\n");
+        exit (1);
+    }
+
+    contexts = g_hash_table_new_full (NULL, NULL, NULL,
+                                      (GDestroyNotify) replay_context_free);
+    start_time = g_get_monotonic_time ();
+
+    while (bus_trace_reader_next (reader, &event)) {
+        if (!max_speed) {
+            gint64 delay = start_time + event.time - g_get_monotonic_time ();
+            if (delay > 0)
+                g_usleep (delay);
+        }
+        dispatch_pending_events ();
+
+        if (event.type == BUS_TRACE_EVENT_CREATE) {
+            replay = g_slice_new0 (ReplayContext);
+            replay->context = ibus_bus_create_input_context (
+                    bus,
+                    event.payload ? event.payload : "test-replay");
+            if (replay->context == NULL) {
+                g_printerr ("Cannot create an input context\n");
+                exit (1);
+            }
+            g_hash_table_replace (contexts,
+                                  GUINT_TO_POINTER (event.context),
+                                  replay);
+            continue;
+        }
+
+        replay = g_hash_table_lookup (contexts,
+                                      GUINT_TO_POINTER (event.context));
+        /* the trace started after the input context was created. */
+        if (replay == NULL)
+            continue;
+
+        switch (event.type) {
+        case BUS_TRACE_EVENT_DESTROY:
+            g_hash_table_remove (contexts, GUINT_TO_POINTER (event.context));
+            break;
+        case BUS_TRACE_EVENT_FOCUS_IN:
+            ibus_input_context_focus_in (replay->context);
+            break;
+        case BUS_TRACE_EVENT_FOCUS_OUT:
+            ibus_input_context_focus_out (replay->context);
+            break;
+        case BUS_TRACE_EVENT_CAPABILITIES:
+            ibus_input_context_set_capabilities (replay->context,
+                                                 event.args[0]);
+            break;
+        case BUS_TRACE_EVENT_ENGINE:
+            /* the input contexts share the global engine. */
+            if (event.payload != NULL &&
+                g_strcmp0 (event.payload, engine_name) != 0) {
+                g_free (engine_name);
+                engine_name = g_strdup (event.payload);
+                if (!ibus_bus_set_global_engine (bus, engine_name))
+                    g_printerr ("Cannot set the engine %s\n", engine_name);
+            }
+            break;
+        case BUS_TRACE_EVENT_SURROUNDING_TEXT:
+            ibus_input_context_set_surrounding_text (
+                    replay->context,
+                    ibus_text_new_from_string (event.payload ? event.payload
+                                                             : ""),
+                    event.args[0],
+                    event.args[1]);
+            break;
+        case BUS_TRACE_EVENT_KEY: {
+            gint64 sent_time = g_get_monotonic_time ();
+            gboolean handled = ibus_input_context_process_key_event (
+                    replay->context,
+                    event.args[0],
+                    event.args[1],
+                    event.args[2]);
+            bus_latency_histogram_record (
+                    &replayed,
+                    g_get_monotonic_time () - sent_time);
+            g_queue_push_tail (&replay->handled,
+                               GUINT_TO_POINTER (handled));
+            break;
+        }
+        case BUS_TRACE_EVENT_KEY_REPLY:
+            bus_latency_histogram_record (&recorded, event.args[1]);
+            if (g_queue_is_empty (&replay->handled))
+                break;
+            if (GPOINTER_TO_UINT (g_queue_pop_head (&replay->handled)) !=
+                (event.args[0] != 0)) {
+                n_differences++;
+            }
+            break;
+        default:
+            /* an event of a newer ibus-daemon */
+            break;
+        }
+    }
+    dispatch_pending_events ();
+
+    g_print ("%-8s %8s %8s %8s %8s %8s (usec)\n",
+             "", "keys", "p50", "p90", "p99", "max");
+    print_histogram ("trace", &recorded);
+    print_histogram ("replay", &replayed);
+    g_print ("%u key events were handled differently\n", n_differences);
+
+    g_hash_table_destroy (contexts);
+    g_free (engine_name);
+    bus_trace_reader_free (reader);
+    g_object_unref (bus);
+
+    return n_differences == 0 ? 0 : 1;
+}
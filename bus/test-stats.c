@@ -0,0 +1,177 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include "stats.h"
+
+static void
+test_histogram (void)
+{
+    BusLatencyHistogram histogram = { 0, };
+    gint64 p50, p99;
+    gint64 i;
+
+    g_assert (bus_latency_histogram_get_percentile (&histogram, 50) == 0);
+
+    /* 1..1000 usec */
+    for (i = 1; i <= 1000; i++)
+        bus_latency_histogram_record (&histogram, i);
+    g_assert (histogram.count == 1000);
+    g_assert (histogram.max == 1000);
+
+    /* a bucket is at most 1/8 of its values wide. */
+    p50 = bus_latency_histogram_get_percentile (&histogram, 50);
+    g_assert (p50 >= 500 && p50 <= 500 + 500 / 8);
+    p99 = bus_latency_histogram_get_percentile (&histogram, 99);
+    g_assert (p99 >= 990 && p99 <= 990 + 990 / 8);
+    g_assert (bus_latency_histogram_get_percentile (&histogram, 100) == 1000);
+    g_assert (bus_latency_histogram_get_percentile (&histogram, 0) == 1);
+
+    /* small values are exact and huge values do not overflow. */
+    bus_latency_histogram_record (&histogram, 0);
+    bus_latency_histogram_record (&histogram, G_MAXINT64);
+    g_assert (histogram.max == G_MAXINT64);
+    g_assert (bus_latency_histogram_get_percentile (&histogram, 0) == 0);
+}
+
+static void
+test_engine_key_latency (void)
+{
+    BusLatencyHistogram *histogram;
+    GVariant *latencies;
+    const gchar *name;
+    guint64 count, p50, p99, max;
+
+    histogram = bus_stats_get_engine_key_latency ("xkb:us::eng");
+    g_assert (histogram == bus_stats_get_engine_key_latency ("xkb:us::eng"));
+    bus_latency_histogram_record (histogram, 3);
+
+    latencies = g_variant_ref_sink (bus_stats_get_engine_key_latencies ());
+    g_assert (g_variant_n_children (latencies) == 1);
+    g_variant_get_child (latencies, 0, "(&s(tttt))",
+                         &name, &count, &p50, &p99, &max);
+    g_assert_cmpstr (name, ==, "xkb:us::eng");
+    g_assert (count == 1 && p50 == 3 && p99 == 3 && max == 3);
+    g_variant_unref (latencies);
+}
+
+static void
+test_engine_key_deadlines (void)
+{
+    BusEngineStats *stats;
+    GVariant *deadlines;
+    const gchar *name;
+    gboolean degraded;
+    guint64 n_misses, n_late_handled;
+
+    stats = bus_stats_get_engine ("xkb:us::eng");
+    g_assert (&stats->key_latency ==
+              bus_stats_get_engine_key_latency ("xkb:us::eng"));
+    stats->degraded = TRUE;
+    stats->n_deadline_misses = 2;
+    stats->n_late_handled = 1;
+
+    deadlines = g_variant_ref_sink (bus_stats_get_engine_key_deadlines ());
+    g_assert (g_variant_n_children (deadlines) == 1);
+    g_variant_get_child (deadlines, 0, "(&sbtt)",
+                         &name, &degraded, &n_misses, &n_late_handled);
+    g_assert_cmpstr (name, ==, "xkb:us::eng");
+    g_assert (degraded && n_misses == 2 && n_late_handled == 1);
+    g_variant_unref (deadlines);
+}
+
+static void
+test_message_counts (void)
+{
+    GDBusMessage *message;
+    GVariant *counts;
+    guint64 count = 0;
+    gint i;
+
+    message = g_dbus_message_new_method_call (NULL,
+                                              "/org/freedesktop/IBus",
+                                              "org.freedesktop.IBus",
+                                              "Ping");
+    /* not counted until the counts are read. */
+    bus_stats_count_message (message);
+    counts = g_variant_ref_sink (bus_stats_get_message_counts ());
+    g_assert (g_variant_n_children (counts) == 0);
+    g_variant_unref (counts);
+
+    bus_stats_count_message (message);
+    bus_stats_count_message (message);
+    counts = g_variant_ref_sink (bus_stats_get_message_counts ());
+    g_assert (g_variant_lookup (counts, "Ping", "t", &count));
+    g_assert (count == 2);
+    g_variant_unref (counts);
+    g_object_unref (message);
+
+    /* the members over the limit are counted together. */
+    for (i = 0; i < BUS_STATS_MAX_MESSAGE_MEMBERS + 1; i++) {
+        gchar *member = g_strdup_printf ("Method%d", i);
+        message = g_dbus_message_new_method_call (NULL,
+                                                  "/org/freedesktop/IBus",
+                                                  "org.freedesktop.IBus",
+                                                  member);
+        bus_stats_count_message (message);
+        g_object_unref (message);
+        g_free (member);
+    }
+    counts = g_variant_ref_sink (bus_stats_get_message_counts ());
+    g_assert (g_variant_n_children (counts) ==
+              BUS_STATS_MAX_MESSAGE_MEMBERS + 1);
+    g_assert (g_variant_lookup (counts,
+                                BUS_STATS_OTHER_MESSAGE_MEMBER,
+                                "t",
+                                &count));
+    g_assert (count == 2);
+    g_variant_unref (counts);
+}
+
+static void
+test_slow_key_events (void)
+{
+    GVariant *events;
+    guint64 serial, latency;
+    gint64 time;
+    const gchar *client, *engine_name;
+    gint i;
+
+    /* fast key events are not kept. */
+    bus_stats_record_slow_key_event ("test", "xkb:us::eng",
+                                     BUS_STATS_SLOW_KEY_EVENT_USEC - 1);
+    events = g_variant_ref_sink (bus_stats_get_slow_key_events ());
+    g_assert (g_variant_n_children (events) == 0);
+    g_variant_unref (events);
+
+    /* only the latest events are kept from the oldest one. */
+    for (i = 0; i < BUS_STATS_N_SLOW_KEY_EVENTS + 2; i++) {
+        bus_stats_record_slow_key_event (
+                "test", i % 2 ? NULL : "xkb:us::eng",
+                BUS_STATS_SLOW_KEY_EVENT_USEC + i);
+    }
+    events = g_variant_ref_sink (bus_stats_get_slow_key_events ());
+    g_assert (g_variant_n_children (events) == BUS_STATS_N_SLOW_KEY_EVENTS);
+    g_variant_get_child (events, 0, "(tx&s&st)",
+                         &serial, &time, &client, &engine_name, &latency);
+    g_assert (serial == 3);
+    g_assert (latency == BUS_STATS_SLOW_KEY_EVENT_USEC + 2);
+    g_assert_cmpstr (client, ==, "test");
+    g_assert_cmpstr (engine_name, ==, "xkb:us::eng");
+    g_variant_get_child (events, BUS_STATS_N_SLOW_KEY_EVENTS - 1,
+                         "(tx&s&st)",
+                         &serial, &time, &client, &engine_name, &latency);
+    g_assert (serial == BUS_STATS_N_SLOW_KEY_EVENTS + 2);
+    g_assert_cmpstr (engine_name, ==, "");
+    g_variant_unref (events);
+}
+
+int
+main(gint argc, gchar **argv)
+{
+    test_histogram ();
+    test_engine_key_latency ();
+    test_engine_key_deadlines ();
+    test_message_counts ();
+    test_slow_key_events ();
+
+    return 0;
+}
@@ -0,0 +1,59 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include <glib/gstdio.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+int
+main(gint argc, gchar **argv)
+{
+    BusTraceReader *reader;
+    BusTraceEvent event;
+    GError *error = NULL;
+    gchar *filename;
+    gint fd;
+
+    fd = g_file_open_tmp ("ibus-trace-XXXXXX", &filename, NULL);
+    g_assert (fd >= 0);
+    close (fd);
+    /* an existing file is not overwritten. */
+    g_assert (!bus_trace_open (filename, &error));
+    g_assert_error (error, G_FILE_ERROR, G_FILE_ERROR_EXIST);
+    g_clear_error (&error);
+    g_unlink (filename);
+
+    g_assert (bus_trace_open (filename, NULL));
+    g_assert (bus_trace_is_recording ());
+    bus_trace_record (BUS_TRACE_EVENT_CREATE, 1, 0, 0, 0, "test");
+    /* fake input contexts are not recorded. */
+    bus_trace_record (BUS_TRACE_EVENT_FOCUS_IN, 0, 0, 0, 0, NULL);
+    bus_trace_record (BUS_TRACE_EVENT_KEY, 1, 'a', 30, G_MAXUINT32, NULL);
+    bus_trace_record (BUS_TRACE_EVENT_ENGINE, 1, 0, 0, 0, "");
+    bus_trace_close ();
+    g_assert (!bus_trace_is_recording ());
+
+    reader = bus_trace_reader_new (filename, &error);
+    g_assert_no_error (error);
+    g_assert (bus_trace_reader_next (reader, &event));
+    g_assert (event.type == BUS_TRACE_EVENT_CREATE);
+    g_assert (event.context == 1);
+    g_assert_cmpstr (event.payload, ==, "test");
+    g_assert (bus_trace_reader_next (reader, &event));
+    g_assert (event.type == BUS_TRACE_EVENT_KEY);
+    g_assert (event.args[0] == 'a');
+    g_assert (event.args[1] == 30);
+    g_assert (event.args[2] == G_MAXUINT32);
+    g_assert (event.payload == NULL);
+    g_assert (event.time >= 0);
+    g_assert (bus_trace_reader_next (reader, &event));
+    g_assert (event.type == BUS_TRACE_EVENT_ENGINE);
+    g_assert (event.payload == NULL);
+    g_assert (!bus_trace_reader_next (reader, &event));
+    bus_trace_reader_free (reader);
+
+    g_unlink (filename);
+    g_free (filename);
+
+    return 0;
+}
@@ -0,0 +1,234 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/* ibus - The Input Bus
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define HEADER_SIZE     (sizeof (BUS_TRACE_MAGIC) + 4)
+#define RECORD_SIZE     28
+/* events are written in blocks of this size, and at focus out. */
+#define BUFFER_SIZE     (64 * 1024)
+
+struct _BusTraceReader {
+    FILE  *file;
+    gchar *payload;
+};
+
+/* the trace being recorded, used only in the main thread */
+static FILE  *trace_file;
+static gint64 trace_start_time;
+
+static void
+put_uint32 (guint8 *p, guint32 value)
+{
+    value = GUINT32_TO_LE (value);
+    memcpy (p, &value, 4);
+}
+
+static guint32
+get_uint32 (const guint8 *p)
+{
+    guint32 value;
+    memcpy (&value, p, 4);
+    return GUINT32_FROM_LE (value);
+}
+
+gboolean
+bus_trace_open (const gchar *filename,
+                GError     **error)
+{
+    guint8 header[HEADER_SIZE];
+    gint fd;
+
+    g_assert (filename != NULL);
+
+    bus_trace_close ();
+    /* the trace has the typed keys: create a new file which only the user
+     * can read, and never follow a symbolic link or reuse a file. */
+    fd = g_open (filename, O_CREAT | O_EXCL | O_WRONLY | O_CLOEXEC, 0600);
+    if (fd >= 0)
+        trace_file = fdopen (fd, "wb");
+    if (trace_file == NULL) {
+        int errsv = errno;
+        if (fd >= 0)
+            close (fd);
+        g_set_error (error,
+                     G_FILE_ERROR,
+                     g_file_error_from_errno (errsv),
+                     "Cannot create %s: %s",
+                     filename, g_strerror (errsv));
+        return FALSE;
+    }
+    setvbuf (trace_file, NULL, _IOFBF, BUFFER_SIZE);
+
+    memcpy (header, BUS_TRACE_MAGIC, sizeof (BUS_TRACE_MAGIC));
+    put_uint32 (header + sizeof (BUS_TRACE_MAGIC), BUS_TRACE_VERSION);
+    fwrite (header, sizeof (header), 1, trace_file);
+    trace_start_time = g_get_monotonic_time ();
+    return TRUE;
+}
+
+void
+bus_trace_close (void)
+{
+    if (trace_file == NULL)
+        return;
+    fclose (trace_file);
+    trace_file = NULL;
+}
+
+gboolean
+bus_trace_is_recording (void)
+{
+    return trace_file != NULL;
+}
+
+void
+bus_trace_record (BusTraceEventType type,
+                  guint32           context,
+                  guint32           arg0,
+                  guint32           arg1,
+                  guint32           arg2,
+                  const gchar      *payload)
+{
+    guint8 record[RECORD_SIZE];
+    gsize length = 0;
+    guint64 time;
+
+    if (trace_file == NULL || context == 0)
+        return;
+
+    if (payload != NULL)
+        length = MIN (strlen (payload), G_MAXUINT16);
+    time = GUINT64_TO_LE (g_get_monotonic_time () - trace_start_time);
+
+    record[0] = type;
+    record[1] = 0;
+    record[2] = length & 0xff;
+    record[3] = length >> 8;
+    put_uint32 (record + 4, context);
+    memcpy (record + 8, &time, 8);
+    put_uint32 (record + 16, arg0);
+    put_uint32 (record + 20, arg1);
+    put_uint32 (record + 24, arg2);
+
+    fwrite (record, sizeof (record), 1, trace_file);
+    if (length > 0)
+        fwrite (payload, length, 1, trace_file);
+
+    /* keep the trace readable while ibus-daemon runs. */
+    if (type == BUS_TRACE_EVENT_FOCUS_OUT)
+        fflush (trace_file);
+}
+
+BusTraceReader *
+bus_trace_reader_new (const gchar *filename,
+                      GError     **error)
+{
+    BusTraceReader *reader;
+    guint8 header[HEADER_SIZE];
+    FILE *file;
+
+    g_assert (filename != NULL);
+
+    file = g_fopen (filename, "rb");
+    if (file == NULL) {
+        int errsv = errno;
+        g_set_error (error,
+                     G_FILE_ERROR,
+                     g_file_error_from_errno (errsv),
+                     "Cannot open %s: %s",
+                     filename, g_strerror (errsv));
+        return NULL;
+    }
+    if (fread (header, sizeof (header), 1, file) != 1 ||
+        memcmp (header, BUS_TRACE_MAGIC, sizeof (BUS_TRACE_MAGIC)) != 0) {
+        g_set_error (error,
+                     G_FILE_ERROR,
+                     G_FILE_ERROR_INVAL,
+                     "%s is not a trace of ibus-daemon",
+                     filename);
+        fclose (file);
+        return NULL;
+    }
+    if (get_uint32 (header + sizeof (BUS_TRACE_MAGIC)) != BUS_TRACE_VERSION) {
+        g_set_error (error,
+                     G_FILE_ERROR,
+                     G_FILE_ERROR_INVAL,
+                     "The version %u of %s is not supported",
+                     get_uint32 (header + sizeof (BUS_TRACE_MAGIC)),
+                     filename);
+        fclose (file);
+        return NULL;
+    }
+
+    reader = g_slice_new0 (BusTraceReader);
+    reader->file = file;
+    return reader;
+}
+
+gboolean
+bus_trace_reader_next (BusTraceReader *reader,
+                       BusTraceEvent  *event)
+{
+    guint8 record[RECORD_SIZE];
+    guint64 time;
+    gsize length;
+
+    g_assert (reader != NULL);
+    g_assert (event != NULL);
+
+    g_clear_pointer (&reader->payload, g_free);
+    if (fread (record, sizeof (record), 1, reader->file) != 1)
+        return FALSE;
+
+    length = record[2] | (record[3] << 8);
+    if (length > 0) {
+        reader->payload = g_malloc (length + 1);
+        if (fread (reader->payload, length, 1, reader->file) != 1)
+            return FALSE;
+        reader->payload[length] = '\0';
+    }
+
+    memcpy (&time, record + 8, 8);
+    event->type = record[0];
+    event->context = get_uint32 (record + 4);
+    event->time = (gint64) GUINT64_FROM_LE (time);
+    event->args[0] = get_uint32 (record + 16);
+    event->args[1] = get_uint32 (record + 20);
+    event->args[2] = get_uint32 (record + 24);
+    event->payload = reader->payload;
+    return TRUE;
+}
+
+void
+bus_trace_reader_free (BusTraceReader *reader)
+{
+    g_assert (reader != NULL);
+
+    fclose (reader->file);
+    g_free (reader->payload);
+    g_slice_free (BusTraceReader, reader);
+}
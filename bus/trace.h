@@ -0,0 +1,152 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/* ibus - The Input Bus
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#ifndef __BUS_TRACE_H_
+#define __BUS_TRACE_H_
+
+#include <glib.h>
+
+/*
+ * A trace of the input context events which ibus-daemon receives, written
+ * with the --trace option and replayed with test-replay.
+ *
+ * The file starts with the 8 bytes of BUS_TRACE_MAGIC and a 32 bit
+ * version. Each event is a 28 bytes record of the type (8 bits), a zero
+ * byte, the length of the payload (16 bits), the context (32 bits), the
+ * time (64 bits) and three arguments (32 bits each), followed by the
+ * payload. The numbers are little endian.
+ */
+
+G_BEGIN_DECLS
+
+#define BUS_TRACE_MAGIC     "IBUSTRC"
+#define BUS_TRACE_VERSION   1
+
+/**
+ * BusTraceEventType:
+ * @BUS_TRACE_EVENT_CREATE: An input context is created. The payload is
+ *     the client name.
+ * @BUS_TRACE_EVENT_DESTROY: The input context is destroyed.
+ * @BUS_TRACE_EVENT_FOCUS_IN: The input context gets the focus.
+ * @BUS_TRACE_EVENT_FOCUS_OUT: The input context loses the focus.
+ * @BUS_TRACE_EVENT_CAPABILITIES: The first argument is the capabilities.
+ * @BUS_TRACE_EVENT_ENGINE: The engine of the input context is changed.
+ *     The payload is the engine name, which is empty without an engine.
+ * @BUS_TRACE_EVENT_SURROUNDING_TEXT: The arguments are the cursor and the
+ *     anchor positions and the payload is the text. Not recorded for
+ *     password and PIN entries.
+ * @BUS_TRACE_EVENT_KEY: A key event is received. The arguments are the
+ *     keyval, the keycode and the modifiers. Not recorded for password and
+ *     PIN entries, and neither is its reply.
+ * @BUS_TRACE_EVENT_KEY_REPLY: The earliest key event without a reply of
+ *     the input context is answered. The arguments are whether it was
+ *     handled and its latency in microseconds.
+ */
+typedef enum {
+    BUS_TRACE_EVENT_CREATE = 1,
+    BUS_TRACE_EVENT_DESTROY,
+    BUS_TRACE_EVENT_FOCUS_IN,
+    BUS_TRACE_EVENT_FOCUS_OUT,
+    BUS_TRACE_EVENT_CAPABILITIES,
+    BUS_TRACE_EVENT_ENGINE,
+    BUS_TRACE_EVENT_SURROUNDING_TEXT,
+    BUS_TRACE_EVENT_KEY,
+    BUS_TRACE_EVENT_KEY_REPLY,
+} BusTraceEventType;
+
+typedef struct _BusTraceEvent BusTraceEvent;
+typedef struct _BusTraceReader BusTraceReader;
+
+/**
+ * BusTraceEvent:
+ * @type: The type of the event.
+ * @context: The number of the input context, which is not 0.
+ * @time: The microseconds since the trace was opened.
+ * @args: The arguments of the event.
+ * @payload: (nullable): The payload or %NULL if it is empty. It is owned
+ *     by the reader and valid until the next event is read.
+ */
+struct _BusTraceEvent {
+    BusTraceEventType type;
+    guint32           context;
+    gint64            time;
+    guint32           args[3];
+    const gchar      *payload;
+};
+
+/**
+ * bus_trace_open:
+ * @filename: The file to write the trace to.
+ * @returns: %FALSE if the file cannot be created or it exists.
+ *
+ * Start recording the events of the input contexts. The file is created
+ * with the mode 0600.
+ */
+gboolean         bus_trace_open                 (const gchar    *filename,
+                                                 GError        **error);
+
+/**
+ * bus_trace_close:
+ *
+ * Stop recording and write the buffered events to the file.
+ */
+void             bus_trace_close                (void);
+
+/**
+ * bus_trace_record:
+ * @context: The number of the input context. Nothing is recorded for 0.
+ * @payload: (nullable): A string which is truncated to 65535 bytes.
+ *
+ * Append an event to the trace. It does nothing when no trace is open.
+ */
+void             bus_trace_record               (BusTraceEventType
+                                                                 type,
+                                                 guint32         context,
+                                                 guint32         arg0,
+                                                 guint32         arg1,
+                                                 guint32         arg2,
+                                                 const gchar    *payload);
+
+/**
+ * bus_trace_is_recording:
+ * @returns: %TRUE if a trace is open.
+ */
+gboolean         bus_trace_is_recording         (void);
+
+/**
+ * bus_trace_reader_new:
+ * @filename: The file of a trace.
+ * @returns: (nullable): A new reader or %NULL if the file is not a trace.
+ */
+BusTraceReader  *bus_trace_reader_new           (const gchar    *filename,
+                                                 GError        **error);
+
+/**
+ * bus_trace_reader_next:
+ * @event: (out): The next event.
+ * @returns: %FALSE at the end of the trace. A truncated last event, which
+ *     ibus-daemon leaves when it is killed while writing, is ignored.
+ */
+gboolean         bus_trace_reader_next          (BusTraceReader *reader,
+                                                 BusTraceEvent  *event);
+
+void             bus_trace_reader_free          (BusTraceReader *reader);
+
+G_END_DECLS
+#endif
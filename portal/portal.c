@@ -247,6 +247,19 @@ ibus_dbus_context_set_surrounding_text (IBusDbusInputContext  *object,
     return _forward_method (object, invocation);
 }
 
+static gboolean
+ibus_dbus_context_set_surrounding_text_delta (IBusDbusInputContext  *object,
+                                              GDBusMethodInvocation *invocation,
+                                              guint                  arg_revision,
+                                              guint                  arg_offset,
+                                              guint                  arg_n_deleted,
+                                              const gchar           *arg_inserted,
+                                              guint                  arg_cursor_pos,
+                                              guint                  arg_anchor_pos)
+{
+    return _forward_method (object, invocation);
+}
+
 static void
 ibus_portal_context_iface_init (IBusDbusInputContextIface *iface)
 {
@@ -265,6 +278,8 @@ ibus_portal_context_iface_init (IBusDbusInputContextIface *iface)
             ibus_dbus_context_set_cursor_location_relative;
     iface->handle_set_engine = ibus_dbus_context_set_engine;
     iface->handle_set_surrounding_text = ibus_dbus_context_set_surrounding_text;
+    iface->handle_set_surrounding_text_delta =
+            ibus_dbus_context_set_surrounding_text_delta;
 }
 
 static void
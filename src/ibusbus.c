@@ -31,6 +31,7 @@
 #include "ibusbus.h"
 #include "ibusmarshalers.h"
 #include "ibusinternal.h"
+#include "ibuskeychannel.h"
 #include "ibusshare.h"
 #include "ibusenginedesc.h"
 #include "ibusserializable.h"
@@ -64,6 +65,7 @@ struct _IBusBusPrivate {
     gboolean watch_ibus_signal;
     guint watch_global_engine_changed_id;
     guint watch_global_shortcut_key_responded_id;
+    guint watch_global_shortcut_key_filter_id;
     IBusConfig *config;
     gchar *unique_name;
     gboolean connect_async;
@@ -309,19 +311,115 @@ _connection_ibus_signal_cb (GDBusConnection *connection,
         g_signal_emit (IBUS_BUS (user_data),
                        bus_signals[GLOBAL_ENGINE_CHANGED], 0,
                        engine_name);
-    } else if (!g_strcmp0 (signal_name, "GlobalShortcutKeyResponded")) {
-        guchar type = (guchar)IBUS_BUS_GLOBAL_BINDING_TYPE_ANY;
-        guint keyval = 0;
-        guint keycode = 0;
-        guint state = 0;
-        gboolean is_backward = FALSE;
-        g_variant_get (parameters, "(yuuub)",
-                       &type, &keyval, &keycode, &state, &is_backward);
-        g_signal_emit (IBUS_BUS (user_data),
-                       bus_signals[GLOBAL_SHORTCUT_KEY_RESPONDED], 0,
-                       type, keyval, keycode, state, is_backward);
     }
-    /* FIXME handle org.freedesktop.IBus.RegistryChanged signal if needed */
+    /* GlobalShortcutKeyResponded is emitted by
+     * _connection_global_shortcut_key_filter_cb.
+     * FIXME handle org.freedesktop.IBus.RegistryChanged signal if needed */
+}
+
+typedef struct {
+    GWeakRef      bus;
+    /* the main context which emits the signal */
+    GMainContext *context;
+} GlobalShortcutKeyFilterData;
+
+typedef struct {
+    IBusBus      *bus;
+    GVariant     *parameters;
+} GlobalShortcutKeyEmitData;
+
+static void
+_global_shortcut_key_filter_data_free (GlobalShortcutKeyFilterData *filter)
+{
+    g_weak_ref_clear (&filter->bus);
+    g_main_context_unref (filter->context);
+    g_slice_free (GlobalShortcutKeyFilterData, filter);
+}
+
+static void
+_global_shortcut_key_emit_data_free (GlobalShortcutKeyEmitData *data)
+{
+    g_object_unref (data->bus);
+    g_variant_unref (data->parameters);
+    g_slice_free (GlobalShortcutKeyEmitData, data);
+}
+
+static gboolean
+_global_shortcut_key_emit_cb (GlobalShortcutKeyEmitData *data)
+{
+    guchar type = (guchar)IBUS_BUS_GLOBAL_BINDING_TYPE_ANY;
+    guint keyval = 0;
+    guint keycode = 0;
+    guint state = 0;
+    gboolean is_backward = FALSE;
+
+    g_variant_get (data->parameters, "(yuuub)",
+                   &type, &keyval, &keycode, &state, &is_backward);
+    g_signal_emit (data->bus,
+                   bus_signals[GLOBAL_SHORTCUT_KEY_RESPONDED], 0,
+                   type, keyval, keycode, state, is_backward);
+    return G_SOURCE_REMOVE;
+}
+
+/* The signal subscription of GDBus emits the signal in an idle source of
+ * the default priority, so an IME switcher could wait until the next key
+ * press to get the key release. This filter runs in the GDBus worker thread
+ * as soon as the signal is received and emits it in a G_PRIORITY_HIGH
+ * source, which the main loop runs before the other pending events. */
+static GDBusMessage *
+_connection_global_shortcut_key_filter_cb (GDBusConnection *connection,
+                                           GDBusMessage    *message,
+                                           gboolean         incoming,
+                                           gpointer         user_data)
+{
+    GlobalShortcutKeyFilterData *filter =
+            (GlobalShortcutKeyFilterData *) user_data;
+    GlobalShortcutKeyEmitData *data;
+    GVariant *parameters;
+    IBusBus *bus;
+    const gchar *sender;
+    GSource *source;
+
+    if (!incoming ||
+        g_dbus_message_get_message_type (message) !=
+                G_DBUS_MESSAGE_TYPE_SIGNAL ||
+        g_strcmp0 (g_dbus_message_get_member (message),
+                   "GlobalShortcutKeyResponded") != 0 ||
+        g_strcmp0 (g_dbus_message_get_interface (message),
+                   IBUS_INTERFACE_IBUS) != 0 ||
+        g_strcmp0 (g_dbus_message_get_path (message), IBUS_PATH_IBUS) != 0) {
+        return message;
+    }
+    /* ibus-daemon sets the sender of its signals and the unique names of
+     * the clients to the other messages, so another client cannot fake
+     * the signal. */
+    sender = g_dbus_message_get_sender (message);
+    if (g_strcmp0 (sender, IBUS_SERVICE_IBUS) != 0 &&
+        g_strcmp0 (sender, ":1.0") != 0) {
+        return message;
+    }
+    parameters = g_dbus_message_get_body (message);
+    if (parameters == NULL ||
+        !g_variant_is_of_type (parameters, G_VARIANT_TYPE ("(yuuub)"))) {
+        return message;
+    }
+    if ((bus = g_weak_ref_get (&filter->bus)) == NULL)
+        return message;
+
+    data = g_slice_new (GlobalShortcutKeyEmitData);
+    data->bus = bus;
+    data->parameters = g_variant_ref (parameters);
+    source = g_idle_source_new ();
+    g_source_set_priority (source, G_PRIORITY_HIGH);
+    g_source_set_callback (source,
+                           (GSourceFunc) _global_shortcut_key_emit_cb,
+                           data,
+                           (GDestroyNotify) _global_shortcut_key_emit_data_free);
+    g_source_attach (source, filter->context);
+    g_source_unref (source);
+    /* The signal subscription adds the match rule and ignores the
+     * message. */
+    return message;
 }
 
 static void
@@ -591,6 +689,7 @@ ibus_bus_init (IBusBus *bus)
     bus->priv->watch_ibus_signal = FALSE;
     bus->priv->watch_global_engine_changed_id = 0;
     bus->priv->watch_global_shortcut_key_responded_id = 0;
+    bus->priv->watch_global_shortcut_key_filter_id = 0;
     bus->priv->unique_name = NULL;
     bus->priv->connect_async = FALSE;
     bus->priv->client_only = FALSE;
@@ -948,12 +1047,25 @@ ibus_bus_create_input_context (IBusBus      *bus,
         if (context == NULL) {
             g_warning ("ibus_bus_create_input_context: %s", error->message);
             g_error_free (error);
+        } else if (ibus_input_context_use_key_channel () &&
+                   !bus->priv->use_portal) {
+            ibus_input_context_open_key_channel (context);
         }
     }
 
     return context;
 }
 
+static void
+_create_input_context_async_step_three_done (IBusInputContext *context,
+                                             GAsyncResult     *res,
+                                             GTask            *task)
+{
+    /* the key events go through D-Bus if the key channel is not open. */
+    g_task_return_pointer (task, context, NULL);
+    g_object_unref (task);
+}
+
 static void
 _create_input_context_async_step_two_done (GObject      *source_object,
                                            GAsyncResult *res,
@@ -962,10 +1074,22 @@ _create_input_context_async_step_two_done (GObject      *source_object,
     GError *error = NULL;
     IBusInputContext *context =
             ibus_input_context_new_async_finish (res, &error);
-    if (context == NULL)
+    IBusBus *bus = (IBusBus *)g_task_get_source_object (task);
+
+    if (context == NULL) {
         g_task_return_error (task, error);
-    else
+    } else if (ibus_input_context_use_key_channel () &&
+               !bus->priv->use_portal) {
+        ibus_input_context_open_key_channel_async (
+                context,
+                g_task_get_cancellable (task),
+                (GAsyncReadyCallback)
+                        _create_input_context_async_step_three_done,
+                task);
+        return;
+    } else {
         g_task_return_pointer (task, context, NULL);
+    }
     g_object_unref (task);
 }
 
@@ -1196,6 +1320,8 @@ ibus_bus_set_watch_dbus_signal (IBusBus        *bus,
 static void
 ibus_bus_watch_ibus_signal (IBusBus *bus)
 {
+    GlobalShortcutKeyFilterData *filter;
+
     g_return_if_fail (bus->priv->connection != NULL);
     g_return_if_fail (bus->priv->watch_global_engine_changed_id == 0);
 
@@ -1222,6 +1348,15 @@ ibus_bus_watch_ibus_signal (IBusBus *bus)
                                               _connection_ibus_signal_cb,
                                               bus,
                                               NULL /* user_data_free_func */);
+    filter = g_slice_new0 (GlobalShortcutKeyFilterData);
+    g_weak_ref_init (&filter->bus, bus);
+    filter->context = g_main_context_ref_thread_default ();
+    bus->priv->watch_global_shortcut_key_filter_id
+        = g_dbus_connection_add_filter (
+                bus->priv->connection,
+                _connection_global_shortcut_key_filter_cb,
+                filter,
+                (GDestroyNotify) _global_shortcut_key_filter_data_free);
     /* FIXME handle org.freedesktop.IBus.RegistryChanged signal if needed */
 }
 
@@ -1237,6 +1372,10 @@ ibus_bus_unwatch_ibus_signal (IBusBus *bus)
             bus->priv->connection,
             bus->priv->watch_global_shortcut_key_responded_id);
     bus->priv->watch_global_shortcut_key_responded_id = 0;
+    g_dbus_connection_remove_filter (
+            bus->priv->connection,
+            bus->priv->watch_global_shortcut_key_filter_id);
+    bus->priv->watch_global_shortcut_key_filter_id = 0;
 }
 
 void
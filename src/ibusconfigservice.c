@@ -21,6 +21,7 @@
  */
 #include "ibusshare.h"
 #include "ibusconfigservice.h"
+#include "ibusservicemethodtable.h"
 
 enum {
     LAST_SIGNAL,
@@ -30,6 +31,23 @@ enum {
     PROP_0,
 };
 
+enum {
+    CONFIG_METHOD_SET_VALUE,
+    CONFIG_METHOD_GET_VALUE,
+    CONFIG_METHOD_GET_VALUES,
+    CONFIG_METHOD_UNSET_VALUE
+};
+
+/* indexed by the CONFIG_METHOD_* values */
+static const gchar *config_method_names[] = {
+    [CONFIG_METHOD_SET_VALUE] = "SetValue",
+    [CONFIG_METHOD_GET_VALUE] = "GetValue",
+    [CONFIG_METHOD_GET_VALUES] = "GetValues",
+    [CONFIG_METHOD_UNSET_VALUE] = "UnsetValue",
+};
+
+static IBusServiceMethodTable *config_methods;
+
 /* functions prototype */
 static void      ibus_config_service_class_init      (IBusConfigServiceClass *class);
 static void      ibus_config_service_init            (IBusConfigService      *config);
@@ -120,6 +138,12 @@ ibus_config_service_class_init (IBusConfigServiceClass *class)
     IBUS_SERVICE_CLASS (class)->service_set_property = ibus_config_service_service_set_property;
 
     ibus_service_class_add_interfaces (IBUS_SERVICE_CLASS (class), introspection_xml);
+    config_methods = ibus_service_method_table_new (
+            IBUS_SERVICE_CLASS (class),
+            IBUS_INTERFACE_CONFIG,
+            config_method_names,
+            G_N_ELEMENTS (config_method_names),
+            sizeof (config_method_names[0]));
 
     class->set_value   = ibus_config_service_set_value;
     class->get_value   = ibus_config_service_get_value;
@@ -149,8 +173,9 @@ ibus_config_service_service_method_call (IBusService           *service,
                                          GDBusMethodInvocation *invocation)
 {
     IBusConfigService *config = IBUS_CONFIG_SERVICE (service);
+    gint method = ibus_service_method_table_lookup (config_methods, invocation);
 
-    if (g_strcmp0 (interface_name, IBUS_INTERFACE_CONFIG) != 0) {
+    if (method < 0) {
         IBUS_SERVICE_CLASS (ibus_config_service_parent_class)->
                 service_method_call (service,
                                      connection,
@@ -163,7 +188,8 @@ ibus_config_service_service_method_call (IBusService           *service,
         return;
     }
 
-    if (g_strcmp0 (method_name, "SetValue") == 0) {
+    switch (method) {
+    case CONFIG_METHOD_SET_VALUE: {
         gchar *section;
         gchar *name;
         GVariant *value;
@@ -184,7 +210,7 @@ ibus_config_service_service_method_call (IBusService           *service,
         return;
     }
 
-    if (g_strcmp0 (method_name, "GetValue") == 0) {
+    case CONFIG_METHOD_GET_VALUE: {
         gchar *section;
         gchar *name;
         GVariant *value;
@@ -204,7 +230,7 @@ ibus_config_service_service_method_call (IBusService           *service,
         return;
     }
 
-    if (g_strcmp0 (method_name, "GetValues") == 0) {
+    case CONFIG_METHOD_GET_VALUES: {
         gchar *section;
         GVariant *value;
         GError *error = NULL;
@@ -225,7 +251,7 @@ ibus_config_service_service_method_call (IBusService           *service,
         return;
     }
 
-    if (g_strcmp0 (method_name, "UnsetValue") == 0) {
+    case CONFIG_METHOD_UNSET_VALUE: {
         gchar *section;
         gchar *name;
         gboolean retval;
@@ -244,8 +270,10 @@ ibus_config_service_service_method_call (IBusService           *service,
         return;
     }
 
-    /* should not be reached */
-    g_return_if_reached ();
+    default:
+        /* should not be reached */
+        g_return_if_reached ();
+    }
 }
 
 static GVariant *
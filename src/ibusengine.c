@@ -22,12 +22,16 @@
  */
 #include <stdarg.h>
 #include <string.h>
+#include <unistd.h>
+#include <gio/gunixfdlist.h>
 
 #include "ibusaccelgroup.h"
 #include "ibusengine.h"
 #include "ibuskeysyms.h"
 #include "ibusmarshalers.h"
 #include "ibusinternal.h"
+#include "ibusprocesskeyevent.h"
+#include "ibusservicemethodtable.h"
 #include "ibusshare.h"
 #include "ibusxevent.h"
 
@@ -69,6 +73,67 @@ enum {
     PROP_ACTIVE_SURROUNDING_TEXT,
 };
 
+enum {
+    ENGINE_METHOD_PROCESS_KEY_EVENT,
+    ENGINE_METHOD_PROCESS_KEY_EVENTS,
+    ENGINE_METHOD_OPEN_PEER_CONNECTION,
+    ENGINE_METHOD_CLOSE_PEER_CONNECTION,
+    ENGINE_METHOD_PANEL_EXTENSION_RECEIVED,
+    ENGINE_METHOD_PANEL_EXTENSION_REGISTER_KEYS,
+    ENGINE_METHOD_FOCUS_IN,
+    ENGINE_METHOD_FOCUS_OUT,
+    ENGINE_METHOD_RESET,
+    ENGINE_METHOD_ENABLE,
+    ENGINE_METHOD_DISABLE,
+    ENGINE_METHOD_PAGE_UP,
+    ENGINE_METHOD_PAGE_DOWN,
+    ENGINE_METHOD_CURSOR_UP,
+    ENGINE_METHOD_CURSOR_DOWN,
+    ENGINE_METHOD_FOCUS_IN_ID,
+    ENGINE_METHOD_FOCUS_OUT_ID,
+    ENGINE_METHOD_CANDIDATE_CLICKED,
+    ENGINE_METHOD_PROPERTY_ACTIVATE,
+    ENGINE_METHOD_PROPERTY_SHOW,
+    ENGINE_METHOD_PROPERTY_HIDE,
+    ENGINE_METHOD_SET_CURSOR_LOCATION,
+    ENGINE_METHOD_SET_CAPABILITIES,
+    ENGINE_METHOD_SET_SURROUNDING_TEXT,
+    ENGINE_METHOD_SET_SURROUNDING_TEXT_DELTA,
+    ENGINE_METHOD_PROCESS_HAND_WRITING_EVENT,
+    ENGINE_METHOD_CANCEL_HAND_WRITING
+};
+
+/* indexed by the ENGINE_METHOD_* values */
+static const gchar *engine_method_names[] = {
+    [ENGINE_METHOD_PROCESS_KEY_EVENT] = "ProcessKeyEvent",
+    [ENGINE_METHOD_PROCESS_KEY_EVENTS] = "ProcessKeyEvents",
+    [ENGINE_METHOD_OPEN_PEER_CONNECTION] = "OpenPeerConnection",
+    [ENGINE_METHOD_CLOSE_PEER_CONNECTION] = "ClosePeerConnection",
+    [ENGINE_METHOD_PANEL_EXTENSION_RECEIVED] = "PanelExtensionReceived",
+    [ENGINE_METHOD_PANEL_EXTENSION_REGISTER_KEYS] = "PanelExtensionRegisterKeys",
+    [ENGINE_METHOD_FOCUS_IN] = "FocusIn",
+    [ENGINE_METHOD_FOCUS_OUT] = "FocusOut",
+    [ENGINE_METHOD_RESET] = "Reset",
+    [ENGINE_METHOD_ENABLE] = "Enable",
+    [ENGINE_METHOD_DISABLE] = "Disable",
+    [ENGINE_METHOD_PAGE_UP] = "PageUp",
+    [ENGINE_METHOD_PAGE_DOWN] = "PageDown",
+    [ENGINE_METHOD_CURSOR_UP] = "CursorUp",
+    [ENGINE_METHOD_CURSOR_DOWN] = "CursorDown",
+    [ENGINE_METHOD_FOCUS_IN_ID] = "FocusInId",
+    [ENGINE_METHOD_FOCUS_OUT_ID] = "FocusOutId",
+    [ENGINE_METHOD_CANDIDATE_CLICKED] = "CandidateClicked",
+    [ENGINE_METHOD_PROPERTY_ACTIVATE] = "PropertyActivate",
+    [ENGINE_METHOD_PROPERTY_SHOW] = "PropertyShow",
+    [ENGINE_METHOD_PROPERTY_HIDE] = "PropertyHide",
+    [ENGINE_METHOD_SET_CURSOR_LOCATION] = "SetCursorLocation",
+    [ENGINE_METHOD_SET_CAPABILITIES] = "SetCapabilities",
+    [ENGINE_METHOD_SET_SURROUNDING_TEXT] = "SetSurroundingText",
+    [ENGINE_METHOD_SET_SURROUNDING_TEXT_DELTA] = "SetSurroundingTextDelta",
+    [ENGINE_METHOD_PROCESS_HAND_WRITING_EVENT] = "ProcessHandWritingEvent",
+    [ENGINE_METHOD_CANCEL_HAND_WRITING] = "CancelHandWriting",
+};
+
 
 /* IBusEnginePriv */
 struct _IBusEnginePrivate {
@@ -81,6 +146,13 @@ struct _IBusEnginePrivate {
     guint surrounding_cursor_pos;
     guint selection_anchor_pos;
 
+    /* surrounding text last received from ibus-daemon, the base of
+       SetSurroundingTextDelta. surrounding_text cannot be used because
+       subclasses may not chain up set_surrounding_text and
+       ibus_engine_delete_surrounding_text() changes it. */
+    IBusText *received_surrounding_text;
+    guint surrounding_revision;
+
     /* cached content-type */
     guint content_purpose;
     guint content_hints;
@@ -90,10 +162,21 @@ struct _IBusEnginePrivate {
     gchar                 *current_extension_name;
     gboolean               has_focus_id;
     gboolean               has_active_surrounding_text;
+
+    /* a private connection to the client of the input context, which
+       ibus-daemon brokers with OpenPeerConnection. */
+    GDBusConnection       *peer_connection;
+
+    /* commit text and preedit text held back while ProcessKeyEvents is
+       processed, see ibus_engine_flush_key_events_updates() */
+    gboolean               processing_key_events;
+    GString               *key_events_commit_text;
+    GVariant              *key_events_preedit_text;
 };
 
 
 static guint            engine_signals[LAST_SIGNAL] = { 0 };
+static IBusServiceMethodTable *engine_methods;
 
 static IBusText *text_empty;
 
@@ -140,6 +223,12 @@ static gboolean  ibus_engine_process_key_event
                                               guint               keyval,
                                               guint               keycode,
                                               guint               state);
+static void      ibus_engine_process_key_events
+                                             (IBusEngine         *engine,
+                                              const IBusProcessKeyEventData
+                                                                 *keys,
+                                              guint               n_keys,
+                                              gboolean           *handled);
 static void      ibus_engine_focus_in        (IBusEngine         *engine);
 static void      ibus_engine_focus_in_id     (IBusEngine         *engine,
                                               const gchar        *object_path,
@@ -196,6 +285,8 @@ static void      ibus_engine_set_content_type
 static void      ibus_engine_emit_signal     (IBusEngine         *engine,
                                               const gchar        *signal_name,
                                               GVariant           *parameters);
+static void      ibus_engine_close_peer_connection
+                                             (IBusEngine         *engine);
 static void      ibus_engine_dbus_property_changed
                                              (IBusEngine         *engine,
                                               const gchar        *property_name,
@@ -214,6 +305,10 @@ static const gchar introspection_xml[] =
     "      <arg direction='in'  type='u' name='state' />"
     "      <arg direction='out' type='b' />"
     "    </method>"
+    "    <method name='ProcessKeyEvents'>"
+    "      <arg direction='in'  type='a(uuu)' name='keys' />"
+    "      <arg direction='out' type='ay' name='handled' />"
+    "    </method>"
     "    <method name='SetCursorLocation'>"
     "      <arg direction='in'  type='i' name='x' />"
     "      <arg direction='in'  type='i' name='y' />"
@@ -266,12 +361,35 @@ static const gchar introspection_xml[] =
     "      <arg direction='in'  type='u' name='cursor_pos' />"
     "      <arg direction='in'  type='u' name='anchor_pos' />"
     "    </method>"
+    "    <method name='SetSurroundingTextDelta'>"
+    "      <arg direction='in'  type='u' name='revision' />"
+    "      <arg direction='in'  type='u' name='offset' />"
+    "      <arg direction='in'  type='u' name='n_deleted' />"
+    "      <arg direction='in'  type='s' name='inserted' />"
+    "      <arg direction='in'  type='u' name='cursor_pos' />"
+    "      <arg direction='in'  type='u' name='anchor_pos' />"
+    "      <arg direction='out' type='b' name='applied' />"
+    "    </method>"
     "    <method name='PanelExtensionReceived'>"
     "      <arg direction='in'  type='v' name='event' />"
     "    </method>"
     "    <method name='PanelExtensionRegisterKeys'>"
     "      <arg direction='in'  type='v' name='data' />"
     "    </method>"
+    "    <method name='OpenPeerConnection'>"
+    "      <arg direction='in'  type='h' name='fd' />"
+    "      <arg direction='in'  type='s' name='guid' />"
+    "      <annotation name='org.gtk.GDBus.Since'\n"
+    "          value='1.5.33' />\n"
+    "      <annotation name='org.gtk.GDBus.DocString'\n"
+    "          value='Stability: Unstable' />\n"
+    "    </method>"
+    "    <method name='ClosePeerConnection'>"
+    "      <annotation name='org.gtk.GDBus.Since'\n"
+    "          value='1.5.33' />\n"
+    "      <annotation name='org.gtk.GDBus.DocString'\n"
+    "          value='Stability: Unstable' />\n"
+    "    </method>"
     /* FIXME signals */
     "    <signal name='CommitText'>"
     "      <arg type='v' name='text' />"
@@ -340,8 +458,15 @@ ibus_engine_class_init (IBusEngineClass *class)
 
     ibus_service_class_add_interfaces (IBUS_SERVICE_CLASS (class),
                                        introspection_xml);
+    engine_methods = ibus_service_method_table_new (
+            IBUS_SERVICE_CLASS (class),
+            IBUS_INTERFACE_ENGINE,
+            engine_method_names,
+            G_N_ELEMENTS (engine_method_names),
+            sizeof (engine_method_names[0]));
 
     class->process_key_event = ibus_engine_process_key_event;
+    class->process_key_events = ibus_engine_process_key_events;
     class->focus_in     = ibus_engine_focus_in;
     class->focus_in_id  = ibus_engine_focus_in_id;
     class->focus_out    = ibus_engine_focus_out;
@@ -1012,8 +1137,14 @@ ibus_engine_destroy (IBusEngine *engine)
     g_clear_pointer (&priv->current_extension_name, g_free);
     if (priv->surrounding_text)
         g_clear_object (&priv->surrounding_text);
+    g_clear_object (&priv->received_surrounding_text);
+    if (priv->key_events_commit_text)
+        g_string_free (priv->key_events_commit_text, TRUE);
+    priv->key_events_commit_text = NULL;
+    g_clear_pointer (&priv->key_events_preedit_text, g_variant_unref);
     if (priv->extension_keybindings)
         g_clear_pointer (&priv->extension_keybindings, g_hash_table_destroy);
+    ibus_engine_close_peer_connection (engine);
 
     IBUS_OBJECT_CLASS(ibus_engine_parent_class)->destroy (IBUS_OBJECT (engine));
 }
@@ -1161,6 +1292,252 @@ ibus_engine_service_authorized_method (IBusService     *service,
     return FALSE;
 }
 
+/* Pass a key event to the "process-key-event" signal and the keybindings
+ * of the panel extensions. */
+static gboolean
+ibus_engine_dispatch_key_event (IBusEngine *engine,
+                                guint       keyval,
+                                guint       keycode,
+                                guint       state)
+{
+    gboolean retval = FALSE;
+
+    g_signal_emit (engine,
+                   engine_signals[PROCESS_KEY_EVENT],
+                   0,
+                   keyval,
+                   keycode,
+                   state,
+                   &retval);
+    if (!retval)
+        retval = ibus_engine_filter_key_event (engine, keyval, keycode, state);
+    return retval;
+}
+
+static void
+ibus_engine_service_process_key_event (IBusEngine            *engine,
+                                       GVariant              *parameters,
+                                       GDBusMethodInvocation *invocation)
+{
+    guint32 keyval = IBUS_KEY_VoidSymbol;
+    guint32 keycode = 0;
+    guint32 state = 0;
+    gboolean retval = FALSE;
+
+    ibus_process_key_event_args_get (parameters, &keyval, &keycode, &state);
+    retval = ibus_engine_dispatch_key_event (engine, keyval, keycode, state);
+    g_dbus_method_invocation_return_value (
+            invocation,
+            ibus_process_key_event_reply (retval));
+}
+
+/**
+ * ibus_engine_flush_key_events_updates:
+ *
+ * Emit the commit text and the preedit text held back while the keys of
+ * "ProcessKeyEvents" are processed. The texts committed for the keys are
+ * sent as one CommitText signal and only the last preedit text is sent.
+ * Any other signal flushes them first to keep the order seen by the
+ * client.
+ */
+static void
+ibus_engine_flush_key_events_updates (IBusEngine *engine)
+{
+    IBusEnginePrivate *priv = engine->priv;
+    GString *commit_text = priv->key_events_commit_text;
+    GVariant *preedit_text = priv->key_events_preedit_text;
+
+    priv->key_events_commit_text = NULL;
+    priv->key_events_preedit_text = NULL;
+    if (commit_text != NULL) {
+        IBusText *text = ibus_text_new_from_string (commit_text->str);
+        GVariant *variant = ibus_serializable_serialize (
+                (IBusSerializable *)text);
+        ibus_engine_emit_signal (engine,
+                                 "CommitText",
+                                 g_variant_new ("(v)", variant));
+        g_object_unref (text);
+        g_string_free (commit_text, TRUE);
+    }
+    if (preedit_text != NULL) {
+        ibus_engine_emit_signal (engine, "UpdatePreeditText", preedit_text);
+        g_variant_unref (preedit_text);
+    }
+}
+
+/**
+ * ibus_engine_service_process_key_events:
+ *
+ * Implement the "ProcessKeyEvents" method call of the
+ * org.freedesktop.IBus.Engine interface.
+ */
+static void
+ibus_engine_service_process_key_events (IBusEngine            *engine,
+                                        GVariant              *parameters,
+                                        GDBusMethodInvocation *invocation)
+{
+    IBusEnginePrivate *priv = engine->priv;
+    const IBusProcessKeyEventData *keys;
+    gsize n_keys = 0;
+    gboolean *handled;
+    guint8 *bitmap;
+    gsize i;
+
+    keys = ibus_process_key_events_args_get (parameters, &n_keys);
+    handled = g_new0 (gboolean, n_keys);
+    bitmap = g_new0 (guint8, (n_keys + 7) / 8);
+
+    priv->processing_key_events = TRUE;
+    IBUS_ENGINE_GET_CLASS (engine)->process_key_events (engine,
+                                                        keys,
+                                                        n_keys,
+                                                        handled);
+    priv->processing_key_events = FALSE;
+    ibus_engine_flush_key_events_updates (engine);
+
+    for (i = 0; i < n_keys; i++) {
+        if (handled[i])
+            bitmap[i / 8] |= 1 << (i % 8);
+    }
+    g_dbus_method_invocation_return_value (
+            invocation,
+            ibus_process_key_events_reply_new (bitmap, n_keys));
+    g_free (bitmap);
+    g_free (handled);
+}
+
+static void
+ibus_engine_peer_connection_closed_cb (GDBusConnection *connection,
+                                       gboolean         remote_peer_vanished,
+                                       GError          *error,
+                                       IBusEngine      *engine)
+{
+    IBusEnginePrivate *priv = engine->priv;
+
+    if (priv->peer_connection != connection)
+        return;
+    g_signal_handlers_disconnect_by_func (
+            connection,
+            G_CALLBACK (ibus_engine_peer_connection_closed_cb),
+            engine);
+    g_clear_object (&priv->peer_connection);
+}
+
+static void
+ibus_engine_close_peer_connection (IBusEngine *engine)
+{
+    IBusEnginePrivate *priv = engine->priv;
+    GDBusConnection *connection = priv->peer_connection;
+
+    if (connection == NULL)
+        return;
+    priv->peer_connection = NULL;
+    g_signal_handlers_disconnect_by_func (
+            connection,
+            G_CALLBACK (ibus_engine_peer_connection_closed_cb),
+            engine);
+    /* ibus_service_connection_closed_cb() unregisters the engine. */
+    g_dbus_connection_close (connection, NULL, NULL, NULL);
+    g_object_unref (connection);
+}
+
+static void
+ibus_engine_peer_connection_new_cb (GObject      *source,
+                                    GAsyncResult *res,
+                                    IBusEngine   *engine)
+{
+    IBusEnginePrivate *priv = engine->priv;
+    GError *error = NULL;
+    GDBusConnection *connection = g_dbus_connection_new_finish (res, &error);
+
+    if (connection == NULL) {
+        g_warning ("Failed to open the peer connection: %s", error->message);
+        g_error_free (error);
+        g_object_unref (engine);
+        return;
+    }
+    if (IBUS_OBJECT_DESTROYED (engine) ||
+        !ibus_service_register ((IBusService *)engine, connection, &error)) {
+        if (error) {
+            g_warning ("Failed to register the engine on the peer "
+                       "connection: %s", error->message);
+            g_error_free (error);
+        }
+        g_dbus_connection_close (connection, NULL, NULL, NULL);
+        g_object_unref (connection);
+        g_object_unref (engine);
+        return;
+    }
+
+    ibus_engine_close_peer_connection (engine);
+    priv->peer_connection = connection;
+    g_signal_connect (connection, "closed",
+                      G_CALLBACK (ibus_engine_peer_connection_closed_cb),
+                      engine);
+    g_dbus_connection_start_message_processing (connection);
+    g_object_unref (engine);
+}
+
+/**
+ * ibus_engine_service_open_peer_connection:
+ *
+ * Implement the "OpenPeerConnection" method call. ibus-daemon passes one
+ * end of a socket pair and gives the other end to the client of the input
+ * context, which sends "ProcessKeyEvent" to the engine over it without
+ * a hop through ibus-daemon.
+ */
+static void
+ibus_engine_service_open_peer_connection (IBusEngine            *engine,
+                                          GVariant              *parameters,
+                                          GDBusMethodInvocation *invocation)
+{
+    GUnixFDList *fd_list = g_dbus_message_get_unix_fd_list (
+            g_dbus_method_invocation_get_message (invocation));
+    gint32 handle = -1;
+    const gchar *guid = NULL;
+    GError *error = NULL;
+    GSocket *socket;
+    GSocketConnection *stream;
+    gint fd;
+
+    g_variant_get (parameters, "(h&s)", &handle, &guid);
+    if (fd_list == NULL) {
+        g_dbus_method_invocation_return_error (
+                invocation,
+                G_DBUS_ERROR,
+                G_DBUS_ERROR_INVALID_ARGS,
+                "OpenPeerConnection needs a file descriptor.");
+        return;
+    }
+    fd = g_unix_fd_list_get (fd_list, handle, &error);
+    if (fd < 0) {
+        g_dbus_method_invocation_return_gerror (invocation, error);
+        g_error_free (error);
+        return;
+    }
+    socket = g_socket_new_from_fd (fd, &error);
+    if (socket == NULL) {
+        close (fd);
+        g_dbus_method_invocation_return_gerror (invocation, error);
+        g_error_free (error);
+        return;
+    }
+    stream = g_socket_connection_factory_create_connection (socket);
+    g_dbus_connection_new (G_IO_STREAM (stream),
+                           guid,
+                           G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_SERVER |
+                           G_DBUS_CONNECTION_FLAGS_DELAY_MESSAGE_PROCESSING,
+                           NULL,
+                           NULL,
+                           (GAsyncReadyCallback)
+                                   ibus_engine_peer_connection_new_cb,
+                           g_object_ref (engine));
+    g_object_unref (stream);
+    g_object_unref (socket);
+    /* The client authenticates only after ibus-daemon gets this reply. */
+    g_dbus_method_invocation_return_value (invocation, NULL);
+}
+
 static void
 ibus_engine_service_panel_extension_register_keys (IBusEngine      *engine,
                                                    GVariant        *parameters,
@@ -1264,8 +1641,11 @@ ibus_engine_service_method_call (IBusService           *service,
 {
     IBusEngine *engine = IBUS_ENGINE (service);
     IBusEnginePrivate *priv = engine->priv;
+    gint method;
+    guint signal_id = 0;
 
-    if (g_strcmp0 (interface_name, IBUS_INTERFACE_ENGINE) != 0) {
+    method = ibus_service_method_table_lookup (engine_methods, invocation);
+    if (method < 0) {
         IBUS_SERVICE_CLASS (ibus_engine_parent_class)->
                 service_method_call (service,
                                      connection,
@@ -1278,32 +1658,42 @@ ibus_engine_service_method_call (IBusService           *service,
         return;
     }
 
-    if (!ibus_engine_service_authorized_method (service, connection))
-        return;
-
-    if (g_strcmp0 (method_name, "ProcessKeyEvent") == 0) {
-        guint keyval, keycode, state;
-        gboolean retval = FALSE;
-
-        g_variant_get (parameters, "(uuu)", &keyval, &keycode, &state);
-        g_signal_emit (engine,
-                       engine_signals[PROCESS_KEY_EVENT],
-                       0,
-                       keyval,
-                       keycode,
-                       state,
-                       &retval);
-        if (!retval) {
-            retval = ibus_engine_filter_key_event (engine,
-                                                   keyval,
-                                                   keycode,
-                                                   state);
+    if (connection == priv->peer_connection) {
+        /* The client of the peer connection can only send key events. */
+        if (method != ENGINE_METHOD_PROCESS_KEY_EVENT) {
+            g_dbus_method_invocation_return_error (
+                    invocation,
+                    G_DBUS_ERROR,
+                    G_DBUS_ERROR_ACCESS_DENIED,
+                    "%s is not allowed on the peer connection.",
+                    method_name);
+            return;
         }
-        g_dbus_method_invocation_return_value (invocation,
-                                               g_variant_new ("(b)", retval));
+    } else if (!ibus_engine_service_authorized_method (service, connection)) {
         return;
     }
-    if (g_strcmp0 (method_name, "PanelExtensionReceived") == 0) {
+
+    switch (method) {
+    case ENGINE_METHOD_PROCESS_KEY_EVENT:
+        ibus_engine_service_process_key_event (engine,
+                                               parameters,
+                                               invocation);
+        return;
+    case ENGINE_METHOD_PROCESS_KEY_EVENTS:
+        ibus_engine_service_process_key_events (engine,
+                                                parameters,
+                                                invocation);
+        return;
+    case ENGINE_METHOD_OPEN_PEER_CONNECTION:
+        ibus_engine_service_open_peer_connection (engine,
+                                                  parameters,
+                                                  invocation);
+        return;
+    case ENGINE_METHOD_CLOSE_PEER_CONNECTION:
+        ibus_engine_close_peer_connection (engine);
+        g_dbus_method_invocation_return_value (invocation, NULL);
+        return;
+    case ENGINE_METHOD_PANEL_EXTENSION_RECEIVED: {
         GVariant *arg0 = NULL;
         IBusExtensionEvent *event = NULL;
 
@@ -1335,38 +1725,41 @@ ibus_engine_service_method_call (IBusService           *service,
         g_dbus_method_invocation_return_value (invocation, NULL);
         return;
     }
-    if (g_strcmp0 (method_name, "PanelExtensionRegisterKeys") == 0) {
+    case ENGINE_METHOD_PANEL_EXTENSION_REGISTER_KEYS:
         ibus_engine_service_panel_extension_register_keys (engine,
                                                            parameters,
                                                            invocation);
         return;
-    }
 
-    static const struct {
-        gchar *member;
-        guint  signal_id;
-    } no_arg_methods[] = {
-        { "FocusIn",     FOCUS_IN },
-        { "FocusOut",    FOCUS_OUT },
-        { "Reset",       RESET },
-        { "Enable",      ENABLE },
-        { "Disable",     DISABLE },
-        { "PageUp",      PAGE_UP },
-        { "PageDown",    PAGE_DOWN },
-        { "CursorUp",    CURSOR_UP },
-        { "CursorDown",  CURSOR_DOWN },
-    };
-
-    gint i;
-    for (i = 0; i < G_N_ELEMENTS (no_arg_methods); i++) {
-        if (g_strcmp0 (method_name, no_arg_methods[i].member) == 0) {
-            g_signal_emit (engine, engine_signals[no_arg_methods[i].signal_id], 0);
-            g_dbus_method_invocation_return_value (invocation, NULL);
-            return;
-        }
-    }
+    case ENGINE_METHOD_FOCUS_IN:
+        signal_id = FOCUS_IN;
+        break;
+    case ENGINE_METHOD_FOCUS_OUT:
+        signal_id = FOCUS_OUT;
+        break;
+    case ENGINE_METHOD_RESET:
+        signal_id = RESET;
+        break;
+    case ENGINE_METHOD_ENABLE:
+        signal_id = ENABLE;
+        break;
+    case ENGINE_METHOD_DISABLE:
+        signal_id = DISABLE;
+        break;
+    case ENGINE_METHOD_PAGE_UP:
+        signal_id = PAGE_UP;
+        break;
+    case ENGINE_METHOD_PAGE_DOWN:
+        signal_id = PAGE_DOWN;
+        break;
+    case ENGINE_METHOD_CURSOR_UP:
+        signal_id = CURSOR_UP;
+        break;
+    case ENGINE_METHOD_CURSOR_DOWN:
+        signal_id = CURSOR_DOWN;
+        break;
 
-    if (g_strcmp0 (method_name, "FocusInId") == 0) {
+    case ENGINE_METHOD_FOCUS_IN_ID: {
         gchar *object_path = NULL;
         gchar *client = NULL;
         g_variant_get (parameters, "(&s&s)", &object_path, &client);
@@ -1379,7 +1772,7 @@ ibus_engine_service_method_call (IBusService           *service,
         return;
     }
 
-    if (g_strcmp0 (method_name, "FocusOutId") == 0) {
+    case ENGINE_METHOD_FOCUS_OUT_ID: {
         gchar *object_path = NULL;
         g_variant_get (parameters, "(&s)", &object_path);
         g_signal_emit (engine,
@@ -1390,7 +1783,7 @@ ibus_engine_service_method_call (IBusService           *service,
         return;
     }
 
-    if (g_strcmp0 (method_name, "CandidateClicked") == 0) {
+    case ENGINE_METHOD_CANDIDATE_CLICKED: {
         guint index, button, state;
         g_variant_get (parameters, "(uuu)", &index, &button, &state);
         g_signal_emit (engine,
@@ -1403,7 +1796,7 @@ ibus_engine_service_method_call (IBusService           *service,
         return;
     }
 
-    if (g_strcmp0 (method_name, "PropertyActivate") == 0) {
+    case ENGINE_METHOD_PROPERTY_ACTIVATE: {
         gchar *name;
         guint state;
         g_variant_get (parameters, "(&su)", &name, &state);
@@ -1416,7 +1809,7 @@ ibus_engine_service_method_call (IBusService           *service,
         return;
     }
 
-    if (g_strcmp0 (method_name, "PropertyShow") == 0) {
+    case ENGINE_METHOD_PROPERTY_SHOW: {
         gchar *name;
         g_variant_get (parameters, "(&s)", &name);
         g_signal_emit (engine,
@@ -1427,7 +1820,7 @@ ibus_engine_service_method_call (IBusService           *service,
         return;
     }
 
-    if (g_strcmp0 (method_name, "PropertyHide") == 0) {
+    case ENGINE_METHOD_PROPERTY_HIDE: {
         gchar *name;
         g_variant_get (parameters, "(&s)", &name);
         g_signal_emit (engine,
@@ -1438,7 +1831,7 @@ ibus_engine_service_method_call (IBusService           *service,
         return;
     }
 
-    if (g_strcmp0 (method_name, "SetCursorLocation") == 0) {
+    case ENGINE_METHOD_SET_CURSOR_LOCATION: {
         gint x, y, w, h;
         g_variant_get (parameters, "(iiii)", &x, &y, &w, &h);
         engine->cursor_area.x = x;
@@ -1454,7 +1847,7 @@ ibus_engine_service_method_call (IBusService           *service,
         return;
     }
 
-    if (g_strcmp0 (method_name, "SetCapabilities") == 0) {
+    case ENGINE_METHOD_SET_CAPABILITIES: {
         guint caps;
         g_variant_get (parameters, "(u)", &caps);
         engine->client_capabilities = caps;
@@ -1463,7 +1856,7 @@ ibus_engine_service_method_call (IBusService           *service,
         return;
     }
 
-    if (g_strcmp0 (method_name, "SetSurroundingText") == 0) {
+    case ENGINE_METHOD_SET_SURROUNDING_TEXT: {
         GVariant *variant = NULL;
         IBusText *text;
         guint cursor_pos;
@@ -1477,19 +1870,63 @@ ibus_engine_service_method_call (IBusService           *service,
         text = IBUS_TEXT (ibus_serializable_deserialize (variant));
         g_variant_unref (variant);
 
+        if (priv->received_surrounding_text)
+            g_object_unref (priv->received_surrounding_text);
+        priv->received_surrounding_text = g_object_ref_sink (text);
+        priv->surrounding_revision = 0;
+
         g_signal_emit (engine, engine_signals[SET_SURROUNDING_TEXT],
                        0,
                        text,
                        cursor_pos,
                        anchor_pos);
-        if (g_object_is_floating (text)) {
-            g_object_unref (text);
-        }
         g_dbus_method_invocation_return_value (invocation, NULL);
         return;
     }
 
-    if (g_strcmp0 (method_name, "ProcessHandWritingEvent") == 0) {
+    case ENGINE_METHOD_SET_SURROUNDING_TEXT_DELTA: {
+        IBusText *text = NULL;
+        const gchar *inserted = NULL;
+        guint revision = 0;
+        guint offset = 0;
+        guint n_deleted = 0;
+        guint cursor_pos = 0;
+        guint anchor_pos = 0;
+
+        g_variant_get (parameters,
+                       "(uuu&suu)",
+                       &revision,
+                       &offset,
+                       &n_deleted,
+                       &inserted,
+                       &cursor_pos,
+                       &anchor_pos);
+
+        /* ibus-daemon sends the whole text if the delta is not applied. */
+        if (priv->received_surrounding_text != NULL &&
+            revision == priv->surrounding_revision) {
+            text = ibus_text_new_from_splice (priv->received_surrounding_text,
+                                              offset,
+                                              n_deleted,
+                                              inserted);
+        }
+        if (text != NULL) {
+            g_object_unref (priv->received_surrounding_text);
+            priv->received_surrounding_text = g_object_ref_sink (text);
+            priv->surrounding_revision++;
+            g_signal_emit (engine, engine_signals[SET_SURROUNDING_TEXT],
+                           0,
+                           text,
+                           cursor_pos,
+                           anchor_pos);
+        }
+        g_dbus_method_invocation_return_value (invocation,
+                                               g_variant_new ("(b)",
+                                                              text != NULL));
+        return;
+    }
+
+    case ENGINE_METHOD_PROCESS_HAND_WRITING_EVENT: {
         const gdouble *coordinates;
         gsize coordinates_len = 0;
 
@@ -1507,7 +1944,7 @@ ibus_engine_service_method_call (IBusService           *service,
         return;
     }
 
-    if (g_strcmp0 (method_name, "CancelHandWriting") == 0) {
+    case ENGINE_METHOD_CANCEL_HAND_WRITING: {
         guint n_strokes = 0;
         g_variant_get (parameters, "(u)", &n_strokes);
         g_signal_emit (engine, engine_signals[CANCEL_HAND_WRITING], 0, n_strokes);
@@ -1515,8 +1952,14 @@ ibus_engine_service_method_call (IBusService           *service,
         return;
     }
 
-    /* should not be reached */
-    g_return_if_reached ();
+    default:
+        /* should not be reached */
+        g_return_if_reached ();
+    }
+
+    /* the methods without arguments */
+    g_signal_emit (engine, engine_signals[signal_id], 0);
+    g_dbus_method_invocation_return_value (invocation, NULL);
 }
 
 /**
@@ -1689,6 +2132,22 @@ ibus_engine_process_key_event (IBusEngine *engine,
     return FALSE;
 }
 
+static void
+ibus_engine_process_key_events (IBusEngine                    *engine,
+                                const IBusProcessKeyEventData *keys,
+                                guint                          n_keys,
+                                gboolean                      *handled)
+{
+    guint i;
+
+    for (i = 0; i < n_keys; i++) {
+        handled[i] = ibus_engine_dispatch_key_event (engine,
+                                                     keys[i].keyval,
+                                                     keys[i].keycode,
+                                                     keys[i].state);
+    }
+}
+
 static void
 ibus_engine_focus_in (IBusEngine *engine)
 {
@@ -1830,12 +2289,55 @@ ibus_engine_set_content_type (IBusEngine *engine,
 {
 }
 
+/* The signals which ibus-daemon relays to the client of the input context
+ * and which are also sent on the peer connection. */
+static gboolean
+ibus_engine_is_peer_signal (const gchar *signal_name)
+{
+    static const gchar *names[] = {
+        "CommitText",
+        "UpdatePreeditText",
+        "ShowPreeditText",
+        "HidePreeditText",
+        "ForwardKeyEvent",
+        "DeleteSurroundingText",
+        "RequireSurroundingText",
+    };
+    gint i;
+
+    for (i = 0; i < G_N_ELEMENTS (names); i++) {
+        if (g_strcmp0 (signal_name, names[i]) == 0)
+            return TRUE;
+    }
+    return FALSE;
+}
+
 static void
 ibus_engine_emit_signal (IBusEngine  *engine,
                          const gchar *signal_name,
                          GVariant    *parameters)
 {
+    IBusEnginePrivate *priv = engine->priv;
     GError *error = NULL;
+
+    if (priv->processing_key_events)
+        ibus_engine_flush_key_events_updates (engine);
+    if (parameters != NULL)
+        g_variant_ref_sink (parameters);
+    /* ibus-daemon keeps the state of the input context with the signals
+     * but does not relay them to the client while the peer connection is
+     * open. */
+    if (priv->peer_connection != NULL &&
+        ibus_engine_is_peer_signal (signal_name)) {
+        g_dbus_connection_emit_signal (
+                priv->peer_connection,
+                NULL,
+                ibus_service_get_object_path ((IBusService *)engine),
+                IBUS_INTERFACE_ENGINE,
+                signal_name,
+                parameters,
+                NULL);
+    }
     ibus_service_emit_signal ((IBusService *)engine,
                               NULL,
                               IBUS_INTERFACE_ENGINE,
@@ -1846,6 +2348,8 @@ ibus_engine_emit_signal (IBusEngine  *engine,
         g_warning ("Failed to emit %s signal: %s", signal_name, error->message);
         g_error_free (error);
     }
+    if (parameters != NULL)
+        g_variant_unref (parameters);
 }
 
 static void
@@ -1932,6 +2436,18 @@ ibus_engine_commit_text (IBusEngine *engine,
     g_return_if_fail (IBUS_IS_ENGINE (engine));
     g_return_if_fail (IBUS_IS_TEXT (text));
 
+    IBusEnginePrivate *priv = engine->priv;
+    /* Attributes cannot be joined. */
+    if (priv->processing_key_events &&
+        (text->attrs == NULL || ibus_attr_list_get (text->attrs, 0) == NULL)) {
+        if (priv->key_events_commit_text == NULL)
+            priv->key_events_commit_text = g_string_new (NULL);
+        g_string_append (priv->key_events_commit_text, text->text);
+        if (g_object_is_floating (text))
+            g_object_unref (text);
+        return;
+    }
+
     GVariant *variant = ibus_serializable_serialize ((IBusSerializable *)text);
     ibus_engine_emit_signal (engine,
                              "CommitText",
@@ -1963,9 +2479,17 @@ ibus_engine_update_preedit_text_with_mode (IBusEngine            *engine,
     g_return_if_fail (IBUS_IS_TEXT (text));
 
     GVariant *variant = ibus_serializable_serialize ((IBusSerializable *)text);
-    ibus_engine_emit_signal (engine,
-                             "UpdatePreeditText",
-                             g_variant_new ("(vubu)", variant, cursor_pos, visible, mode));
+    GVariant *parameters = g_variant_new ("(vubu)",
+                                          variant, cursor_pos, visible, mode);
+    IBusEnginePrivate *priv = engine->priv;
+    if (priv->processing_key_events) {
+        /* The commit text held back is sent before the preedit text. */
+        if (priv->key_events_preedit_text != NULL)
+            g_variant_unref (priv->key_events_preedit_text);
+        priv->key_events_preedit_text = g_variant_ref_sink (parameters);
+    } else {
+        ibus_engine_emit_signal (engine, "UpdatePreeditText", parameters);
+    }
 
     if (g_object_is_floating (text)) {
         g_object_unref (text);
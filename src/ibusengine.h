@@ -45,6 +45,7 @@
 #include "ibuslookuptable.h"
 #include "ibusmessage.h"
 #include "ibusproplist.h"
+#include "ibusxevent.h"
 
 /*
  * Type macros.
@@ -181,10 +182,19 @@ struct _IBusEngineClass {
                                      const gchar    *client);
     void        (* focus_out_id)    (IBusEngine     *engine,
                                      const gchar    *object_path);
+    /* Set handled[i] for each key of the "ProcessKeyEvents" D-Bus method.
+     * The default emits #IBusEngine::process-key-event for each key.
+     * Since: 1.5.33 */
+    void        (* process_key_events)
+                                    (IBusEngine     *engine,
+                                     const IBusProcessKeyEventData
+                                                    *keys,
+                                     guint           n_keys,
+                                     gboolean       *handled);
 
     /*< private >*/
     /* padding */
-    gpointer pdummy[2];
+    gpointer pdummy[1];
 };
 
 GType        ibus_engine_get_type       (void);
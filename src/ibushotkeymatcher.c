@@ -0,0 +1,216 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/* ibus - The Input Bus
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "ibushotkeymatcher.h"
+#include "ibuskeysyms.h"
+#include "ibustypes.h"
+
+/* The table is at most half full, so a lookup ends at an empty slot. */
+#define MIN_N_SLOTS 8
+
+typedef struct {
+    guint keyval;
+    guint modifiers;
+    /* 0 for an empty slot */
+    guint action;
+} Slot;
+
+struct _IBusHotkeyMatcher {
+    gint  ref_count;
+    guint mask;
+    Slot  slots[];
+};
+
+static inline guint
+hotkey_hash (guint keyval,
+             guint modifiers)
+{
+    guint32 hash = (keyval * 0x9e3779b1u) ^ (modifiers * 0x85ebca6bu);
+    return hash ^ (hash >> 16);
+}
+
+static const Slot *
+ibus_hotkey_matcher_find (const IBusHotkeyMatcher *matcher,
+                          guint                    keyval,
+                          guint                    modifiers)
+{
+    guint i = hotkey_hash (keyval, modifiers) & matcher->mask;
+
+    for (;; i = (i + 1) & matcher->mask) {
+        const Slot *slot = &matcher->slots[i];
+        if (slot->action == 0 ||
+            (slot->keyval == keyval && slot->modifiers == modifiers)) {
+            return slot;
+        }
+    }
+}
+
+IBusHotkeyMatcher *
+ibus_hotkey_matcher_new (const IBusHotkeyBinding *bindings,
+                         guint                    n_bindings)
+{
+    IBusHotkeyMatcher *matcher;
+    guint n_slots = MIN_N_SLOTS;
+    guint i;
+
+    g_return_val_if_fail (bindings != NULL || n_bindings == 0, NULL);
+
+    while (n_slots < n_bindings * 2)
+        n_slots *= 2;
+
+    matcher = g_malloc0 (sizeof (IBusHotkeyMatcher) + n_slots * sizeof (Slot));
+    matcher->ref_count = 1;
+    matcher->mask = n_slots - 1;
+
+    for (i = 0; i < n_bindings; i++) {
+        guint modifiers =
+                ibus_hotkey_matcher_normalize_modifiers (bindings[i].modifiers);
+        Slot *slot;
+
+        g_return_val_if_fail (bindings[i].action != 0, matcher);
+        slot = (Slot *) ibus_hotkey_matcher_find (matcher,
+                                                  bindings[i].keyval,
+                                                  modifiers);
+        if (slot->action != 0)
+            continue;
+        slot->keyval = bindings[i].keyval;
+        slot->modifiers = modifiers;
+        slot->action = bindings[i].action;
+    }
+    return matcher;
+}
+
+IBusHotkeyMatcher *
+ibus_hotkey_matcher_ref (IBusHotkeyMatcher *matcher)
+{
+    g_return_val_if_fail (matcher != NULL, NULL);
+
+    g_atomic_int_inc (&matcher->ref_count);
+    return matcher;
+}
+
+void
+ibus_hotkey_matcher_unref (IBusHotkeyMatcher *matcher)
+{
+    g_return_if_fail (matcher != NULL);
+
+    if (g_atomic_int_dec_and_test (&matcher->ref_count))
+        g_free (matcher);
+}
+
+guint
+ibus_hotkey_matcher_normalize_modifiers (guint modifiers)
+{
+    if (modifiers & IBUS_SUPER_MASK) {
+        modifiers &= ~IBUS_SUPER_MASK;
+        modifiers |= IBUS_MOD4_MASK;
+    }
+    return modifiers & IBUS_MODIFIER_FILTER & ~IBUS_RELEASE_MASK;
+}
+
+guint
+ibus_hotkey_matcher_get_modifier (guint keyval)
+{
+    switch (keyval) {
+    case IBUS_KEY_Control_L:
+    case IBUS_KEY_Control_R:
+        return IBUS_CONTROL_MASK;
+    case IBUS_KEY_Shift_L:
+    case IBUS_KEY_Shift_R:
+        return IBUS_SHIFT_MASK;
+    case IBUS_KEY_Caps_Lock:
+        return IBUS_LOCK_MASK;
+    case IBUS_KEY_Alt_L:
+    case IBUS_KEY_Alt_R:
+        return IBUS_MOD1_MASK;
+    case IBUS_KEY_Meta_L:
+    case IBUS_KEY_Meta_R:
+        return IBUS_META_MASK;
+    case IBUS_KEY_Super_L:
+    case IBUS_KEY_Super_R:
+        return IBUS_MOD4_MASK;
+    case IBUS_KEY_Hyper_L:
+    case IBUS_KEY_Hyper_R:
+        return IBUS_HYPER_MASK;
+    default:;
+    }
+    return 0;
+}
+
+guint
+ibus_hotkey_matcher_lookup (const IBusHotkeyMatcher *matcher,
+                            guint                    keyval,
+                            guint                    modifiers)
+{
+    g_return_val_if_fail (matcher != NULL, 0);
+
+    modifiers = ibus_hotkey_matcher_normalize_modifiers (modifiers);
+    return ibus_hotkey_matcher_find (matcher, keyval, modifiers)->action;
+}
+
+IBusHotkeyMatch
+ibus_hotkey_matcher_process (const IBusHotkeyMatcher *matcher,
+                             IBusHotkeyMatcherState  *state,
+                             guint                    keyval,
+                             guint                    modifiers,
+                             guint                   *action)
+{
+    gboolean is_pressed = (modifiers & IBUS_RELEASE_MASK) == 0;
+    guint hotkey_action;
+
+    g_return_val_if_fail (matcher != NULL, IBUS_HOTKEY_MATCH_NONE);
+    g_return_val_if_fail (state != NULL, IBUS_HOTKEY_MATCH_NONE);
+
+    modifiers = ibus_hotkey_matcher_normalize_modifiers (modifiers);
+    hotkey_action = ibus_hotkey_matcher_find (matcher,
+                                              keyval,
+                                              modifiers)->action;
+    if (hotkey_action != 0) {
+        if (modifiers != 0) {
+            if (is_pressed) {
+                state->modifiers = modifiers;
+                state->action = hotkey_action;
+            } else if (state->modifiers != 0) {
+                /* The key is released but the modifiers are held. */
+                return IBUS_HOTKEY_MATCH_NONE;
+            }
+        }
+        if (action)
+            *action = hotkey_action;
+        return is_pressed ? IBUS_HOTKEY_MATCH_PRESS
+                          : IBUS_HOTKEY_MATCH_RELEASE;
+    }
+
+    if (!is_pressed && state->modifiers != 0) {
+        state->modifiers &= modifiers;
+        state->modifiers &= ~ibus_hotkey_matcher_get_modifier (keyval);
+        if (state->modifiers == 0) {
+            /* The last modifier of the hotkey is released. */
+            if (action)
+                *action = state->action;
+            state->action = 0;
+            return IBUS_HOTKEY_MATCH_RELEASE;
+        }
+    }
+    return IBUS_HOTKEY_MATCH_NONE;
+}
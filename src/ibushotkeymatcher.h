@@ -0,0 +1,122 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/* ibus - The Input Bus
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#ifndef __IBUS_HOTKEY_MATCHER_H_
+#define __IBUS_HOTKEY_MATCHER_H_
+
+/*
+ * IBusHotkeyMatcher matches key events with a set of global hotkeys. The
+ * hotkeys are compiled into a flat open addressing hash table of the
+ * keyval and the normalized modifiers, so a key event is matched with one
+ * lookup and without allocations.
+ *
+ * A matcher is not changed after it is created, so it can be shared by
+ * threads without a lock and replaced with a new one when the hotkeys
+ * change. The press and release state of a hotkey is kept by the caller
+ * in an IBusHotkeyMatcherState:
+ *
+ * - The press of a hotkey matches with IBUS_HOTKEY_MATCH_PRESS and
+ *   repeats match again.
+ * - The release of the key of a hotkey with modifiers does not match
+ *   while its modifiers are held, and the release of the last one of
+ *   them matches with IBUS_HOTKEY_MATCH_RELEASE. An IME switcher shows
+ *   its window on the press and selects the engine on the release.
+ * - The release of a hotkey without modifiers matches with
+ *   IBUS_HOTKEY_MATCH_RELEASE.
+ *
+ * The matcher is not a public API. Its functions are G_GNUC_INTERNAL and
+ * linked from libibus-private.la.
+ */
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _IBusHotkeyMatcher IBusHotkeyMatcher;
+typedef struct _IBusHotkeyMatcherState IBusHotkeyMatcherState;
+typedef struct _IBusHotkeyBinding IBusHotkeyBinding;
+
+typedef enum {
+    IBUS_HOTKEY_MATCH_NONE = 0,
+    IBUS_HOTKEY_MATCH_PRESS,
+    IBUS_HOTKEY_MATCH_RELEASE,
+} IBusHotkeyMatch;
+
+/* A hotkey and its action, which is not 0. */
+struct _IBusHotkeyBinding {
+    guint keyval;
+    guint modifiers;
+    guint action;
+};
+
+/* Initialize it with zeros. */
+struct _IBusHotkeyMatcherState {
+    /* the modifiers of the pressed hotkey which are still held */
+    guint modifiers;
+    guint action;
+};
+
+/* The first binding of the same keyval and modifiers is used. */
+G_GNUC_INTERNAL
+IBusHotkeyMatcher
+                *ibus_hotkey_matcher_new        (const IBusHotkeyBinding
+                                                                *bindings,
+                                                 guint           n_bindings);
+G_GNUC_INTERNAL
+IBusHotkeyMatcher
+                *ibus_hotkey_matcher_ref        (IBusHotkeyMatcher
+                                                                *matcher);
+G_GNUC_INTERNAL
+void             ibus_hotkey_matcher_unref      (IBusHotkeyMatcher
+                                                                *matcher);
+
+/* Returns the action of the hotkey or 0. The release bit of @modifiers
+ * is ignored. */
+G_GNUC_INTERNAL
+guint            ibus_hotkey_matcher_lookup     (const IBusHotkeyMatcher
+                                                                *matcher,
+                                                 guint           keyval,
+                                                 guint           modifiers);
+
+/* Match a key event and update @state. @action is set to the action of
+ * the matched hotkey. */
+G_GNUC_INTERNAL
+IBusHotkeyMatch  ibus_hotkey_matcher_process    (const IBusHotkeyMatcher
+                                                                *matcher,
+                                                 IBusHotkeyMatcherState
+                                                                *state,
+                                                 guint           keyval,
+                                                 guint           modifiers,
+                                                 guint          *action);
+
+/* IBUS_SUPER_MASK becomes IBUS_MOD4_MASK since GTK4 sends the former and
+ * Qt5 the latter, and the modifiers out of IBUS_MODIFIER_FILTER and the
+ * release bit are removed. */
+G_GNUC_INTERNAL
+guint            ibus_hotkey_matcher_normalize_modifiers
+                                                (guint           modifiers);
+
+/* Returns the normalized modifier of a modifier key or 0. */
+G_GNUC_INTERNAL
+guint            ibus_hotkey_matcher_get_modifier
+                                                (guint           keyval);
+
+G_END_DECLS
+#endif
@@ -21,9 +21,16 @@
  * USA
  */
 #include "ibusinputcontext.h"
+#include <unistd.h>
+#include <glib-unix.h>
 #include <gio/gio.h>
+#include <gio/gunixfdlist.h>
 #include "ibusshare.h"
 #include "ibusinternal.h"
+#include "ibuskeychannel.h"
+#include "ibusprocesskeyevent.h"
+#include "ibuskeymap.h"
+#include "ibuskeysyms.h"
 #include "ibusmarshalers.h"
 #include "ibusattribute.h"
 #include "ibuslookuptable.h"
@@ -69,8 +76,80 @@ struct _IBusInputContextPrivate {
     IBusText *surrounding_text;
     guint     surrounding_cursor_pos;
     guint     selection_anchor_pos;
+
+    /* TRUE if ibus-daemon has the cached surrounding text, so that a change
+     * can be sent as a delta against surrounding_revision */
+    gboolean  surrounding_text_synced;
+    guint     surrounding_revision;
+    /* incremented each time the whole surrounding text is sent */
+    guint     surrounding_text_serial;
+    /* TRUE if ibus-daemon does not know SetSurroundingTextDelta */
+    gboolean  no_surrounding_text_delta;
+
+    /* pre-edit text received last, the base of UpdatePreeditTextDelta */
+    IBusText *preedit_text;
+    /* TRUE if a delta did not apply to preedit_text */
+    gboolean  no_preedit_delta;
+    /* capabilities set by the application */
+    guint32   capabilities;
+
+    /* key events without D-Bus, see ibus_input_context_open_key_channel() */
+    IBusKeyChannel *key_channel;
+    guint     key_channel_source_id;
+    guint32   key_channel_serial;
+    /* KeyChannelCall in the order of the key events */
+    GQueue    key_channel_calls;
+    /* the pushed key events which have no reply yet */
+    guint     n_key_channel_keys;
+    /* D-Bus signals received from ibus-daemon */
+    guint32   n_received_signals;
+
+    /* a peer connection to the engine, see
+       ibus_input_context_open_engine_link() */
+    GDBusConnection *engine_link;
+    gchar    *engine_link_path;
+    guint     engine_link_signal_id;
+    /* converts the keycodes as ibus-daemon does, or NULL */
+    IBusKeymap *engine_link_keymap;
+    /* keyvals of the shortcut keys which ibus-daemon handles */
+    GArray   *engine_link_keys;
+    /* TRUE if a shortcut key has modifiers */
+    gboolean  engine_link_modifiers;
+    /* FALSE after the focus out until ibus-daemon closes the link */
+    gboolean  engine_link_sending;
+    gboolean  engine_link_opening;
+    gboolean  has_focus;
+    /* asynchronous key events in flight on the link and through
+       ibus-daemon while the engine link is enabled */
+    guint     n_link_key_events;
+    guint     n_bus_key_events;
+    /* GTasks of the key events for ibus-daemon which wait for the key
+       events on the link to keep the order */
+    GQueue    deferred_key_events;
 };
 
+typedef struct {
+    guint32   keyval;
+    guint32   keycode;
+    guint32   state;
+    gint      timeout_msec;
+} EngineLinkKeyEvent;
+
+typedef struct {
+    guint32   serial;
+    guint32   keyval;
+    guint32   keycode;
+    guint32   state;
+    /* NULL for ibus_input_context_process_key_event() */
+    GTask    *task;
+    /* FALSE while it waits for a free slot */
+    gboolean  pushed;
+    gboolean  done;
+    gboolean  processed;
+    /* the number of D-Bus signals sent before the reply */
+    guint32   n_signals;
+} KeyChannelCall;
+
 typedef struct _IBusInputContextPrivate IBusInputContextPrivate;
 
 static guint            context_signals[LAST_SIGNAL] = { 0 };
@@ -83,6 +162,23 @@ static void     ibus_input_context_g_signal     (GDBusProxy             *proxy,
                                                  const gchar            *sender_name,
                                                  const gchar            *signal_name,
                                                  GVariant               *parameters);
+static void     ibus_input_context_close_key_channel
+                                                (IBusInputContext       *context);
+static void     ibus_input_context_complete_key_channel_calls
+                                                (IBusInputContext       *context);
+static void     ibus_input_context_key_channel_reply
+                                                (IBusInputContext       *context,
+                                                 guint32                 serial,
+                                                 gboolean                processed,
+                                                 guint32                 n_signals);
+static void     ibus_input_context_push_key_channel_calls
+                                                (IBusInputContext       *context);
+static void     ibus_input_context_close_engine_link
+                                                (IBusInputContext       *context);
+static void     ibus_input_context_open_engine_link
+                                                (IBusInputContext       *context);
+static gboolean ibus_input_context_use_engine_link
+                                                (void);
 
 G_DEFINE_TYPE_WITH_PRIVATE (IBusInputContext,
                             ibus_input_context,
@@ -515,6 +611,8 @@ ibus_input_context_init (IBusInputContext *context)
 
     priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
     priv->surrounding_text = g_object_ref_sink (text_empty);
+    g_queue_init (&priv->key_channel_calls);
+    g_queue_init (&priv->deferred_key_events);
 }
 
 static void
@@ -527,15 +625,138 @@ ibus_input_context_real_destroy (IBusProxy *context)
         g_object_unref (priv->surrounding_text);
         priv->surrounding_text = NULL;
     }
+    g_clear_object (&priv->preedit_text);
+    ibus_input_context_close_key_channel (IBUS_INPUT_CONTEXT (context));
+    priv->has_focus = FALSE;
+    ibus_input_context_close_engine_link (IBUS_INPUT_CONTEXT (context));
 
     IBUS_PROXY_CLASS(ibus_input_context_parent_class)->destroy (context);
 }
 
+/* Keep @text as the base of the next UpdatePreeditTextDelta. This takes
+ * the floating reference of @text if any. */
 static void
-ibus_input_context_g_signal (GDBusProxy  *proxy,
-                             const gchar *sender_name,
-                             const gchar *signal_name,
-                             GVariant    *parameters)
+ibus_input_context_cache_preedit_text (IBusInputContext *context,
+                                       IBusText         *text)
+{
+    IBusInputContextPrivate *priv;
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
+
+    if (g_object_is_floating (text))
+        g_object_ref_sink (text);
+    else
+        g_object_ref (text);
+    if (priv->preedit_text)
+        g_object_unref (priv->preedit_text);
+    priv->preedit_text = text;
+}
+
+static gboolean
+ibus_input_context_attrs_contain (GVariant      *attrs,
+                                  IBusAttribute *attr)
+{
+    GVariantIter iter;
+    guint type, value, start_index, end_index;
+
+    g_variant_iter_init (&iter, attrs);
+    while (g_variant_iter_next (&iter, "(uuuu)",
+                                &type, &value, &start_index, &end_index)) {
+        if (attr->type == type && attr->value == value &&
+            attr->start_index == start_index &&
+            attr->end_index == end_index) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static void
+ibus_input_context_update_preedit_text_delta (IBusInputContext *context,
+                                              GVariant         *parameters)
+{
+    IBusInputContextPrivate *priv;
+    const gchar *inserted = NULL;
+    GVariant *removed = NULL;
+    GVariant *added = NULL;
+    guint offset, n_deleted, cursor_pos, mode;
+    gboolean visible, with_mode;
+    IBusText *text = NULL;
+    IBusAttrList *attrs;
+    IBusAttribute *attr;
+    GVariantIter iter;
+    guint type, value, start_index, end_index;
+    guint i;
+
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
+
+    g_variant_get (parameters, "(uu&s@a(uuuu)@a(uuuu)ubub)",
+                   &offset, &n_deleted, &inserted, &removed, &added,
+                   &cursor_pos, &visible, &mode, &with_mode);
+
+    if (priv->preedit_text) {
+        text = ibus_text_new_from_splice (priv->preedit_text,
+                                          offset, n_deleted, inserted);
+    }
+    if (text == NULL) {
+        /* drop the delta mode so that ibus-daemon sends the whole text
+         * again. The deltas already sent are dropped until then. */
+        if (!priv->no_preedit_delta) {
+            g_warning ("%s: The delta does not match the pre-edit text.",
+                       G_STRFUNC);
+            g_clear_object (&priv->preedit_text);
+            priv->no_preedit_delta = TRUE;
+            ibus_input_context_set_capabilities (context, priv->capabilities);
+        }
+        goto out;
+    }
+
+    attrs = ibus_attr_list_new ();
+    for (i = 0;
+         priv->preedit_text->attrs &&
+         (attr = ibus_attr_list_get (priv->preedit_text->attrs, i)) != NULL;
+         i++) {
+        if (!ibus_input_context_attrs_contain (removed, attr))
+            ibus_attr_list_append (attrs, attr);
+    }
+    g_variant_iter_init (&iter, added);
+    while (g_variant_iter_next (&iter, "(uuuu)",
+                                &type, &value, &start_index, &end_index)) {
+        ibus_attr_list_append (attrs,
+                               ibus_attribute_new (type, value,
+                                                   start_index, end_index));
+    }
+    ibus_text_set_attributes (text, attrs);
+
+    /* cache it before the emission so that the handlers cannot sink the
+     * floating reference. */
+    ibus_input_context_cache_preedit_text (context, text);
+    if (with_mode) {
+        g_signal_emit (context,
+                       context_signals[UPDATE_PREEDIT_TEXT_WITH_MODE],
+                       0,
+                       text,
+                       cursor_pos,
+                       visible,
+                       mode);
+    } else {
+        g_signal_emit (context,
+                       context_signals[UPDATE_PREEDIT_TEXT],
+                       0,
+                       text,
+                       cursor_pos,
+                       visible);
+    }
+
+out:
+    g_variant_unref (removed);
+    g_variant_unref (added);
+}
+
+static void
+ibus_input_context_dispatch_signal (GDBusProxy  *proxy,
+                                    const gchar *sender_name,
+                                    const gchar *signal_name,
+                                    GVariant    *parameters)
 {
     g_assert (IBUS_IS_INPUT_CONTEXT (proxy));
 
@@ -586,10 +807,7 @@ ibus_input_context_g_signal (GDBusProxy  *proxy,
                        cursor_pos,
                        visible);
 
-        if (g_object_is_floating (text)) {
-            g_object_ref_sink (text);
-            g_object_unref (text);
-        }
+        ibus_input_context_cache_preedit_text (context, text);
         return;
     }
     if (g_strcmp0 (signal_name, "UpdatePreeditTextWithMode") == 0) {
@@ -610,10 +828,11 @@ ibus_input_context_g_signal (GDBusProxy  *proxy,
                        visible,
                        mode);
 
-        if (g_object_is_floating (text)) {
-            g_object_ref_sink (text);
-            g_object_unref (text);
-        }
+        ibus_input_context_cache_preedit_text (context, text);
+        return;
+    }
+    if (g_strcmp0 (signal_name, "UpdatePreeditTextDelta") == 0) {
+        ibus_input_context_update_preedit_text_delta (context, parameters);
         return;
     }
 
@@ -680,83 +899,979 @@ ibus_input_context_g_signal (GDBusProxy  *proxy,
                        0,
                        prop_list);
 
-        if (g_object_is_floating (prop_list)) {
-            g_object_ref_sink (prop_list);
-            g_object_unref (prop_list);
-        }
-        return;
+        if (g_object_is_floating (prop_list)) {
+            g_object_ref_sink (prop_list);
+            g_object_unref (prop_list);
+        }
+        return;
+    }
+
+    if (g_strcmp0 (signal_name, "UpdateProperty") == 0) {
+        GVariant *variant = NULL;
+        g_variant_get (parameters, "(v)", &variant);
+        IBusProperty *prop = IBUS_PROPERTY (ibus_serializable_deserialize (variant));
+        g_variant_unref (variant);
+
+        g_signal_emit (context, context_signals[UPDATE_PROPERTY], 0, prop);
+
+        if (g_object_is_floating (prop)) {
+            g_object_ref_sink (prop);
+            g_object_unref (prop);
+        }
+        return;
+    }
+
+    if (g_strcmp0 (signal_name, "ForwardKeyEvent") == 0) {
+        guint32 keyval;
+        guint32 keycode;
+        guint32 state;
+
+        g_variant_get (parameters, "(uuu)", &keyval, &keycode, &state);
+
+        /* Forward key event back with IBUS_FORWARD_MASK. And process_key_event will
+         * not process key event with IBUS_FORWARD_MASK again. */
+        g_signal_emit (context,
+                       context_signals[FORWARD_KEY_EVENT],
+                       0,
+                       keyval,
+                       keycode,
+                       state | IBUS_FORWARD_MASK);
+        return;
+    }
+
+    if (g_strcmp0 (signal_name, "DeleteSurroundingText") == 0) {
+        gint offset_from_cursor;
+        guint nchars;
+
+        g_variant_get (parameters, "(iu)", &offset_from_cursor, &nchars);
+
+        g_signal_emit (context,
+                       context_signals[DELETE_SURROUNDING_TEXT],
+                       0,
+                       offset_from_cursor,
+                       nchars);
+        return;
+    }
+
+    IBusInputContextPrivate *priv;
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (IBUS_INPUT_CONTEXT (context));
+
+    if (g_strcmp0 (signal_name, "Enabled") == 0) {
+        priv->needs_surrounding_text = FALSE;
+        g_signal_emit (context, context_signals[ENABLED], 0);
+        return;
+    }
+
+    if (g_strcmp0 (signal_name, "Disabled") == 0) {
+        priv->needs_surrounding_text = FALSE;
+        g_signal_emit (context, context_signals[DISABLED], 0);
+        return;
+    }
+
+    if (g_strcmp0 (signal_name, "RequireSurroundingText") == 0) {
+        priv->needs_surrounding_text = TRUE;
+        g_signal_emit (context, context_signals[REQUIRE_SURROUNDING_TEXT], 0);
+        return;
+    }
+
+    G_DBUS_PROXY_CLASS (ibus_input_context_parent_class)->g_signal (
+                                proxy, sender_name, signal_name, parameters);
+}
+
+static void
+ibus_input_context_g_signal (GDBusProxy  *proxy,
+                             const gchar *sender_name,
+                             const gchar *signal_name,
+                             GVariant    *parameters)
+{
+    IBusInputContext *context = IBUS_INPUT_CONTEXT (proxy);
+    IBusInputContextPrivate *priv;
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
+
+    ibus_input_context_dispatch_signal (proxy,
+                                        sender_name,
+                                        signal_name,
+                                        parameters);
+
+    /* ibus-daemon sends the reply of the key channel with D-Bus when the
+     * channel is full. */
+    if (g_strcmp0 (signal_name, "KeyChannelReply") == 0) {
+        guint32 serial;
+        gboolean processed;
+
+        g_variant_get (parameters, "(ub)", &serial, &processed);
+        ibus_input_context_key_channel_reply (context,
+                                              serial,
+                                              processed,
+                                              priv->n_received_signals);
+        ibus_input_context_push_key_channel_calls (context);
+    }
+
+    /* a reply from the key channel can wait for this signal. */
+    priv->n_received_signals++;
+    if (!g_queue_is_empty (&priv->key_channel_calls))
+        ibus_input_context_complete_key_channel_calls (context);
+
+    /* The engine may be created after FocusIn. */
+    if (g_strcmp0 (signal_name, "Enabled") == 0 && priv->has_focus &&
+        priv->engine_link == NULL && ibus_input_context_use_engine_link ()) {
+        ibus_input_context_open_engine_link (context);
+    }
+}
+
+static void
+ibus_input_context_free_key_channel_call (KeyChannelCall *call)
+{
+    if (call->task)
+        g_object_unref (call->task);
+    g_slice_free (KeyChannelCall, call);
+}
+
+/* Complete the asynchronous key events which have the replies in order.
+ * A reply waits until the D-Bus signals which ibus-daemon sent before it
+ * are received, e.g. CommitText before FALSE for a space key. */
+static void
+ibus_input_context_complete_key_channel_calls (IBusInputContext *context)
+{
+    IBusInputContextPrivate *priv;
+    KeyChannelCall *call;
+
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
+    while ((call = g_queue_peek_head (&priv->key_channel_calls)) != NULL &&
+           call->done && call->task != NULL &&
+           (gint32) (call->n_signals - priv->n_received_signals) <= 0) {
+        g_queue_pop_head (&priv->key_channel_calls);
+        g_task_return_boolean (call->task, call->processed);
+        ibus_input_context_free_key_channel_call (call);
+    }
+}
+
+/* Set the reply of the key event @serial. A reply which ibus-daemon sends
+ * with D-Bus can overtake the replies of the earlier key events in the
+ * channel, so the call is looked up by its serial. */
+static void
+ibus_input_context_key_channel_reply (IBusInputContext *context,
+                                      guint32           serial,
+                                      gboolean          processed,
+                                      guint32           n_signals)
+{
+    IBusInputContextPrivate *priv;
+    GList *l;
+
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
+    if (priv->n_key_channel_keys > 0)
+        priv->n_key_channel_keys--;
+    for (l = priv->key_channel_calls.head; l != NULL; l = l->next) {
+        KeyChannelCall *call = l->data;
+        if (call->serial == serial && call->pushed && !call->done) {
+            call->done = TRUE;
+            call->processed = processed;
+            call->n_signals = n_signals;
+            return;
+        }
+    }
+    g_warning ("%s: Unexpected reply %u.", G_STRFUNC, serial);
+}
+
+/* Push the key events which wait for a free slot. A key event waits behind
+ * the channel instead of going with D-Bus, which could overtake the key
+ * events in the channel. */
+static void
+ibus_input_context_push_key_channel_calls (IBusInputContext *context)
+{
+    IBusInputContextPrivate *priv;
+    GList *l;
+
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
+    if (priv->key_channel == NULL)
+        return;
+    for (l = priv->key_channel_calls.head;
+         l != NULL && priv->n_key_channel_keys < IBUS_KEY_CHANNEL_N_SLOTS;
+         l = l->next) {
+        KeyChannelCall *call = l->data;
+        if (call->pushed)
+            continue;
+        if (!ibus_key_channel_push_key (priv->key_channel,
+                                        call->keyval,
+                                        call->keycode,
+                                        call->state,
+                                        call->serial)) {
+            break;
+        }
+        call->pushed = TRUE;
+        priv->n_key_channel_keys++;
+    }
+}
+
+static void
+ibus_input_context_read_key_channel (IBusInputContext *context)
+{
+    IBusInputContextPrivate *priv;
+    guint32 serial;
+    gboolean processed;
+    guint32 n_signals;
+
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
+    ibus_key_channel_acknowledge (priv->key_channel, FALSE);
+    while (ibus_key_channel_pop_reply (priv->key_channel,
+                                       &serial, &processed, &n_signals)) {
+        ibus_input_context_key_channel_reply (context,
+                                              serial,
+                                              processed,
+                                              n_signals);
+    }
+    ibus_input_context_push_key_channel_calls (context);
+}
+
+static gboolean
+_key_channel_reply_cb (gint              fd,
+                       GIOCondition      condition,
+                       IBusInputContext *context)
+{
+    ibus_input_context_read_key_channel (context);
+    ibus_input_context_complete_key_channel_calls (context);
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+ibus_input_context_close_key_channel (IBusInputContext *context)
+{
+    IBusInputContextPrivate *priv;
+    KeyChannelCall *call;
+
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
+    if (priv->key_channel_source_id != 0) {
+        g_source_remove (priv->key_channel_source_id);
+        priv->key_channel_source_id = 0;
+    }
+    while ((call = g_queue_pop_head (&priv->key_channel_calls)) != NULL) {
+        if (call->task) {
+            g_task_return_new_error (call->task,
+                                     G_IO_ERROR,
+                                     G_IO_ERROR_CLOSED,
+                                     "The key channel is closed.");
+        }
+        ibus_input_context_free_key_channel_call (call);
+    }
+    priv->n_key_channel_keys = 0;
+    g_clear_pointer (&priv->key_channel, ibus_key_channel_free);
+}
+
+gboolean
+ibus_input_context_use_key_channel (void)
+{
+    static gint use_key_channel = -1;
+
+    if (use_key_channel < 0) {
+        const gchar *env = g_getenv ("IBUS_ENABLE_KEY_CHANNEL");
+        use_key_channel = (env != NULL && g_strcmp0 (env, "0") != 0 &&
+                           g_ascii_strcasecmp (env, "false") != 0) ? 1 : 0;
+    }
+    return use_key_channel == 1;
+}
+
+static void
+ibus_input_context_set_key_channel (IBusInputContext *context,
+                                    IBusKeyChannel   *channel)
+{
+    IBusInputContextPrivate *priv;
+    gint reply_fd = -1;
+
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
+    ibus_input_context_close_key_channel (context);
+    priv->key_channel = channel;
+    ibus_key_channel_get_fds (channel, NULL, NULL, &reply_fd);
+    priv->key_channel_source_id =
+            g_unix_fd_add (reply_fd,
+                           G_IO_IN,
+                           (GUnixFDSourceFunc) _key_channel_reply_cb,
+                           context);
+}
+
+static GUnixFDList *
+ibus_input_context_new_key_channel_fd_list (IBusKeyChannel *channel)
+{
+    GUnixFDList *fd_list = g_unix_fd_list_new ();
+    gint fds[3];
+    gint i;
+
+    ibus_key_channel_get_fds (channel, &fds[0], &fds[1], &fds[2]);
+    for (i = 0; i < G_N_ELEMENTS (fds); i++)
+        g_unix_fd_list_append (fd_list, fds[i], NULL);
+    return fd_list;
+}
+
+static void
+ibus_input_context_warn_key_channel (GError *error)
+{
+    /* an old ibus-daemon or a platform without memfd */
+    if (!g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD) &&
+        !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED)) {
+        g_warning ("Cannot open the key channel: %s", error->message);
+    }
+    g_error_free (error);
+}
+
+/* Open the shared memory channel for key events with the OpenKeyChannel
+ * method. The key events go through D-Bus if this fails. */
+void
+ibus_input_context_open_key_channel (IBusInputContext *context)
+{
+    IBusKeyChannel *channel;
+    GUnixFDList *fd_list;
+    GVariant *result;
+    GError *error = NULL;
+
+    g_assert (IBUS_IS_INPUT_CONTEXT (context));
+
+    if ((channel = ibus_key_channel_new (&error)) == NULL) {
+        ibus_input_context_warn_key_channel (error);
+        return;
+    }
+    fd_list = ibus_input_context_new_key_channel_fd_list (channel);
+    result = g_dbus_proxy_call_with_unix_fd_list_sync (
+            (GDBusProxy *) context,
+            "OpenKeyChannel",
+            g_variant_new ("(hhh)", 0, 1, 2),
+            G_DBUS_CALL_FLAGS_NONE,
+            -1,
+            fd_list,
+            NULL,
+            NULL,
+            &error);
+    g_object_unref (fd_list);
+    if (result == NULL) {
+        ibus_key_channel_free (channel);
+        ibus_input_context_warn_key_channel (error);
+        return;
+    }
+    g_variant_unref (result);
+    ibus_input_context_set_key_channel (context, channel);
+}
+
+static void
+_open_key_channel_done (GDBusProxy   *proxy,
+                        GAsyncResult *res,
+                        GTask        *task)
+{
+    IBusKeyChannel *channel = g_task_get_task_data (task);
+    GError *error = NULL;
+    GVariant *result = g_dbus_proxy_call_with_unix_fd_list_finish (proxy,
+                                                                   NULL,
+                                                                   res,
+                                                                   &error);
+    if (result == NULL) {
+        ibus_key_channel_free (channel);
+        ibus_input_context_warn_key_channel (error);
+    } else {
+        g_variant_unref (result);
+        ibus_input_context_set_key_channel (IBUS_INPUT_CONTEXT (proxy),
+                                            channel);
+    }
+    g_task_return_boolean (task, TRUE);
+    g_object_unref (task);
+}
+
+void
+ibus_input_context_open_key_channel_async (IBusInputContext   *context,
+                                           GCancellable       *cancellable,
+                                           GAsyncReadyCallback callback,
+                                           gpointer            user_data)
+{
+    GTask *task;
+    IBusKeyChannel *channel;
+    GUnixFDList *fd_list;
+    GError *error = NULL;
+
+    g_assert (IBUS_IS_INPUT_CONTEXT (context));
+
+    task = g_task_new (context, cancellable, callback, user_data);
+    if ((channel = ibus_key_channel_new (&error)) == NULL) {
+        ibus_input_context_warn_key_channel (error);
+        g_task_return_boolean (task, TRUE);
+        g_object_unref (task);
+        return;
+    }
+    g_task_set_task_data (task, channel, NULL);
+    fd_list = ibus_input_context_new_key_channel_fd_list (channel);
+    g_dbus_proxy_call_with_unix_fd_list (
+            (GDBusProxy *) context,
+            "OpenKeyChannel",
+            g_variant_new ("(hhh)", 0, 1, 2),
+            G_DBUS_CALL_FLAGS_NONE,
+            -1,
+            fd_list,
+            cancellable,
+            (GAsyncReadyCallback) _open_key_channel_done,
+            task);
+    g_object_unref (fd_list);
+}
+
+static gboolean
+ibus_input_context_use_engine_link (void)
+{
+    static gint use_engine_link = -1;
+
+    if (use_engine_link < 0) {
+        const gchar *env = g_getenv ("IBUS_ENABLE_ENGINE_LINK");
+        use_engine_link = (env != NULL && g_strcmp0 (env, "0") != 0 &&
+                           g_ascii_strcasecmp (env, "false") != 0) ? 1 : 0;
+    }
+    return use_engine_link == 1;
+}
+
+static void
+ibus_input_context_close_engine_link (IBusInputContext *context)
+{
+    IBusInputContextPrivate *priv;
+    GDBusConnection *connection;
+
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
+    if ((connection = priv->engine_link) == NULL)
+        return;
+    priv->engine_link = NULL;
+    priv->engine_link_sending = FALSE;
+    g_dbus_connection_signal_unsubscribe (connection,
+                                          priv->engine_link_signal_id);
+    priv->engine_link_signal_id = 0;
+    g_signal_handlers_disconnect_by_data (connection, context);
+    if (!g_dbus_connection_is_closed (connection))
+        g_dbus_connection_close (connection, NULL, NULL, NULL);
+    g_object_unref (connection);
+    g_clear_pointer (&priv->engine_link_path, g_free);
+    g_clear_object (&priv->engine_link_keymap);
+    g_clear_pointer (&priv->engine_link_keys, g_array_unref);
+}
+
+static void
+_engine_link_closed_cb (GDBusConnection  *connection,
+                        gboolean          remote_peer_vanished,
+                        GError           *error,
+                        IBusInputContext *context)
+{
+    IBusInputContextPrivate *priv;
+
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
+    ibus_input_context_close_engine_link (context);
+    /* ibus-daemon closes the link when the engine changes. */
+    if (priv->has_focus)
+        ibus_input_context_open_engine_link (context);
+}
+
+/* Dispatch the signals which the engine sends over the link instead of
+ * ibus-daemon. */
+static void
+_engine_link_signal_cb (GDBusConnection  *connection,
+                        const gchar      *sender_name,
+                        const gchar      *object_path,
+                        const gchar      *interface_name,
+                        const gchar      *signal_name,
+                        GVariant         *parameters,
+                        IBusInputContext *context)
+{
+    static const gchar *names[] = {
+        "CommitText",
+        "ShowPreeditText",
+        "HidePreeditText",
+        "ForwardKeyEvent",
+        "DeleteSurroundingText",
+        "RequireSurroundingText",
+    };
+    gint i;
+
+    if (g_strcmp0 (signal_name, "UpdatePreeditText") == 0) {
+        GVariant *cached_var_client_commit;
+        gboolean client_commit = FALSE;
+        GVariant *text = NULL;
+        guint cursor_pos = 0;
+        gboolean visible = FALSE;
+        guint mode = 0;
+
+        cached_var_client_commit =
+            g_dbus_proxy_get_cached_property ((GDBusProxy *)context,
+                                              "ClientCommitPreedit");
+        if (cached_var_client_commit) {
+            g_variant_get (cached_var_client_commit, "(b)", &client_commit);
+            g_variant_unref (cached_var_client_commit);
+        }
+        if (client_commit) {
+            ibus_input_context_dispatch_signal ((GDBusProxy *)context,
+                                                sender_name,
+                                                "UpdatePreeditTextWithMode",
+                                                parameters);
+            return;
+        }
+        g_variant_get (parameters, "(vubu)",
+                       &text, &cursor_pos, &visible, &mode);
+        parameters = g_variant_ref_sink (
+                g_variant_new ("(vub)", text, cursor_pos, visible));
+        ibus_input_context_dispatch_signal ((GDBusProxy *)context,
+                                            sender_name,
+                                            "UpdatePreeditText",
+                                            parameters);
+        g_variant_unref (parameters);
+        g_variant_unref (text);
+        return;
+    }
+    for (i = 0; i < G_N_ELEMENTS (names); i++) {
+        if (g_strcmp0 (signal_name, names[i]) == 0) {
+            ibus_input_context_dispatch_signal ((GDBusProxy *)context,
+                                                sender_name,
+                                                signal_name,
+                                                parameters);
+            return;
+        }
+    }
+}
+
+typedef struct {
+    IBusInputContext *context;
+    gchar            *path;
+    gchar            *keymap;
+    GVariant         *reserved_keys;
+} OpenEngineLinkData;
+
+static void
+ibus_input_context_free_open_engine_link_data (OpenEngineLinkData *data)
+{
+    g_free (data->path);
+    g_free (data->keymap);
+    g_variant_unref (data->reserved_keys);
+    g_object_unref (data->context);
+    g_slice_free (OpenEngineLinkData, data);
+}
+
+static void
+_engine_link_connected (GObject            *source,
+                        GAsyncResult       *res,
+                        OpenEngineLinkData *data)
+{
+    IBusInputContext *context = data->context;
+    IBusInputContextPrivate *priv;
+    GDBusConnection *connection;
+    GVariantIter iter;
+    guint keyval, state;
+    GError *error = NULL;
+
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
+    priv->engine_link_opening = FALSE;
+    connection = g_dbus_connection_new_finish (res, &error);
+    if (connection == NULL) {
+        g_warning ("Cannot connect to the engine: %s", error->message);
+        g_error_free (error);
+        ibus_input_context_free_open_engine_link_data (data);
+        return;
+    }
+    if (IBUS_PROXY_DESTROYED (context) ||
+        g_dbus_connection_is_closed (connection)) {
+        g_dbus_connection_close (connection, NULL, NULL, NULL);
+        g_object_unref (connection);
+        ibus_input_context_free_open_engine_link_data (data);
+        return;
+    }
+
+    ibus_input_context_close_engine_link (context);
+    priv->engine_link = connection;
+    priv->engine_link_path = g_strdup (data->path);
+    if (*data->keymap != '\0')
+        priv->engine_link_keymap = ibus_keymap_get (data->keymap);
+    priv->engine_link_keys = g_array_new (FALSE, FALSE, sizeof (guint));
+    priv->engine_link_modifiers = FALSE;
+    g_variant_iter_init (&iter, data->reserved_keys);
+    while (g_variant_iter_next (&iter, "(uu)", &keyval, &state)) {
+        g_array_append_val (priv->engine_link_keys, keyval);
+        if (state != 0)
+            priv->engine_link_modifiers = TRUE;
+    }
+    priv->engine_link_signal_id = g_dbus_connection_signal_subscribe (
+            connection,
+            NULL,
+            IBUS_INTERFACE_ENGINE,
+            NULL,
+            data->path,
+            NULL,
+            G_DBUS_SIGNAL_FLAGS_NONE,
+            (GDBusSignalCallback) _engine_link_signal_cb,
+            context,
+            NULL);
+    g_signal_connect (connection, "closed",
+                      G_CALLBACK (_engine_link_closed_cb),
+                      context);
+    priv->engine_link_sending = priv->has_focus;
+    ibus_input_context_free_open_engine_link_data (data);
+}
+
+static void
+_open_engine_link_done (GDBusProxy       *proxy,
+                        GAsyncResult     *res,
+                        IBusInputContext *context)
+{
+    IBusInputContextPrivate *priv;
+    OpenEngineLinkData *data;
+    GUnixFDList *fd_list = NULL;
+    GVariant *result;
+    GError *error = NULL;
+    gint32 handle = -1;
+    GSocket *socket = NULL;
+    GSocketConnection *stream;
+    gint fd = -1;
+
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
+    result = g_dbus_proxy_call_with_unix_fd_list_finish (proxy,
+                                                         &fd_list,
+                                                         res,
+                                                         &error);
+    if (result == NULL) {
+        /* an old ibus-daemon or a context which needs ibus-daemon in the
+         * middle */
+        if (!g_error_matches (error, G_DBUS_ERROR,
+                              G_DBUS_ERROR_UNKNOWN_METHOD) &&
+            !g_error_matches (error, G_DBUS_ERROR,
+                              G_DBUS_ERROR_NOT_SUPPORTED)) {
+            g_warning ("Cannot open the engine link: %s", error->message);
+        }
+        g_error_free (error);
+        priv->engine_link_opening = FALSE;
+        g_object_unref (context);
+        return;
+    }
+
+    data = g_slice_new0 (OpenEngineLinkData);
+    data->context = context;
+    g_variant_get (result, "(hos@a(uu))",
+                   &handle, &data->path, &data->keymap, &data->reserved_keys);
+    g_variant_unref (result);
+    if (fd_list != NULL) {
+        fd = g_unix_fd_list_get (fd_list, handle, &error);
+        g_object_unref (fd_list);
+    }
+    if (fd >= 0 && (socket = g_socket_new_from_fd (fd, &error)) == NULL)
+        close (fd);
+    if (socket == NULL) {
+        g_warning ("Cannot open the engine link: %s",
+                   error ? error->message : "no file descriptor");
+        g_clear_error (&error);
+        priv->engine_link_opening = FALSE;
+        ibus_input_context_free_open_engine_link_data (data);
+        return;
+    }
+    stream = g_socket_connection_factory_create_connection (socket);
+    g_dbus_connection_new (G_IO_STREAM (stream),
+                           NULL,
+                           G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT,
+                           NULL,
+                           NULL,
+                           (GAsyncReadyCallback) _engine_link_connected,
+                           data);
+    g_object_unref (stream);
+    g_object_unref (socket);
+}
+
+/* Ask ibus-daemon for a peer connection to the engine with the
+ * OpenEngineLink method, so that the key events go to the engine without
+ * a hop through ibus-daemon. ibus-daemon keeps the focus, the shortcut
+ * keys and the engine switching and closes the link when it needs to see
+ * the key events again. */
+static void
+ibus_input_context_open_engine_link (IBusInputContext *context)
+{
+    IBusInputContextPrivate *priv;
+
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
+    if (priv->engine_link_opening)
+        return;
+    priv->engine_link_opening = TRUE;
+    g_dbus_proxy_call_with_unix_fd_list ((GDBusProxy *) context,
+                                         "OpenEngineLink",
+                                         NULL,
+                                         G_DBUS_CALL_FLAGS_NONE,
+                                         -1,
+                                         NULL,
+                                         NULL,
+                                         (GAsyncReadyCallback)
+                                                 _open_engine_link_done,
+                                         g_object_ref (context));
+}
+
+static gboolean
+ibus_input_context_is_modifier_key (guint keyval)
+{
+    switch (keyval) {
+    case IBUS_KEY_Control_L:
+    case IBUS_KEY_Control_R:
+    case IBUS_KEY_Shift_L:
+    case IBUS_KEY_Shift_R:
+    case IBUS_KEY_Alt_L:
+    case IBUS_KEY_Alt_R:
+    case IBUS_KEY_Meta_L:
+    case IBUS_KEY_Meta_R:
+    case IBUS_KEY_Super_L:
+    case IBUS_KEY_Super_R:
+    case IBUS_KEY_Hyper_L:
+    case IBUS_KEY_Hyper_R:
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+/* %TRUE if a key event can go to the engine over the link. The shortcut
+ * keys of ibus-daemon and the post process key event need ibus-daemon. */
+static gboolean
+ibus_input_context_is_engine_link_key (IBusInputContext *context,
+                                       guint32           keyval)
+{
+    IBusInputContextPrivate *priv;
+    GVariant *cached_var_post;
+    gboolean post_process = FALSE;
+    guint i;
+
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
+    if (priv->engine_link == NULL || !priv->engine_link_sending)
+        return FALSE;
+    for (i = 0; i < priv->engine_link_keys->len; i++) {
+        if (g_array_index (priv->engine_link_keys, guint, i) == keyval)
+            return FALSE;
+    }
+    /* ibus-daemon sees the release of the modifiers of a shortcut key. */
+    if (priv->engine_link_modifiers &&
+        ibus_input_context_is_modifier_key (keyval)) {
+        return FALSE;
+    }
+    cached_var_post =
+        g_dbus_proxy_get_cached_property ((GDBusProxy *)context,
+                                          "EffectivePostProcessKeyEvent");
+    if (cached_var_post) {
+        g_variant_get (cached_var_post, "(b)", &post_process);
+        g_variant_unref (cached_var_post);
+    }
+    return !post_process;
+}
+
+/* Convert the keyval from the keycode as bus_engine_proxy_process_key_event()
+ * does. */
+static GVariant *
+ibus_input_context_new_engine_link_key_event (IBusInputContext *context,
+                                              guint32           keyval,
+                                              guint32           keycode,
+                                              guint32           state)
+{
+    IBusInputContextPrivate *priv;
+
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
+    if (keycode != 0 && priv->engine_link_keymap != NULL) {
+        guint t = ibus_keymap_lookup_keysym (priv->engine_link_keymap,
+                                             keycode,
+                                             state);
+        if (t != IBUS_KEY_VoidSymbol)
+            keyval = t;
     }
+    return ibus_process_key_event_args_new (keyval, keycode, state);
+}
 
-    if (g_strcmp0 (signal_name, "UpdateProperty") == 0) {
-        GVariant *variant = NULL;
-        g_variant_get (parameters, "(v)", &variant);
-        IBusProperty *prop = IBUS_PROPERTY (ibus_serializable_deserialize (variant));
-        g_variant_unref (variant);
+static void     ibus_input_context_send_key_event
+                                                (IBusInputContext       *context,
+                                                 GTask                  *task,
+                                                 gboolean                use_link);
 
-        g_signal_emit (context, context_signals[UPDATE_PROPERTY], 0, prop);
+static void
+ibus_input_context_return_key_event (GTask    *task,
+                                     GVariant *result,
+                                     GError   *error)
+{
+    gboolean processed = FALSE;
 
-        if (g_object_is_floating (prop)) {
-            g_object_ref_sink (prop);
-            g_object_unref (prop);
-        }
-        return;
+    if (result != NULL) {
+        processed = ibus_process_key_event_reply_get (result);
+        g_variant_unref (result);
+        g_task_return_boolean (task, processed);
+    } else {
+        g_task_return_error (task, error);
     }
+    g_object_unref (task);
+}
 
-    if (g_strcmp0 (signal_name, "ForwardKeyEvent") == 0) {
-        guint32 keyval;
-        guint32 keycode;
-        guint32 state;
+static void
+_process_key_event_bus_done (GDBusProxy   *proxy,
+                             GAsyncResult *res,
+                             GTask        *task)
+{
+    IBusInputContextPrivate *priv;
+    GError *error = NULL;
+    GVariant *result = g_dbus_proxy_call_finish (proxy, res, &error);
 
-        g_variant_get (parameters, "(uuu)", &keyval, &keycode, &state);
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (IBUS_INPUT_CONTEXT (proxy));
+    priv->n_bus_key_events--;
+    ibus_input_context_return_key_event (task, result, error);
+}
 
-        /* Forward key event back with IBUS_FORWARD_MASK. And process_key_event will
-         * not process key event with IBUS_FORWARD_MASK again. */
-        g_signal_emit (context,
-                       context_signals[FORWARD_KEY_EVENT],
-                       0,
-                       keyval,
-                       keycode,
-                       state | IBUS_FORWARD_MASK);
-        return;
-    }
+/* %TRUE if @error shows that the engine did not get the key event, so that
+ * it can go through ibus-daemon instead. Any other error, e.g. the link
+ * closed while the call was in flight, can come after the engine
+ * processed the key event. */
+static gboolean
+ibus_input_context_is_undelivered_key_event (GError *error)
+{
+    return g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD) ||
+           g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_OBJECT) ||
+           g_error_matches (error,
+                            G_DBUS_ERROR,
+                            G_DBUS_ERROR_UNKNOWN_INTERFACE);
+}
 
-    if (g_strcmp0 (signal_name, "DeleteSurroundingText") == 0) {
-        gint offset_from_cursor;
-        guint nchars;
+static void
+_process_key_event_link_done (GDBusConnection *connection,
+                              GAsyncResult    *res,
+                              GTask           *task)
+{
+    IBusInputContext *context = g_object_ref (g_task_get_source_object (task));
+    IBusInputContextPrivate *priv;
+    GError *error = NULL;
+    GVariant *result = g_dbus_connection_call_finish (connection,
+                                                      res,
+                                                      &error);
 
-        g_variant_get (parameters, "(iu)", &offset_from_cursor, &nchars);
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
+    priv->n_link_key_events--;
+    if (result == NULL && ibus_input_context_is_undelivered_key_event (error)) {
+        /* the engine left the link. The later key events on the link fail
+         * after this one, so they are sent again in order. */
+        g_error_free (error);
+        ibus_input_context_send_key_event (context, task, FALSE);
+    } else if (result == NULL &&
+               !g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        /* the engine may have processed it, so it is not sent again. */
+        g_error_free (error);
+        g_task_return_boolean (task, FALSE);
+        g_object_unref (task);
+    } else {
+        ibus_input_context_return_key_event (task, result, error);
+    }
 
-        g_signal_emit (context,
-                       context_signals[DELETE_SURROUNDING_TEXT],
-                       0,
-                       offset_from_cursor,
-                       nchars);
-        return;
+    if (priv->n_link_key_events == 0) {
+        while ((task = g_queue_pop_head (&priv->deferred_key_events)))
+            ibus_input_context_send_key_event (context, task, FALSE);
     }
+    g_object_unref (context);
+}
 
+static void
+ibus_input_context_send_key_event (IBusInputContext *context,
+                                   GTask            *task,
+                                   gboolean          use_link)
+{
     IBusInputContextPrivate *priv;
-    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (IBUS_INPUT_CONTEXT (context));
+    EngineLinkKeyEvent *event = g_task_get_task_data (task);
 
-    if (g_strcmp0 (signal_name, "Enabled") == 0) {
-        priv->needs_surrounding_text = FALSE;
-        g_signal_emit (context, context_signals[ENABLED], 0);
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
+    /* a call on a closed link could not tell if it was delivered. */
+    if (use_link && !g_dbus_connection_is_closed (priv->engine_link)) {
+        priv->n_link_key_events++;
+        g_dbus_connection_call (priv->engine_link,
+                                NULL,
+                                priv->engine_link_path,
+                                IBUS_INTERFACE_ENGINE,
+                                "ProcessKeyEvent",
+                                ibus_input_context_new_engine_link_key_event (
+                                        context,
+                                        event->keyval,
+                                        event->keycode,
+                                        event->state),
+                                G_VARIANT_TYPE ("(b)"),
+                                G_DBUS_CALL_FLAGS_NONE,
+                                event->timeout_msec,
+                                g_task_get_cancellable (task),
+                                (GAsyncReadyCallback)
+                                        _process_key_event_link_done,
+                                task);
         return;
     }
+    priv->n_bus_key_events++;
+    g_dbus_proxy_call ((GDBusProxy *) context,
+                       "ProcessKeyEvent",
+                       ibus_process_key_event_args_new (event->keyval,
+                                                        event->keycode,
+                                                        event->state),
+                       G_DBUS_CALL_FLAGS_NONE,
+                       event->timeout_msec,
+                       g_task_get_cancellable (task),
+                       (GAsyncReadyCallback) _process_key_event_bus_done,
+                       task);
+}
 
-    if (g_strcmp0 (signal_name, "Disabled") == 0) {
-        priv->needs_surrounding_text = FALSE;
-        g_signal_emit (context, context_signals[DISABLED], 0);
-        return;
-    }
+/* Wait until the engine has the key events in flight on the link before a
+ * key event goes through ibus-daemon, and send the deferred ones ahead of
+ * it. Peer.Ping is answered after the engine received the earlier calls on
+ * the link, which its main loop then dispatches before the later ones. */
+static void
+ibus_input_context_sync_engine_link (IBusInputContext *context)
+{
+    IBusInputContextPrivate *priv;
+    GVariant *result;
+    GTask *task;
 
-    if (g_strcmp0 (signal_name, "RequireSurroundingText") == 0) {
-        priv->needs_surrounding_text = TRUE;
-        g_signal_emit (context, context_signals[REQUIRE_SURROUNDING_TEXT], 0);
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
+    if (priv->n_link_key_events == 0)
         return;
+    if (priv->engine_link != NULL) {
+        result = g_dbus_connection_call_sync (priv->engine_link,
+                                              NULL,
+                                              priv->engine_link_path,
+                                              "org.freedesktop.DBus.Peer",
+                                              "Ping",
+                                              NULL,
+                                              NULL,
+                                              G_DBUS_CALL_FLAGS_NONE,
+                                              -1,
+                                              NULL,
+                                              NULL);
+        if (result != NULL)
+            g_variant_unref (result);
     }
+    while ((task = g_queue_pop_head (&priv->deferred_key_events)))
+        ibus_input_context_send_key_event (context, task, FALSE);
+}
 
-    G_DBUS_PROXY_CLASS (ibus_input_context_parent_class)->g_signal (
-                                proxy, sender_name, signal_name, parameters);
+/* Send an asynchronous key event while the engine link is enabled. A key
+ * event goes over the link only if no key event is in flight through
+ * ibus-daemon, and a key event for ibus-daemon waits for the key events
+ * on the link, so that the engine gets the key events and the caller gets
+ * the replies in order. */
+static void
+ibus_input_context_route_key_event (IBusInputContext   *context,
+                                    guint32             keyval,
+                                    guint32             keycode,
+                                    guint32             state,
+                                    gint                timeout_msec,
+                                    GCancellable       *cancellable,
+                                    GAsyncReadyCallback callback,
+                                    gpointer            user_data)
+{
+    IBusInputContextPrivate *priv;
+    EngineLinkKeyEvent *event;
+    GTask *task;
+
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
+    event = g_new (EngineLinkKeyEvent, 1);
+    event->keyval = keyval;
+    event->keycode = keycode;
+    event->state = state;
+    event->timeout_msec = timeout_msec;
+    task = g_task_new (context, cancellable, callback, user_data);
+    g_task_set_source_tag (task, ibus_input_context_process_key_event_async);
+    g_task_set_task_data (task, event, g_free);
+
+    if (!g_queue_is_empty (&priv->deferred_key_events)) {
+        g_queue_push_tail (&priv->deferred_key_events, task);
+    } else if (ibus_input_context_is_engine_link_key (context, keyval) &&
+               priv->n_bus_key_events == 0 &&
+               g_queue_is_empty (&priv->key_channel_calls)) {
+        ibus_input_context_send_key_event (context, task, TRUE);
+    } else if (priv->n_link_key_events > 0) {
+        g_queue_push_tail (&priv->deferred_key_events, task);
+    } else {
+        ibus_input_context_send_key_event (context, task, FALSE);
+    }
 }
 
 IBusInputContext *
@@ -941,6 +2056,41 @@ ibus_input_context_cancel_hand_writing (IBusInputContext   *context,
                        );
 }
 
+/* Send a key event with the key channel if it is open. The post process
+ * key event needs the D-Bus reply to order the signals and the reply. */
+static KeyChannelCall *
+ibus_input_context_push_key_channel (IBusInputContext *context,
+                                     guint32           keyval,
+                                     guint32           keycode,
+                                     guint32           state)
+{
+    IBusInputContextPrivate *priv;
+    GVariant *cached_var_post;
+    gboolean post_process = FALSE;
+    KeyChannelCall *call;
+
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
+    if (priv->key_channel == NULL)
+        return NULL;
+    cached_var_post =
+        g_dbus_proxy_get_cached_property ((GDBusProxy *)context,
+                                          "EffectivePostProcessKeyEvent");
+    if (cached_var_post) {
+        g_variant_get (cached_var_post, "(b)", &post_process);
+        g_variant_unref (cached_var_post);
+    }
+    if (post_process)
+        return NULL;
+    call = g_slice_new0 (KeyChannelCall);
+    call->serial = priv->key_channel_serial++;
+    call->keyval = keyval;
+    call->keycode = keycode;
+    call->state = state;
+    g_queue_push_tail (&priv->key_channel_calls, call);
+    ibus_input_context_push_key_channel_calls (context);
+    return call;
+}
+
 void
 ibus_input_context_process_key_event_async (IBusInputContext   *context,
                                             guint32             keyval,
@@ -951,11 +2101,32 @@ ibus_input_context_process_key_event_async (IBusInputContext   *context,
                                             GAsyncReadyCallback callback,
                                             gpointer            user_data)
 {
+    KeyChannelCall *call;
+
     g_assert (IBUS_IS_INPUT_CONTEXT (context));
 
+    if (ibus_input_context_use_engine_link ()) {
+        ibus_input_context_route_key_event (context,
+                                            keyval, keycode, state,
+                                            timeout_msec,
+                                            cancellable,
+                                            callback,
+                                            user_data);
+        return;
+    }
+
+    call = ibus_input_context_push_key_channel (context,
+                                                keyval, keycode, state);
+    if (call != NULL) {
+        call->task = g_task_new (context, cancellable, callback, user_data);
+        g_task_set_source_tag (call->task,
+                               ibus_input_context_process_key_event_async);
+        return;
+    }
+
     g_dbus_proxy_call ((GDBusProxy *) context,
                        "ProcessKeyEvent",                   /* method_name */
-                       g_variant_new ("(uuu)",
+                       ibus_process_key_event_args_new (
                             keyval, keycode, state),        /* parameters */
                        G_DBUS_CALL_FLAGS_NONE,              /* flags */
                        timeout_msec,                        /* timeout */
@@ -976,10 +2147,15 @@ ibus_input_context_process_key_event_async_finish (IBusInputContext  *context,
 
     gboolean processed = FALSE;
 
+    if (g_async_result_is_tagged (res,
+                                  ibus_input_context_process_key_event_async)) {
+        return g_task_propagate_boolean (G_TASK (res), error);
+    }
+
     GVariant *variant = g_dbus_proxy_call_finish ((GDBusProxy *) context,
                                                    res, error);
     if (variant != NULL) {
-        g_variant_get (variant, "(b)", &processed);
+        processed = ibus_process_key_event_reply_get (variant);
         g_variant_unref (variant);
     }
 
@@ -992,11 +2168,76 @@ ibus_input_context_process_key_event (IBusInputContext *context,
                                       guint32           keycode,
                                       guint32           state)
 {
+    IBusInputContextPrivate *priv;
+    KeyChannelCall *call;
+
     g_assert (IBUS_IS_INPUT_CONTEXT (context));
 
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
+    /* the same order as ibus_input_context_route_key_event(). A call on the
+     * link follows the asynchronous ones on the link. */
+    if (ibus_input_context_is_engine_link_key (context, keyval) &&
+        priv->n_bus_key_events == 0 &&
+        g_queue_is_empty (&priv->deferred_key_events) &&
+        g_queue_is_empty (&priv->key_channel_calls) &&
+        !g_dbus_connection_is_closed (priv->engine_link)) {
+        GVariant *result;
+        GError *error = NULL;
+
+        result = g_dbus_connection_call_sync (
+                priv->engine_link,
+                NULL,
+                priv->engine_link_path,
+                IBUS_INTERFACE_ENGINE,
+                "ProcessKeyEvent",
+                ibus_input_context_new_engine_link_key_event (context,
+                                                              keyval,
+                                                              keycode,
+                                                              state),
+                G_VARIANT_TYPE ("(b)"),
+                G_DBUS_CALL_FLAGS_NONE,
+                -1,
+                NULL,
+                &error);
+        if (result != NULL) {
+            gboolean processed = ibus_process_key_event_reply_get (result);
+            g_variant_unref (result);
+            return processed;
+        }
+        /* send it to ibus-daemon only if the engine did not get it. */
+        if (!ibus_input_context_is_undelivered_key_event (error)) {
+            g_error_free (error);
+            return FALSE;
+        }
+        g_error_free (error);
+    } else {
+        ibus_input_context_sync_engine_link (context);
+    }
+
+    call = ibus_input_context_push_key_channel (context,
+                                                keyval, keycode, state);
+    if (call != NULL) {
+        gboolean processed;
+
+        while (!call->done) {
+            if (!ibus_key_channel_wait_reply (priv->key_channel,
+                                              ibus_get_timeout ())) {
+                g_warning ("%s: Timeout of the key channel.", G_STRFUNC);
+                break;
+            }
+            ibus_input_context_read_key_channel (context);
+        }
+        processed = call->processed;
+        g_queue_remove (&priv->key_channel_calls, call);
+        ibus_input_context_free_key_channel_call (call);
+        /* the call held back the asynchronous key events after it. */
+        ibus_input_context_complete_key_channel_calls (context);
+        return processed;
+    }
+
     GVariant *result = g_dbus_proxy_call_sync ((GDBusProxy *) context,
                             "ProcessKeyEvent",              /* method_name */
-                            g_variant_new ("(uuu)",
+                            ibus_process_key_event_args_new (
                                  keyval, keycode, state),   /* parameters */
                             G_DBUS_CALL_FLAGS_NONE,         /* flags */
                             -1,                             /* timeout */
@@ -1004,9 +2245,8 @@ ibus_input_context_process_key_event (IBusInputContext *context,
                             NULL);
 
     if (result != NULL) {
-        gboolean processed = FALSE;
+        gboolean processed = ibus_process_key_event_reply_get (result);
 
-        g_variant_get (result, "(b)", &processed);
         g_variant_unref (result);
         return processed;
     }
@@ -1014,6 +2254,126 @@ ibus_input_context_process_key_event (IBusInputContext *context,
     return FALSE;
 }
 
+void
+ibus_input_context_process_key_events_async (
+        IBusInputContext              *context,
+        const IBusProcessKeyEventData *keys,
+        guint                          n_keys,
+        gint                           timeout_msec,
+        GCancellable                  *cancellable,
+        GAsyncReadyCallback            callback,
+        gpointer                       user_data)
+{
+    g_assert (IBUS_IS_INPUT_CONTEXT (context));
+    g_assert (keys != NULL || n_keys == 0);
+
+    /* ibus-daemon answers the key events in the order of the calls, but the
+     * key events on the key channel or the engine link can overtake them. */
+    g_dbus_proxy_call ((GDBusProxy *) context,
+                       "ProcessKeyEvents",                  /* method_name */
+                       ibus_process_key_events_args_new (
+                            keys, n_keys),                  /* parameters */
+                       G_DBUS_CALL_FLAGS_NONE,              /* flags */
+                       timeout_msec,                        /* timeout */
+                       cancellable,                         /* cancellable */
+                       callback,                            /* callback */
+                       user_data                            /* user_data */
+                       );
+}
+
+/**
+ * ibus_input_context_get_key_events_reply:
+ *
+ * Unpack the bitmap in the reply of "ProcessKeyEvents" to @handled.
+ */
+static gboolean
+ibus_input_context_get_key_events_reply (GVariant  *reply,
+                                         gboolean  *handled,
+                                         guint      n_keys,
+                                         GError   **error)
+{
+    const guint8 *bitmap = ibus_process_key_events_reply_get (reply, n_keys);
+    guint i;
+
+    if (bitmap == NULL) {
+        g_set_error (error,
+                     G_DBUS_ERROR,
+                     G_DBUS_ERROR_INVALID_ARGS,
+                     "The reply of ProcessKeyEvents is too short for %u keys.",
+                     n_keys);
+        return FALSE;
+    }
+    for (i = 0; i < n_keys; i++)
+        handled[i] = (bitmap[i / 8] >> (i % 8)) & 1;
+    return TRUE;
+}
+
+gboolean
+ibus_input_context_process_key_events_async_finish (
+        IBusInputContext  *context,
+        GAsyncResult      *res,
+        gboolean          *handled,
+        guint              n_keys,
+        GError           **error)
+{
+    GVariant *variant;
+    gboolean retval;
+
+    g_assert (IBUS_IS_INPUT_CONTEXT (context));
+    g_assert (G_IS_ASYNC_RESULT (res));
+    g_assert (handled != NULL || n_keys == 0);
+    g_assert (error == NULL || *error == NULL);
+
+    variant = g_dbus_proxy_call_finish ((GDBusProxy *) context, res, error);
+    if (variant == NULL)
+        return FALSE;
+    retval = ibus_input_context_get_key_events_reply (variant,
+                                                      handled,
+                                                      n_keys,
+                                                      error);
+    g_variant_unref (variant);
+    return retval;
+}
+
+gboolean
+ibus_input_context_process_key_events (IBusInputContext              *context,
+                                       const IBusProcessKeyEventData *keys,
+                                       guint                          n_keys,
+                                       gboolean                      *handled)
+{
+    GVariant *result;
+    GError *error = NULL;
+    gboolean retval;
+
+    g_assert (IBUS_IS_INPUT_CONTEXT (context));
+    g_assert (keys != NULL || n_keys == 0);
+    g_assert (handled != NULL || n_keys == 0);
+
+    result = g_dbus_proxy_call_sync ((GDBusProxy *) context,
+                            "ProcessKeyEvents",             /* method_name */
+                            ibus_process_key_events_args_new (
+                                 keys, n_keys),             /* parameters */
+                            G_DBUS_CALL_FLAGS_NONE,         /* flags */
+                            -1,                             /* timeout */
+                            NULL,                           /* cancellable */
+                            &error);
+    if (result == NULL) {
+        g_warning ("%s: %s", G_STRFUNC, error->message);
+        g_error_free (error);
+        return FALSE;
+    }
+    retval = ibus_input_context_get_key_events_reply (result,
+                                                      handled,
+                                                      n_keys,
+                                                      &error);
+    if (!retval) {
+        g_warning ("%s: %s", G_STRFUNC, error->message);
+        g_error_free (error);
+    }
+    g_variant_unref (result);
+    return retval;
+}
+
 void
 ibus_input_context_set_cursor_location (IBusInputContext *context,
                                         gint32            x,
@@ -1054,11 +2414,38 @@ ibus_input_context_set_cursor_location_relative (IBusInputContext *context,
                        );
 }
 
+/* UpdatePreeditTextDelta is applied in ibus_input_context_g_signal() and
+ * the applications receive the whole text with the update-preedit-text
+ * signals, unless the D-Bus signals do not reach it or the application
+ * handles them with its own GDBusProxy::g-signal handler. */
+static gboolean
+ibus_input_context_applies_preedit_delta (IBusInputContext *context)
+{
+    GDBusProxyFlags flags = g_dbus_proxy_get_flags ((GDBusProxy *) context);
+
+    if (flags & G_DBUS_PROXY_FLAGS_DO_NOT_CONNECT_SIGNALS)
+        return FALSE;
+    return !g_signal_has_handler_pending (
+            context,
+            g_signal_lookup ("g-signal", G_TYPE_DBUS_PROXY),
+            0,
+            TRUE);
+}
+
 void
 ibus_input_context_set_capabilities (IBusInputContext   *context,
                                      guint32             capabilites)
 {
+    IBusInputContextPrivate *priv;
+
     g_assert (IBUS_IS_INPUT_CONTEXT (context));
+
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
+    priv->capabilities = capabilites;
+    if (priv->no_preedit_delta)
+        capabilites &= ~IBUS_CAP_PREEDIT_DELTA;
+    else if (ibus_input_context_applies_preedit_delta (context))
+        capabilites |= IBUS_CAP_PREEDIT_DELTA;
     g_dbus_proxy_call ((GDBusProxy *) context,
                        "SetCapabilities",                   /* method_name */
                        g_variant_new ("(u)", capabilites),  /* parameters */
@@ -1120,6 +2507,95 @@ ibus_input_context_property_hide (IBusInputContext *context,
                        );
 }
 
+static void
+ibus_input_context_send_surrounding_text (IBusInputContext *context)
+{
+    IBusInputContextPrivate *priv;
+    GVariant *variant;
+
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
+    variant = ibus_serializable_serialize (
+            (IBusSerializable *)priv->surrounding_text);
+    priv->surrounding_text_synced = TRUE;
+    priv->surrounding_revision = 0;
+    priv->surrounding_text_serial++;
+    g_dbus_proxy_call ((GDBusProxy *) context,
+                       "SetSurroundingText",        /* method_name */
+                       g_variant_new ("(vuu)",
+                                      variant,
+                                      priv->surrounding_cursor_pos,
+                                      priv->selection_anchor_pos),
+                       G_DBUS_CALL_FLAGS_NONE,      /* flags */
+                       -1,                          /* timeout */
+                       NULL,                        /* cancellable */
+                       NULL,                        /* callback */
+                       NULL                         /* user_data */
+                       );
+}
+
+static void
+ibus_input_context_set_surrounding_text_delta_done (IBusInputContext *context,
+                                                    GAsyncResult     *res,
+                                                    gpointer          user_data)
+{
+    IBusInputContextPrivate *priv;
+    GError *error = NULL;
+    GVariant *variant;
+    gboolean applied = FALSE;
+
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
+    variant = g_dbus_proxy_call_finish ((GDBusProxy *) context, res, &error);
+    if (variant != NULL) {
+        g_variant_get (variant, "(b)", &applied);
+        g_variant_unref (variant);
+    } else {
+        if (g_error_matches (error, G_DBUS_ERROR, G_DBUS_ERROR_UNKNOWN_METHOD))
+            priv->no_surrounding_text_delta = TRUE;
+        g_error_free (error);
+    }
+
+    /* ibus-daemon did not have the revision which the delta is based on.
+     * Send the whole text unless it has been sent after the delta. */
+    if (!applied &&
+        GPOINTER_TO_UINT (user_data) == priv->surrounding_text_serial &&
+        priv->needs_surrounding_text) {
+        ibus_input_context_send_surrounding_text (context);
+    }
+}
+
+static void
+ibus_input_context_send_surrounding_text_delta (IBusInputContext *context,
+                                                IBusText         *old_text)
+{
+    IBusInputContextPrivate *priv;
+    gchar *inserted;
+    guint offset = 0;
+    guint n_deleted = 0;
+
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
+    inserted = ibus_text_diff (old_text,
+                               priv->surrounding_text,
+                               &offset,
+                               &n_deleted);
+    g_dbus_proxy_call ((GDBusProxy *) context,
+                       "SetSurroundingTextDelta",   /* method_name */
+                       g_variant_new ("(uuusuu)",
+                                      priv->surrounding_revision,
+                                      offset,
+                                      n_deleted,
+                                      inserted,
+                                      priv->surrounding_cursor_pos,
+                                      priv->selection_anchor_pos),
+                       G_DBUS_CALL_FLAGS_NONE,      /* flags */
+                       -1,                          /* timeout */
+                       NULL,                        /* cancellable */
+                       (GAsyncReadyCallback)
+                       ibus_input_context_set_surrounding_text_delta_done,
+                       GUINT_TO_POINTER (priv->surrounding_text_serial));
+    priv->surrounding_revision++;
+    g_free (inserted);
+}
+
 void
 ibus_input_context_set_surrounding_text (IBusInputContext   *context,
                                          IBusText           *text,
@@ -1147,27 +2623,28 @@ ibus_input_context_set_surrounding_text (IBusInputContext   *context,
         priv->surrounding_text == NULL ||
         text != priv->surrounding_text ||
         g_strcmp0 (text->text, priv->surrounding_text->text) != 0) {
-        if (priv->surrounding_text)
-            g_object_unref (priv->surrounding_text);
+        IBusText *old_text = priv->surrounding_text;
+
         priv->surrounding_text = (IBusText *) g_object_ref_sink (text);
         priv->surrounding_cursor_pos = cursor_pos;
         priv->selection_anchor_pos = anchor_pos;
 
-        if (priv->needs_surrounding_text) {
-            GVariant *variant = ibus_serializable_serialize ((IBusSerializable *)text);
-            g_dbus_proxy_call ((GDBusProxy *) context,
-                               "SetSurroundingText",        /* method_name */
-                               g_variant_new ("(vuu)",
-                                              variant,
-                                              cursor_pos,
-                                              anchor_pos),  /* parameters */
-                                G_DBUS_CALL_FLAGS_NONE,     /* flags */
-                                -1,                         /* timeout */
-                                NULL,                       /* cancellable */
-                                NULL,                       /* callback */
-                                NULL                        /* user_data */
-                                );
+        /* Send only the changed range if ibus-daemon has the previous text.
+         * Attributes cannot be sent in a delta. */
+        if (!priv->needs_surrounding_text) {
+            priv->surrounding_text_synced = FALSE;
+        } else if (old_text != NULL &&
+                   priv->surrounding_text_synced &&
+                   !priv->no_surrounding_text_delta &&
+                   (text->attrs == NULL ||
+                    ibus_attr_list_get (text->attrs, 0) == NULL)) {
+            ibus_input_context_send_surrounding_text_delta (context,
+                                                            old_text);
+        } else {
+            ibus_input_context_send_surrounding_text (context);
         }
+        if (old_text)
+            g_object_unref (old_text);
     } else {
         g_object_unref(text);
     }
@@ -1651,11 +3128,52 @@ ibus_input_context_post_process_key_event (IBusInputContext *context)
                            );                                           \
     }
 
-DEFINE_FUNC(focus_in, FocusIn);
-DEFINE_FUNC(focus_out, FocusOut);
 DEFINE_FUNC(reset, Reset);
 DEFINE_FUNC(page_up, PageUp);
 DEFINE_FUNC(page_down, PageDown);
 DEFINE_FUNC(cursor_up, CursorUp);
 DEFINE_FUNC(cursor_down, CursorDown);
 #undef DEFINE_FUNC
+
+void
+ibus_input_context_focus_in (IBusInputContext *context)
+{
+    IBusInputContextPrivate *priv;
+
+    g_assert (IBUS_IS_INPUT_CONTEXT (context));
+
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
+    priv->has_focus = TRUE;
+    g_dbus_proxy_call ((GDBusProxy *) context,
+                       "FocusIn",
+                       NULL,
+                       G_DBUS_CALL_FLAGS_NONE,
+                       -1,
+                       NULL,
+                       NULL,
+                       NULL);
+    if (priv->engine_link == NULL && ibus_input_context_use_engine_link ())
+        ibus_input_context_open_engine_link (context);
+}
+
+void
+ibus_input_context_focus_out (IBusInputContext *context)
+{
+    IBusInputContextPrivate *priv;
+
+    g_assert (IBUS_IS_INPUT_CONTEXT (context));
+
+    priv = IBUS_INPUT_CONTEXT_GET_PRIVATE (context);
+    priv->has_focus = FALSE;
+    /* Keep the link open to receive the signals which the engine sends
+     * until ibus-daemon closes it. */
+    priv->engine_link_sending = FALSE;
+    g_dbus_proxy_call ((GDBusProxy *) context,
+                       "FocusOut",
+                       NULL,
+                       G_DBUS_CALL_FLAGS_NONE,
+                       -1,
+                       NULL,
+                       NULL,
+                       NULL);
+}
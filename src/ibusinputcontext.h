@@ -43,6 +43,7 @@
 #include "ibusproxy.h"
 #include "ibusenginedesc.h"
 #include "ibustext.h"
+#include "ibusxevent.h"
 
 /*
  * Type macros.
@@ -298,6 +299,92 @@ gboolean     ibus_input_context_process_key_event
                                              guint32             keycode,
                                              guint32             state);
 
+/**
+ * ibus_input_context_process_key_events_async:
+ * @context: An IBusInputContext.
+ * @keys: (array length=n_keys): The key events in order.
+ * @n_keys: The number of @keys.
+ * @timeout_msec: The timeout in milliseconds or -1 to use the default timeout.
+ * @cancellable: A GCancellable or NULL.
+ * @callback: A GAsyncReadyCallback to call when the request is satisfied or NULL
+ *      if you don't care about the result of the method invocation.
+ * @user_data: The data to pass to callback.
+ *
+ * Pass a run of key events, e.g. from a paste, a macro or key repeat, to
+ * input method engine with one call instead of one call per key event.
+ * Engines which do not implement #IBusEngineClass.process_key_events()
+ * get the key events one by one in #IBusEngine::process-key-event.
+ * The commit text of the key events is sent in one
+ * #IBusInputContext::commit-text signal and only the last preedit text
+ * is sent.
+ *
+ * see_also: ibus_input_context_process_key_event_async()
+ *
+ * Since: 1.5.33
+ * Stability: Unstable
+ */
+void        ibus_input_context_process_key_events_async
+                                            (IBusInputContext   *context,
+                                             const IBusProcessKeyEventData
+                                                                *keys,
+                                             guint               n_keys,
+                                             gint                timeout_msec,
+                                             GCancellable       *cancellable,
+                                             GAsyncReadyCallback callback,
+                                             gpointer            user_data);
+
+/**
+ * ibus_input_context_process_key_events_async_finish:
+ * @context: An #IBusInputContext.
+ * @res: A #GAsyncResult obtained from the #GAsyncReadyCallback passed to
+ *      ibus_input_context_process_key_events_async().
+ * @handled: (out caller-allocates) (array length=n_keys): Return location
+ *      for whether each key event is processed.
+ * @n_keys: The number of the key events passed to
+ *      ibus_input_context_process_key_events_async().
+ * @error: Return location for error or %NULL.
+ *
+ * Finishes an operation started with
+ *      ibus_input_context_process_key_events_async().
+ *
+ * Returns: %TRUE if @handled is set;
+ *      %FALSE if some errors happen and the @error will be set.
+ *
+ * Since: 1.5.33
+ * Stability: Unstable
+ */
+gboolean     ibus_input_context_process_key_events_async_finish
+                                            (IBusInputContext   *context,
+                                             GAsyncResult       *res,
+                                             gboolean           *handled,
+                                             guint               n_keys,
+                                             GError            **error);
+
+/**
+ * ibus_input_context_process_key_events:
+ * @context: An #IBusInputContext.
+ * @keys: (array length=n_keys): The key events in order.
+ * @n_keys: The number of @keys.
+ * @handled: (out caller-allocates) (array length=n_keys): Return location
+ *      for whether each key event is processed.
+ *
+ * Pass a run of key events to input method engine and wait for the reply
+ * from ibus (i.e. synchronous IPC).
+ *
+ * Returns: %TRUE if @handled is set; %FALSE otherwise.
+ *
+ * See also: ibus_input_context_process_key_events_async()
+ *
+ * Since: 1.5.33
+ * Stability: Unstable
+ */
+gboolean     ibus_input_context_process_key_events
+                                            (IBusInputContext   *context,
+                                             const IBusProcessKeyEventData
+                                                                *keys,
+                                             guint               n_keys,
+                                             gboolean           *handled);
+
 /**
  * ibus_input_context_set_cursor_location:
  * @context: An IBusInputContext.
@@ -459,6 +546,9 @@ void         ibus_input_context_set_engine  (IBusInputContext   *context,
  * @text: An #IBusText surrounding the current cursor on the application.
  * @cursor_pos: Current cursor position in characters in @text.
  * @anchor_pos: Anchor position of selection in @text.
+ *
+ * If ibus-daemon already has the previous surrounding text, only the
+ * changed range is sent. Otherwise the whole @text is sent.
 */
 void         ibus_input_context_set_surrounding_text
                                             (IBusInputContext   *context,
@@ -0,0 +1,414 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/* ibus - The Input Bus
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <unistd.h>
+#include <gio/gio.h>
+#ifdef HAVE_SYS_EVENTFD_H
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "ibuskeychannel.h"
+
+#if defined (HAVE_SYS_EVENTFD_H) && defined (HAVE_MEMFD_CREATE)
+#define KEY_CHANNEL_SUPPORTED 1
+#endif
+
+#define KEY_CHANNEL_MAGIC 0x4942534b /* "IBSK" */
+
+typedef struct {
+    guint32 keyval;
+    guint32 keycode;
+    guint32 state;
+    guint32 serial;
+} KeyRecord;
+
+typedef struct {
+    guint32 serial;
+    guint32 processed;
+    guint32 n_signals;
+    guint32 padding;
+} ReplyRecord;
+
+/* The indexes run freely and wrap around. Each one is written by one side
+ * only: the client writes key_tail and reply_head, ibus-daemon writes
+ * key_head and reply_tail. They are copies of the indexes in
+ * IBusKeyChannel, which each side uses for its own records, so that the
+ * other side cannot move them. */
+typedef struct {
+    guint32     magic;
+    guint32     n_slots;
+    gint        key_head;
+    gint        key_tail;
+    gint        reply_head;
+    gint        reply_tail;
+    KeyRecord   keys[IBUS_KEY_CHANNEL_N_SLOTS];
+    ReplyRecord replies[IBUS_KEY_CHANNEL_N_SLOTS];
+} KeyChannelShared;
+
+struct _IBusKeyChannel {
+    KeyChannelShared *shared;
+    gint memfd;
+    /* eventfd to wake up ibus-daemon for keys */
+    gint key_fd;
+    /* eventfd to wake up the client for replies */
+    gint reply_fd;
+    /* the indexes which this side writes, see KeyChannelShared */
+    guint key_head;
+    guint key_tail;
+    guint reply_head;
+    guint reply_tail;
+};
+
+#ifdef KEY_CHANNEL_SUPPORTED
+static void
+ibus_key_channel_notify (gint fd)
+{
+    guint64 value = 1;
+    while (write (fd, &value, sizeof (value)) < 0 && errno == EINTR);
+}
+
+static gboolean
+ibus_key_channel_map (IBusKeyChannel *channel,
+                      GError        **error)
+{
+    channel->shared = mmap (NULL, sizeof (KeyChannelShared),
+                            PROT_READ | PROT_WRITE, MAP_SHARED,
+                            channel->memfd, 0);
+    if (channel->shared == MAP_FAILED) {
+        int errsv = errno;
+        channel->shared = NULL;
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                     "mmap: %s", g_strerror (errsv));
+        return FALSE;
+    }
+    return TRUE;
+}
+#endif
+
+/*
+ * ibus_key_channel_new:
+ *
+ * Create a channel on the client side. The memfd is sealed so that
+ * ibus-daemon can map it without trusting the client for its size.
+ */
+IBusKeyChannel *
+ibus_key_channel_new (GError **error)
+{
+#ifdef KEY_CHANNEL_SUPPORTED
+    IBusKeyChannel *channel = g_slice_new0 (IBusKeyChannel);
+
+    channel->memfd = channel->key_fd = channel->reply_fd = -1;
+    channel->memfd = memfd_create ("ibus-key-channel",
+                                   MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (channel->memfd < 0 ||
+        ftruncate (channel->memfd, sizeof (KeyChannelShared)) < 0 ||
+        fcntl (channel->memfd, F_ADD_SEALS,
+               F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+        int errsv = errno;
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                     "memfd: %s", g_strerror (errsv));
+        ibus_key_channel_free (channel);
+        return NULL;
+    }
+    channel->key_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+    channel->reply_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (channel->key_fd < 0 || channel->reply_fd < 0) {
+        int errsv = errno;
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                     "eventfd: %s", g_strerror (errsv));
+        ibus_key_channel_free (channel);
+        return NULL;
+    }
+    if (!ibus_key_channel_map (channel, error)) {
+        ibus_key_channel_free (channel);
+        return NULL;
+    }
+    channel->shared->magic = KEY_CHANNEL_MAGIC;
+    channel->shared->n_slots = IBUS_KEY_CHANNEL_N_SLOTS;
+    return channel;
+#else
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                 "The key channel is not supported on this platform.");
+    return NULL;
+#endif
+}
+
+/*
+ * ibus_key_channel_new_from_fds:
+ *
+ * Map the channel which a client created. The channel takes the file
+ * descriptors even if it fails.
+ */
+IBusKeyChannel *
+ibus_key_channel_new_from_fds (gint     memfd,
+                               gint     key_fd,
+                               gint     reply_fd,
+                               GError **error)
+{
+    IBusKeyChannel *channel = g_slice_new0 (IBusKeyChannel);
+
+    channel->memfd = memfd;
+    channel->key_fd = key_fd;
+    channel->reply_fd = reply_fd;
+#ifdef KEY_CHANNEL_SUPPORTED
+    {
+        struct stat st;
+        int seals = fcntl (memfd, F_GET_SEALS);
+        if (seals < 0 || (seals & F_SEAL_SHRINK) == 0 ||
+            fstat (memfd, &st) < 0 || st.st_size < sizeof (KeyChannelShared)) {
+            g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                         "The key channel is not a sealed memfd.");
+            ibus_key_channel_free (channel);
+            return NULL;
+        }
+    }
+    /* ibus-daemon must not block on the eventfds of a client. */
+    if (fcntl (key_fd, F_SETFL, O_NONBLOCK) < 0 ||
+        fcntl (reply_fd, F_SETFL, O_NONBLOCK) < 0) {
+        int errsv = errno;
+        g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                     "fcntl: %s", g_strerror (errsv));
+        ibus_key_channel_free (channel);
+        return NULL;
+    }
+    if (!ibus_key_channel_map (channel, error)) {
+        ibus_key_channel_free (channel);
+        return NULL;
+    }
+    if (channel->shared->magic != KEY_CHANNEL_MAGIC ||
+        channel->shared->n_slots != IBUS_KEY_CHANNEL_N_SLOTS) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                     "The key channel has an unknown layout.");
+        ibus_key_channel_free (channel);
+        return NULL;
+    }
+    /* read once; the client may change them afterwards. */
+    channel->key_head = (guint) g_atomic_int_get (&channel->shared->key_head);
+    channel->reply_tail =
+            (guint) g_atomic_int_get (&channel->shared->reply_tail);
+    return channel;
+#else
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                 "The key channel is not supported on this platform.");
+    ibus_key_channel_free (channel);
+    return NULL;
+#endif
+}
+
+void
+ibus_key_channel_free (IBusKeyChannel *channel)
+{
+    g_return_if_fail (channel != NULL);
+
+#ifdef KEY_CHANNEL_SUPPORTED
+    if (channel->shared)
+        munmap (channel->shared, sizeof (KeyChannelShared));
+#endif
+    if (channel->memfd >= 0)
+        close (channel->memfd);
+    if (channel->key_fd >= 0)
+        close (channel->key_fd);
+    if (channel->reply_fd >= 0)
+        close (channel->reply_fd);
+    g_slice_free (IBusKeyChannel, channel);
+}
+
+void
+ibus_key_channel_get_fds (IBusKeyChannel *channel,
+                          gint           *memfd,
+                          gint           *key_fd,
+                          gint           *reply_fd)
+{
+    g_return_if_fail (channel != NULL);
+
+    if (memfd)
+        *memfd = channel->memfd;
+    if (key_fd)
+        *key_fd = channel->key_fd;
+    if (reply_fd)
+        *reply_fd = channel->reply_fd;
+}
+
+gboolean
+ibus_key_channel_push_key (IBusKeyChannel *channel,
+                           guint32         keyval,
+                           guint32         keycode,
+                           guint32         state,
+                           guint32         serial)
+{
+#ifdef KEY_CHANNEL_SUPPORTED
+    KeyChannelShared *shared = channel->shared;
+    guint tail = channel->key_tail;
+    guint head = (guint) g_atomic_int_get (&shared->key_head);
+    KeyRecord *record;
+
+    if (tail - head >= IBUS_KEY_CHANNEL_N_SLOTS)
+        return FALSE;
+    record = &shared->keys[tail % IBUS_KEY_CHANNEL_N_SLOTS];
+    record->keyval = keyval;
+    record->keycode = keycode;
+    record->state = state;
+    record->serial = serial;
+    channel->key_tail = tail + 1;
+    g_atomic_int_set (&shared->key_tail, (gint) channel->key_tail);
+    ibus_key_channel_notify (channel->key_fd);
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+gboolean
+ibus_key_channel_pop_key (IBusKeyChannel *channel,
+                          guint32        *keyval,
+                          guint32        *keycode,
+                          guint32        *state,
+                          guint32        *serial)
+{
+#ifdef KEY_CHANNEL_SUPPORTED
+    KeyChannelShared *shared = channel->shared;
+    guint head = channel->key_head;
+    guint tail = (guint) g_atomic_int_get (&shared->key_tail);
+    KeyRecord record;
+
+    /* the client can write anything to key_tail. */
+    if (head == tail || tail - head > IBUS_KEY_CHANNEL_N_SLOTS)
+        return FALSE;
+    record = shared->keys[head % IBUS_KEY_CHANNEL_N_SLOTS];
+    channel->key_head = head + 1;
+    g_atomic_int_set (&shared->key_head, (gint) channel->key_head);
+    *keyval = record.keyval;
+    *keycode = record.keycode;
+    *state = record.state;
+    *serial = record.serial;
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+gboolean
+ibus_key_channel_push_reply (IBusKeyChannel *channel,
+                             guint32         serial,
+                             gboolean        processed,
+                             guint32         n_signals)
+{
+#ifdef KEY_CHANNEL_SUPPORTED
+    KeyChannelShared *shared = channel->shared;
+    guint tail = channel->reply_tail;
+    guint head = (guint) g_atomic_int_get (&shared->reply_head);
+    ReplyRecord *record;
+
+    /* the client can write anything to reply_head. */
+    if (tail - head >= IBUS_KEY_CHANNEL_N_SLOTS)
+        return FALSE;
+    record = &shared->replies[tail % IBUS_KEY_CHANNEL_N_SLOTS];
+    record->serial = serial;
+    record->processed = processed ? 1 : 0;
+    record->n_signals = n_signals;
+    channel->reply_tail = tail + 1;
+    g_atomic_int_set (&shared->reply_tail, (gint) channel->reply_tail);
+    ibus_key_channel_notify (channel->reply_fd);
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+gboolean
+ibus_key_channel_pop_reply (IBusKeyChannel *channel,
+                            guint32        *serial,
+                            gboolean       *processed,
+                            guint32        *n_signals)
+{
+#ifdef KEY_CHANNEL_SUPPORTED
+    KeyChannelShared *shared = channel->shared;
+    guint head = channel->reply_head;
+    guint tail = (guint) g_atomic_int_get (&shared->reply_tail);
+    ReplyRecord *record;
+
+    if (head == tail || tail - head > IBUS_KEY_CHANNEL_N_SLOTS)
+        return FALSE;
+    record = &shared->replies[head % IBUS_KEY_CHANNEL_N_SLOTS];
+    *serial = record->serial;
+    *processed = record->processed != 0;
+    *n_signals = record->n_signals;
+    channel->reply_head = head + 1;
+    g_atomic_int_set (&shared->reply_head, (gint) channel->reply_head);
+    return TRUE;
+#else
+    return FALSE;
+#endif
+}
+
+/*
+ * ibus_key_channel_wait_reply:
+ *
+ * Wait until ibus-daemon pushes a reply or @timeout_msec passes.
+ * Returns %FALSE on the timeout.
+ */
+gboolean
+ibus_key_channel_wait_reply (IBusKeyChannel *channel,
+                             gint            timeout_msec)
+{
+#ifdef KEY_CHANNEL_SUPPORTED
+    struct pollfd fds = { channel->reply_fd, POLLIN, 0 };
+    gint64 end_time = g_get_monotonic_time () + timeout_msec * 1000LL;
+
+    for (;;) {
+        int retval = poll (&fds, 1, timeout_msec);
+        if (retval > 0)
+            return TRUE;
+        if (retval == 0 || errno != EINTR)
+            return FALSE;
+        if (timeout_msec > 0)
+            timeout_msec = MAX (0, (end_time - g_get_monotonic_time ()) / 1000);
+    }
+#else
+    return FALSE;
+#endif
+}
+
+void
+ibus_key_channel_acknowledge (IBusKeyChannel *channel,
+                              gboolean        daemon)
+{
+#ifdef KEY_CHANNEL_SUPPORTED
+    guint64 value;
+    gint fd = daemon ? channel->key_fd : channel->reply_fd;
+    while (read (fd, &value, sizeof (value)) < 0 && errno == EINTR);
+#endif
+}
+
+void
+ibus_key_channel_wake_up (IBusKeyChannel *channel,
+                          gboolean        daemon)
+{
+#ifdef KEY_CHANNEL_SUPPORTED
+    ibus_key_channel_notify (daemon ? channel->key_fd : channel->reply_fd);
+#endif
+}
@@ -0,0 +1,122 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/* ibus - The Input Bus
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#ifndef __IBUS_KEY_CHANNEL_H_
+#define __IBUS_KEY_CHANNEL_H_
+
+/*
+ * IBusKeyChannel carries key events from an IBusInputContext to
+ * ibus-daemon and their replies without D-Bus. It is a pair of
+ * single-producer single-consumer rings in a sealed memfd shared by the
+ * client and ibus-daemon, with one eventfd for each direction to wake up
+ * the reader. D-Bus stays the control plane: the client creates the
+ * channel and passes the file descriptors with the "OpenKeyChannel"
+ * method of the org.freedesktop.IBus.InputContext interface.
+ *
+ * The channel is not a public API and it is available only on Linux. The
+ * functions are G_GNUC_INTERNAL and linked from libibus-private.la.
+ */
+
+#include <gio/gio.h>
+#ifdef IBUS_COMPILATION
+#include "ibusxevent.h"
+#else
+#include <ibus.h>
+#endif
+
+G_BEGIN_DECLS
+
+typedef struct _IBusKeyChannel IBusKeyChannel;
+
+/* The number of key events which can be in flight on a channel. */
+#define IBUS_KEY_CHANNEL_N_SLOTS 64
+
+G_GNUC_INTERNAL
+IBusKeyChannel  *ibus_key_channel_new           (GError         **error);
+G_GNUC_INTERNAL
+IBusKeyChannel  *ibus_key_channel_new_from_fds  (gint             memfd,
+                                                 gint             key_fd,
+                                                 gint             reply_fd,
+                                                 GError         **error);
+G_GNUC_INTERNAL
+void             ibus_key_channel_free          (IBusKeyChannel  *channel);
+G_GNUC_INTERNAL
+void             ibus_key_channel_get_fds       (IBusKeyChannel  *channel,
+                                                 gint            *memfd,
+                                                 gint            *key_fd,
+                                                 gint            *reply_fd);
+
+/* client side */
+G_GNUC_INTERNAL
+gboolean         ibus_key_channel_push_key      (IBusKeyChannel  *channel,
+                                                 guint32          keyval,
+                                                 guint32          keycode,
+                                                 guint32          state,
+                                                 guint32          serial);
+G_GNUC_INTERNAL
+gboolean         ibus_key_channel_pop_reply     (IBusKeyChannel  *channel,
+                                                 guint32         *serial,
+                                                 gboolean        *processed,
+                                                 guint32         *n_signals);
+G_GNUC_INTERNAL
+gboolean         ibus_key_channel_wait_reply    (IBusKeyChannel  *channel,
+                                                 gint             timeout_msec);
+
+/* ibus-daemon side */
+G_GNUC_INTERNAL
+gboolean         ibus_key_channel_pop_key       (IBusKeyChannel  *channel,
+                                                 guint32         *keyval,
+                                                 guint32         *keycode,
+                                                 guint32         *state,
+                                                 guint32         *serial);
+G_GNUC_INTERNAL
+gboolean         ibus_key_channel_push_reply    (IBusKeyChannel  *channel,
+                                                 guint32          serial,
+                                                 gboolean         processed,
+                                                 guint32          n_signals);
+
+/* Clear the wake-up counter of the eventfd which the caller reads. */
+G_GNUC_INTERNAL
+void             ibus_key_channel_acknowledge   (IBusKeyChannel  *channel,
+                                                 gboolean         daemon);
+/* Set it again, e.g. when the caller leaves records for the next wake-up. */
+G_GNUC_INTERNAL
+void             ibus_key_channel_wake_up       (IBusKeyChannel  *channel,
+                                                 gboolean         daemon);
+
+#ifdef IBUS_COMPILATION
+#include "ibusinputcontext.h"
+
+/* IBusBus opens the channel when it creates an input context if
+ * IBUS_ENABLE_KEY_CHANNEL is set. */
+G_GNUC_INTERNAL gboolean
+ibus_input_context_use_key_channel      (void);
+G_GNUC_INTERNAL void
+ibus_input_context_open_key_channel     (IBusInputContext    *context);
+G_GNUC_INTERNAL void
+ibus_input_context_open_key_channel_async
+                                        (IBusInputContext    *context,
+                                         GCancellable        *cancellable,
+                                         GAsyncReadyCallback  callback,
+                                         gpointer             user_data);
+#endif
+
+G_END_DECLS
+#endif
@@ -24,6 +24,7 @@
 #include "ibuspanelservice.h"
 #include "ibusmarshalers.h"
 #include "ibusinternal.h"
+#include "ibusservicemethodtable.h"
 
 #define IBUS_PANEL_SERVICE_GET_PRIVATE(o)  \
    (G_TYPE_INSTANCE_GET_PRIVATE ((o), IBUS_TYPE_PANEL_SERVICE, \
@@ -68,6 +69,77 @@ enum {
     PROP_0,
 };
 
+enum {
+    PANEL_METHOD_UPDATE_PREEDIT_TEXT,
+    PANEL_METHOD_UPDATE_AUXILIARY_TEXT,
+    PANEL_METHOD_UPDATE_LOOKUP_TABLE,
+    PANEL_METHOD_FOCUS_IN,
+    PANEL_METHOD_FOCUS_OUT,
+    PANEL_METHOD_DESTROY_CONTEXT,
+    PANEL_METHOD_REGISTER_PROPERTIES,
+    PANEL_METHOD_UPDATE_PROPERTY,
+    PANEL_METHOD_SET_CURSOR_LOCATION,
+    PANEL_METHOD_SET_CURSOR_LOCATION_RELATIVE,
+    PANEL_METHOD_CONTENT_TYPE,
+    PANEL_METHOD_PANEL_EXTENSION_RECEIVED,
+    PANEL_METHOD_PROCESS_KEY_EVENT,
+    PANEL_METHOD_COMMIT_TEXT_RECEIVED,
+    PANEL_METHOD_CANDIDATE_CLICKED_LOOKUP_TABLE,
+    PANEL_METHOD_SEND_MESSAGE_RECEIVED,
+    PANEL_METHOD_CURSOR_UP_LOOKUP_TABLE,
+    PANEL_METHOD_CURSOR_DOWN_LOOKUP_TABLE,
+    PANEL_METHOD_HIDE_AUXILIARY_TEXT,
+    PANEL_METHOD_HIDE_LANGUAGE_BAR,
+    PANEL_METHOD_HIDE_LOOKUP_TABLE,
+    PANEL_METHOD_HIDE_PREEDIT_TEXT,
+    PANEL_METHOD_PAGE_UP_LOOKUP_TABLE,
+    PANEL_METHOD_PAGE_DOWN_LOOKUP_TABLE,
+    PANEL_METHOD_RESET,
+    PANEL_METHOD_SHOW_AUXILIARY_TEXT,
+    PANEL_METHOD_SHOW_LANGUAGE_BAR,
+    PANEL_METHOD_SHOW_LOOKUP_TABLE,
+    PANEL_METHOD_SHOW_PREEDIT_TEXT,
+    PANEL_METHOD_START_SETUP,
+    PANEL_METHOD_STATE_CHANGED
+};
+
+/* indexed by the PANEL_METHOD_* values */
+static const gchar *panel_method_names[] = {
+    [PANEL_METHOD_UPDATE_PREEDIT_TEXT] = "UpdatePreeditText",
+    [PANEL_METHOD_UPDATE_AUXILIARY_TEXT] = "UpdateAuxiliaryText",
+    [PANEL_METHOD_UPDATE_LOOKUP_TABLE] = "UpdateLookupTable",
+    [PANEL_METHOD_FOCUS_IN] = "FocusIn",
+    [PANEL_METHOD_FOCUS_OUT] = "FocusOut",
+    [PANEL_METHOD_DESTROY_CONTEXT] = "DestroyContext",
+    [PANEL_METHOD_REGISTER_PROPERTIES] = "RegisterProperties",
+    [PANEL_METHOD_UPDATE_PROPERTY] = "UpdateProperty",
+    [PANEL_METHOD_SET_CURSOR_LOCATION] = "SetCursorLocation",
+    [PANEL_METHOD_SET_CURSOR_LOCATION_RELATIVE] = "SetCursorLocationRelative",
+    [PANEL_METHOD_CONTENT_TYPE] = "ContentType",
+    [PANEL_METHOD_PANEL_EXTENSION_RECEIVED] = "PanelExtensionReceived",
+    [PANEL_METHOD_PROCESS_KEY_EVENT] = "ProcessKeyEvent",
+    [PANEL_METHOD_COMMIT_TEXT_RECEIVED] = "CommitTextReceived",
+    [PANEL_METHOD_CANDIDATE_CLICKED_LOOKUP_TABLE] = "CandidateClickedLookupTable",
+    [PANEL_METHOD_SEND_MESSAGE_RECEIVED] = "SendMessageReceived",
+    [PANEL_METHOD_CURSOR_UP_LOOKUP_TABLE] = "CursorUpLookupTable",
+    [PANEL_METHOD_CURSOR_DOWN_LOOKUP_TABLE] = "CursorDownLookupTable",
+    [PANEL_METHOD_HIDE_AUXILIARY_TEXT] = "HideAuxiliaryText",
+    [PANEL_METHOD_HIDE_LANGUAGE_BAR] = "HideLanguageBar",
+    [PANEL_METHOD_HIDE_LOOKUP_TABLE] = "HideLookupTable",
+    [PANEL_METHOD_HIDE_PREEDIT_TEXT] = "HidePreeditText",
+    [PANEL_METHOD_PAGE_UP_LOOKUP_TABLE] = "PageUpLookupTable",
+    [PANEL_METHOD_PAGE_DOWN_LOOKUP_TABLE] = "PageDownLookupTable",
+    [PANEL_METHOD_RESET] = "Reset",
+    [PANEL_METHOD_SHOW_AUXILIARY_TEXT] = "ShowAuxiliaryText",
+    [PANEL_METHOD_SHOW_LANGUAGE_BAR] = "ShowLanguageBar",
+    [PANEL_METHOD_SHOW_LOOKUP_TABLE] = "ShowLookupTable",
+    [PANEL_METHOD_SHOW_PREEDIT_TEXT] = "ShowPreeditText",
+    [PANEL_METHOD_START_SETUP] = "StartSetup",
+    [PANEL_METHOD_STATE_CHANGED] = "StateChanged",
+};
+
+static IBusServiceMethodTable *panel_methods;
+
 static guint            panel_signals[LAST_SIGNAL] = { 0 };
 
 /* functions prototype */
@@ -333,6 +405,12 @@ ibus_panel_service_class_init (IBusPanelServiceClass *class)
 
     ibus_service_class_add_interfaces (IBUS_SERVICE_CLASS (class),
                                        introspection_xml);
+    panel_methods = ibus_service_method_table_new (
+            IBUS_SERVICE_CLASS (class),
+            IBUS_INTERFACE_PANEL,
+            panel_method_names,
+            G_N_ELEMENTS (panel_method_names),
+            sizeof (panel_method_names[0]));
 
     class->focus_in              = ibus_panel_service_focus_in;
     class->focus_out             = ibus_panel_service_focus_out;
@@ -1163,8 +1241,10 @@ ibus_panel_service_service_method_call (IBusService           *service,
                                         GDBusMethodInvocation *invocation)
 {
     IBusPanelService *panel = IBUS_PANEL_SERVICE (service);
+    gint method = ibus_service_method_table_lookup (panel_methods, invocation);
+    guint signal_id = 0;
 
-    if (g_strcmp0 (interface_name, IBUS_INTERFACE_PANEL) != 0) {
+    if (method < 0) {
         IBUS_SERVICE_CLASS (ibus_panel_service_parent_class)->
                 service_method_call (service,
                                      connection,
@@ -1180,7 +1260,8 @@ ibus_panel_service_service_method_call (IBusService           *service,
     if (!ibus_panel_service_service_authorized_method (service, connection))
         return;
 
-    if (g_strcmp0 (method_name, "UpdatePreeditText") == 0) {
+    switch (method) {
+    case PANEL_METHOD_UPDATE_PREEDIT_TEXT: {
         GVariant *variant = NULL;
         guint cursor = 0;
         gboolean visible = FALSE;
@@ -1195,7 +1276,7 @@ ibus_panel_service_service_method_call (IBusService           *service,
         return;
     }
 
-    if (g_strcmp0 (method_name, "UpdateAuxiliaryText") == 0) {
+    case PANEL_METHOD_UPDATE_AUXILIARY_TEXT: {
         GVariant *variant = NULL;
         gboolean visible = FALSE;
 
@@ -1209,7 +1290,7 @@ ibus_panel_service_service_method_call (IBusService           *service,
         return;
     }
 
-    if (g_strcmp0 (method_name, "UpdateLookupTable") == 0) {
+    case PANEL_METHOD_UPDATE_LOOKUP_TABLE: {
         GVariant *variant = NULL;
         gboolean visible = FALSE;
 
@@ -1223,7 +1304,7 @@ ibus_panel_service_service_method_call (IBusService           *service,
         return;
     }
 
-    if (g_strcmp0 (method_name, "FocusIn") == 0) {
+    case PANEL_METHOD_FOCUS_IN: {
         const gchar *path;
         g_variant_get (parameters, "(&o)", &path);
         g_signal_emit (panel, panel_signals[FOCUS_IN], 0, path);
@@ -1231,7 +1312,7 @@ ibus_panel_service_service_method_call (IBusService           *service,
         return;
     }
 
-    if (g_strcmp0 (method_name, "FocusOut") == 0) {
+    case PANEL_METHOD_FOCUS_OUT: {
         const gchar *path;
         g_variant_get (parameters, "(&o)", &path);
         g_signal_emit (panel, panel_signals[FOCUS_OUT], 0, path);
@@ -1239,7 +1320,7 @@ ibus_panel_service_service_method_call (IBusService           *service,
         return;
     }
 
-    if (g_strcmp0 (method_name, "DestroyContext") == 0) {
+    case PANEL_METHOD_DESTROY_CONTEXT: {
         const gchar *path;
         g_variant_get (parameters, "(&o)", &path);
         g_signal_emit (panel, panel_signals[DESTROY_CONTEXT], 0, path);
@@ -1247,7 +1328,7 @@ ibus_panel_service_service_method_call (IBusService           *service,
         return;
     }
 
-    if (g_strcmp0 (method_name, "RegisterProperties") == 0) {
+    case PANEL_METHOD_REGISTER_PROPERTIES: {
         GVariant *variant = g_variant_get_child_value (parameters, 0);
         IBusPropList *prop_list = IBUS_PROP_LIST (ibus_serializable_deserialize (variant));
         g_variant_unref (variant);
@@ -1258,7 +1339,7 @@ ibus_panel_service_service_method_call (IBusService           *service,
         return;
     }
 
-    if (g_strcmp0 (method_name, "UpdateProperty") == 0) {
+    case PANEL_METHOD_UPDATE_PROPERTY: {
         GVariant *variant = g_variant_get_child_value (parameters, 0);
         IBusProperty *property = IBUS_PROPERTY (ibus_serializable_deserialize (variant));
         g_variant_unref (variant);
@@ -1269,7 +1350,7 @@ ibus_panel_service_service_method_call (IBusService           *service,
         return;
     }
 
-    if (g_strcmp0 (method_name, "SetCursorLocation") == 0) {
+    case PANEL_METHOD_SET_CURSOR_LOCATION: {
         gint x, y, w, h;
         g_variant_get (parameters, "(iiii)", &x, &y, &w, &h);
         g_signal_emit (panel, panel_signals[SET_CURSOR_LOCATION], 0, x, y, w, h);
@@ -1277,7 +1358,7 @@ ibus_panel_service_service_method_call (IBusService           *service,
         return;
     }
 
-    if (g_strcmp0 (method_name, "SetCursorLocationRelative") == 0) {
+    case PANEL_METHOD_SET_CURSOR_LOCATION_RELATIVE: {
         gint x, y, w, h;
         g_variant_get (parameters, "(iiii)", &x, &y, &w, &h);
         g_signal_emit (panel, panel_signals[SET_CURSOR_LOCATION_RELATIVE],
@@ -1286,7 +1367,7 @@ ibus_panel_service_service_method_call (IBusService           *service,
         return;
     }
 
-    if (g_strcmp0 (method_name, "ContentType") == 0) {
+    case PANEL_METHOD_CONTENT_TYPE: {
         guint purpose, hints;
         g_variant_get (parameters, "(uu)", &purpose, &hints);
         g_signal_emit (panel, panel_signals[SET_CONTENT_TYPE], 0,
@@ -1295,7 +1376,7 @@ ibus_panel_service_service_method_call (IBusService           *service,
         return;
     }
 
-    if (g_strcmp0 (method_name, "PanelExtensionReceived") == 0) {
+    case PANEL_METHOD_PANEL_EXTENSION_RECEIVED: {
         GVariant *arg0 = NULL;
         IBusExtensionEvent *event = NULL;
         g_variant_get (parameters, "(v)", &arg0);
@@ -1317,7 +1398,7 @@ ibus_panel_service_service_method_call (IBusService           *service,
         g_dbus_method_invocation_return_value (invocation, NULL);
         return;
     }
-    if (g_strcmp0 (method_name, "ProcessKeyEvent") == 0) {
+    case PANEL_METHOD_PROCESS_KEY_EVENT: {
         guint keyval, keycode, state;
         gboolean retval = FALSE;
 
@@ -1333,7 +1414,7 @@ ibus_panel_service_service_method_call (IBusService           *service,
                                                g_variant_new ("(b)", retval));
         return;
     }
-    if (g_strcmp0 (method_name, "CommitTextReceived") == 0) {
+    case PANEL_METHOD_COMMIT_TEXT_RECEIVED: {
         GVariant *arg0 = NULL;
         IBusText *text = NULL;
 
@@ -1357,7 +1438,7 @@ ibus_panel_service_service_method_call (IBusService           *service,
         _g_object_unref_if_floating (text);
         return;
     }
-    if (g_strcmp0 (method_name, "CandidateClickedLookupTable") == 0) {
+    case PANEL_METHOD_CANDIDATE_CLICKED_LOOKUP_TABLE: {
         guint index = 0;
         guint button = 0;
         guint state = 0;
@@ -1368,7 +1449,7 @@ ibus_panel_service_service_method_call (IBusService           *service,
                        index, button, state);
         return;
     }
-    if (g_strcmp0 (method_name, "SendMessageReceived") == 0) {
+    case PANEL_METHOD_SEND_MESSAGE_RECEIVED: {
         GVariant *arg0 = NULL;
         IBusMessage *message = NULL;
         g_variant_get (parameters, "(v)", &arg0);
@@ -1390,40 +1471,60 @@ ibus_panel_service_service_method_call (IBusService           *service,
     }
 
 
-    const static struct {
-        const gchar *name;
-        const gint signal_id;
-    } no_arg_methods [] = {
-        { "CursorUpLookupTable",   CURSOR_UP_LOOKUP_TABLE },
-        { "CursorDownLookupTable", CURSOR_DOWN_LOOKUP_TABLE },
-        { "HideAuxiliaryText",     HIDE_AUXILIARY_TEXT },
-        { "HideLanguageBar",       HIDE_LANGUAGE_BAR },
-        { "HideLookupTable",       HIDE_LOOKUP_TABLE },
-        { "HidePreeditText",       HIDE_PREEDIT_TEXT },
-        { "PageUpLookupTable",     PAGE_UP_LOOKUP_TABLE },
-        { "PageDownLookupTable",   PAGE_DOWN_LOOKUP_TABLE },
-        { "Reset",                 RESET },
-        { "ShowAuxiliaryText",     SHOW_AUXILIARY_TEXT },
-        { "ShowLanguageBar",       SHOW_LANGUAGE_BAR },
-        { "ShowLookupTable",       SHOW_LOOKUP_TABLE },
-        { "ShowPreeditText",       SHOW_PREEDIT_TEXT },
-        { "StartSetup",            START_SETUP },
-        { "StateChanged",          STATE_CHANGED },
-    };
-
-    gint i;
-    for (i = 0; i < G_N_ELEMENTS (no_arg_methods); i++) {
-        if (g_strcmp0 (method_name, no_arg_methods[i].name) == 0) {
-            if (no_arg_methods[i].signal_id >= 0) {
-                g_signal_emit (panel, panel_signals[no_arg_methods[i].signal_id], 0);
-            }
-            g_dbus_method_invocation_return_value (invocation, NULL);
-            return;
-        }
+    case PANEL_METHOD_CURSOR_UP_LOOKUP_TABLE:
+        signal_id = CURSOR_UP_LOOKUP_TABLE;
+        break;
+    case PANEL_METHOD_CURSOR_DOWN_LOOKUP_TABLE:
+        signal_id = CURSOR_DOWN_LOOKUP_TABLE;
+        break;
+    case PANEL_METHOD_HIDE_AUXILIARY_TEXT:
+        signal_id = HIDE_AUXILIARY_TEXT;
+        break;
+    case PANEL_METHOD_HIDE_LANGUAGE_BAR:
+        signal_id = HIDE_LANGUAGE_BAR;
+        break;
+    case PANEL_METHOD_HIDE_LOOKUP_TABLE:
+        signal_id = HIDE_LOOKUP_TABLE;
+        break;
+    case PANEL_METHOD_HIDE_PREEDIT_TEXT:
+        signal_id = HIDE_PREEDIT_TEXT;
+        break;
+    case PANEL_METHOD_PAGE_UP_LOOKUP_TABLE:
+        signal_id = PAGE_UP_LOOKUP_TABLE;
+        break;
+    case PANEL_METHOD_PAGE_DOWN_LOOKUP_TABLE:
+        signal_id = PAGE_DOWN_LOOKUP_TABLE;
+        break;
+    case PANEL_METHOD_RESET:
+        signal_id = RESET;
+        break;
+    case PANEL_METHOD_SHOW_AUXILIARY_TEXT:
+        signal_id = SHOW_AUXILIARY_TEXT;
+        break;
+    case PANEL_METHOD_SHOW_LANGUAGE_BAR:
+        signal_id = SHOW_LANGUAGE_BAR;
+        break;
+    case PANEL_METHOD_SHOW_LOOKUP_TABLE:
+        signal_id = SHOW_LOOKUP_TABLE;
+        break;
+    case PANEL_METHOD_SHOW_PREEDIT_TEXT:
+        signal_id = SHOW_PREEDIT_TEXT;
+        break;
+    case PANEL_METHOD_START_SETUP:
+        signal_id = START_SETUP;
+        break;
+    case PANEL_METHOD_STATE_CHANGED:
+        signal_id = STATE_CHANGED;
+        break;
+
+    default:
+        /* should not be reached */
+        g_return_if_reached ();
     }
 
-    /* should not be reached */
-    g_return_if_reached ();
+    /* the methods without arguments */
+    g_signal_emit (panel, panel_signals[signal_id], 0);
+    g_dbus_method_invocation_return_value (invocation, NULL);
 }
 
 static GVariant *
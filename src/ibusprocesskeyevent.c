@@ -0,0 +1,154 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/* ibus - The Input Bus
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "ibusprocesskeyevent.h"
+
+gboolean
+ibus_process_key_event_args_get (GVariant *parameters,
+                                 guint32  *keyval,
+                                 guint32  *keycode,
+                                 guint32  *state)
+{
+    guint32 *args[] = { keyval, keycode, state };
+    gsize i;
+
+    if (g_variant_n_children (parameters) != G_N_ELEMENTS (args))
+        return FALSE;
+    /* a message body from the wire is serialized; a child of a serialized
+     * tuple is a view into its data, so the arguments are read without
+     * parsing a format string. */
+    for (i = 0; i < G_N_ELEMENTS (args); i++) {
+        GVariant *child = g_variant_get_child_value (parameters, i);
+        *args[i] = g_variant_get_uint32 (child);
+        g_variant_unref (child);
+    }
+    return TRUE;
+}
+
+GVariant *
+ibus_process_key_event_args_new (guint32 keyval,
+                                 guint32 keycode,
+                                 guint32 state)
+{
+    GVariant *args[] = {
+        g_variant_new_uint32 (keyval),
+        g_variant_new_uint32 (keycode),
+        g_variant_new_uint32 (state),
+    };
+    return g_variant_new_tuple (args, G_N_ELEMENTS (args));
+}
+
+GVariant *
+ibus_process_key_event_reply (gboolean processed)
+{
+    static GVariant *replies[2];
+
+    if (g_once_init_enter (&replies[0])) {
+        GVariant *child = g_variant_new_boolean (TRUE);
+        replies[1] = g_variant_ref_sink (g_variant_new_tuple (&child, 1));
+        child = g_variant_new_boolean (FALSE);
+        g_once_init_leave (&replies[0],
+                           g_variant_ref_sink (g_variant_new_tuple (&child,
+                                                                    1)));
+    }
+    return replies[processed ? 1 : 0];
+}
+
+gboolean
+ibus_process_key_event_reply_get (GVariant *reply)
+{
+    GVariant *child;
+    gboolean processed;
+
+    if (g_variant_n_children (reply) != 1)
+        return FALSE;
+    child = g_variant_get_child_value (reply, 0);
+    processed = g_variant_get_boolean (child);
+    g_variant_unref (child);
+    return processed;
+}
+
+const IBusProcessKeyEventData *
+ibus_process_key_events_args_get (GVariant *parameters,
+                                  gsize    *n_keys)
+{
+    const IBusProcessKeyEventData *keys;
+    GVariant *child;
+
+    *n_keys = 0;
+    if (g_variant_n_children (parameters) != 1)
+        return NULL;
+    /* (uuu) is a fixed size type of 12 bytes like IBusProcessKeyEventData,
+     * so the array is used in place. The child keeps the data alive with
+     * @parameters. */
+    child = g_variant_get_child_value (parameters, 0);
+    keys = g_variant_get_fixed_array (child,
+                                      n_keys,
+                                      sizeof (IBusProcessKeyEventData));
+    g_variant_unref (child);
+    return keys;
+}
+
+GVariant *
+ibus_process_key_events_args_new (const IBusProcessKeyEventData *keys,
+                                  gsize                          n_keys)
+{
+    GVariant *array;
+
+    G_STATIC_ASSERT (sizeof (IBusProcessKeyEventData) == 3 * sizeof (guint32));
+    array = g_variant_new_fixed_array (G_VARIANT_TYPE ("(uuu)"),
+                                       keys,
+                                       n_keys,
+                                       sizeof (IBusProcessKeyEventData));
+    return g_variant_new_tuple (&array, 1);
+}
+
+GVariant *
+ibus_process_key_events_reply_new (const guint8 *handled,
+                                   gsize         n_keys)
+{
+    GVariant *bitmap = g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
+                                                  handled,
+                                                  (n_keys + 7) / 8,
+                                                  1);
+    return g_variant_new_tuple (&bitmap, 1);
+}
+
+const guint8 *
+ibus_process_key_events_reply_get (GVariant *reply,
+                                   gsize     n_keys)
+{
+    const guint8 *handled;
+    GVariant *child;
+    gsize n_bytes = 0;
+
+    if (g_variant_n_children (reply) != 1)
+        return NULL;
+    child = g_variant_get_child_value (reply, 0);
+    handled = g_variant_get_fixed_array (child, &n_bytes, 1);
+    g_variant_unref (child);
+    /* an engine answers with a bitmap which is too short for the keys. */
+    if (n_bytes < (n_keys + 7) / 8)
+        return NULL;
+    return handled;
+}
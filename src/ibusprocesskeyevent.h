@@ -0,0 +1,86 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/* ibus - The Input Bus
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#ifndef __IBUS_PROCESS_KEY_EVENT_H_
+#define __IBUS_PROCESS_KEY_EVENT_H_
+
+/*
+ * The fast path of the "ProcessKeyEvent" D-Bus method, which is used where
+ * the key events go over D-Bus: the fixed layout arguments and the replies
+ * are read and built without GVariant format strings. The arguments of
+ * "ProcessKeyEvents" are an array of IBusProcessKeyEventData in the message
+ * and its reply is a bitmap in which bit i % 8 of byte i / 8 is set if the
+ * key event i is handled.
+ *
+ * The functions are not a public API. They are G_GNUC_INTERNAL and linked
+ * from libibus-private.la.
+ */
+
+#include <gio/gio.h>
+#ifdef IBUS_COMPILATION
+#include "ibusxevent.h"
+#else
+#include <ibus.h>
+#endif
+
+G_BEGIN_DECLS
+
+/* The "ProcessKeyEvent" fast path. The reply is owned by libibus and
+ * it is not floating. */
+G_GNUC_INTERNAL
+gboolean         ibus_process_key_event_args_get
+                                                (GVariant        *parameters,
+                                                 guint32         *keyval,
+                                                 guint32         *keycode,
+                                                 guint32         *state);
+G_GNUC_INTERNAL
+GVariant        *ibus_process_key_event_args_new
+                                                (guint32          keyval,
+                                                 guint32          keycode,
+                                                 guint32          state);
+G_GNUC_INTERNAL
+GVariant        *ibus_process_key_event_reply   (gboolean         processed);
+G_GNUC_INTERNAL
+gboolean         ibus_process_key_event_reply_get
+                                                (GVariant        *reply);
+
+/* The "ProcessKeyEvents" fast path. The returned arrays point into the
+ * GVariants. */
+G_GNUC_INTERNAL
+const IBusProcessKeyEventData *
+                 ibus_process_key_events_args_get
+                                                (GVariant        *parameters,
+                                                 gsize           *n_keys);
+G_GNUC_INTERNAL
+GVariant        *ibus_process_key_events_args_new
+                                                (const IBusProcessKeyEventData
+                                                                 *keys,
+                                                 gsize            n_keys);
+G_GNUC_INTERNAL
+GVariant        *ibus_process_key_events_reply_new
+                                                (const guint8    *handled,
+                                                 gsize            n_keys);
+G_GNUC_INTERNAL
+const guint8    *ibus_process_key_events_reply_get
+                                                (GVariant        *reply,
+                                                 gsize            n_keys);
+
+G_END_DECLS
+#endif
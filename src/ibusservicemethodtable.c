@@ -0,0 +1,112 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/* ibus - The Input Bus
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include "ibusservicemethodtable.h"
+
+struct _IBusServiceMethodTable {
+    GDBusInterfaceInfo *interface_info;
+    /* GDBusMethodInfo of the introspection xml to the index + 1 */
+    GHashTable *methods;
+    /* method name to the index + 1 */
+    GHashTable *names;
+};
+
+IBusServiceMethodTable *
+ibus_service_method_table_new (IBusServiceClass    *class,
+                               const gchar         *interface_name,
+                               const gchar * const *method_names,
+                               guint                n_methods,
+                               gsize                stride)
+{
+    IBusServiceMethodTable *table;
+    GDBusInterfaceInfo **p;
+    guint i;
+
+    g_return_val_if_fail (IBUS_IS_SERVICE_CLASS (class), NULL);
+    g_return_val_if_fail (interface_name != NULL, NULL);
+    g_return_val_if_fail (method_names != NULL || n_methods == 0, NULL);
+
+    table = g_slice_new0 (IBusServiceMethodTable);
+    for (p = (GDBusInterfaceInfo **)class->interfaces->data; *p != NULL; p++) {
+        if (g_strcmp0 ((*p)->name, interface_name) == 0) {
+            table->interface_info = g_dbus_interface_info_ref (*p);
+            break;
+        }
+    }
+    if (table->interface_info == NULL)
+        g_warning ("%s: No interface %s", G_STRFUNC, interface_name);
+
+    table->methods = g_hash_table_new (g_direct_hash, g_direct_equal);
+    table->names = g_hash_table_new (g_str_hash, g_str_equal);
+    for (i = 0; i < n_methods; i++) {
+        const gchar *name = *(const gchar * const *)
+                ((const guint8 *)method_names + i * stride);
+        GDBusMethodInfo *info = NULL;
+
+        if (table->interface_info != NULL) {
+            info = g_dbus_interface_info_lookup_method (table->interface_info,
+                                                        name);
+        }
+        if (info == NULL) {
+            g_warning ("%s: No method %s in %s",
+                       G_STRFUNC, name, interface_name);
+            continue;
+        }
+        g_hash_table_insert (table->methods, info, GINT_TO_POINTER (i + 1));
+        g_hash_table_insert (table->names, info->name, GINT_TO_POINTER (i + 1));
+    }
+    return table;
+}
+
+gint
+ibus_service_method_table_lookup (IBusServiceMethodTable *table,
+                                  GDBusMethodInvocation  *invocation)
+{
+    const GDBusMethodInfo *info;
+    gint index;
+
+    info = g_dbus_method_invocation_get_method_info (invocation);
+    index = GPOINTER_TO_INT (g_hash_table_lookup (table->methods, info)) - 1;
+    if (index >= 0 || table->interface_info == NULL)
+        return index;
+    /* A subclass can replace the introspection xml of the interface. */
+    if (g_strcmp0 (g_dbus_method_invocation_get_interface_name (invocation),
+                   table->interface_info->name) != 0) {
+        return -1;
+    }
+    return GPOINTER_TO_INT (g_hash_table_lookup (
+            table->names,
+            g_dbus_method_invocation_get_method_name (invocation))) - 1;
+}
+
+void
+ibus_service_method_table_free (IBusServiceMethodTable *table)
+{
+    g_return_if_fail (table != NULL);
+
+    g_hash_table_destroy (table->methods);
+    g_hash_table_destroy (table->names);
+    if (table->interface_info != NULL)
+        g_dbus_interface_info_unref (table->interface_info);
+    g_slice_free (IBusServiceMethodTable, table);
+}
@@ -0,0 +1,87 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+/* vim:set et sts=4: */
+/* ibus - The Input Bus
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
+ * USA
+ */
+
+#ifndef __IBUS_SERVICE_METHOD_TABLE_H_
+#define __IBUS_SERVICE_METHOD_TABLE_H_
+
+/*
+ * IBusServiceMethodTable maps the D-Bus methods of an interface of an
+ * IBusService to indexes in a constant time, so that the
+ * service_method_call class method does not compare the method name with
+ * each method. libibus and ibus-daemon use it for their services.
+ *
+ * The table is not a public API. The functions are G_GNUC_INTERNAL and
+ * linked from libibus-private.la.
+ */
+
+#ifdef IBUS_COMPILATION
+#include "ibusservice.h"
+#else
+#include <ibus.h>
+#endif
+
+G_BEGIN_DECLS
+
+typedef struct _IBusServiceMethodTable IBusServiceMethodTable;
+
+/**
+ * ibus_service_method_table_new:
+ * @klass: An IBusServiceClass.
+ * @interface_name: The interface name in the introspection xml of @klass.
+ * @method_names: The first method name.
+ * @n_methods: The number of the method names.
+ * @stride: The distance in bytes between the method names, e.g.
+ *          sizeof (const gchar *) for an array of strings or the size of
+ *          an element for an array of structures which have the name as
+ *          a member.
+ *
+ * Resolve the methods of @interface_name in the introspection xml which
+ * was added to @klass with ibus_service_class_add_interfaces().
+ *
+ * Returns: A newly allocated #IBusServiceMethodTable.
+ */
+G_GNUC_INTERNAL
+IBusServiceMethodTable *
+                 ibus_service_method_table_new  (IBusServiceClass   *klass,
+                                                 const gchar        *interface_name,
+                                                 const gchar * const *method_names,
+                                                 guint               n_methods,
+                                                 gsize               stride);
+
+/**
+ * ibus_service_method_table_lookup:
+ *
+ * Returns: The index of the method of @invocation in the method names of
+ *          ibus_service_method_table_new() or -1 if the method is not
+ *          a method of the interface of @table.
+ */
+G_GNUC_INTERNAL
+gint             ibus_service_method_table_lookup
+                                                (IBusServiceMethodTable
+                                                                    *table,
+                                                 GDBusMethodInvocation
+                                                                    *invocation);
+
+G_GNUC_INTERNAL
+void             ibus_service_method_table_free (IBusServiceMethodTable
+                                                                    *table);
+
+G_END_DECLS
+#endif
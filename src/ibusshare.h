@@ -161,6 +161,16 @@
  */
 #define IBUS_INTERFACE_PORTAL   "org.freedesktop.IBus.Portal"
 
+/**
+ * IBUS_INTERFACE_STATS:
+ *
+ * D-Bus interface for the statistics of ibus-daemon.
+ *
+ * Since: 1.5.33
+ * Stability: Unstable
+ */
+#define IBUS_INTERFACE_STATS    "org.freedesktop.IBus.Stats"
+
 /**
  * IBUS_INTERFACE_INPUT_CONTEXT:
  *
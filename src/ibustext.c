@@ -20,6 +20,8 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301
  * USA
  */
+#include <string.h>
+
 #include "ibustext.h"
 
 /* functions prototype */
@@ -288,3 +290,83 @@ ibus_text_set_attributes (IBusText     *text,
     text->attrs = attrs;
     g_object_ref_sink (text->attrs);
 }
+
+gchar *
+ibus_text_diff (IBusText *old_text,
+                IBusText *new_text,
+                guint    *offset,
+                guint    *n_deleted)
+{
+    const gchar *old_start, *old_end;
+    const gchar *new_start, *new_end;
+
+    g_return_val_if_fail (IBUS_IS_TEXT (old_text), NULL);
+    g_return_val_if_fail (IBUS_IS_TEXT (new_text), NULL);
+
+    /* the common prefix in whole characters */
+    old_start = old_text->text;
+    new_start = new_text->text;
+    while (*old_start != '\0' && *new_start != '\0') {
+        const gchar *old_next = g_utf8_next_char (old_start);
+        const gchar *new_next = g_utf8_next_char (new_start);
+        if (old_next - old_start != new_next - new_start ||
+            memcmp (old_start, new_start, old_next - old_start) != 0) {
+            break;
+        }
+        old_start = old_next;
+        new_start = new_next;
+    }
+
+    /* the common suffix which does not overlap the prefix */
+    old_end = old_start + strlen (old_start);
+    new_end = new_start + strlen (new_start);
+    while (old_end > old_start && new_end > new_start) {
+        const gchar *old_prev = g_utf8_prev_char (old_end);
+        const gchar *new_prev = g_utf8_prev_char (new_end);
+        if (old_end - old_prev != new_end - new_prev ||
+            memcmp (old_prev, new_prev, old_end - old_prev) != 0) {
+            break;
+        }
+        old_end = old_prev;
+        new_end = new_prev;
+    }
+
+    if (offset != NULL)
+        *offset = g_utf8_pointer_to_offset (old_text->text, old_start);
+    if (n_deleted != NULL)
+        *n_deleted = g_utf8_pointer_to_offset (old_start, old_end);
+    return g_strndup (new_start, new_end - new_start);
+}
+
+IBusText *
+ibus_text_new_from_splice (IBusText    *text,
+                           guint        offset,
+                           guint        n_deleted,
+                           const gchar *inserted)
+{
+    IBusText *retval;
+    const gchar *start, *end;
+    GString *str;
+    glong length;
+
+    g_return_val_if_fail (IBUS_IS_TEXT (text), NULL);
+    g_return_val_if_fail (inserted != NULL, NULL);
+
+    length = g_utf8_strlen (text->text, -1);
+    if (offset > length || n_deleted > length - offset)
+        return NULL;
+
+    start = g_utf8_offset_to_pointer (text->text, offset);
+    end = g_utf8_offset_to_pointer (start, n_deleted);
+
+    str = g_string_sized_new (strlen (text->text) + strlen (inserted) + 1);
+    g_string_append_len (str, text->text, start - text->text);
+    g_string_append (str, inserted);
+    g_string_append (str, end);
+
+    retval = g_object_new (IBUS_TYPE_TEXT, NULL);
+    retval->is_static = FALSE;
+    retval->text = g_string_free (str, FALSE);
+
+    return retval;
+}
@@ -214,6 +214,52 @@ IBusAttrList *   ibus_text_get_attributes           (IBusText       *text);
 void             ibus_text_set_attributes           (IBusText       *text,
                                                      IBusAttrList   *attrs);
 
+/**
+ * ibus_text_diff:
+ * @old_text: An #IBusText.
+ * @new_text: An #IBusText.
+ * @offset: (out) (optional): The character offset of the first character
+ *     which differs.
+ * @n_deleted: (out) (optional): The number of characters of @old_text which
+ *     are replaced.
+ *
+ * Compare the strings of @old_text and @new_text. Replacing @n_deleted
+ * characters at @offset of @old_text with the returned string gives
+ * the string of @new_text. The attributes are not compared.
+ *
+ * Returns: (transfer full): The inserted string.
+ *
+ * Since: 1.5.33
+ * Stability: Unstable
+ */
+gchar           *ibus_text_diff                     (IBusText       *old_text,
+                                                     IBusText       *new_text,
+                                                     guint          *offset,
+                                                     guint          *n_deleted);
+
+/**
+ * ibus_text_new_from_splice:
+ * @text: An #IBusText.
+ * @offset: The character offset in @text.
+ * @n_deleted: The number of characters to delete at @offset.
+ * @inserted: The string to insert at @offset.
+ *
+ * Creates a new #IBusText whose string is the string of @text with
+ * @n_deleted characters at @offset replaced by @inserted.
+ * The new #IBusText has no attributes.
+ * See also ibus_text_diff().
+ *
+ * Returns: (transfer full) (nullable): A newly allocated #IBusText or %NULL
+ *     if the range is out of @text.
+ *
+ * Since: 1.5.33
+ * Stability: Unstable
+ */
+IBusText        *ibus_text_new_from_splice          (IBusText       *text,
+                                                     guint           offset,
+                                                     guint           n_deleted,
+                                                     const gchar    *inserted);
+
 
 G_END_DECLS
 #endif
@@ -112,6 +112,10 @@ typedef enum
  * @IBUS_CAP_SYNC_PROCESS_KEY: Asynchronous process key events are not
  *  supported and the ibus_engine_forward_key_event() should not be
  *  used for the return value of #IBusEngine::process_key_event().
+ * @IBUS_CAP_PREEDIT_DELTA: Client can apply the UpdatePreeditTextDelta
+ *  D-Bus signal instead of receiving the whole pre-edit text on every
+ *  update. #IBusInputContext sets it by itself unless the application
+ *  connects to #GDBusProxy::g-signal. Since: 1.5.33
  *
  * Capability flags of UI.
  */
@@ -125,6 +129,7 @@ typedef enum {
     IBUS_CAP_OSK                = 1 << 6,
     IBUS_CAP_SYNC_PROCESS_KEY   = 1 << 7,
     IBUS_CAP_SYNC_PROCESS_KEY_V2 = IBUS_CAP_SYNC_PROCESS_KEY,
+    IBUS_CAP_PREEDIT_DELTA      = 1 << 8,
 } IBusCapabilite;
 
 /**
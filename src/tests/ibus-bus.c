@@ -609,6 +609,26 @@ test_get_engines (void)
     g_list_free (engines);
 }
 
+static void
+test_get_engines_twice (void)
+{
+    static const gchar *properties[] = { "Engines", "ActiveEngines" };
+    guint i;
+
+    /* ibus-daemon replies the cached engines from the second call, which
+     * should be the same as the first one. */
+    for (i = 0; i < G_N_ELEMENTS (properties); i++) {
+        GVariant *first = ibus_bus_get_ibus_property (bus, properties[i]);
+        GVariant *second = ibus_bus_get_ibus_property (bus, properties[i]);
+
+        g_assert (first != NULL);
+        g_assert (second != NULL);
+        g_assert (g_variant_equal (first, second));
+        g_variant_unref (first);
+        g_variant_unref (second);
+    }
+}
+
 static void
 test_get_global_engine (void)
 {
@@ -1097,6 +1117,7 @@ main (gint    argc,
     g_test_add_func ("/ibus/get-current-input-context",
                      test_get_current_input_context);
     g_test_add_func ("/ibus/get-engines", test_get_engines);
+    g_test_add_func ("/ibus/get-engines-twice", test_get_engines_twice);
     g_test_add_func ("/ibus/get-global-engine", test_get_global_engine);
     g_test_add_func ("/ibus/set-preload-engines", test_set_preload_engines);
     g_test_add_func ("/ibus/async-apis", test_async_apis);
@@ -0,0 +1,239 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include "ibus.h"
+#include "ibushotkeymatcher.h"
+
+#define N_CALLS 1000000
+
+enum {
+    ACTION_SWITCHER = 1,
+    ACTION_SWITCHER_BACKWARD,
+    ACTION_EMOJI,
+};
+
+static const IBusHotkeyBinding bindings[] = {
+    { IBUS_KEY_space, IBUS_SUPER_MASK, ACTION_SWITCHER },
+    { IBUS_KEY_space, IBUS_MOD4_MASK | IBUS_SHIFT_MASK,
+      ACTION_SWITCHER_BACKWARD },
+    { IBUS_KEY_e, IBUS_CONTROL_MASK | IBUS_MOD1_MASK, ACTION_EMOJI },
+    /* a duplicate is ignored. */
+    { IBUS_KEY_e, IBUS_CONTROL_MASK | IBUS_MOD1_MASK, ACTION_SWITCHER },
+    { IBUS_KEY_Henkan, 0, ACTION_SWITCHER },
+};
+
+static IBusHotkeyMatch
+process (IBusHotkeyMatcher      *matcher,
+         IBusHotkeyMatcherState *state,
+         guint                   keyval,
+         guint                   modifiers,
+         guint                  *action)
+{
+    *action = 0;
+    return ibus_hotkey_matcher_process (matcher, state, keyval, modifiers,
+                                        action);
+}
+
+static void
+test_lookup (void)
+{
+    IBusHotkeyMatcher *matcher =
+            ibus_hotkey_matcher_new (bindings, G_N_ELEMENTS (bindings));
+
+    /* IBUS_SUPER_MASK and IBUS_MOD4_MASK are the same. */
+    g_assert_cmpuint (ibus_hotkey_matcher_lookup (matcher,
+                                                  IBUS_KEY_space,
+                                                  IBUS_MOD4_MASK),
+                      ==, ACTION_SWITCHER);
+    g_assert_cmpuint (ibus_hotkey_matcher_lookup (
+                              matcher,
+                              IBUS_KEY_space,
+                              IBUS_SUPER_MASK | IBUS_SHIFT_MASK),
+                      ==, ACTION_SWITCHER_BACKWARD);
+    /* the lock and the release bits are ignored. */
+    g_assert_cmpuint (ibus_hotkey_matcher_lookup (
+                              matcher,
+                              IBUS_KEY_e,
+                              IBUS_CONTROL_MASK | IBUS_MOD1_MASK |
+                              IBUS_LOCK_MASK | IBUS_RELEASE_MASK),
+                      ==, ACTION_EMOJI);
+    g_assert_cmpuint (ibus_hotkey_matcher_lookup (matcher,
+                                                  IBUS_KEY_space, 0),
+                      ==, 0);
+    g_assert_cmpuint (ibus_hotkey_matcher_lookup (matcher,
+                                                  IBUS_KEY_e,
+                                                  IBUS_CONTROL_MASK),
+                      ==, 0);
+
+    ibus_hotkey_matcher_unref (matcher);
+}
+
+static void
+test_press_release (void)
+{
+    IBusHotkeyMatcher *matcher =
+            ibus_hotkey_matcher_new (bindings, G_N_ELEMENTS (bindings));
+    IBusHotkeyMatcherState state = { 0, };
+    guint action;
+
+    /* Super down, space down, space repeat, space up, Super up */
+    g_assert_cmpint (process (matcher, &state, IBUS_KEY_Super_L, 0, &action),
+                     ==, IBUS_HOTKEY_MATCH_NONE);
+    g_assert_cmpint (process (matcher, &state,
+                              IBUS_KEY_space, IBUS_SUPER_MASK, &action),
+                     ==, IBUS_HOTKEY_MATCH_PRESS);
+    g_assert_cmpuint (action, ==, ACTION_SWITCHER);
+    g_assert_cmpint (process (matcher, &state,
+                              IBUS_KEY_space, IBUS_SUPER_MASK, &action),
+                     ==, IBUS_HOTKEY_MATCH_PRESS);
+    g_assert_cmpint (process (matcher, &state,
+                              IBUS_KEY_space,
+                              IBUS_SUPER_MASK | IBUS_RELEASE_MASK,
+                              &action),
+                     ==, IBUS_HOTKEY_MATCH_NONE);
+    g_assert_cmpint (process (matcher, &state,
+                              IBUS_KEY_Super_L,
+                              IBUS_SUPER_MASK | IBUS_RELEASE_MASK,
+                              &action),
+                     ==, IBUS_HOTKEY_MATCH_RELEASE);
+    g_assert_cmpuint (action, ==, ACTION_SWITCHER);
+    g_assert_cmpuint (state.modifiers, ==, 0);
+
+    /* Super and Shift down, space down, Shift up, Super up */
+    g_assert_cmpint (process (matcher, &state,
+                              IBUS_KEY_space,
+                              IBUS_MOD4_MASK | IBUS_SHIFT_MASK,
+                              &action),
+                     ==, IBUS_HOTKEY_MATCH_PRESS);
+    g_assert_cmpuint (action, ==, ACTION_SWITCHER_BACKWARD);
+    g_assert_cmpint (process (matcher, &state,
+                              IBUS_KEY_Shift_L,
+                              IBUS_MOD4_MASK | IBUS_SHIFT_MASK |
+                              IBUS_RELEASE_MASK,
+                              &action),
+                     ==, IBUS_HOTKEY_MATCH_NONE);
+    g_assert_cmpint (process (matcher, &state,
+                              IBUS_KEY_Super_R,
+                              IBUS_MOD4_MASK | IBUS_RELEASE_MASK,
+                              &action),
+                     ==, IBUS_HOTKEY_MATCH_RELEASE);
+    g_assert_cmpuint (action, ==, ACTION_SWITCHER_BACKWARD);
+
+    /* a hotkey without modifiers matches both the press and the release. */
+    g_assert_cmpint (process (matcher, &state, IBUS_KEY_Henkan, 0, &action),
+                     ==, IBUS_HOTKEY_MATCH_PRESS);
+    g_assert_cmpint (process (matcher, &state,
+                              IBUS_KEY_Henkan, IBUS_RELEASE_MASK, &action),
+                     ==, IBUS_HOTKEY_MATCH_RELEASE);
+
+    /* the other keys do not match. */
+    g_assert_cmpint (process (matcher, &state, IBUS_KEY_a, 0, &action),
+                     ==, IBUS_HOTKEY_MATCH_NONE);
+    g_assert_cmpint (process (matcher, &state,
+                              IBUS_KEY_a, IBUS_RELEASE_MASK, &action),
+                     ==, IBUS_HOTKEY_MATCH_NONE);
+
+    ibus_hotkey_matcher_unref (matcher);
+}
+
+static void
+test_many_bindings (void)
+{
+    IBusHotkeyBinding many[200];
+    IBusHotkeyMatcher *matcher;
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (many); i++) {
+        guint n = i / 26;
+        many[i].keyval = IBUS_KEY_a + i % 26;
+        many[i].modifiers = ((n & 1) ? IBUS_SHIFT_MASK : 0) |
+                            ((n & 2) ? IBUS_CONTROL_MASK : 0) |
+                            ((n & 4) ? IBUS_MOD1_MASK : 0);
+        many[i].action = i + 1;
+    }
+    matcher = ibus_hotkey_matcher_new (many, G_N_ELEMENTS (many));
+    for (i = 0; i < G_N_ELEMENTS (many); i++) {
+        g_assert_cmpuint (ibus_hotkey_matcher_lookup (matcher,
+                                                      many[i].keyval,
+                                                      many[i].modifiers),
+                          ==, i + 1);
+    }
+    ibus_hotkey_matcher_unref (matcher);
+
+    matcher = ibus_hotkey_matcher_new (NULL, 0);
+    g_assert_cmpuint (ibus_hotkey_matcher_lookup (matcher, IBUS_KEY_a, 0),
+                      ==, 0);
+    ibus_hotkey_matcher_unref (matcher);
+}
+
+/* Compare the matcher with the GTree of IBusHotkeyProfile for typed keys
+ * which are not hotkeys, the usual case of a key event. */
+static void
+bench_hotkey_matcher (void)
+{
+    IBusHotkeyMatcher *matcher =
+            ibus_hotkey_matcher_new (bindings, G_N_ELEMENTS (bindings));
+    IBusHotkeyMatcherState state = { 0, };
+    IBusHotkeyProfile *profile = ibus_hotkey_profile_new ();
+    GTimer *timer = g_timer_new ();
+    gdouble matcher_time, profile_time;
+    guint i, n_matches = 0;
+
+    for (i = 0; i < G_N_ELEMENTS (bindings); i++) {
+        /* the profile does not take the duplicate. */
+        if (ibus_hotkey_profile_lookup_hotkey (profile,
+                                               bindings[i].keyval,
+                                               bindings[i].modifiers)) {
+            continue;
+        }
+        ibus_hotkey_profile_add_hotkey (
+                profile,
+                bindings[i].keyval,
+                bindings[i].modifiers,
+                g_quark_from_static_string ("hotkey"));
+    }
+
+    g_timer_start (timer);
+    for (i = 0; i < N_CALLS; i++) {
+        guint action;
+        n_matches += ibus_hotkey_matcher_process (
+                matcher, &state,
+                IBUS_KEY_a + i % 26,
+                (i & 1) ? IBUS_RELEASE_MASK : 0,
+                &action) != IBUS_HOTKEY_MATCH_NONE;
+    }
+    matcher_time = g_timer_elapsed (timer, NULL);
+
+    g_timer_start (timer);
+    for (i = 0; i < N_CALLS; i++) {
+        n_matches += ibus_hotkey_profile_lookup_hotkey (
+                profile,
+                IBUS_KEY_a + i % 26,
+                (i & 1) ? IBUS_RELEASE_MASK : 0) != 0;
+    }
+    profile_time = g_timer_elapsed (timer, NULL);
+    g_assert_cmpuint (n_matches, ==, 0);
+
+    g_print ("\nmatcher: %.1f ns/key\n", matcher_time * 1e9 / N_CALLS);
+    g_print ("IBusHotkeyProfile: %.1f ns/key\n",
+             profile_time * 1e9 / N_CALLS);
+
+    g_timer_destroy (timer);
+    g_object_unref (profile);
+    ibus_hotkey_matcher_unref (matcher);
+}
+
+gint
+main (gint    argc,
+      gchar **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+    g_test_add_func ("/ibus/hotkey-matcher/lookup", test_lookup);
+    g_test_add_func ("/ibus/hotkey-matcher/press-release",
+                     test_press_release);
+    g_test_add_func ("/ibus/hotkey-matcher/many-bindings",
+                     test_many_bindings);
+    /* it measures rather than checks, so run it with "-m perf". */
+    if (g_test_perf ())
+        g_test_add_func ("/ibus/hotkey-matcher/bench", bench_hotkey_matcher);
+    return g_test_run ();
+}
@@ -0,0 +1,308 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include <locale.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ibus.h"
+
+/* A benchmark of the key event latency through libibus and ibus-daemon.
+ *
+ * The key events are sent in the three modes of IBUS_ENABLE_SYNC_MODE in
+ * the IM modules:
+ *   sync:   ibus_input_context_process_key_event()
+ *   async:  ibus_input_context_process_key_event_async() without waiting
+ *   hybrid: ibus_input_context_process_key_event_async() and iterate the
+ *           main context until the reply
+ * and in the scenarios of steady typing, a held key which repeats and
+ * typing while the engine is switched.
+ *
+ * Run it with "make benchmark", which starts a private ibus-daemon with
+ * ibus-engine-simple.
+ */
+
+#define ENGINE_1 "xkb:us::eng"
+#define ENGINE_2 "xkb:jp::jpn"
+/* The async mode does not send more key events before the replies. */
+#define MAX_ASYNC_KEYS_IN_FLIGHT 64
+
+typedef enum {
+    MODE_SYNC,
+    MODE_ASYNC,
+    MODE_HYBRID,
+} Mode;
+
+typedef enum {
+    SCENARIO_TYPING,
+    SCENARIO_REPEAT,
+    SCENARIO_ENGINE_SWITCH,
+} Scenario;
+
+typedef struct {
+    /* latencies of the key events in microseconds */
+    GArray  *latencies;
+    guint    n_in_flight;
+    guint    n_errors;
+} Result;
+
+typedef struct {
+    Result  *result;
+    gint64   sent_time;
+    /* the hybrid mode waits for done and frees the data */
+    gboolean hybrid;
+    gboolean done;
+} KeyEventData;
+
+static IBusBus *bus;
+static gint n_keys = 2000;
+/* microseconds between the key events of the typing scenario */
+static gint typing_interval = 2000;
+static gchar *mode_name = NULL;
+
+static const GOptionEntry entries[] =
+{
+    { "keys", 'n', 0, G_OPTION_ARG_INT, &n_keys,
+      "the number of key events per scenario.", "N" },
+    { "interval", 'i', 0, G_OPTION_ARG_INT, &typing_interval,
+      "microseconds between the key events of the steady typing.", "USEC" },
+    { "mode", 'm', 0, G_OPTION_ARG_STRING, &mode_name,
+      "run only sync, async or hybrid mode.", "MODE" },
+    { NULL },
+};
+
+static const gchar *mode_names[] = { "sync", "async", "hybrid" };
+static const gchar *scenario_names[] = { "typing", "repeat", "switch" };
+
+/* evdev keycodes of a-z */
+static const guint keycodes[] = {
+    30, 48, 46, 32, 18, 33, 34, 35, 23, 36, 37, 38, 50,
+    49, 24, 25, 16, 19, 31, 20, 22, 47, 17, 45, 21, 44
+};
+
+static void
+process_key_event_done (GObject      *object,
+                        GAsyncResult *res,
+                        gpointer      user_data)
+{
+    KeyEventData *data = (KeyEventData *) user_data;
+    GError *error = NULL;
+    gint64 latency;
+
+    ibus_input_context_process_key_event_async_finish (
+            IBUS_INPUT_CONTEXT (object), res, &error);
+    latency = g_get_monotonic_time () - data->sent_time;
+    if (error != NULL) {
+        data->result->n_errors++;
+        g_error_free (error);
+    }
+    g_array_append_val (data->result->latencies, latency);
+    data->result->n_in_flight--;
+    data->done = TRUE;
+    if (!data->hybrid)
+        g_slice_free (KeyEventData, data);
+}
+
+static void
+send_key_event (IBusInputContext *context,
+                Mode              mode,
+                Result           *result,
+                guint             keyval,
+                guint             keycode,
+                guint             state)
+{
+    KeyEventData *data;
+    gint64 sent_time = g_get_monotonic_time ();
+
+    if (mode == MODE_SYNC) {
+        gint64 latency;
+        ibus_input_context_process_key_event (context,
+                                              keyval, keycode, state);
+        latency = g_get_monotonic_time () - sent_time;
+        g_array_append_val (result->latencies, latency);
+        return;
+    }
+
+    while (result->n_in_flight >= MAX_ASYNC_KEYS_IN_FLIGHT)
+        g_main_context_iteration (NULL, TRUE);
+
+    data = g_slice_new0 (KeyEventData);
+    data->result = result;
+    data->sent_time = sent_time;
+    data->hybrid = (mode == MODE_HYBRID);
+    result->n_in_flight++;
+    ibus_input_context_process_key_event_async (context,
+                                                keyval, keycode, state,
+                                                -1,
+                                                NULL,
+                                                process_key_event_done,
+                                                data);
+    if (mode == MODE_HYBRID) {
+        while (!data->done)
+            g_main_context_iteration (NULL, TRUE);
+        g_slice_free (KeyEventData, data);
+    } else {
+        while (g_main_context_iteration (NULL, FALSE));
+    }
+}
+
+static void
+wait_until (gint64 time)
+{
+    gint64 now;
+    while ((now = g_get_monotonic_time ()) < time) {
+        /* the async mode receives the replies while it waits. */
+        if (!g_main_context_iteration (NULL, FALSE))
+            g_usleep (MIN (time - now, 100));
+    }
+}
+
+static void
+set_engine (IBusInputContext *context,
+            const gchar      *name)
+{
+    if (ibus_bus_get_use_global_engine (bus)) {
+        ibus_bus_set_global_engine_async (bus, name, -1, NULL, NULL, NULL);
+    } else {
+        ibus_input_context_set_engine (context, name);
+    }
+}
+
+static gint
+compare_latency (gconstpointer a,
+                 gconstpointer b)
+{
+    gint64 x = *(const gint64 *) a;
+    gint64 y = *(const gint64 *) b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static gint64
+get_percentile (GArray *latencies,
+                gdouble percentile)
+{
+    guint i;
+    if (latencies->len == 0)
+        return 0;
+    i = (guint) (latencies->len * percentile / 100.0);
+    return g_array_index (latencies, gint64, MIN (i, latencies->len - 1));
+}
+
+static gboolean
+run_scenario (Mode     mode,
+              Scenario scenario)
+{
+    IBusInputContext *context;
+    Result result = { 0, };
+    gint64 start_time, elapsed;
+    gint i;
+
+    context = ibus_bus_create_input_context (bus, "ibus-key-latency");
+    g_assert (context != NULL);
+    ibus_input_context_set_capabilities (context, IBUS_CAP_FOCUS);
+    ibus_input_context_focus_in (context);
+    if (ibus_bus_get_use_global_engine (bus))
+        ibus_bus_set_global_engine (bus, ENGINE_1);
+    else
+        ibus_input_context_set_engine (context, ENGINE_1);
+
+    result.latencies = g_array_sized_new (FALSE, FALSE, sizeof (gint64),
+                                          n_keys);
+    start_time = g_get_monotonic_time ();
+    for (i = 0; i < n_keys; i++) {
+        guint letter = i % 26;
+        guint state = 0;
+
+        switch (scenario) {
+        case SCENARIO_TYPING:
+            wait_until (start_time + (gint64) i * typing_interval);
+            /* a press and a release per key */
+            if (i % 2)
+                state = IBUS_RELEASE_MASK;
+            letter = (i / 2) % 26;
+            break;
+        case SCENARIO_REPEAT:
+            /* presses of a held key without a delay */
+            letter = 0;
+            break;
+        case SCENARIO_ENGINE_SWITCH:
+            if (i % 2)
+                state = IBUS_RELEASE_MASK;
+            letter = (i / 2) % 26;
+            if (i % 20 == 0)
+                set_engine (context, (i / 20) % 2 ? ENGINE_2 : ENGINE_1);
+            break;
+        default:
+            g_assert_not_reached ();
+        }
+        send_key_event (context, mode, &result,
+                        IBUS_KEY_a + letter, keycodes[letter], state);
+    }
+    while (result.n_in_flight > 0)
+        g_main_context_iteration (NULL, TRUE);
+    elapsed = g_get_monotonic_time () - start_time;
+
+    g_array_sort (result.latencies, compare_latency);
+    g_print ("%-8s %-8s %8u %10.0f %8" G_GINT64_FORMAT
+             " %8" G_GINT64_FORMAT " %8" G_GINT64_FORMAT
+             " %8" G_GINT64_FORMAT "\n",
+             mode_names[mode],
+             scenario_names[scenario],
+             result.latencies->len,
+             result.latencies->len * (gdouble) G_USEC_PER_SEC /
+                     MAX (elapsed, 1),
+             get_percentile (result.latencies, 50),
+             get_percentile (result.latencies, 99),
+             get_percentile (result.latencies, 99.9),
+             get_percentile (result.latencies, 100));
+    if (result.n_errors > 0)
+        g_printerr ("%u key events failed\n", result.n_errors);
+
+    g_array_free (result.latencies, TRUE);
+    ibus_input_context_focus_out (context);
+    ibus_proxy_destroy (IBUS_PROXY (context));
+    g_object_unref (context);
+    return result.n_errors == 0;
+}
+
+gint
+main (gint    argc,
+      gchar **argv)
+{
+    GOptionContext *option;
+    GError *error = NULL;
+    gboolean retval = TRUE;
+    Mode mode;
+    Scenario scenario;
+
+    setlocale (LC_ALL, "");
+    option = g_option_context_new (NULL);
+    g_option_context_add_main_entries (option, entries, NULL);
+    if (!g_option_context_parse (option, &argc, &argv, &error)) {
+        g_printerr ("Option parsing failed: %s\n", error->message);
+        g_error_free (error);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free (option);
+
+    ibus_init ();
+    bus = ibus_bus_new ();
+    if (!ibus_bus_is_connected (bus)) {
+        g_printerr ("ibus-daemon is not running\n");
+        return EXIT_FAILURE;
+    }
+
+    g_print ("%-8s %-8s %8s %10s %8s %8s %8s %8s (usec)\n",
+             "mode", "scenario", "keys", "keys/s",
+             "p50", "p99", "p999", "max");
+    for (mode = MODE_SYNC; mode <= MODE_HYBRID; mode++) {
+        if (mode_name && g_strcmp0 (mode_name, mode_names[mode]) != 0)
+            continue;
+        for (scenario = SCENARIO_TYPING;
+             scenario <= SCENARIO_ENGINE_SWITCH;
+             scenario++) {
+            retval = run_scenario (mode, scenario) && retval;
+        }
+    }
+
+    g_object_unref (bus);
+    return retval ? EXIT_SUCCESS : EXIT_FAILURE;
+}
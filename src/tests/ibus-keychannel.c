@@ -0,0 +1,289 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include <unistd.h>
+
+#include "ibus.h"
+#include "ibuskeychannel.h"
+#include "ibusprocesskeyevent.h"
+
+/* Map the client channel as ibus-daemon does with the passed fds. */
+static IBusKeyChannel *
+open_daemon_side (IBusKeyChannel *client)
+{
+    gint memfd, key_fd, reply_fd;
+    GError *error = NULL;
+    IBusKeyChannel *daemon;
+
+    ibus_key_channel_get_fds (client, &memfd, &key_fd, &reply_fd);
+    daemon = ibus_key_channel_new_from_fds (dup (memfd),
+                                            dup (key_fd),
+                                            dup (reply_fd),
+                                            &error);
+    g_assert_no_error (error);
+    return daemon;
+}
+
+static void
+test_ring (void)
+{
+    GError *error = NULL;
+    IBusKeyChannel *client = ibus_key_channel_new (&error);
+    IBusKeyChannel *daemon;
+    guint32 keyval, keycode, state, serial, n_signals;
+    gboolean processed;
+    guint32 i;
+
+    if (client == NULL) {
+        g_assert_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED);
+        g_error_free (error);
+        g_test_skip ("The key channel is not supported.");
+        return;
+    }
+    daemon = open_daemon_side (client);
+
+    g_assert_false (ibus_key_channel_pop_key (daemon,
+                                              &keyval, &keycode, &state,
+                                              &serial));
+    /* fill the ring twice to go over the wrap around. */
+    for (i = 0; i < IBUS_KEY_CHANNEL_N_SLOTS * 2; i++) {
+        if (i % IBUS_KEY_CHANNEL_N_SLOTS == 0) {
+            guint32 j;
+            for (j = 0; j < IBUS_KEY_CHANNEL_N_SLOTS; j++) {
+                g_assert_true (ibus_key_channel_push_key (client,
+                                                          IBUS_KEY_a + j,
+                                                          30,
+                                                          0,
+                                                          i + j));
+            }
+            g_assert_false (ibus_key_channel_push_key (client,
+                                                       IBUS_KEY_a, 30, 0, 0));
+        }
+        g_assert_true (ibus_key_channel_pop_key (daemon,
+                                                 &keyval, &keycode, &state,
+                                                 &serial));
+        g_assert_cmpuint (serial, ==, i);
+        g_assert_cmpuint (keyval, ==,
+                          IBUS_KEY_a + i % IBUS_KEY_CHANNEL_N_SLOTS);
+        g_assert_true (ibus_key_channel_push_reply (daemon,
+                                                    serial,
+                                                    serial % 2,
+                                                    serial * 3));
+        g_assert_true (ibus_key_channel_wait_reply (client, 0));
+        ibus_key_channel_acknowledge (client, FALSE);
+        g_assert_true (ibus_key_channel_pop_reply (client,
+                                                   &serial, &processed,
+                                                   &n_signals));
+        g_assert_cmpuint (serial, ==, i);
+        g_assert_cmpint (processed, ==, i % 2);
+        g_assert_cmpuint (n_signals, ==, i * 3);
+    }
+    g_assert_false (ibus_key_channel_wait_reply (client, 0));
+    g_assert_false (ibus_key_channel_pop_reply (client,
+                                                &serial, &processed,
+                                                &n_signals));
+
+    ibus_key_channel_free (daemon);
+    ibus_key_channel_free (client);
+}
+
+static void
+test_unsealed_memfd (void)
+{
+    GError *error = NULL;
+    IBusKeyChannel *client = ibus_key_channel_new (&error);
+    IBusKeyChannel *daemon;
+    gint fds[2];
+
+    if (client == NULL) {
+        g_error_free (error);
+        g_test_skip ("The key channel is not supported.");
+        return;
+    }
+    /* a pipe cannot be sealed. */
+    g_assert_cmpint (pipe (fds), ==, 0);
+    close (fds[1]);
+    daemon = ibus_key_channel_new_from_fds (fds[0], -1, -1, &error);
+    g_assert_null (daemon);
+    g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT);
+    g_error_free (error);
+    ibus_key_channel_free (client);
+}
+
+/* Read the arguments of a ProcessKeyEvent call as GDBus does from the
+ * wire. */
+static GVariant *
+new_process_key_event_body (void)
+{
+    GDBusMessage *message, *parsed;
+    guchar *blob;
+    gsize size;
+    GVariant *body;
+    GError *error = NULL;
+
+    message = g_dbus_message_new_method_call (NULL,
+                                              "/org/freedesktop/IBus/Engine/1",
+                                              IBUS_INTERFACE_ENGINE,
+                                              "ProcessKeyEvent");
+    g_dbus_message_set_body (message,
+                             g_variant_new ("(uuu)",
+                                            IBUS_KEY_a, 30, IBUS_SHIFT_MASK));
+    blob = g_dbus_message_to_blob (message, &size,
+                                   G_DBUS_CAPABILITY_FLAGS_NONE, &error);
+    g_assert_no_error (error);
+    parsed = g_dbus_message_new_from_blob (blob, size,
+                                           G_DBUS_CAPABILITY_FLAGS_NONE,
+                                           &error);
+    g_assert_no_error (error);
+    body = g_variant_ref (g_dbus_message_get_body (parsed));
+    g_free (blob);
+    g_object_unref (parsed);
+    g_object_unref (message);
+    return body;
+}
+
+static void
+test_process_key_event_args (void)
+{
+    GVariant *body = new_process_key_event_body ();
+    GVariant *args;
+    guint32 keyval = 0, keycode = 0, state = 0;
+
+    g_assert_true (ibus_process_key_event_args_get (body,
+                                                    &keyval,
+                                                    &keycode,
+                                                    &state));
+    g_assert_cmpuint (keyval, ==, IBUS_KEY_a);
+    g_assert_cmpuint (keycode, ==, 30);
+    g_assert_cmpuint (state, ==, IBUS_SHIFT_MASK);
+    g_variant_unref (body);
+
+    args = g_variant_ref_sink (ibus_process_key_event_args_new (IBUS_KEY_b,
+                                                                48,
+                                                                0));
+    g_assert_true (g_variant_is_of_type (args, G_VARIANT_TYPE ("(uuu)")));
+    g_variant_get (args, "(uuu)", &keyval, &keycode, &state);
+    g_assert_cmpuint (keyval, ==, IBUS_KEY_b);
+    g_assert_cmpuint (keycode, ==, 48);
+    g_assert_cmpuint (state, ==, 0);
+    g_variant_unref (args);
+
+    g_assert_true (g_variant_is_of_type (ibus_process_key_event_reply (TRUE),
+                                         G_VARIANT_TYPE ("(b)")));
+    g_assert_false (g_variant_is_floating (ibus_process_key_event_reply (TRUE)));
+    g_assert_true (ibus_process_key_event_reply_get (
+            ibus_process_key_event_reply (TRUE)));
+    g_assert_false (ibus_process_key_event_reply_get (
+            ibus_process_key_event_reply (FALSE)));
+}
+
+static void
+test_process_key_events_args (void)
+{
+    const IBusProcessKeyEventData keys[] = {
+        { IBUS_KEY_a, 30, 0 },
+        { IBUS_KEY_a, 30, IBUS_RELEASE_MASK },
+        { IBUS_KEY_B, 48, IBUS_SHIFT_MASK },
+    };
+    const guint8 bitmap[] = { 0x05, 0x01 };
+    const IBusProcessKeyEventData *got;
+    const guint8 *handled;
+    GVariant *args, *reply;
+    gsize n_keys = 0;
+    guint32 keyval = 0, keycode = 0, state = 0;
+    GVariantIter *iter;
+
+    args = g_variant_ref_sink (
+            ibus_process_key_events_args_new (keys, G_N_ELEMENTS (keys)));
+    g_assert_true (g_variant_is_of_type (args, G_VARIANT_TYPE ("(a(uuu))")));
+    g_variant_get (args, "(a(uuu))", &iter);
+    g_assert_cmpuint (g_variant_iter_n_children (iter), ==, 3);
+    g_variant_iter_skip (iter, 2);
+    g_assert_true (g_variant_iter_next (iter, "(uuu)",
+                                        &keyval, &keycode, &state));
+    g_assert_cmpuint (keyval, ==, IBUS_KEY_B);
+    g_assert_cmpuint (keycode, ==, 48);
+    g_assert_cmpuint (state, ==, IBUS_SHIFT_MASK);
+    g_variant_iter_free (iter);
+
+    got = ibus_process_key_events_args_get (args, &n_keys);
+    g_assert_cmpuint (n_keys, ==, G_N_ELEMENTS (keys));
+    g_assert_cmpmem (got, n_keys * sizeof (got[0]), keys, sizeof (keys));
+    g_variant_unref (args);
+
+    reply = g_variant_ref_sink (ibus_process_key_events_reply_new (bitmap, 9));
+    g_assert_true (g_variant_is_of_type (reply, G_VARIANT_TYPE ("(ay)")));
+    handled = ibus_process_key_events_reply_get (reply, 9);
+    g_assert_nonnull (handled);
+    g_assert_cmpuint (handled[0], ==, 0x05);
+    g_assert_cmpuint (handled[1], ==, 0x01);
+    /* the bitmap has no bit for the 17th key. */
+    g_assert_null (ibus_process_key_events_reply_get (reply, 17));
+    g_variant_unref (reply);
+}
+
+#define N_CALLS 200000
+
+/* Compare the CPU time of the argument and reply handling of one
+ * ProcessKeyEvent call with the format strings and with the fast path. */
+static void
+bench_process_key_event (void)
+{
+    GVariant *body = new_process_key_event_body ();
+    GTimer *timer = g_timer_new ();
+    gdouble format_time, fast_time;
+    guint32 keyval, keycode, state, sum = 0;
+    gboolean processed;
+    guint i;
+
+    for (i = 0; i < N_CALLS; i++) {
+        GVariant *args, *reply;
+        g_variant_get (body, "(uuu)", &keyval, &keycode, &state);
+        args = g_variant_ref_sink (g_variant_new ("(uuu)",
+                                                  keyval, keycode, state));
+        reply = g_variant_ref_sink (g_variant_new ("(b)", i & 1));
+        g_variant_get (reply, "(b)", &processed);
+        sum += processed;
+        g_variant_unref (reply);
+        g_variant_unref (args);
+    }
+    format_time = g_timer_elapsed (timer, NULL);
+
+    g_timer_start (timer);
+    for (i = 0; i < N_CALLS; i++) {
+        GVariant *args, *reply;
+        ibus_process_key_event_args_get (body, &keyval, &keycode, &state);
+        args = g_variant_ref_sink (
+                ibus_process_key_event_args_new (keyval, keycode, state));
+        reply = g_variant_ref (ibus_process_key_event_reply (i & 1));
+        sum -= ibus_process_key_event_reply_get (reply);
+        g_variant_unref (reply);
+        g_variant_unref (args);
+    }
+    fast_time = g_timer_elapsed (timer, NULL);
+    g_assert_cmpuint (sum, ==, 0);
+
+    g_print ("\nformat strings: %.1f ns/call\n", format_time * 1e9 / N_CALLS);
+    g_print ("fast path: %.1f ns/call\n", fast_time * 1e9 / N_CALLS);
+
+    g_timer_destroy (timer);
+    g_variant_unref (body);
+}
+
+gint
+main (gint    argc,
+      gchar **argv)
+{
+    g_test_init (&argc, &argv, NULL);
+    g_test_add_func ("/ibus/key-channel/ring", test_ring);
+    g_test_add_func ("/ibus/key-channel/unsealed-memfd", test_unsealed_memfd);
+    g_test_add_func ("/ibus/key-channel/process-key-event-args",
+                     test_process_key_event_args);
+    g_test_add_func ("/ibus/key-channel/process-key-events-args",
+                     test_process_key_events_args);
+    /* it measures rather than checks, so run it with "-m perf". */
+    if (g_test_perf ()) {
+        g_test_add_func ("/ibus/key-channel/process-key-event-bench",
+                         bench_process_key_event);
+    }
+    return g_test_run ();
+}
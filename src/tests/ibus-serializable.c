@@ -54,6 +54,66 @@ test_text (void)
     g_variant_type_info_assert_no_infos ();
 }
 
+static void
+test_text_diff (void)
+{
+    static const struct {
+        const gchar *old_str;
+        const gchar *new_str;
+        guint        offset;
+        guint        n_deleted;
+        const gchar *inserted;
+    } diffs[] = {
+        { "Hello",           "Hello",            5, 0, "" },
+        { "Hello",           "Hello world",      5, 0, " world" },
+        { "Hello world",     "Hello",            5, 6, "" },
+        { "Hello world",     "Hello, world",     5, 0, "," },
+        { "",                "Hello",            0, 0, "Hello" },
+        { "aaa",             "aa",               2, 1, "" },
+        { "\xe6\x97\xa5\xe6\x9c\xac", "\xe6\x97\xa5\xe8\xaa\x9e\xe6\x9c\xac",
+                                                 1, 0, "\xe8\xaa\x9e" },
+        /* U+65E5 and U+6587 share the first byte */
+        { "\xe6\x97\xa5",       "\xe6\x96\x87",        0, 1, "\xe6\x96\x87" },
+    };
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS (diffs); i++) {
+        IBusText *old_text = ibus_text_new_from_string (diffs[i].old_str);
+        IBusText *new_text = ibus_text_new_from_string (diffs[i].new_str);
+        IBusText *text;
+        guint offset = G_MAXUINT;
+        guint n_deleted = G_MAXUINT;
+        gchar *inserted;
+
+        g_object_ref_sink (old_text);
+        g_object_ref_sink (new_text);
+        inserted = ibus_text_diff (old_text, new_text, &offset, &n_deleted);
+        g_assert_cmpuint (offset, ==, diffs[i].offset);
+        g_assert_cmpuint (n_deleted, ==, diffs[i].n_deleted);
+        g_assert_cmpstr (inserted, ==, diffs[i].inserted);
+
+        text = ibus_text_new_from_splice (old_text, offset, n_deleted,
+                                          inserted);
+        g_assert (text != NULL);
+        g_object_ref_sink (text);
+        g_assert_cmpstr (ibus_text_get_text (text), ==, diffs[i].new_str);
+
+        g_object_unref (text);
+        g_free (inserted);
+        g_object_unref (new_text);
+        g_object_unref (old_text);
+    }
+
+    /* out of range */
+    {
+        IBusText *text = ibus_text_new_from_string ("Hello");
+        g_object_ref_sink (text);
+        g_assert (ibus_text_new_from_splice (text, 6, 0, "") == NULL);
+        g_assert (ibus_text_new_from_splice (text, 3, 3, "") == NULL);
+        g_object_unref (text);
+    }
+}
+
 static void
 test_engine_desc (void)
 {
@@ -189,6 +249,7 @@ main (gint    argc,
     g_test_add_func ("/ibus/varianttypeinfo", test_varianttypeinfo);
     g_test_add_func ("/ibus/attrlist", test_attr_list);
     g_test_add_func ("/ibus/text", test_text);
+    g_test_add_func ("/ibus/textdiff", test_text_diff);
     g_test_add_func ("/ibus/enginedesc", test_engine_desc);
     g_test_add_func ("/ibus/lookuptable", test_lookup_table);
     g_test_add_func ("/ibus/property", test_property);
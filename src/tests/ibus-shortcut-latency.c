@@ -0,0 +1,193 @@
+/* -*- mode: C; c-basic-offset: 4; indent-tabs-mode: nil; -*- */
+
+#include "ibus.h"
+
+/* Measure the time from a key event of the IME switcher keys to
+ * the global-shortcut-key-responded signal of IBusBus, which the panel
+ * waits for to show and hide the switcher. */
+
+#define N_ROUNDS 50
+/* The signal used to come only with the next key press, so a lost signal
+ * fails the test instead of being measured. */
+#define TIMEOUT_USEC (2 * G_USEC_PER_SEC)
+
+static IBusBus *bus;
+
+typedef struct {
+    guint    n_responded;
+    guint    state;
+    gboolean is_backward;
+} Response;
+
+static void
+global_shortcut_key_responded_cb (IBusBus  *bus,
+                                  guchar    type,
+                                  guint     keyval,
+                                  guint     keycode,
+                                  guint     state,
+                                  gboolean  is_backward,
+                                  Response *response)
+{
+    g_assert_cmpuint (type, ==, IBUS_BUS_GLOBAL_BINDING_TYPE_IME_SWITCHER);
+    response->n_responded++;
+    response->state = state;
+    response->is_backward = is_backward;
+}
+
+static void
+process_key_event_done (GObject      *object,
+                        GAsyncResult *res,
+                        gpointer      user_data)
+{
+    GError *error = NULL;
+
+    ibus_input_context_process_key_event_async_finish (
+            IBUS_INPUT_CONTEXT (object), res, &error);
+    g_assert_no_error (error);
+}
+
+static void
+send_key_event (IBusInputContext *context,
+                guint             keyval,
+                guint             keycode,
+                guint             state)
+{
+    ibus_input_context_process_key_event_async (context,
+                                                keyval, keycode, state,
+                                                -1,
+                                                NULL,
+                                                process_key_event_done,
+                                                NULL);
+}
+
+/* Returns the microseconds until the next response. */
+static gint64
+wait_for_response (Response *response,
+                   gint64    sent_time)
+{
+    guint n_responded = response->n_responded;
+    gint64 now = sent_time;
+
+    while (response->n_responded == n_responded) {
+        g_assert_cmpint (now - sent_time, <, TIMEOUT_USEC);
+        /* do not block forever if the signal is lost. */
+        if (!g_main_context_iteration (NULL, FALSE))
+            g_usleep (50);
+        now = g_get_monotonic_time ();
+    }
+    return g_get_monotonic_time () - sent_time;
+}
+
+static gint
+compare_latency (gconstpointer a,
+                 gconstpointer b)
+{
+    gint64 la = *(const gint64 *) a;
+    gint64 lb = *(const gint64 *) b;
+    return la < lb ? -1 : la > lb ? 1 : 0;
+}
+
+static void
+print_latencies (const gchar *name,
+                 GArray      *latencies)
+{
+    g_array_sort (latencies, compare_latency);
+    g_print ("%s: median %" G_GINT64_FORMAT " usec, max %" G_GINT64_FORMAT
+             " usec\n",
+             name,
+             g_array_index (latencies, gint64, latencies->len / 2),
+             g_array_index (latencies, gint64, latencies->len - 1));
+}
+
+static void
+test_shortcut_latency (void)
+{
+    static const IBusProcessKeyEventData keys[] = {
+        { IBUS_KEY_space, 0, IBUS_SUPER_MASK },
+        { 0, },
+    };
+    IBusInputContext *context;
+    Response response = { 0, };
+    GArray *press_latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+    GArray *release_latencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+    gulong handler_id;
+    guint i;
+
+    /* the test replaces the IME switcher keys of the daemon, which cannot
+     * be read back, so it needs the private daemon of runtest. */
+    if (bus == NULL) {
+        g_test_skip ("Run with the private ibus-daemon of runtest.");
+        return;
+    }
+
+    ibus_bus_set_watch_ibus_signal (bus, TRUE);
+    handler_id = g_signal_connect (
+            bus, "global-shortcut-key-responded",
+            G_CALLBACK (global_shortcut_key_responded_cb), &response);
+    g_assert_true (ibus_bus_set_global_shortcut_keys (
+            bus, IBUS_BUS_GLOBAL_BINDING_TYPE_IME_SWITCHER, keys));
+
+    context = ibus_bus_create_input_context (bus, "test-shortcut-latency");
+    g_assert_nonnull (context);
+    ibus_input_context_set_capabilities (context, IBUS_CAP_FOCUS);
+    ibus_input_context_focus_in (context);
+
+    for (i = 0; i < N_ROUNDS; i++) {
+        gint64 sent_time, latency;
+
+        /* Super down, space down and up: the switcher is shown. */
+        send_key_event (context, IBUS_KEY_Super_L, 125, 0);
+        sent_time = g_get_monotonic_time ();
+        send_key_event (context, IBUS_KEY_space, 57, IBUS_SUPER_MASK);
+        latency = wait_for_response (&response, sent_time);
+        g_assert_cmpuint (response.state & IBUS_RELEASE_MASK, ==, 0);
+        g_array_append_val (press_latencies, latency);
+        send_key_event (context, IBUS_KEY_space, 57,
+                        IBUS_SUPER_MASK | IBUS_RELEASE_MASK);
+
+        /* Super up: the switcher selects the engine. No key event
+         * follows, which used to deliver the signal late. */
+        sent_time = g_get_monotonic_time ();
+        send_key_event (context, IBUS_KEY_Super_L, 125,
+                        IBUS_SUPER_MASK | IBUS_RELEASE_MASK);
+        latency = wait_for_response (&response, sent_time);
+        g_assert_cmpuint (response.state & IBUS_RELEASE_MASK, !=, 0);
+        g_assert_false (response.is_backward);
+        g_array_append_val (release_latencies, latency);
+    }
+    g_assert_cmpuint (response.n_responded, ==, N_ROUNDS * 2);
+
+    g_print ("\n");
+    print_latencies ("press", press_latencies);
+    print_latencies ("release", release_latencies);
+
+    g_array_free (press_latencies, TRUE);
+    g_array_free (release_latencies, TRUE);
+    g_signal_handler_disconnect (bus, handler_id);
+    ibus_input_context_focus_out (context);
+    g_object_unref (context);
+    ibus_bus_set_watch_ibus_signal (bus, FALSE);
+}
+
+gint
+main (gint    argc,
+      gchar **argv)
+{
+    gint result;
+
+    ibus_init ();
+    g_test_init (&argc, &argv, NULL);
+    /* runtest exports IBUS_ADDRESS_FILE for its private ibus-daemon. */
+    if (g_getenv ("IBUS_ADDRESS_FILE") != NULL) {
+        bus = ibus_bus_new ();
+        if (!ibus_bus_is_connected (bus)) {
+            g_warning ("Not connected to ibus-daemon");
+            g_object_unref (bus);
+            return -1;
+        }
+    }
+    g_test_add_func ("/ibus/shortcut-latency", test_shortcut_latency);
+    result = g_test_run ();
+    g_clear_object (&bus);
+    return result;
+}
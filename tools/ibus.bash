@@ -128,6 +128,7 @@ __ibus()
             return 0
             ;;
         watch)
+            COMPREPLY=( $( compgen -W '--interval --count --json' -- "$cur" ))
             return 0
             ;;
         *)
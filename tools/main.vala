@@ -41,6 +41,9 @@ string engine_id = null;
 bool verbose = false;
 string daemon_type = null;
 string systemd_service_file = null;
+int watch_interval = 1000;
+int watch_count = 0;
+bool watch_json = false;
 GLib.MainLoop loop = null;
 
 
@@ -580,7 +583,369 @@ int get_set_engine(string[] argv) {
 }
 
 
+/* ibus watch does not update faster than this in milliseconds so that it
+ * does not load ibus-daemon. */
+private const int WATCH_MIN_INTERVAL = 100;
+/* The number of the message members and the slow key events in a text
+ * update. */
+private const int WATCH_N_TEXT_ROWS = 10;
+/* BUS_STATS_SLOW_KEY_EVENT_USEC of ibus-daemon in milliseconds. */
+private const int WATCH_SLOW_KEY_EVENT_MSEC = 20;
+
+
+class WatchSample {
+    public int64 time;
+    public GLib.Variant engines;
+    public GLib.Variant queues;
+    public GLib.Variant messages;
+    public GLib.Variant slow_events;
+}
+
+
+class WatchRate {
+    public string name;
+    public double rate;
+}
+
+
+private WatchSample? get_watch_sample(GLib.DBusConnection connection) {
+    GLib.Variant properties = null;
+    try {
+        var variant = connection.call_sync (
+                "org.freedesktop.IBus",
+                "/org/freedesktop/IBus",
+                "org.freedesktop.DBus.Properties",
+                "GetAll",
+                new GLib.Variant("(s)", "org.freedesktop.IBus.Stats"),
+                new GLib.VariantType("(a{sv})"),
+                GLib.DBusCallFlags.NONE,
+                -1,
+                null);
+        properties = variant.get_child_value(0);
+    } catch (GLib.Error e) {
+        stderr.printf("%s\n", e.message);
+        return null;
+    }
+
+    var sample = new WatchSample();
+    sample.time = GLib.get_monotonic_time();
+    sample.engines = properties.lookup_value(
+            "EngineKeyLatency", new GLib.VariantType("a(s(tttt))"));
+    sample.queues = properties.lookup_value(
+            "QueueStats", new GLib.VariantType("a(ss(uut))"));
+    sample.messages = properties.lookup_value(
+            "MessageCounts", new GLib.VariantType("a{st}"));
+    sample.slow_events = properties.lookup_value(
+            "SlowKeyEvents", new GLib.VariantType("a(txsst)"));
+    if (sample.engines == null || sample.queues == null ||
+        sample.messages == null || sample.slow_events == null) {
+        stderr.printf(_("ibus-daemon does not provide the statistics.\n"));
+        return null;
+    }
+    return sample;
+}
+
+
+private double get_watch_rate(uint64 count,
+                              uint64 previous_count,
+                              double seconds) {
+    /* The counts are reset when ibus-daemon restarts. */
+    if (seconds <= 0.0 || count < previous_count)
+        return 0.0;
+    return (count - previous_count) / seconds;
+}
+
+
+private uint64 get_watch_engine_count(WatchSample? sample, string name) {
+    if (sample == null)
+        return 0;
+    for (size_t i = 0; i < sample.engines.n_children(); i++) {
+        string engine_name = null;
+        uint64 count = 0;
+        uint64 p50 = 0;
+        uint64 p99 = 0;
+        uint64 max = 0;
+        sample.engines.get_child_value(i).get(
+                "(s(tttt))",
+                ref engine_name, ref count, ref p50, ref p99, ref max);
+        if (engine_name == name)
+            return count;
+    }
+    return 0;
+}
+
+
+/* The message counts start when they are read first, so the rates are
+ * known from the second sample. */
+private GLib.GenericArray<WatchRate>
+get_watch_message_rates(WatchSample  sample,
+                        WatchSample? previous) {
+    var rates = new GLib.GenericArray<WatchRate>();
+    if (previous == null)
+        return rates;
+    double seconds = (sample.time - previous.time) / 1000000.0;
+    for (size_t i = 0; i < sample.messages.n_children(); i++) {
+        string member = null;
+        uint64 count = 0;
+        sample.messages.get_child_value(i).get("{st}",
+                                               ref member, ref count);
+        var previous_count = previous.messages.lookup_value(
+                member, GLib.VariantType.UINT64);
+        var rate = new WatchRate();
+        rate.name = member;
+        rate.rate = get_watch_rate(
+                count,
+                previous_count != null ? previous_count.get_uint64() : 0,
+                seconds);
+        rates.add(rate);
+    }
+    rates.sort((a, b) => {
+        if (a.rate != b.rate)
+            return a.rate > b.rate ? -1 : 1;
+        return GLib.strcmp(a.name, b.name);
+    });
+    return rates;
+}
+
+
+private string watch_json_string(string str) {
+    var builder = new GLib.StringBuilder("\"");
+    for (int i = 0; i < str.length; i++) {
+        char c = (char)str.data[i];
+        if (c == '"' || c == '\\')
+            builder.append_printf("\\%c", c);
+        else if (str.data[i] < 0x20)
+            builder.append_printf("\\u%04x", str.data[i]);
+        else
+            builder.append_c(c);
+    }
+    builder.append_c('"');
+    return builder.str;
+}
+
+
+/* printf("%f") uses the decimal point of the locale. */
+private string watch_json_double(double value) {
+    char[] buffer = new char[double.DTOSTR_BUF_SIZE];
+    return value.format(buffer, "%.2f");
+}
+
+
+private void print_watch_json(WatchSample  sample,
+                              WatchSample? previous,
+                              ref uint64   last_serial) {
+    double seconds = previous != null
+            ? (sample.time - previous.time) / 1000000.0 : 0.0;
+    var builder = new GLib.StringBuilder();
+    builder.append_printf("{\"time\":%" + int64.FORMAT,
+                          GLib.get_real_time());
+
+    builder.append(",\"engines\":[");
+    for (size_t i = 0; i < sample.engines.n_children(); i++) {
+        string name = null;
+        uint64 count = 0;
+        uint64 p50 = 0;
+        uint64 p99 = 0;
+        uint64 max = 0;
+        sample.engines.get_child_value(i).get(
+                "(s(tttt))", ref name, ref count, ref p50, ref p99, ref max);
+        double rate = previous != null
+                ? get_watch_rate(count,
+                                 get_watch_engine_count(previous, name),
+                                 seconds)
+                : 0.0;
+        builder.append_printf(
+                "%s{\"name\":%s,\"count\":%" + uint64.FORMAT +
+                ",\"keys_per_sec\":%s,\"p50_us\":%" + uint64.FORMAT +
+                ",\"p99_us\":%" + uint64.FORMAT +
+                ",\"max_us\":%" + uint64.FORMAT + "}",
+                i > 0 ? "," : "",
+                watch_json_string(name), count, watch_json_double(rate),
+                p50, p99, max);
+    }
+
+    builder.append("],\"queues\":[");
+    for (size_t i = 0; i < sample.queues.n_children(); i++) {
+        string queue = null;
+        string lane = null;
+        uint32 depth = 0;
+        uint32 high_water_mark = 0;
+        uint64 n_messages = 0;
+        sample.queues.get_child_value(i).get(
+                "(ss(uut))", ref queue, ref lane,
+                ref depth, ref high_water_mark, ref n_messages);
+        builder.append_printf(
+                "%s{\"queue\":%s,\"lane\":%s,\"depth\":%u," +
+                "\"high_water_mark\":%u,\"messages\":%" +
+                uint64.FORMAT + "}",
+                i > 0 ? "," : "",
+                watch_json_string(queue), watch_json_string(lane),
+                depth, high_water_mark, n_messages);
+    }
+
+    builder.append("],\"message_rates\":{");
+    var rates = get_watch_message_rates(sample, previous);
+    for (int i = 0; i < rates.length; i++) {
+        builder.append_printf("%s%s:%s",
+                              i > 0 ? "," : "",
+                              watch_json_string(rates[i].name),
+                              watch_json_double(rates[i].rate));
+    }
+
+    /* Only the slow key events after the previous update are printed. */
+    builder.append("},\"slow_key_events\":[");
+    int64 real_offset = GLib.get_real_time() - GLib.get_monotonic_time();
+    bool first = true;
+    for (size_t i = 0; i < sample.slow_events.n_children(); i++) {
+        uint64 serial = 0;
+        int64 time = 0;
+        string client = null;
+        string engine = null;
+        uint64 latency = 0;
+        sample.slow_events.get_child_value(i).get(
+                "(txsst)", ref serial, ref time, ref client, ref engine,
+                ref latency);
+        if (serial <= last_serial)
+            continue;
+        last_serial = serial;
+        builder.append_printf(
+                "%s{\"time\":%" + int64.FORMAT + ",\"client\":%s," +
+                "\"engine\":%s,\"latency_us\":%" + uint64.FORMAT + "}",
+                first ? "" : ",",
+                time + real_offset,
+                watch_json_string(client), watch_json_string(engine),
+                latency);
+        first = false;
+    }
+    builder.append("]}");
+    print("%s\n", builder.str);
+}
+
+
+private void print_watch_text(WatchSample  sample,
+                              WatchSample? previous,
+                              bool         clear) {
+    double seconds = previous != null
+            ? (sample.time - previous.time) / 1000000.0 : 0.0;
+    if (clear)
+        print("\x1b[H\x1b[2J");
+
+    print(_("Key latency of engines:\n"));
+    print("  %-24s %8s %10s %9s %9s %9s\n",
+          "ENGINE", "KEYS/S", "KEYS", "P50 MS", "P99 MS", "MAX MS");
+    for (size_t i = 0; i < sample.engines.n_children(); i++) {
+        string name = null;
+        uint64 count = 0;
+        uint64 p50 = 0;
+        uint64 p99 = 0;
+        uint64 max = 0;
+        sample.engines.get_child_value(i).get(
+                "(s(tttt))", ref name, ref count, ref p50, ref p99, ref max);
+        double rate = previous != null
+                ? get_watch_rate(count,
+                                 get_watch_engine_count(previous, name),
+                                 seconds)
+                : 0.0;
+        print("  %-24s %8.1f %10" + uint64.FORMAT + " %9.2f %9.2f %9.2f\n",
+              name, rate, count,
+              p50 / 1000.0, p99 / 1000.0, max / 1000.0);
+    }
+
+    print(_("\nDispatch queues:\n"));
+    print("  %-24s %8s %10s %10s\n",
+          "QUEUE", "DEPTH", "MAX DEPTH", "MESSAGES");
+    for (size_t i = 0; i < sample.queues.n_children(); i++) {
+        string queue = null;
+        string lane = null;
+        uint32 depth = 0;
+        uint32 high_water_mark = 0;
+        uint64 n_messages = 0;
+        sample.queues.get_child_value(i).get(
+                "(ss(uut))", ref queue, ref lane,
+                ref depth, ref high_water_mark, ref n_messages);
+        print("  %-24s %8u %10u %10" + uint64.FORMAT + "\n",
+              "%s/%s".printf(queue, lane),
+              depth, high_water_mark, n_messages);
+    }
+
+    print(_("\nMessages per second:\n"));
+    var rates = get_watch_message_rates(sample, previous);
+    for (int i = 0; i < rates.length && i < WATCH_N_TEXT_ROWS; i++)
+        print("  %-24s %8.1f\n", rates[i].name, rates[i].rate);
+
+    print(_("\nSlow key events (%d ms or more):\n"),
+          WATCH_SLOW_KEY_EVENT_MSEC);
+    int64 real_offset = GLib.get_real_time() - GLib.get_monotonic_time();
+    size_t n_events = sample.slow_events.n_children();
+    size_t start = n_events > WATCH_N_TEXT_ROWS
+            ? n_events - WATCH_N_TEXT_ROWS : 0;
+    for (size_t i = start; i < n_events; i++) {
+        uint64 serial = 0;
+        int64 time = 0;
+        string client = null;
+        string engine = null;
+        uint64 latency = 0;
+        sample.slow_events.get_child_value(i).get(
+                "(txsst)", ref serial, ref time, ref client, ref engine,
+                ref latency);
+        time += real_offset;
+        var date = new GLib.DateTime.from_unix_local(time / 1000000);
+        print("  %s.%03d %-24s %-24s %9.2f\n",
+              date.format("%H:%M:%S"), (int)(time % 1000000 / 1000),
+              client, engine, latency / 1000.0);
+    }
+    print("\n");
+}
+
+
 int message_watch(string[] argv) {
+    const OptionEntry[] options = {
+        { "interval", 'i', 0, OptionArg.INT, out watch_interval,
+          N_("Update the statistics every MSEC milliseconds"), "MSEC" },
+        { "count", 'c', 0, OptionArg.INT, out watch_count,
+          N_("Exit after COUNT updates"), "COUNT" },
+        { "json", 0, 0, OptionArg.NONE, out watch_json,
+          N_("Print a JSON object per update and line"), null },
+        { null }
+    };
+
+    var option = new OptionContext();
+    option.add_main_entries(options, Config.GETTEXT_PACKAGE);
+
+    try {
+        option.parse(ref argv);
+    } catch (OptionError e) {
+        stderr.printf("%s\n", e.message);
+        return Posix.EXIT_FAILURE;
+    }
+    if (watch_interval < WATCH_MIN_INTERVAL)
+        watch_interval = WATCH_MIN_INTERVAL;
+
+    var bus = get_bus();
+    if (bus == null) {
+        stderr.printf(_("Can't connect to IBus.\n"));
+        return Posix.EXIT_FAILURE;
+    }
+    var connection = bus.get_connection();
+    bool clear = !watch_json && Posix.isatty(Posix.STDOUT_FILENO);
+
+    /* One GetAll call per update reads the statistics which ibus-daemon
+     * keeps anyway, so the overhead does not grow with the typing. */
+    WatchSample? previous = null;
+    uint64 last_serial = 0;
+    for (int i = 0; watch_count <= 0 || i < watch_count; i++) {
+        if (i > 0)
+            GLib.Thread.usleep((ulong)watch_interval * 1000);
+        var sample = get_watch_sample(connection);
+        if (sample == null)
+            return Posix.EXIT_FAILURE;
+        if (watch_json)
+            print_watch_json(sample, previous, ref last_serial);
+        else
+            print_watch_text(sample, previous, clear);
+        stdout.flush();
+        previous = sample;
+    }
     return Posix.EXIT_SUCCESS;
 }
 
@@ -1154,7 +1519,8 @@ const CommandEntry commands[]  = {
     { "engine", N_("Set or get engine"), get_set_engine },
     { "exit", N_("Exit ibus-daemon"), exit_daemon },
     { "list-engine", N_("Show available engines"), list_engine },
-    { "watch", N_("(Not implemented)"), message_watch },
+    { "watch", N_("Monitor key latency and messages of ibus-daemon"),
+      message_watch },
     { "restart", N_("Restart ibus-daemon"), restart_daemon },
     { "start", N_("Start ibus-daemon"), start_daemon },
     { "version", N_("Show version"), print_version },